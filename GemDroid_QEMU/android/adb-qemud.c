@@ -166,6 +166,21 @@ _adb_on_host_data(void* opaque, void* connection, const void* buff, int size)
     }
 }
 
+/* A callback that is invoked when the host can accept data again.
+ * Param:
+ *  opaque - AdbClient instance.
+ *  connection - An opaque pointer that identifies connection with the ADB host.
+ */
+static void
+_adb_on_host_writable(void* opaque, void* connection)
+{
+    AdbClient* const adb_client = (AdbClient*)opaque;
+
+    D("ADB client %p(o=%p) can send data to the host %p again",
+      adb_client, adb_client->opaque, connection);
+    qemud_client_wake_writer(adb_client->qemud_client);
+}
+
 /* ADB guest API required for adb_server_register_guest */
 static AdbGuestRoutines _adb_client_routines = {
     /* A callback that is invoked when the host is connected. */
@@ -174,6 +189,8 @@ static AdbGuestRoutines _adb_client_routines = {
     _adb_on_host_disconnect,
     /* A callback that is invoked when the host sends data. */
     _adb_on_host_data,
+    /* A callback that is invoked when the host can accept data again. */
+    _adb_on_host_writable,
 };
 
 /********************************************************************************
@@ -278,6 +295,38 @@ _adb_client_recv(void* opaque, uint8_t* msg, int msglen, QemudClient* client)
     }
 }
 
+/* A callback that is invoked when ADB guest sends data to the service through
+ * the 'adb' pipe.
+ * Param:
+ *  opaque - AdbClient instance.
+ *  iov, iovcnt - Guest buffers.
+ *  client - adb QEMUD client.
+ * Return:
+ *  Number of bytes consumed, or 0 if the guest must wait.
+ */
+static int
+_adb_client_recv_buffers(void* opaque,
+                         const struct iovec* iov,
+                         int iovcnt,
+                         QemudClient* client)
+{
+    AdbClient* const adb_client = (AdbClient*)opaque;
+    int total = 0;
+    int nn;
+
+    if (adb_client->state == ADBC_STATE_CONNECTED) {
+        /* Pass the guest buffers through to the host. */
+        return adb_server_on_guest_buffers(adb_client->opaque, iov, iovcnt);
+    }
+
+    /* Handshake messages are tiny, handle them as usual. */
+    for (nn = 0; nn < iovcnt; nn++) {
+        _adb_client_recv(opaque, iov[nn].iov_base, iov[nn].iov_len, client);
+        total += iov[nn].iov_len;
+    }
+    return total;
+}
+
 /* A callback that is invoked when ADB guest disconnects from the service. */
 static void
 _adb_client_close(void* opaque)
@@ -317,6 +366,8 @@ _adb_service_connect(void*          opaque,
         _adb_client_free(adb_client);
         return NULL;
     }
+    qemud_client_set_recv_buffers(adb_client->qemud_client,
+                                  _adb_client_recv_buffers);
 
     return adb_client->qemud_client;
 }
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "android/adb-send-queue.h"
+#include "android/sockets.h"
+#include "android/utils/system.h"
+
+#include <errno.h>
+
+#ifdef _WIN32
+#include "qemu-common.h"  /* for struct iovec */
+#else
+#include <sys/uio.h>
+#endif
+
+void
+adb_send_queue_init(AdbSendQueue* queue, int capacity)
+{
+    uint8_t* buff;
+
+    AARRAY_NEW(buff, capacity);
+    cbuffer_reset(queue->ring, buff, capacity);
+}
+
+void
+adb_send_queue_done(AdbSendQueue* queue)
+{
+    AFREE(queue->ring->buff);
+    cbuffer_reset(queue->ring, NULL, 0);
+}
+
+/* Fills |vec| with the (at most two) segments of queued data.
+ * Returns the number of segments. */
+static int
+_adb_send_queue_segments(AdbSendQueue* queue, struct iovec* vec)
+{
+    CBuffer* const ring = queue->ring;
+    uint8_t* base;
+    int count = 0;
+    int first = cbuffer_read_peek(ring, &base);
+
+    if (first > 0) {
+        vec[count].iov_base = base;
+        vec[count].iov_len  = first;
+        count++;
+        if (first < ring->count) {
+            /* The data wraps around the end of the ring. */
+            vec[count].iov_base = ring->buff;
+            vec[count].iov_len  = ring->count - first;
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Sends |count| buffers from |vec|, returning 0 when the socket would
+ * block, or -1 on error. */
+static int
+_adb_send_queue_send(int so, const struct iovec* vec, int count)
+{
+    int sent;
+
+    if (count == 0) {
+        return 0;
+    }
+    sent = socket_sendv(so, vec, count);
+    if (sent < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+        sent = 0;
+    }
+    return sent;
+}
+
+int
+adb_send_queue_sendv(AdbSendQueue* queue,
+                     int so,
+                     const struct iovec* iov,
+                     int iovcnt)
+{
+    struct iovec vec[SOCKET_SENDV_MAX];
+    int queued = adb_send_queue_size(queue);
+    int count = _adb_send_queue_segments(queue, vec);
+    int accepted = 0;
+    int sent, nn;
+
+    /* Send the queued data and the guest buffers at once. The buffers that
+     * don't fit in a single call are simply queued below. */
+    for (nn = 0; nn < iovcnt && count < SOCKET_SENDV_MAX; nn++) {
+        vec[count++] = iov[nn];
+    }
+    sent = _adb_send_queue_send(so, vec, count);
+    if (sent < 0) {
+        return -1;
+    }
+
+    /* The queued data always goes out first. */
+    if (sent >= queued) {
+        cbuffer_read_step(queue->ring, queued);
+        sent -= queued;
+    } else {
+        cbuffer_read_step(queue->ring, sent);
+        sent = 0;
+    }
+
+    /* Skip what was sent directly from the guest buffers, and queue what
+     * is left, as long as the ring buffer has room for it. */
+    for (nn = 0; nn < iovcnt; nn++) {
+        const uint8_t* data = iov[nn].iov_base;
+        int len = (int)iov[nn].iov_len;
+        int written;
+
+        if (sent >= len) {
+            sent -= len;
+            accepted += len;
+            continue;
+        }
+        data += sent;
+        len -= sent;
+        accepted += sent;
+        sent = 0;
+
+        written = cbuffer_write(queue->ring, data, len);
+        accepted += written;
+        if (written < len) {
+            break;
+        }
+    }
+    return accepted;
+}
+
+int
+adb_send_queue_flush(AdbSendQueue* queue, int so)
+{
+    struct iovec vec[2];
+    int count = _adb_send_queue_segments(queue, vec);
+    int sent = _adb_send_queue_send(so, vec, count);
+
+    if (sent < 0) {
+        return -1;
+    }
+    cbuffer_read_step(queue->ring, sent);
+    return adb_send_queue_size(queue);
+}
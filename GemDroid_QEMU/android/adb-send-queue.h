@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_ADB_SEND_QUEUE_H_
+#define ANDROID_ADB_SEND_QUEUE_H_
+
+#include "android/cbuffer.h"
+#include "android/utils/compiler.h"
+
+ANDROID_BEGIN_HEADER
+
+/*
+ * Queue of guest data pending transmission to an ADB host socket.
+ *
+ * Guest buffers are sent to the socket directly, together with the data
+ * already queued, using a single vectored send. Only the part that the
+ * socket doesn't accept immediately is copied, into a fixed-size ring
+ * buffer. When the ring is full, the caller is told how many bytes were
+ * accepted, so that it can make the guest wait instead of buffering an
+ * unbounded amount of data.
+ */
+
+/* Default capacity of the ring buffer, in bytes. */
+#define ADB_SEND_QUEUE_CAPACITY  (256 * 1024)
+
+typedef struct AdbSendQueue AdbSendQueue;
+struct AdbSendQueue {
+    /* Data pending transmission. */
+    CBuffer     ring[1];
+};
+
+struct iovec;
+
+/* Initializes the queue with a ring buffer of |capacity| bytes. */
+extern void adb_send_queue_init(AdbSendQueue* queue, int capacity);
+
+/* Releases the queue's ring buffer. */
+extern void adb_send_queue_done(AdbSendQueue* queue);
+
+/* Returns the number of bytes pending transmission. */
+static __inline__ int
+adb_send_queue_size(AdbSendQueue* queue)
+{
+    return cbuffer_read_avail(queue->ring);
+}
+
+/* Returns the number of bytes that can still be queued. */
+static __inline__ int
+adb_send_queue_avail(AdbSendQueue* queue)
+{
+    return cbuffer_write_avail(queue->ring);
+}
+
+/* Sends the queued data, then the |iovcnt| buffers in |iov|, to the
+ * non-blocking socket |so|. The part of |iov| that can't be sent
+ * immediately is queued, as long as the ring buffer has room.
+ * Return:
+ *  The number of bytes from |iov| that were sent or queued, which is less
+ *  than their total size when the ring buffer is full, or -1 on a socket
+ *  error (see errno).
+ */
+extern int adb_send_queue_sendv(AdbSendQueue* queue,
+                                int so,
+                                const struct iovec* iov,
+                                int iovcnt);
+
+/* Sends as much queued data as possible to the non-blocking socket |so|.
+ * Return:
+ *  The number of bytes still pending, or -1 on a socket error (see errno).
+ */
+extern int adb_send_queue_flush(AdbSendQueue* queue, int so);
+
+ANDROID_END_HEADER
+
+#endif  /* ANDROID_ADB_SEND_QUEUE_H_ */
@@ -0,0 +1,361 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/adb-send-queue.h"
+
+#include "android/base/memory/ScopedPtr.h"
+#include "android/base/sockets/SocketUtils.h"
+#include "android/base/sockets/SocketWaiter.h"
+#include "android/base/system/System.h"
+#include "android/base/threads/Thread.h"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+namespace android {
+namespace base {
+
+namespace {
+
+// Byte at |offset| of the test stream.
+inline uint8_t patternAt(size_t offset) {
+    return static_cast<uint8_t>((offset * 7) + (offset >> 12));
+}
+
+void fillPattern(uint8_t* buffer, size_t size, size_t offset) {
+    for (size_t n = 0; n < size; ++n) {
+        buffer[n] = patternAt(offset + n);
+    }
+}
+
+// A fake ADB host: reads everything from its socket until the connection
+// is closed, optionally checking the content against the test pattern.
+class FakeAdbHostReader : public Thread {
+public:
+    FakeAdbHostReader(int socket, bool check) :
+            Thread(), mSocket(socket), mCheck(check), mReceived(0),
+            mErrors(0) {}
+
+    virtual intptr_t main() {
+        static uint8_t buffer[65536];
+        socketSetBlocking(mSocket);
+        for (;;) {
+            ssize_t len = socketRecv(mSocket, buffer, sizeof(buffer));
+            if (len <= 0) {
+                break;
+            }
+            if (mCheck) {
+                for (ssize_t n = 0; n < len; ++n) {
+                    if (buffer[n] != patternAt(mReceived + n)) {
+                        mErrors++;
+                    }
+                }
+            }
+            mReceived += len;
+        }
+        return 0;
+    }
+
+    size_t received() const { return mReceived; }
+    size_t errors() const { return mErrors; }
+
+private:
+    int mSocket;
+    bool mCheck;
+    size_t mReceived;
+    size_t mErrors;
+};
+
+// A fake ADB host: writes |size| bytes to its socket, then closes it.
+class FakeAdbHostWriter : public Thread {
+public:
+    FakeAdbHostWriter(int socket, size_t size) :
+            Thread(), mSocket(socket), mSize(size) {}
+
+    virtual intptr_t main() {
+        static uint8_t buffer[65536];
+        size_t left = mSize;
+        socketSetBlocking(mSocket);
+        while (left > 0) {
+            size_t chunk = left < sizeof(buffer) ? left : sizeof(buffer);
+            ssize_t len = socketSend(mSocket, buffer, chunk);
+            if (len <= 0) {
+                break;
+            }
+            left -= len;
+        }
+        socketShutdownWrites(mSocket);
+        return 0;
+    }
+
+private:
+    int mSocket;
+    size_t mSize;
+};
+
+// Waits until |socket| can be written to.
+void waitWritable(SocketWaiter* waiter, int socket) {
+    waiter->update(socket, SocketWaiter::kEventWrite);
+    waiter->wait(1000);
+}
+
+// Sends |total| bytes of the test pattern through |queue| to |socket|, in
+// writes of |numPages| separate guest pages, as the guest pipe does.
+void pushThroughQueue(AdbSendQueue* queue,
+                      int socket,
+                      size_t total,
+                      int numPages) {
+    const size_t kPageSize = 4096;
+    ScopedPtr<SocketWaiter> waiter(SocketWaiter::create());
+    uint8_t* pages = static_cast<uint8_t*>(malloc(numPages * kPageSize));
+    size_t offset = 0;
+    while (offset < total) {
+        struct iovec iov[16];
+        int count = 0;
+        size_t len = 0;
+        while (count < numPages && offset + len < total) {
+            iov[count].iov_base = pages + count * kPageSize;
+            iov[count].iov_len = kPageSize;
+            fillPattern(pages + count * kPageSize, kPageSize, offset + len);
+            len += kPageSize;
+            count++;
+        }
+        // Like the guest, retry what wasn't accepted.
+        size_t done = 0;
+        while (done < len) {
+            int first = done / kPageSize;
+            struct iovec rest[16];
+            for (int n = first; n < count; ++n) {
+                rest[n - first] = iov[n];
+            }
+            rest[0].iov_base = static_cast<uint8_t*>(rest[0].iov_base) +
+                               (done % kPageSize);
+            rest[0].iov_len -= done % kPageSize;
+            int ret = adb_send_queue_sendv(queue, socket, rest, count - first);
+            ASSERT_LE(0, ret);
+            done += ret;
+            if (done < len) {
+                waitWritable(waiter.get(), socket);
+            }
+        }
+        offset += len;
+    }
+    while (adb_send_queue_size(queue) > 0) {
+        ASSERT_LE(0, adb_send_queue_flush(queue, socket));
+        if (adb_send_queue_size(queue) > 0) {
+            waitWritable(waiter.get(), socket);
+        }
+    }
+    free(pages);
+}
+
+}  // namespace
+
+TEST(AdbSendQueue, DirectSend) {
+    // Both sockets of the pair are non-blocking.
+    int sockets[2];
+    ASSERT_EQ(0, socketCreatePair(&sockets[0], &sockets[1]));
+    socketSetBlocking(sockets[1]);
+
+    AdbSendQueue queue;
+    adb_send_queue_init(&queue, 1024);
+
+    uint8_t data[300];
+    fillPattern(data, sizeof(data), 0);
+    struct iovec iov[3] = {
+        { data, 100 }, { data + 100, 50 }, { data + 150, 150 },
+    };
+    EXPECT_EQ(300, adb_send_queue_sendv(&queue, sockets[0], iov, 3));
+    EXPECT_EQ(0, adb_send_queue_size(&queue));
+    EXPECT_EQ(1024, adb_send_queue_avail(&queue));
+
+    uint8_t received[300];
+    size_t len = 0;
+    while (len < sizeof(received)) {
+        ssize_t ret = socketRecv(sockets[1], received + len,
+                                 sizeof(received) - len);
+        ASSERT_LT(0, ret);
+        len += ret;
+    }
+    EXPECT_EQ(0, memcmp(data, received, sizeof(data)));
+
+    adb_send_queue_done(&queue);
+    socketClose(sockets[0]);
+    socketClose(sockets[1]);
+}
+
+TEST(AdbSendQueue, QueueWhenSocketIsFull) {
+    int sockets[2];
+    ASSERT_EQ(0, socketCreatePair(&sockets[0], &sockets[1]));
+
+    const int kCapacity = 10000;
+    AdbSendQueue queue;
+    adb_send_queue_init(&queue, kCapacity);
+
+    // Nobody reads the other end, so the socket buffers fill up, then
+    // the ring buffer, and the queue stops accepting data.
+    uint8_t data[4096];
+    size_t offset = 0;
+    for (;;) {
+        fillPattern(data, sizeof(data), offset);
+        struct iovec iov[2] = {
+            { data, 1000 }, { data + 1000, sizeof(data) - 1000 },
+        };
+        int ret = adb_send_queue_sendv(&queue, sockets[0], iov, 2);
+        ASSERT_LE(0, ret);
+        offset += ret;
+        if (ret < (int)sizeof(data)) {
+            break;
+        }
+    }
+    EXPECT_EQ(kCapacity, adb_send_queue_size(&queue));
+    EXPECT_EQ(0, adb_send_queue_avail(&queue));
+
+    // Now let a fake host read everything, and check the order.
+    FakeAdbHostReader reader(sockets[1], true);
+    ASSERT_TRUE(reader.start());
+    ScopedPtr<SocketWaiter> waiter(SocketWaiter::create());
+    while (adb_send_queue_size(&queue) > 0) {
+        ASSERT_LE(0, adb_send_queue_flush(&queue, sockets[0]));
+        waitWritable(waiter.get(), sockets[0]);
+    }
+    socketClose(sockets[0]);
+    ASSERT_TRUE(reader.wait(NULL));
+    EXPECT_EQ(offset, reader.received());
+    EXPECT_EQ(0U, reader.errors());
+
+    adb_send_queue_done(&queue);
+    socketClose(sockets[1]);
+}
+
+TEST(AdbSendQueue, PushToFakeHost) {
+    int sockets[2];
+    ASSERT_EQ(0, socketCreatePair(&sockets[0], &sockets[1]));
+
+    AdbSendQueue queue;
+    adb_send_queue_init(&queue, 32768);
+
+    FakeAdbHostReader reader(sockets[1], true);
+    ASSERT_TRUE(reader.start());
+    const size_t kTotal = 4 * 1024 * 1024;
+    pushThroughQueue(&queue, sockets[0], kTotal, 5);
+    socketClose(sockets[0]);
+    ASSERT_TRUE(reader.wait(NULL));
+    EXPECT_EQ(kTotal, reader.received());
+    EXPECT_EQ(0U, reader.errors());
+
+    adb_send_queue_done(&queue);
+    socketClose(sockets[1]);
+}
+
+// Push (guest to host) and pull (host to guest) throughput against a fake
+// ADB host thread, for the vectored send path and the previous ones:
+// copying the guest pages into one buffer before each send, and reading
+// the host socket in small chunks.
+TEST(AdbSendQueue, DISABLED_ThroughputBenchmark) {
+    const size_t kTotal = 512 * 1024 * 1024;
+    const int kPages = 16;
+
+    // Push through the queue, without copying the guest pages.
+    {
+        int sockets[2];
+        ASSERT_EQ(0, socketCreatePair(&sockets[0], &sockets[1]));
+        AdbSendQueue queue;
+        adb_send_queue_init(&queue, ADB_SEND_QUEUE_CAPACITY);
+        FakeAdbHostReader reader(sockets[1], false);
+        ASSERT_TRUE(reader.start());
+
+        double start = System::getHighResTimeUs();
+        pushThroughQueue(&queue, sockets[0], kTotal, kPages);
+        socketClose(sockets[0]);
+        reader.wait(NULL);
+        double us = System::getHighResTimeUs() - start;
+        EXPECT_EQ(kTotal, reader.received());
+        printf("push, vectored send:  %8.1f MiB/s\n",
+               kTotal / us * 1e6 / (1024. * 1024.));
+
+        adb_send_queue_done(&queue);
+        socketClose(sockets[1]);
+    }
+
+    // Push by copying the guest pages into a single buffer first.
+    {
+        int sockets[2];
+        ASSERT_EQ(0, socketCreatePair(&sockets[0], &sockets[1]));
+        socketSetBlocking(sockets[0]);
+        FakeAdbHostReader reader(sockets[1], false);
+        ASSERT_TRUE(reader.start());
+        const size_t kChunk = kPages * 4096;
+        uint8_t* pages = static_cast<uint8_t*>(malloc(kChunk));
+        uint8_t* msg = static_cast<uint8_t*>(malloc(kChunk));
+
+        double start = System::getHighResTimeUs();
+        for (size_t offset = 0; offset < kTotal; offset += kChunk) {
+            fillPattern(pages, kChunk, offset);
+            memcpy(msg, pages, kChunk);
+            size_t sent = 0;
+            while (sent < kChunk) {
+                ssize_t ret = socketSend(sockets[0], msg + sent,
+                                         kChunk - sent);
+                ASSERT_LT(0, ret);
+                sent += ret;
+            }
+        }
+        socketClose(sockets[0]);
+        reader.wait(NULL);
+        double us = System::getHighResTimeUs() - start;
+        EXPECT_EQ(kTotal, reader.received());
+        printf("push, copy and send:  %8.1f MiB/s\n",
+               kTotal / us * 1e6 / (1024. * 1024.));
+
+        free(msg);
+        free(pages);
+        socketClose(sockets[1]);
+    }
+
+    // Pull with 64 KiB and 4 KiB reads from the host socket.
+    static const size_t kReadSizes[] = { 65536, 4096 };
+    for (size_t n = 0; n < sizeof(kReadSizes) / sizeof(kReadSizes[0]); ++n) {
+        int sockets[2];
+        ASSERT_EQ(0, socketCreatePair(&sockets[0], &sockets[1]));
+        socketSetBlocking(sockets[0]);
+        FakeAdbHostWriter writer(sockets[1], kTotal);
+        ASSERT_TRUE(writer.start());
+        uint8_t* buffer = static_cast<uint8_t*>(malloc(kReadSizes[n]));
+
+        double start = System::getHighResTimeUs();
+        size_t received = 0;
+        for (;;) {
+            ssize_t len = socketRecv(sockets[0], buffer, kReadSizes[n]);
+            if (len <= 0) {
+                break;
+            }
+            received += len;
+        }
+        double us = System::getHighResTimeUs() - start;
+        writer.wait(NULL);
+        EXPECT_EQ(kTotal, received);
+        printf("pull, %5u byte reads: %8.1f MiB/s\n",
+               (unsigned)kReadSizes[n], kTotal / us * 1e6 / (1024. * 1024.));
+
+        free(buffer);
+        socketClose(sockets[0]);
+        socketClose(sockets[1]);
+    }
+}
+
+}  // namespace base
+}  // namespace android
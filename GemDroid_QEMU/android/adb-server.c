@@ -22,6 +22,7 @@
 #include "android/utils/format.h"
 #include "android/utils/list.h"
 #include "android/utils/misc.h"
+#include "android/adb-send-queue.h"
 #include "android/adb-server.h"
 
 #define  E(...)    derror(__VA_ARGS__)
@@ -31,6 +32,10 @@
 #define  FHP(dst, dstLen, src, srcLen)  format_hex_printable2(dst, dstLen, src, (srcLen < 32) ? srcLen : 32)
 #define  FHP_MAX (9*(32/4) + 4 + 9*(32/8)) // format_hex_printable2 output len for 32 src bytes
 
+/* Maximum size of the data read from an ADB host at once. Large reads keep
+ * the number of messages queued for the guest pipe low during 'adb push'. */
+#define ADB_HOST_READ_SIZE  65536
+
 typedef struct AdbServer    AdbServer;
 typedef struct AdbHost      AdbHost;
 typedef struct AdbGuest     AdbGuest;
@@ -71,11 +76,9 @@ struct AdbHost {
     /* Size of the pending data buffer. */
     int         pending_data_size;
     /* Contains data that are pending to be sent to the host. */
-    uint8_t*    pending_send_buffer;
-    /* Number of bytes that are pending to be sent to the host. */
-    int         pending_send_data_size;
-    /* Size of the pending_send_buffer */
-    int         pending_send_buffer_size;
+    AdbSendQueue    send_queue[1];
+    /* If not 0, the guest waits for room in send_queue. */
+    int         guest_waiting;
 };
 
 /* ADB server descriptor. */
@@ -119,6 +122,7 @@ _adb_host_new(AdbServer* adb_srv)
     alist_init(&adb_host->list_entry);
     adb_host->adb_srv = adb_srv;
     adb_host->host_so = -1;
+    adb_send_queue_init(adb_host->send_queue, ADB_SEND_QUEUE_CAPACITY);
 
     return adb_host;
 }
@@ -141,45 +145,12 @@ _adb_host_free(AdbHost* adb_host)
         if (adb_host->pending_data != NULL) {
             free(adb_host->pending_data);
         }
-        if (adb_host->pending_send_buffer != NULL) {
-            free(adb_host->pending_send_buffer);
-        }
+        adb_send_queue_done(adb_host->send_queue);
 
         AFREE(adb_host);
     }
 }
 
-static void
-_adb_host_append_message(AdbHost* adb_host, const void* msg, int msglen)
-{
-    printf("Append %d bytes to ADB host buffer.\n", msglen);
-
-    /* Make sure that buffer can contain the appending data. */
-    if (adb_host->pending_send_buffer == NULL) {
-        adb_host->pending_send_buffer = (uint8_t*)malloc(msglen);
-        adb_host->pending_send_buffer_size = msglen;
-    } else if ((adb_host->pending_send_data_size + msglen) >
-               adb_host->pending_send_buffer_size) {
-        adb_host->pending_send_buffer =
-            (uint8_t*)realloc(adb_host->pending_send_buffer,
-                              adb_host->pending_send_data_size + msglen);
-        adb_host->pending_send_buffer_size =
-            adb_host->pending_send_data_size + msglen;
-    }
-
-    if (adb_host->pending_send_buffer == NULL) {
-        D("Unable to allocate %d bytes for pending ADB host data.",
-          adb_host->pending_send_data_size + msglen);
-        adb_host->pending_send_buffer_size = adb_host->pending_send_data_size = 0;
-        loopIo_dontWantWrite(adb_host->io);
-        return;
-    }
-
-    memcpy(adb_host->pending_send_buffer + adb_host->pending_send_data_size,
-           msg, msglen);
-    loopIo_wantWrite(adb_host->io);
-}
-
 /* Connects ADB host with ADB guest. */
 static void
 _adb_connect(AdbHost* adb_host, AdbGuest* adb_guest)
@@ -203,6 +174,11 @@ _on_adb_host_disconnected(AdbHost* adb_host)
         D("Disconnecting ADB host %p(so=%d) from ADB guest %p(o=%p)",
           adb_host, adb_host->host_so, adb_guest, adb_guest->opaque);
         adb_host->adb_guest = NULL;
+        /* Don't leave the guest waiting for a write that can't complete. */
+        if (adb_host->guest_waiting &&
+            adb_guest->callbacks->on_writable != NULL) {
+            adb_guest->callbacks->on_writable(adb_guest->opaque, adb_guest);
+        }
         adb_guest->callbacks->on_disconnect(adb_guest->opaque, adb_guest);
         adb_guest->adb_host = NULL;
     } else {
@@ -219,12 +195,16 @@ _on_adb_host_disconnected(AdbHost* adb_host)
     }
 }
 
-/* Read I/O callback on ADB host socket. */
-static void
+/* Read I/O callback on ADB host socket.
+ * Return:
+ *  0 on success, or -1 if the host got disconnected and was destroyed.
+ */
+static int
 _on_adb_host_read(AdbHost* adb_host)
 {
+    /* The data is consumed before returning, so one buffer is enough. */
+    static char buff[ADB_HOST_READ_SIZE];
     char tmp[FHP_MAX];
-    char buff[4096];
 
     /* Read data from the socket. */
     const int size = socket_recv(adb_host->host_so, buff, sizeof(buff));
@@ -234,6 +214,7 @@ _on_adb_host_read(AdbHost* adb_host)
     } else if (size == 0) {
         /* This is a "disconnect" condition. */
         _on_adb_host_disconnected(adb_host);
+        return -1;
     } else {
         D("%s %d bytes received from ADB host %p(so=%d): %s",
            adb_host->adb_guest ? "Transfer" : "Pend", size, adb_host,
@@ -263,52 +244,37 @@ _on_adb_host_read(AdbHost* adb_host)
             }
         }
     }
+    return 0;
 }
 
 /* Write I/O callback on ADB host socket. */
 static void
 _on_adb_host_write(AdbHost* adb_host)
 {
-    while (adb_host->pending_send_data_size && adb_host->pending_send_buffer != NULL) {
-        const int sent = socket_send(adb_host->host_so,
-                                     adb_host->pending_send_buffer,
-                                     adb_host->pending_send_data_size);
-        if (sent < 0) {
-            if (errno == EWOULDBLOCK) {
-                /* Try again later. */
-                return;
-            } else {
-                D("Unable to send pending data to the ADB host: %s",
-                   strerror(errno));
-                free(adb_host->pending_send_buffer);
-                adb_host->pending_send_buffer = NULL;
-                adb_host->pending_send_buffer_size = 0;
-                adb_host->pending_send_data_size = 0;
-                break;
-            }
-        } else if (sent == 0) {
-            /* Disconnect condition. */
-            free(adb_host->pending_send_buffer);
-            adb_host->pending_send_buffer = NULL;
-            adb_host->pending_send_buffer_size = 0;
-            adb_host->pending_send_data_size = 0;
-            _on_adb_host_disconnected(adb_host);
-            break;
-        } else if (sent == adb_host->pending_send_data_size) {
-            free(adb_host->pending_send_buffer);
-            adb_host->pending_send_buffer = NULL;
-            adb_host->pending_send_buffer_size = 0;
-            adb_host->pending_send_data_size = 0;
-        } else {
-            adb_host->pending_send_data_size -= sent;
-            memmove(adb_host->pending_send_buffer,
-                    adb_host->pending_send_buffer + sent,
-                    adb_host->pending_send_data_size);
-            return;
-        }
+    AdbGuest* const adb_guest = adb_host->adb_guest;
+    const int left = adb_send_queue_flush(adb_host->send_queue,
+                                          adb_host->host_so);
+
+    if (left < 0) {
+        /* The queued data can't be delivered anymore. Disconnect, which
+         * also wakes up a guest waiting for the queue to drain. */
+        E("Unable to send pending data to the ADB host: %s", strerror(errno));
+        _on_adb_host_disconnected(adb_host);
+        return;
+    }
+    if (left == 0) {
+        loopIo_dontWantWrite(adb_host->io);
     }
 
-    loopIo_dontWantWrite(adb_host->io);
+    /* Let the guest send more data once half of the queue is free. */
+    if (adb_host->guest_waiting &&
+        adb_send_queue_avail(adb_host->send_queue) >=
+                ADB_SEND_QUEUE_CAPACITY / 2) {
+        adb_host->guest_waiting = 0;
+        if (adb_guest != NULL && adb_guest->callbacks->on_writable != NULL) {
+            adb_guest->callbacks->on_writable(adb_guest->opaque, adb_guest);
+        }
+    }
 }
 
 /* I/O callback on ADB host socket. */
@@ -320,7 +286,9 @@ _on_adb_host_io(void* opaque, int fd, unsigned events)
 
     /* Dispatch I/O to read / write handlers. */
     if ((events & LOOP_IO_READ) != 0) {
-        _on_adb_host_read(adb_host);
+        if (_on_adb_host_read(adb_host) < 0) {
+            return;
+        }
     }
     if ((events & LOOP_IO_WRITE) != 0) {
         _on_adb_host_write(adb_host);
@@ -512,41 +480,66 @@ adb_server_complete_connection(void* opaque)
     }
 }
 
-void
-adb_server_on_guest_message(void* opaque, const uint8_t* msg, int msglen)
+int
+adb_server_on_guest_buffers(void* opaque, const struct iovec* iov, int iovcnt)
 {
     AdbGuest* const adb_guest = (AdbGuest*)opaque;
     AdbHost* const adb_host = adb_guest->adb_host;
-    char tmp[FHP_MAX];
+    int total = 0;
+    int accepted;
+    int nn;
 
-    if (adb_host != NULL) {
-        D("Sending %d bytes to the ADB host: %s", msglen, FHP(tmp, sizeof(tmp), msg, msglen));
-
-        /* Lets see if we can send the data immediatelly... */
-        if (adb_host->pending_send_buffer == NULL) {
-            /* There are no data that are pending to be sent to the host. Do the
-             * direct send. */
-            const int sent = socket_send(adb_host->host_so, msg, msglen);
-            if (sent < 0) {
-                if (errno == EWOULDBLOCK) {
-                } else {
-                    D("Unable to send data to ADB host: %s", strerror(errno));
-                }
-            } else if (sent == 0) {
-                /* Disconnect condition. */
-                _on_adb_host_disconnected(adb_host);
-            } else if (sent < msglen) {
-                /* Couldn't send everything. Schedule write via I/O callback. */
-                _adb_host_append_message(adb_host, msg + sent, msglen - sent);
-            }
-        } else {
-            /* There are data that are pending to be sent to the host. We need
-             * to append new data to the end of the pending data buffer. */
-            _adb_host_append_message(adb_host, msg, msglen);
+    for (nn = 0; nn < iovcnt; nn++) {
+        total += iov[nn].iov_len;
+    }
+
+    if (adb_host == NULL) {
+        D("ADB host is disconneted and can't accept %d bytes", total);
+        return total;
+    }
+
+    D("Sending %d bytes to the ADB host in %d buffers", total, iovcnt);
+
+    /* Send the data directly, and queue what the socket doesn't take. */
+    accepted = adb_send_queue_sendv(adb_host->send_queue, adb_host->host_so,
+                                    iov, iovcnt);
+    if (accepted < 0) {
+        D("Unable to send data to ADB host: %s", strerror(errno));
+        return total;
+    }
+    if (adb_send_queue_size(adb_host->send_queue) > 0) {
+        /* Schedule write via I/O callback. */
+        loopIo_wantWrite(adb_host->io);
+    }
+    if (accepted == 0) {
+        adb_host->guest_waiting = 1;
+    }
+    return accepted;
+}
+
+void
+adb_server_on_guest_message(void* opaque, const uint8_t* msg, int msglen)
+{
+    char tmp[FHP_MAX];
+    struct iovec iov;
+    int accepted;
+
+    D("Received %d bytes from the ADB guest: %s",
+      msglen, FHP(tmp, sizeof(tmp), msg, msglen));
+
+    iov.iov_base = (void*)msg;
+    iov.iov_len  = msglen;
+    accepted = adb_server_on_guest_buffers(opaque, &iov, 1);
+    if (accepted < msglen) {
+        /* The qemud message channel can't be paused, and dropping a part of
+         * the stream would corrupt the ADB protocol. Close the connection
+         * instead, so that both ends can recover. */
+        AdbHost* const adb_host = ((AdbGuest*)opaque)->adb_host;
+        E("ADB host send queue is full, closing connection (%d bytes pending)",
+          msglen - accepted);
+        if (adb_host != NULL) {
+            _on_adb_host_disconnected(adb_host);
         }
-    } else {
-        D("ADB host is disconneted and can't accept %d bytes in %s",
-          msglen, FHP(tmp, sizeof(tmp), msg, msglen));
     }
 }
 
@@ -59,6 +59,18 @@ typedef void (*adbguest_read)(void* opaque,
  */
 typedef void (*adbguest_disconnect)(void* opaque, void* connection);
 
+/* Callback to be invoked when the host ADB can accept guest data again, after
+ * adb_server_on_guest_buffers returned 0.
+ * Param:
+ *  opaque - An opaque pointer associated with the guest. This pointer contains
+ *      the 'opaque' parameter that was passed to the adb_server_register_guest
+ *      routine.
+ *  connection - An opaque pointer defining the connection between the host and
+ *      the guest ADB. This pointer must be used for further operations on the
+ *      host <-> guest connection.
+ */
+typedef void (*adbguest_writable)(void* opaque, void* connection);
+
 /* Defines a set of callbacks for a guest ADB. */
 typedef struct AdbGuestRoutines AdbGuestRoutines;
 struct AdbGuestRoutines {
@@ -68,6 +80,8 @@ struct AdbGuestRoutines {
     adbguest_disconnect  on_disconnect;
     /* Callback to invoke when ADB host sends data. */
     adbguest_read        on_read;
+    /* Callback to invoke when ADB host can accept data again. */
+    adbguest_writable    on_writable;
 };
 
 /* Initializes ADB server.
@@ -110,7 +124,9 @@ extern void* adb_server_register_guest(void* opaque, AdbGuestRoutines* callbacks
  */
 extern void adb_server_complete_connection(void* opaque);
 
-/* Handles data received from the guest.
+/* Handles data received from the guest. Since the caller can't be asked to
+ * wait, the host connection is closed if the send queue can't take the whole
+ * message.
  * Param:
  *  opaque - An opaque pointer returned from adb_server_register_guest.
  * data, size - Data buffer received from the guest.
@@ -119,6 +135,21 @@ extern void adb_server_on_guest_message(void* opaque,
                                         const uint8_t* data,
                                         int size);
 
+/* Handles data received from the guest, without copying it unless the host
+ * socket can't take it immediately. In this case, the data is queued up to a
+ * limit (see android/adb-send-queue.h).
+ * Param:
+ *  opaque - An opaque pointer returned from adb_server_register_guest.
+ *  iov, iovcnt - Guest buffers.
+ * Return:
+ *  Number of bytes consumed. 0 means that the guest must wait for the
+ *  'adbguest_writable' callback before sending more data.
+ */
+struct iovec;
+extern int adb_server_on_guest_buffers(void* opaque,
+                                       const struct iovec* iov,
+                                       int iovcnt);
+
 /* Notifies the ADB server that the guest has closed its connection.
  * Param:
  *  opaque - An opaque pointer returned from adb_server_register_guest.
@@ -213,11 +213,12 @@ protected:
     static void finalizeSlice(String* strings, size_t count);
 
     // Minimum capacity for the in-object storage array |mStorage|,
-    // not including the terminating zero. With a value of 16,
-    // each String instance is 24 bytes on a 32-bit system, and
-    // 32-bytes on a 64-bit one.
+    // not including the terminating zero. With a value of 24,
+    // each String instance is 32 bytes on a 32-bit system, and
+    // 40-bytes on a 64-bit one. This keeps most configuration keys
+    // and short values out of the heap.
     enum {
-        kMinCapacity = 15
+        kMinCapacity = 23
     };
 
     char* mStr;
@@ -41,7 +41,11 @@ void StringAppendFormatWithArgs(String* string,
                                 const char* format,
                                 va_list args) {
     size_t cur_size = string->size();
-    size_t extra = 0;
+    // First format into the current spare capacity (including the room
+    // for the terminating zero), which is often enough for short results
+    // and avoids a second vsnprintf() pass and a heap allocation. An
+    // all-zero String instance has no buffer yet.
+    size_t extra = string->c_str() ? string->capacity() - cur_size + 1U : 0;
     for (;;) {
         va_list args2;
         va_copy(args2, args);
@@ -55,23 +59,21 @@ void StringAppendFormatWithArgs(String* string,
 
         if (ret > 0) {
             size_t ret_sz = static_cast<size_t>(ret);
-            if (extra == 0) {
-                // First pass, resize the string and try again.
-                extra = ret_sz + 1;
-                string->resize(cur_size + extra);
-                continue;
-            }
             if (ret_sz < extra) {
-                // Second pass or later, success!
+                // Success!
                 string->resize(cur_size + ret_sz);
                 return;
             }
+            // Truncated, resize the string to the exact size and try again.
+            extra = ret_sz + 1;
+            string->resize(cur_size + extra);
+            continue;
         }
 
         // NOTE: The MSVCRT.DLL implementation of snprintf() is broken and
         // will return -1 in case of truncation. This code path is taken
-        // when this happens, or when |ret_sz| is equal or larger than
-        // |extra|. Grow the buffer to allow for more room, then try again.
+        // when this happens. Grow the buffer to allow for more room, then
+        // try again.
         extra += (extra >> 1) + 32;
         string->resize(cur_size + extra);
     }
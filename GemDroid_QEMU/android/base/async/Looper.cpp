@@ -11,6 +11,7 @@
 
 #include "android/base/async/Looper.h"
 
+#include "android/base/containers/PodVector.h"
 #include "android/base/containers/ScopedPointerSet.h"
 #include "android/base/containers/TailQueueList.h"
 #include "android/base/Log.h"
@@ -27,16 +28,24 @@ namespace base {
 
 namespace {
 
-// Generic looper implementation based on select().
+// Generic looper implementation based on a SocketWaiter, i.e. epoll()
+// on Linux and select() elsewhere.
+//
+// Active timers are kept in a binary min-heap ordered by deadline, so
+// arming, re-arming and stopping a timer are O(log n) operations, and
+// finding the next deadline is O(1). Timers with the same deadline fire
+// in the order they were armed.
 class GenLooper : public Looper {
 public:
     GenLooper() :
             Looper(),
             mWaiter(SocketWaiter::create()),
+            mFdWatchByFd(),
             mFdWatches(),
             mPendingFdWatches(),
-            mTimers(),
             mActiveTimers(),
+            mTimerSequence(0U),
+            mTimers(),
             mPendingTimers(),
             mForcedExit(false) {}
 
@@ -147,12 +156,36 @@ public:
 
     void addFdWatch(FdWatch* watch) {
         mFdWatches.add(watch);
+        int fd = watch->fd();
+        if (fd >= 0) {
+            if ((size_t)fd >= mFdWatchByFd.size()) {
+                size_t oldSize = mFdWatchByFd.size();
+                mFdWatchByFd.resize(fd + 1);
+                for (size_t n = oldSize; n <= (size_t)fd; ++n) {
+                    mFdWatchByFd[n] = NULL;
+                }
+            }
+            mFdWatchByFd[fd] = watch;
+        }
     }
 
     void delFdWatch(FdWatch* watch) {
+        int fd = watch->fd();
+        if (fd >= 0 && (size_t)fd < mFdWatchByFd.size() &&
+            mFdWatchByFd[fd] == watch) {
+            mFdWatchByFd[fd] = NULL;
+        }
         mFdWatches.pick(watch);
     }
 
+    // Return the FdWatch for a given file descriptor, or NULL.
+    FdWatch* findFdWatch(int fd) const {
+        if (fd >= 0 && (size_t)fd < mFdWatchByFd.size()) {
+            return mFdWatchByFd[fd];
+        }
+        return NULL;
+    }
+
     void addPendingFdWatch(FdWatch* watch) {
         mPendingFdWatches.insertTail(watch);
     }
@@ -181,6 +214,8 @@ public:
         Timer(GenLooper* looper, Callback callback, void* opaque) :
                 Looper::Timer(looper, callback, opaque),
                 mDeadline(kDurationInfinite),
+                mSequence(0U),
+                mHeapIndex(kNotInHeap),
                 mPending(false),
                 mPendingLink() {
             DCHECK(mCallback);
@@ -193,13 +228,20 @@ public:
 
         virtual ~Timer() {
             clearPending();
+            genLooper()->disableTimer(this);
             genLooper()->delTimer(this);
         }
 
-        Timer* next() const { return mPendingLink.next(); }
-
         Duration deadline() const { return mDeadline; }
 
+        // Return true iff this timer must fire before |other|.
+        bool firesBefore(const Timer* other) const {
+            if (mDeadline != other->mDeadline) {
+                return mDeadline < other->mDeadline;
+            }
+            return mSequence < other->mSequence;
+        }
+
         virtual void startRelative(Duration deadlineMs) {
             if (deadlineMs != kDurationInfinite) {
                 deadlineMs += mLooper->nowMs();
@@ -208,9 +250,10 @@ public:
         }
 
         virtual void startAbsolute(Duration deadlineMs) {
-            if (mDeadline != kDurationInfinite) {
-                genLooper()->disableTimer(this);
-            }
+            // Re-arming or stopping a timer that expired but didn't fire
+            // yet cancels that.
+            clearPending();
+            genLooper()->disableTimer(this);
             mDeadline = deadlineMs;
             if (mDeadline != kDurationInfinite) {
                 genLooper()->enableTimer(this);
@@ -247,7 +290,13 @@ public:
         TAIL_QUEUE_LIST_TRAITS(Traits, Timer, mPendingLink);
 
     private:
+        friend class GenLooper;
+
+        static const size_t kNotInHeap = (size_t)-1;
+
         Duration mDeadline;
+        uint64_t mSequence;    // Arming order, to break deadline ties.
+        size_t mHeapIndex;     // Position in mActiveTimers, if active.
         bool mPending;
         TailQueueLink<Timer> mPendingLink;
     };
@@ -261,21 +310,82 @@ public:
     }
 
     void enableTimer(Timer* timer) {
-        // Find the first timer that expires after this one.
-        Timer* item = mActiveTimers.front();
-        while (item && item->deadline() < timer->deadline()) {
-            item = item->next();
+        DCHECK(timer->mHeapIndex == Timer::kNotInHeap);
+        timer->mSequence = mTimerSequence++;
+        size_t index = mActiveTimers.size();
+        mActiveTimers.append(timer);
+        timer->mHeapIndex = index;
+        siftUp(index);
+    }
+
+    void disableTimer(Timer* timer) {
+        size_t index = timer->mHeapIndex;
+        if (index == Timer::kNotInHeap) {
+            return;
         }
-        if (item) {
-            mActiveTimers.insertBefore(item, timer);
+        DCHECK(mActiveTimers[index] == timer);
+        timer->mHeapIndex = Timer::kNotInHeap;
+
+        // Move the last timer into the hole, then restore the heap order.
+        size_t last = mActiveTimers.size() - 1U;
+        if (index != last) {
+            Timer* moved = mActiveTimers[last];
+            mActiveTimers[index] = moved;
+            moved->mHeapIndex = index;
+            mActiveTimers.resize(last);
+            if (index > 0 &&
+                moved->firesBefore(mActiveTimers[(index - 1U) / 2U])) {
+                siftUp(index);
+            } else {
+                siftDown(index);
+            }
         } else {
-            mActiveTimers.insertTail(timer);
+            mActiveTimers.resize(last);
         }
     }
 
-    void disableTimer(Timer* timer) {
-        // Simply remove from the list.
-        mActiveTimers.remove(timer);
+    // Return the active timer with the earliest deadline, or NULL.
+    Timer* firstActiveTimer() const {
+        return mActiveTimers.empty() ? NULL : mActiveTimers[0];
+    }
+
+    void heapSet(size_t index, Timer* timer) {
+        mActiveTimers[index] = timer;
+        timer->mHeapIndex = index;
+    }
+
+    void siftUp(size_t index) {
+        Timer* timer = mActiveTimers[index];
+        while (index > 0) {
+            size_t parent = (index - 1U) / 2U;
+            if (!timer->firesBefore(mActiveTimers[parent])) {
+                break;
+            }
+            heapSet(index, mActiveTimers[parent]);
+            index = parent;
+        }
+        heapSet(index, timer);
+    }
+
+    void siftDown(size_t index) {
+        size_t count = mActiveTimers.size();
+        Timer* timer = mActiveTimers[index];
+        for (;;) {
+            size_t child = 2U * index + 1U;
+            if (child >= count) {
+                break;
+            }
+            if (child + 1U < count &&
+                mActiveTimers[child + 1U]->firesBefore(mActiveTimers[child])) {
+                child++;
+            }
+            if (!mActiveTimers[child]->firesBefore(timer)) {
+                break;
+            }
+            heapSet(index, mActiveTimers[child]);
+            index = child;
+        }
+        heapSet(index, timer);
     }
 
     void addPendingTimer(Timer* timer) {
@@ -308,7 +418,7 @@ public:
             // Compute next deadline from timers.
             Duration nextDeadline = kDurationInfinite;
 
-            Timer* firstTimer = mActiveTimers.front();
+            Timer* firstTimer = firstActiveTimer();
             if (firstTimer) {
                 nextDeadline = firstTimer->deadline();
             }
@@ -340,15 +450,9 @@ public:
                         break;
                     }
 
-                    // Find the FdWatch for this file descriptor.
-                    // TODO(digit): Improve efficiency with a map?
-                    FdWatchSet::Iterator iter(&mFdWatches);
-                    while (iter.hasNext()) {
-                        FdWatch* watch = iter.next();
-                        if (watch->fd() == fd) {
-                            watch->setPending(events);
-                            break;
-                        }
+                    FdWatch* watch = findFdWatch(fd);
+                    if (watch && !watch->isPending()) {
+                        watch->setPending(events);
                     }
                 }
             }
@@ -357,16 +461,16 @@ public:
             DCHECK(mPendingTimers.empty());
 
             const Duration kNow = nowMs();
-            Timer* timer = mActiveTimers.front();
-            while (timer) {
-                if (timer->deadline() > kNow) {
+            for (;;) {
+                Timer* timer = firstActiveTimer();
+                if (!timer || timer->deadline() > kNow) {
                     break;
                 }
 
-                // Remove from active list, add to pending list.
-                mActiveTimers.remove(timer);
+                // Remove from active heap, add to pending list, which
+                // thus stays sorted.
+                disableTimer(timer);
                 timer->setPending();
-                timer = timer->next();
             }
 
             // Fire the pending timers, this is done in a separate step
@@ -391,7 +495,8 @@ public:
                 watch->fire();
             }
 
-            if (ret == 0) {
+            // Also stop when descriptors are always ready.
+            if (ret == 0 || nowMs() >= deadlineMs) {
                 return ETIMEDOUT;
             }
         }
@@ -401,18 +506,23 @@ public:
 
     typedef TailQueueList<Timer> TimerList;
     typedef ScopedPointerSet<Timer> TimerSet;
+    typedef PodVector<Timer*> TimerHeap;
 
     typedef TailQueueList<FdWatch> FdWatchList;
     typedef ScopedPointerSet<FdWatch> FdWatchSet;
 
 private:
+    // NOTE: The sets own the watches and timers, whose destructors
+    // use the other members, so they must be destroyed first.
     ScopedPtr<SocketWaiter> mWaiter;
+    PodVector<FdWatch*> mFdWatchByFd;  // Fd watches, indexed by fd.
     FdWatchSet mFdWatches;         // Set of all fd watches.
     FdWatchList mPendingFdWatches;  // Queue of pending fd watches.
 
-    TimerSet  mTimers;        // Set of all timers.
-    TimerList mActiveTimers;  // Sorted list of active timers.
-    TimerList mPendingTimers; // Sorted list of pending timers.
+    TimerHeap mActiveTimers;    // Min-heap of active timers.
+    uint64_t  mTimerSequence;   // Arming counter, see Timer::firesBefore().
+    TimerSet  mTimers;          // Set of all timers.
+    TimerList mPendingTimers;   // Sorted list of pending timers.
 
     bool mForcedExit;
 };
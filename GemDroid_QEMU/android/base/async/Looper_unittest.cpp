@@ -0,0 +1,319 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/base/async/Looper.h"
+
+#include "android/base/containers/PodVector.h"
+#include "android/base/memory/ScopedPtr.h"
+#include "android/base/sockets/SocketUtils.h"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <stdio.h>
+
+namespace android {
+namespace base {
+
+namespace {
+
+typedef Looper::Duration Duration;
+
+// A timer that records its index in a shared vector when it fires.
+struct OrderedTimer {
+    int index;
+    PodVector<int>* fired;
+    Looper::Timer* timer;
+};
+
+void onOrderedTimer(void* opaque) {
+    OrderedTimer* t = static_cast<OrderedTimer*>(opaque);
+    t->fired->append(t->index);
+}
+
+// Simple pseudo-random number generator, for reproducible tests.
+unsigned nextRandom(unsigned* seed) {
+    *seed = *seed * 1103515245U + 12345U;
+    return *seed >> 16;
+}
+
+}  // namespace
+
+TEST(Looper, TimersFireInDeadlineOrder) {
+    const int kCount = 200;
+    ScopedPtr<Looper> looper(Looper::create());
+    PodVector<int> fired;
+    OrderedTimer timers[kCount];
+    Duration deadlines[kCount];
+
+    // All deadlines are in the past, so that all timers expire during the
+    // same iteration. Many of them share the same deadline.
+    Duration base = looper->nowMs() - 1000;
+    unsigned seed = 1;
+    for (int n = 0; n < kCount; n++) {
+        deadlines[n] = base + nextRandom(&seed) % 50;
+        timers[n].index = n;
+        timers[n].fired = &fired;
+        timers[n].timer = looper->createTimer(onOrderedTimer, &timers[n]);
+        timers[n].timer->startAbsolute(deadlines[n]);
+    }
+
+    EXPECT_EQ(ETIMEDOUT, looper->runWithTimeoutMs(0));
+    ASSERT_EQ((size_t)kCount, fired.size());
+    for (int n = 1; n < kCount; n++) {
+        int a = fired[n - 1];
+        int b = fired[n];
+        EXPECT_TRUE(deadlines[a] < deadlines[b] ||
+                    (deadlines[a] == deadlines[b] && a < b))
+                << "timer " << a << " fired before timer " << b;
+    }
+
+    for (int n = 0; n < kCount; n++) {
+        delete timers[n].timer;
+    }
+}
+
+TEST(Looper, StoppedAndRestartedTimers) {
+    const int kCount = 100;
+    ScopedPtr<Looper> looper(Looper::create());
+    PodVector<int> fired;
+    OrderedTimer timers[kCount];
+
+    Duration base = looper->nowMs() - 1000;
+    for (int n = 0; n < kCount; n++) {
+        timers[n].index = n;
+        timers[n].fired = &fired;
+        timers[n].timer = looper->createTimer(onOrderedTimer, &timers[n]);
+        timers[n].timer->startAbsolute(base + n);
+    }
+    // Stop every odd timer, and restart every multiple of 4 so that they
+    // now fire in reverse order, after all the others.
+    for (int n = 0; n < kCount; n++) {
+        if (n & 1) {
+            timers[n].timer->stop();
+            EXPECT_FALSE(timers[n].timer->isActive());
+        } else if ((n % 4) == 0) {
+            timers[n].timer->startAbsolute(base + 2 * kCount - n);
+        }
+    }
+
+    EXPECT_EQ(ETIMEDOUT, looper->runWithTimeoutMs(0));
+
+    PodVector<int> expected;
+    for (int n = 2; n < kCount; n += 4) {
+        expected.append(n);
+    }
+    for (int n = kCount - 4; n >= 0; n -= 4) {
+        expected.append(n);
+    }
+    ASSERT_EQ(expected.size(), fired.size());
+    for (size_t n = 0; n < expected.size(); n++) {
+        EXPECT_EQ(expected[n], fired[n]) << "at position " << n;
+    }
+
+    for (int n = 0; n < kCount; n++) {
+        EXPECT_FALSE(timers[n].timer->isActive());
+        delete timers[n].timer;
+    }
+}
+
+namespace {
+
+struct RepeatTimer {
+    Looper* looper;
+    Looper::Timer* timer;
+    int count;
+};
+
+void onRepeatTimer(void* opaque) {
+    RepeatTimer* t = static_cast<RepeatTimer*>(opaque);
+    if (--t->count > 0) {
+        t->timer->startRelative(0);
+    }
+}
+
+}  // namespace
+
+TEST(Looper, TimerRestartedFromCallback) {
+    ScopedPtr<Looper> looper(Looper::create());
+    RepeatTimer t;
+    t.looper = looper.get();
+    t.timer = looper->createTimer(onRepeatTimer, &t);
+    t.count = 10;
+    t.timer->startRelative(0);
+
+    // Without fd watches, each run returns after one iteration, and
+    // EWOULDBLOCK once the timer is no longer active.
+    int ret;
+    do {
+        ret = looper->runWithTimeoutMs(10000);
+    } while (ret == ETIMEDOUT);
+    EXPECT_EQ(EWOULDBLOCK, ret);
+    EXPECT_EQ(0, t.count);
+    delete t.timer;
+}
+
+TEST(Looper, DeleteActiveTimers) {
+    ScopedPtr<Looper> looper(Looper::create());
+    PodVector<int> fired;
+    OrderedTimer timers[3];
+    for (int n = 0; n < 3; n++) {
+        timers[n].index = n;
+        timers[n].fired = &fired;
+        timers[n].timer = looper->createTimer(onOrderedTimer, &timers[n]);
+        timers[n].timer->startRelative(0);
+    }
+    delete timers[0].timer;
+    delete timers[2].timer;
+
+    EXPECT_EQ(ETIMEDOUT, looper->runWithTimeoutMs(0));
+    ASSERT_EQ(1U, fired.size());
+    EXPECT_EQ(1, fired[0]);
+    delete timers[1].timer;
+
+    // Timers still active when the looper is destroyed.
+    Looper::Timer* timer = looper->createTimer(onOrderedTimer, &timers[0]);
+    timer->startRelative(100000);
+    looper.reset(NULL);
+}
+
+namespace {
+
+struct ReadWatch {
+    Looper* looper;
+    int count;
+};
+
+void onReadWatch(void* opaque, int fd, unsigned events) {
+    ReadWatch* w = static_cast<ReadWatch*>(opaque);
+    char c;
+    EXPECT_EQ(Looper::FdWatch::kEventRead, events);
+    EXPECT_EQ(1, socketRecv(fd, &c, 1));
+    if (++w->count == 3) {
+        w->looper->forceQuit();
+    }
+}
+
+}  // namespace
+
+TEST(Looper, FdWatchRead) {
+    ScopedPtr<Looper> looper(Looper::create());
+    int s1, s2;
+    ASSERT_EQ(0, socketCreatePair(&s1, &s2));
+
+    ReadWatch w = { looper.get(), 0 };
+    Looper::FdWatch* watch = looper->createFdWatch(s1, onReadWatch, &w);
+    watch->wantRead();
+    EXPECT_EQ(3, socketSend(s2, "abc", 3));
+
+    EXPECT_EQ(0, looper->runWithTimeoutMs(10000));
+    EXPECT_EQ(3, w.count);
+
+    delete watch;
+    socketClose(s1);
+    socketClose(s2);
+}
+
+namespace {
+
+// Benchmark state: each socket pair bounces a byte back and forth, and
+// each timer re-arms itself for the next iteration.
+struct BenchState {
+    Looper* looper;
+    long events;
+};
+
+struct BenchTimer {
+    BenchState* state;
+    Looper::Timer* timer;
+};
+
+void onBenchRead(void* opaque, int fd, unsigned events) {
+    BenchState* state = static_cast<BenchState*>(opaque);
+    char c;
+    if (socketRecv(fd, &c, 1) == 1) {
+        socketSend(fd, &c, 1);
+    }
+    state->events++;
+}
+
+void onBenchTimer(void* opaque) {
+    BenchTimer* t = static_cast<BenchTimer*>(opaque);
+    t->state->events++;
+    t->timer->startRelative(0);
+}
+
+}  // namespace
+
+// Events per second for N busy file descriptors and M timers re-armed on
+// each iteration.
+TEST(Looper, DISABLED_EventsPerSecondBenchmark) {
+    static const int kFds[] = { 1, 16, 256 };
+    static const int kTimers[] = { 0, 16, 1024 };
+    const Duration kRunMs = 1000;
+
+    for (size_t f = 0; f < sizeof(kFds) / sizeof(kFds[0]); f++) {
+        for (size_t t = 0; t < sizeof(kTimers) / sizeof(kTimers[0]); t++) {
+            int numFds = kFds[f];
+            int numTimers = kTimers[t];
+            ScopedPtr<Looper> looper(Looper::create());
+            BenchState state = { looper.get(), 0 };
+
+            PodVector<int> sockets;
+            PodVector<Looper::FdWatch*> watches;
+            for (int n = 0; n < numFds; n++) {
+                int s1, s2;
+                ASSERT_EQ(0, socketCreatePair(&s1, &s2));
+                sockets.append(s1);
+                sockets.append(s2);
+                for (int i = 0; i < 2; i++) {
+                    int fd = (i == 0) ? s1 : s2;
+                    Looper::FdWatch* watch =
+                            looper->createFdWatch(fd, onBenchRead, &state);
+                    watch->wantRead();
+                    watches.append(watch);
+                }
+                socketSend(s1, "!", 1);
+            }
+
+            BenchTimer* timers = new BenchTimer[numTimers];
+            for (int n = 0; n < numTimers; n++) {
+                timers[n].state = &state;
+                timers[n].timer =
+                        looper->createTimer(onBenchTimer, &timers[n]);
+                timers[n].timer->startRelative(0);
+            }
+
+            Duration start = looper->nowMs();
+            looper->runWithTimeoutMs(kRunMs);
+            Duration elapsed = looper->nowMs() - start;
+            if (elapsed <= 0) {
+                elapsed = 1;
+            }
+            printf("%4d fds %5d timers: %10.0f events/s\n",
+                   numFds, numTimers, state.events * 1000.0 / elapsed);
+
+            for (int n = 0; n < numTimers; n++) {
+                delete timers[n].timer;
+            }
+            delete [] timers;
+            for (size_t n = 0; n < watches.size(); n++) {
+                delete watches[n];
+            }
+            for (size_t n = 0; n < sockets.size(); n++) {
+                socketClose(sockets[n]);
+            }
+        }
+    }
+}
+
+}  // namespace base
+}  // namespace android
@@ -0,0 +1,172 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/base/containers/IntMap.h"
+
+#include "android/base/containers/HashUtils.h"
+#include "android/base/Log.h"
+
+#include <stdlib.h>
+
+namespace android {
+namespace base {
+
+namespace {
+
+// Return the ideal slot of |key| in an array of |1U << shift| entries.
+// Multiplicative (Fibonacci) hashing spreads sequential ids, which are
+// the common case, evenly over the array.
+inline size_t idealSlot(int key, size_t shift) {
+    return (static_cast<uint32_t>(key) * 2654435769U) >> (32U - shift);
+}
+
+}  // namespace
+
+IntMapBase::IntMapBase() :
+        mShift(internal::kMinShift),
+        mCount(0),
+        mEntries(NULL) {
+    mEntries = static_cast<Entry*>(
+            ::calloc(1U << mShift, sizeof(mEntries[0])));
+}
+
+IntMapBase::~IntMapBase() {
+    mCount = 0;
+    mShift = 0;
+    ::free(mEntries);
+}
+
+IntMapBase::Iterator::Iterator(const IntMapBase* map) :
+        mEntries(map->mEntries),
+        mCapacity(1U << map->mShift),
+        mPos(0U),
+        mNext(0U) {
+    mNext = skipUnused(0U);
+}
+
+void IntMapBase::Iterator::next() {
+    DCHECK(mNext < mCapacity);
+    mPos = mNext;
+    mNext = skipUnused(mPos + 1U);
+}
+
+size_t IntMapBase::Iterator::skipUnused(size_t pos) const {
+    while (pos < mCapacity && mEntries[pos].dist == 0) {
+        pos++;
+    }
+    return pos;
+}
+
+void IntMapBase::clear() {
+    mCount = 0;
+    mShift = internal::kMinShift;
+    size_t capacity = 1U << mShift;
+    ::free(mEntries);
+    mEntries = static_cast<Entry*>(::calloc(capacity, sizeof(mEntries[0])));
+}
+
+void* IntMapBase::setItem(int key, void* value) {
+    intptr_t pos = find(key);
+    if (pos >= 0) {
+        void* result = mEntries[pos].value;
+        mEntries[pos].value = value;
+        return result;
+    }
+    size_t newShift = internal::hashShiftAdjust(mCount + 1U, mShift);
+    if (newShift != mShift) {
+        resize(newShift);
+    }
+    insert(key, value);
+    mCount++;
+    return NULL;
+}
+
+void* IntMapBase::removeItem(int key) {
+    intptr_t found = find(key);
+    if (found < 0) {
+        return NULL;
+    }
+    void* result = mEntries[found].value;
+
+    // Shift the following entries back by one slot, until one is unused
+    // or already in its ideal slot.
+    size_t mask = (1U << mShift) - 1U;
+    size_t pos = static_cast<size_t>(found);
+    for (;;) {
+        size_t next = (pos + 1U) & mask;
+        if (mEntries[next].dist <= 1U) {
+            break;
+        }
+        mEntries[pos] = mEntries[next];
+        mEntries[pos].dist--;
+        pos = next;
+    }
+    mEntries[pos].dist = 0;
+    mCount--;
+    return result;
+}
+
+intptr_t IntMapBase::find(int key) const {
+    size_t mask = (1U << mShift) - 1U;
+    size_t pos = idealSlot(key, mShift);
+    for (uint32_t dist = 1U; ; dist++) {
+        const Entry& entry = mEntries[pos];
+        // Stop at an unused entry (dist == 0), or at one that is closer to
+        // its ideal slot than |key| would be: |key| would have taken it.
+        if (entry.dist < dist) {
+            return -1;
+        }
+        if (entry.key == key) {
+            return static_cast<intptr_t>(pos);
+        }
+        pos = (pos + 1U) & mask;
+    }
+}
+
+void IntMapBase::insert(int key, void* value) {
+    size_t mask = (1U << mShift) - 1U;
+    size_t pos = idealSlot(key, mShift);
+    Entry item = { key, 1U, value };
+    for (;;) {
+        Entry& entry = mEntries[pos];
+        if (entry.dist == 0) {
+            entry = item;
+            return;
+        }
+        if (entry.dist < item.dist) {
+            // Take the slot from an entry closer to its ideal slot, and
+            // carry on with that one instead.
+            Entry tmp = entry;
+            entry = item;
+            item = tmp;
+        }
+        pos = (pos + 1U) & mask;
+        item.dist++;
+    }
+}
+
+void IntMapBase::resize(size_t newShift) {
+    size_t capacity = 1U << mShift;
+    Entry* entries = mEntries;
+
+    mShift = newShift;
+    mEntries = static_cast<Entry*>(
+            ::calloc(1U << newShift, sizeof(mEntries[0])));
+    for (size_t n = 0; n < capacity; ++n) {
+        if (entries[n].dist != 0) {
+            insert(entries[n].key, entries[n].value);
+        }
+    }
+    ::free(entries);
+}
+
+}  // namespace base
+}  // namespace android
@@ -0,0 +1,208 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_BASE_CONTAINERS_INT_MAP_H
+#define ANDROID_BASE_CONTAINERS_INT_MAP_H
+
+#include "android/base/Compiler.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+namespace base {
+
+// An IntMap<T> models a map from integer keys to pointers to objects of
+// type T. NULL is a valid value. The objects are not owned by the map.
+//
+// The implementation is an open-addressing hash table using Robin Hood
+// hashing: all entries live in a single array, and each one records its
+// distance from its ideal slot. Entries that are further away from their
+// ideal slot take precedence on insertion, which keeps probe sequences
+// short even at high load, and lets a lookup for a missing key stop as
+// soon as it meets an entry that is closer to its own ideal slot.
+// Removal shifts the following entries back, so there are no tombstones.
+//
+// Usage example:
+//
+//     IntMap<Foo> map;           // Creates new empty map.
+//     map.set(42, foo);          // Associate foo to key 42.
+//     if (map.contains(42)) {    // Test whether the map has key 42.
+//         Foo* foo = map.get(42);
+//         map.remove(42);
+//     }
+//
+//  Iterating over a map:
+//
+//     IntMap<Foo>::Iterator iter(&map);
+//     while (iter.hasNext()) {
+//         iter.next();
+//         .. do something with iter.key() and iter.value()
+//     }
+//
+//  Note that the iterator becomes invalid if you add or remove keys
+//  to/from the map. Iteration order is unspecified.
+
+class IntMapBase {
+public:
+    IntMapBase();
+    ~IntMapBase();
+
+    struct Entry {
+        int key;
+        // 0 for unused entries, otherwise 1 + distance from ideal slot.
+        uint32_t dist;
+        void* value;
+    };
+
+    class Iterator {
+    public:
+        explicit Iterator(const IntMapBase* map);
+        ~Iterator() {}
+
+        bool hasNext() const {
+            return mNext < mCapacity;
+        }
+
+        // Move to the next entry. Only call this if hasNext() is true.
+        void next();
+
+        int key() const { return mEntries[mPos].key; }
+        void* value() const { return mEntries[mPos].value; }
+
+    private:
+        // No default constructor
+        Iterator();
+
+        DISALLOW_COPY_AND_ASSIGN(Iterator);
+
+        // Return the position of the first used entry at or after |pos|,
+        // or |mCapacity| if there is none.
+        size_t skipUnused(size_t pos) const;
+
+        const Entry* mEntries;
+        size_t mCapacity;
+        size_t mPos;
+        size_t mNext;
+    };
+
+protected:
+    bool empty() const {
+        return mCount == 0;
+    }
+
+    size_t size() const {
+        return mCount;
+    }
+
+    bool contains(int key) const {
+        return find(key) >= 0;
+    }
+
+    void* getItem(int key, void* def) const {
+        intptr_t pos = find(key);
+        return (pos >= 0) ? mEntries[pos].value : def;
+    }
+
+    void clear();
+
+    // Set the value for |key|. Return the previous value, or NULL.
+    void* setItem(int key, void* value);
+
+    // Remove |key| from the map. Return its value, or NULL.
+    void* removeItem(int key);
+
+private:
+    // Return the index of |key|'s entry, or -1 if it isn't in the map.
+    intptr_t find(int key) const;
+
+    // Add |key| to the map, knowing that it isn't there yet.
+    void insert(int key, void* value);
+
+    void resize(size_t newShift);
+
+    size_t mShift;
+    size_t mCount;
+    Entry* mEntries;
+
+    DISALLOW_COPY_AND_ASSIGN(IntMapBase);
+};
+
+template <typename T>
+class IntMap : public IntMapBase {
+public:
+    // Default constructor creates an empty map.
+    IntMap() : IntMapBase() {}
+
+    // Destructor simply destroys the map, not the objects in it.
+    ~IntMap() {}
+
+    // Return true iff the map is empty.
+    bool empty() const {
+        return IntMapBase::empty();
+    }
+
+    // Return the number of keys in the map.
+    size_t size() const {
+        return IntMapBase::size();
+    }
+
+    // Return true iff the map has a value for |key|. Necessary because
+    // NULL is a valid value.
+    bool contains(int key) const {
+        return IntMapBase::contains(key);
+    }
+
+    // Return the value associated with |key|, or |def| if it is not in
+    // the map.
+    T* get(int key, T* def = NULL) const {
+        return static_cast<T*>(IntMapBase::getItem(key, def));
+    }
+
+    // Remove all keys from the map.
+    void clear() {
+        IntMapBase::clear();
+    }
+
+    // Associate |value| with |key|. Return the previous value, or NULL if
+    // |key| was not in the map.
+    T* set(int key, T* value) {
+        return static_cast<T*>(IntMapBase::setItem(key, value));
+    }
+
+    // Remove |key| from the map. Return its value, or NULL if it was not
+    // in the map.
+    T* remove(int key) {
+        return static_cast<T*>(IntMapBase::removeItem(key));
+    }
+
+    // Iterator class for this map. Note that adding or removing keys
+    // makes the iterator invalid. Usage example is:
+    //
+    //     IntMap<Foo>::Iterator  iter(&fooMap);
+    //     while (iter.hasNext()) {
+    //        iter.next();
+    //        .. do something with |iter.key()| and |iter.value()|
+    //     }
+    class Iterator : public IntMapBase::Iterator {
+    public:
+        Iterator(const IntMap* map) : IntMapBase::Iterator(map) {}
+
+        T* value() const {
+            return static_cast<T*>(IntMapBase::Iterator::value());
+        }
+    };
+};
+
+}  // namespace base
+}  // namespace android
+
+#endif  // ANDROID_BASE_CONTAINERS_INT_MAP_H
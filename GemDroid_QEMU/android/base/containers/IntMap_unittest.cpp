@@ -0,0 +1,231 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/base/containers/IntMap.h"
+
+#include "android/base/containers/PodVector.h"
+#include "android/base/system/System.h"
+
+#include <gtest/gtest.h>
+
+#include <limits.h>
+#include <stdio.h>
+
+namespace android {
+namespace base {
+
+namespace {
+
+class Foo {
+public:
+    Foo() : mValue(0) {}
+    explicit Foo(int value) : mValue(value) {}
+
+    int value() const { return mValue; }
+
+private:
+    int mValue;
+};
+
+// Simple pseudo-random number generator, for reproducible tests.
+unsigned nextRandom(unsigned* seed) {
+    *seed = *seed * 1103515245U + 12345U;
+    return *seed >> 8;
+}
+
+}  // namespace
+
+TEST(IntMap, DefaultConstructor) {
+    IntMap<Foo> map;
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(0U, map.size());
+    EXPECT_FALSE(map.contains(0));
+    EXPECT_FALSE(map.get(0));
+
+    IntMap<Foo>::Iterator iter(&map);
+    EXPECT_FALSE(iter.hasNext());
+}
+
+TEST(IntMap, SetGetRemove) {
+    IntMap<Foo> map;
+    Foo foo1(1), foo2(2);
+
+    EXPECT_FALSE(map.set(10, &foo1));
+    EXPECT_EQ(1U, map.size());
+    EXPECT_EQ(&foo1, map.get(10));
+    EXPECT_EQ(&foo2, map.get(11, &foo2));
+
+    EXPECT_EQ(&foo1, map.set(10, &foo2));
+    EXPECT_EQ(1U, map.size());
+    EXPECT_EQ(&foo2, map.get(10));
+
+    EXPECT_FALSE(map.remove(11));
+    EXPECT_EQ(&foo2, map.remove(10));
+    EXPECT_TRUE(map.empty());
+    EXPECT_FALSE(map.contains(10));
+}
+
+TEST(IntMap, NullValue) {
+    IntMap<Foo> map;
+    Foo foo;
+    EXPECT_FALSE(map.set(-1, NULL));
+    EXPECT_TRUE(map.contains(-1));
+    EXPECT_EQ(1U, map.size());
+    EXPECT_EQ(NULL, map.get(-1, &foo));
+    EXPECT_FALSE(map.remove(-1));
+    EXPECT_FALSE(map.contains(-1));
+}
+
+TEST(IntMap, ExtremeKeys) {
+    IntMap<Foo> map;
+    Foo foos[4];
+    const int keys[4] = { INT_MIN, -1, 0, INT_MAX };
+    for (int n = 0; n < 4; n++) {
+        map.set(keys[n], &foos[n]);
+    }
+    for (int n = 0; n < 4; n++) {
+        EXPECT_EQ(&foos[n], map.get(keys[n]));
+    }
+}
+
+TEST(IntMap, ManyKeysWithRandomOperations) {
+    const int kCount = 5000;
+    IntMap<Foo> map;
+    Foo* foos = new Foo[kCount];
+    bool present[kCount] = { false };
+    size_t count = 0;
+
+    // Keys are multiples of a large power of two, to stress collisions
+    // in the low bits.
+    unsigned seed = 1;
+    for (int round = 0; round < 50000; round++) {
+        int n = nextRandom(&seed) % kCount;
+        int key = n << 12;
+        if (nextRandom(&seed) % 3 == 0) {
+            EXPECT_EQ(present[n] ? &foos[n] : NULL, map.remove(key));
+            if (present[n]) {
+                count--;
+            }
+            present[n] = false;
+        } else {
+            EXPECT_EQ(present[n] ? &foos[n] : NULL, map.set(key, &foos[n]));
+            if (!present[n]) {
+                count++;
+            }
+            present[n] = true;
+        }
+        ASSERT_EQ(count, map.size());
+    }
+
+    for (int n = 0; n < kCount; n++) {
+        EXPECT_EQ(present[n], map.contains(n << 12)) << "for key " << n;
+        EXPECT_EQ(present[n] ? &foos[n] : NULL, map.get(n << 12));
+    }
+
+    // The iterator must visit each key exactly once.
+    bool visited[kCount] = { false };
+    size_t numVisited = 0;
+    IntMap<Foo>::Iterator iter(&map);
+    while (iter.hasNext()) {
+        iter.next();
+        int n = iter.key() >> 12;
+        ASSERT_TRUE(present[n]);
+        EXPECT_FALSE(visited[n]);
+        EXPECT_EQ(&foos[n], iter.value());
+        visited[n] = true;
+        numVisited++;
+    }
+    EXPECT_EQ(count, numVisited);
+
+    delete [] foos;
+}
+
+TEST(IntMap, Clear) {
+    IntMap<Foo> map;
+    Foo foo;
+    for (int n = 0; n < 100; n++) {
+        map.set(n, &foo);
+    }
+    EXPECT_EQ(100U, map.size());
+    map.clear();
+    EXPECT_TRUE(map.empty());
+    EXPECT_FALSE(map.contains(50));
+    map.set(50, &foo);
+    EXPECT_EQ(&foo, map.get(50));
+}
+
+namespace {
+
+// The linear scan that AIntMap used before it was based on IntMap.
+void* linearLookup(const PodVector<int>& keys,
+                   const PodVector<void*>& values,
+                   int key) {
+    for (size_t n = 0; n < keys.size(); n++) {
+        if (keys[n] == key) {
+            return values[n];
+        }
+    }
+    return NULL;
+}
+
+}  // namespace
+
+// Lookup time for 10 to 100k random keys, against a linear scan.
+TEST(IntMap, DISABLED_LookupBenchmark) {
+    static const int kSizes[] = { 10, 100, 1000, 10000, 100000 };
+    const int kLookups = 1000000;
+
+    for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); s++) {
+        int size = kSizes[s];
+        IntMap<Foo> map;
+        PodVector<int> keys;
+        PodVector<void*> values;
+        Foo foo;
+        unsigned seed = 1;
+        for (int n = 0; n < size; n++) {
+            int key = (int)nextRandom(&seed);
+            map.set(key, &foo);
+            keys.append(key);
+            values.append(&foo);
+        }
+
+        // Look up random keys from the map.
+        size_t found = 0;
+        seed = 2;
+        double start = System::getHighResTimeUs();
+        for (int n = 0; n < kLookups; n++) {
+            found += (map.get(keys[nextRandom(&seed) % size]) != NULL);
+        }
+        double mapNs = (System::getHighResTimeUs() - start) * 1e3 / kLookups;
+        EXPECT_EQ((size_t)kLookups, found);
+
+        // Keep the linear scan to about 1e8 key comparisons.
+        int linearLookups = 100000000 / size;
+        if (linearLookups > kLookups) {
+            linearLookups = kLookups;
+        }
+        found = 0;
+        seed = 2;
+        start = System::getHighResTimeUs();
+        for (int n = 0; n < linearLookups; n++) {
+            int key = keys[nextRandom(&seed) % size];
+            found += (linearLookup(keys, values, key) != NULL);
+        }
+        double linearNs = (System::getHighResTimeUs() - start) * 1e3 / linearLookups;
+        EXPECT_EQ((size_t)linearLookups, found);
+
+        printf("%6d keys: IntMap %7.1f ns/lookup   linear %10.1f ns/lookup\n",
+               size, mapNs, linearNs);
+    }
+}
+
+}  // namespace base
+}  // namespace android
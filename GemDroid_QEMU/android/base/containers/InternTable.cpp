@@ -0,0 +1,126 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/base/containers/InternTable.h"
+
+#include "android/base/containers/HashUtils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace android {
+namespace base {
+
+namespace {
+
+// 32-bit FNV-1a hash of a string.
+uint32_t stringHash(const StringView& str) {
+    uint32_t hash = 2166136261U;
+    for (size_t n = 0; n < str.size(); ++n) {
+        hash ^= static_cast<uint8_t>(str.data()[n]);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+// Return the ideal slot of |hash| in an array of |1U << shift| entries.
+inline size_t idealSlot(uint32_t hash, size_t shift) {
+    return (hash * 2654435769U) >> (32U - shift);
+}
+
+}  // namespace
+
+InternTable::InternTable() :
+        mShift(internal::kMinShift),
+        mCount(0),
+        mEntries(NULL),
+        mArena() {
+    mEntries = static_cast<Entry*>(
+            ::calloc(1U << mShift, sizeof(mEntries[0])));
+}
+
+InternTable::~InternTable() {
+    ::free(mEntries);
+}
+
+const char* InternTable::intern(const StringView& str) {
+    uint32_t hash = stringHash(str);
+    size_t pos = lookup(str, hash);
+    if (mEntries[pos].str) {
+        return mEntries[pos].str;
+    }
+
+    size_t newShift = internal::hashShiftAdjust(mCount + 1U, mShift);
+    if (newShift != mShift) {
+        resize(newShift);
+        pos = lookup(str, hash);
+    }
+
+    Entry& entry = mEntries[pos];
+    entry.str = mArena.strDup(str);
+    entry.hash = hash;
+    entry.size = static_cast<uint32_t>(str.size());
+    mCount++;
+    return entry.str;
+}
+
+const char* InternTable::find(const StringView& str) const {
+    return mEntries[lookup(str, stringHash(str))].str;
+}
+
+void InternTable::clear() {
+    mCount = 0;
+    mShift = internal::kMinShift;
+    ::free(mEntries);
+    mEntries = static_cast<Entry*>(
+            ::calloc(1U << mShift, sizeof(mEntries[0])));
+    mArena.reset();
+}
+
+size_t InternTable::lookup(const StringView& str, uint32_t hash) const {
+    size_t mask = (1U << mShift) - 1U;
+    size_t pos = idealSlot(hash, mShift);
+    for (;;) {
+        const Entry& entry = mEntries[pos];
+        if (!entry.str) {
+            return pos;
+        }
+        if (entry.hash == hash && entry.size == str.size() &&
+            !::memcmp(entry.str, str.data(), str.size())) {
+            return pos;
+        }
+        pos = (pos + 1U) & mask;
+    }
+}
+
+void InternTable::resize(size_t newShift) {
+    size_t capacity = 1U << mShift;
+    Entry* entries = mEntries;
+
+    mShift = newShift;
+    mEntries = static_cast<Entry*>(
+            ::calloc(1U << newShift, sizeof(mEntries[0])));
+    size_t mask = (1U << newShift) - 1U;
+    for (size_t n = 0; n < capacity; ++n) {
+        if (entries[n].str) {
+            // All strings are distinct, just find an unused entry.
+            size_t pos = idealSlot(entries[n].hash, newShift);
+            while (mEntries[pos].str) {
+                pos = (pos + 1U) & mask;
+            }
+            mEntries[pos] = entries[n];
+        }
+    }
+    ::free(entries);
+}
+
+}  // namespace base
+}  // namespace android
@@ -0,0 +1,85 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_BASE_CONTAINERS_INTERN_TABLE_H
+#define ANDROID_BASE_CONTAINERS_INTERN_TABLE_H
+
+#include "android/base/Compiler.h"
+#include "android/base/StringView.h"
+#include "android/base/memory/Arena.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+namespace base {
+
+// An InternTable keeps a single, immutable copy of each distinct string
+// added to it. This is useful for strings that are repeated many times,
+// like configuration keys: they are stored only once, and two interned
+// strings are equal if and only if they have the same address.
+//
+// The copies are zero-terminated and stored in an Arena owned by the
+// table, so they remain valid until the table is cleared or destroyed.
+// Strings can embed zero bytes.
+//
+// Usage example:
+//
+//     InternTable table;
+//     const char* key1 = table.intern("hw.ramSize");
+//     const char* key2 = table.intern(StringView(line, keyLen));
+//     if (key1 == key2) {
+//         ... same key.
+//     }
+//
+class InternTable {
+public:
+    InternTable();
+    ~InternTable();
+
+    // Return the number of strings in the table.
+    size_t size() const { return mCount; }
+
+    // Return the interned copy of |str|, adding it to the table if needed.
+    const char* intern(const StringView& str);
+
+    // Return the interned copy of |str|, or NULL if it is not in the table.
+    const char* find(const StringView& str) const;
+
+    // Remove all strings from the table. This invalidates all pointers
+    // previously returned by intern() and find().
+    void clear();
+
+private:
+    struct Entry {
+        const char* str;    // NULL for unused entries.
+        uint32_t hash;
+        uint32_t size;
+    };
+
+    // Return the position of the entry for |str| with |hash|, or of the
+    // unused entry where it should be inserted.
+    size_t lookup(const StringView& str, uint32_t hash) const;
+
+    void resize(size_t newShift);
+
+    size_t mShift;
+    size_t mCount;
+    Entry* mEntries;
+    Arena mArena;
+
+    DISALLOW_COPY_AND_ASSIGN(InternTable);
+};
+
+}  // namespace base
+}  // namespace android
+
+#endif  // ANDROID_BASE_CONTAINERS_INTERN_TABLE_H
@@ -0,0 +1,155 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/base/containers/InternTable.h"
+
+#include "android/base/containers/PodVector.h"
+#include "android/base/containers/StringVector.h"
+#include "android/base/StringFormat.h"
+#include "android/base/system/System.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace android {
+namespace base {
+
+TEST(InternTable, DefaultConstructor) {
+    InternTable table;
+    EXPECT_EQ(0U, table.size());
+    EXPECT_FALSE(table.find("foo"));
+}
+
+TEST(InternTable, Intern) {
+    InternTable table;
+    char buffer[] = "hw.ramSize";
+    const char* str1 = table.intern(buffer);
+    EXPECT_NE(buffer, str1);
+    EXPECT_STREQ(buffer, str1);
+    EXPECT_EQ(1U, table.size());
+
+    // A different copy of the same string returns the same pointer.
+    const char* str2 = table.intern("hw.ramSize");
+    EXPECT_EQ(str1, str2);
+    EXPECT_EQ(1U, table.size());
+
+    // The interned copy doesn't depend on the source.
+    buffer[0] = 'x';
+    EXPECT_STREQ("hw.ramSize", str1);
+
+    const char* str3 = table.intern("hw.ram");
+    EXPECT_NE(str1, str3);
+    EXPECT_STREQ("hw.ram", str3);
+    EXPECT_EQ(2U, table.size());
+
+    const char* str4 = table.intern(StringView("hw.ramSize.extra", 6));
+    EXPECT_EQ(str3, str4);
+    EXPECT_EQ(2U, table.size());
+}
+
+TEST(InternTable, EmptyString) {
+    InternTable table;
+    const char* str = table.intern("");
+    EXPECT_TRUE(str);
+    EXPECT_STREQ("", str);
+    EXPECT_EQ(str, table.intern(""));
+    EXPECT_EQ(str, table.find(""));
+}
+
+TEST(InternTable, EmbeddedZeroes) {
+    InternTable table;
+    const char* str1 = table.intern(StringView("foo\0bar", 7));
+    const char* str2 = table.intern(StringView("foo", 3));
+    EXPECT_NE(str1, str2);
+    EXPECT_EQ(0, memcmp("foo\0bar", str1, 8));
+    EXPECT_EQ(2U, table.size());
+    EXPECT_EQ(str1, table.find(StringView("foo\0bar", 7)));
+    EXPECT_EQ(str2, table.find("foo"));
+}
+
+TEST(InternTable, Find) {
+    InternTable table;
+    const char* str = table.intern("disk.dataPartition.size");
+    EXPECT_EQ(str, table.find("disk.dataPartition.size"));
+    EXPECT_FALSE(table.find("disk.dataPartition"));
+    EXPECT_FALSE(table.find("disk.cachePartition.size"));
+    EXPECT_EQ(1U, table.size());
+}
+
+TEST(InternTable, ManyStrings) {
+    InternTable table;
+    const size_t kCount = 10000;
+    PodVector<const char*> strings;
+    strings.resize(kCount);
+    for (size_t n = 0; n < kCount; ++n) {
+        String str = StringFormat("key.%d", (int)n);
+        strings[n] = table.intern(str.c_str());
+        EXPECT_STREQ(str.c_str(), strings[n]);
+    }
+    EXPECT_EQ(kCount, table.size());
+
+    // Check that all strings were preserved when the table grew.
+    for (size_t n = 0; n < kCount; ++n) {
+        String str = StringFormat("key.%d", (int)n);
+        EXPECT_EQ(strings[n], table.find(str.c_str())) << "For " << str.c_str();
+        EXPECT_EQ(strings[n], table.intern(str.c_str())) << "For " << str.c_str();
+    }
+    EXPECT_EQ(kCount, table.size());
+}
+
+TEST(InternTable, Clear) {
+    InternTable table;
+    for (int n = 0; n < 100; ++n) {
+        table.intern(StringFormat("key.%d", n).c_str());
+    }
+    EXPECT_EQ(100U, table.size());
+
+    table.clear();
+    EXPECT_EQ(0U, table.size());
+    EXPECT_FALSE(table.find("key.0"));
+
+    const char* str = table.intern("key.0");
+    EXPECT_STREQ("key.0", str);
+    EXPECT_EQ(1U, table.size());
+}
+
+// Time to intern many repeated keys, compared to copying each of them
+// to the heap.
+TEST(InternTable, DISABLED_InternBenchmark) {
+    const int kKeys = 100;
+    const int kLookups = 1000000;
+    StringVector keys;
+    for (int n = 0; n < kKeys; ++n) {
+        keys.append(StringFormat("hw.config.key%d", n));
+    }
+
+    InternTable table;
+    double start = System::getHighResTimeUs();
+    for (int n = 0; n < kLookups; ++n) {
+        table.intern(keys[n % kKeys].c_str());
+    }
+    double internNs = (System::getHighResTimeUs() - start) * 1e3 / kLookups;
+
+    start = System::getHighResTimeUs();
+    for (int n = 0; n < kLookups; ++n) {
+        ::free(::strdup(keys[n % kKeys].c_str()));
+    }
+    double strdupNs = (System::getHighResTimeUs() - start) * 1e3 / kLookups;
+
+    printf("%d keys, %d lookups: intern %5.1f ns/key   strdup %5.1f ns/key\n",
+           kKeys, kLookups, internNs, strdupNs);
+}
+
+}  // namespace base
+}  // namespace android
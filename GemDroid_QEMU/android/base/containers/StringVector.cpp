@@ -69,8 +69,8 @@ void StringVector::remove(size_t index) {
     size_t oldSize = size();
     if (index >= oldSize)
         return;
-    String::finalizeSlice(begin(), 1U);
-    String::moveSlice(begin(), index + 1, index, oldSize - index);
+    String::finalizeSlice(begin() + index, 1U);
+    String::moveSlice(begin(), index + 1, index, oldSize - index - 1U);
     mEnd -= sizeof(String);
 }
 
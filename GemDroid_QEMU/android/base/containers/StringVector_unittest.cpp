@@ -109,6 +109,25 @@ TEST(StringVector, Remove) {
     }
 }
 
+TEST(StringVector, RemoveFromMiddle) {
+    StringVector v;
+    const size_t kMaxCount = 100;
+    for (size_t n = 0; n < kMaxCount; ++n) {
+        v.append(genHashString(n));
+    }
+    // Remove every other item, starting from the end, then check that
+    // the remaining ones were not altered.
+    for (size_t n = kMaxCount; n > 0; n -= 2) {
+        v.remove(n - 1U);
+    }
+    EXPECT_EQ(kMaxCount / 2U, v.size());
+    for (size_t n = 0; n < v.size(); ++n) {
+        String expected = genHashString(2U * n);
+        EXPECT_EQ(expected.size(), v[n].size()) << "At index " << n;
+        EXPECT_STREQ(expected.c_str(), v[n].c_str()) << "At index " << n;
+    }
+}
+
 TEST(StringVector, Swap) {
     static const char* const kList1[] = {
         "Hello", "World!",
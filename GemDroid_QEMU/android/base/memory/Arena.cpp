@@ -0,0 +1,141 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/base/memory/Arena.h"
+
+#include "android/base/Log.h"
+#include "android/base/StringView.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace android {
+namespace base {
+
+namespace {
+
+// Size of a chunk header, rounded up so that chunk data is aligned.
+const size_t kChunkHeaderSize =
+        (sizeof(void*) + sizeof(size_t) + Arena::kDefaultAlignment - 1U) &
+        ~static_cast<size_t>(Arena::kDefaultAlignment - 1U);
+
+inline char* alignUp(char* pos, size_t alignment) {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(pos);
+    addr = (addr + alignment - 1U) & ~static_cast<uintptr_t>(alignment - 1U);
+    return reinterpret_cast<char*>(addr);
+}
+
+}  // namespace
+
+Arena::Arena(size_t chunkSize) :
+        mChunks(NULL),
+        mPos(NULL),
+        mEnd(NULL),
+        mChunkSize(chunkSize),
+        mChunkCount(0),
+        mAllocatedSize(0) {}
+
+Arena::~Arena() {
+    while (mChunks) {
+        Chunk* chunk = mChunks;
+        mChunks = chunk->next;
+        ::free(chunk);
+    }
+}
+
+Arena::Chunk* Arena::newChunk(size_t size) {
+    Chunk* chunk = static_cast<Chunk*>(::malloc(kChunkHeaderSize + size));
+    CHECK(chunk != NULL);
+    chunk->next = NULL;
+    chunk->size = size;
+    mChunkCount++;
+    return chunk;
+}
+
+void* Arena::alloc(size_t size, size_t alignment) {
+    DCHECK(alignment != 0 && (alignment & (alignment - 1U)) == 0);
+
+    char* pos = alignUp(mPos, alignment);
+    if (mPos && pos <= mEnd && size <= static_cast<size_t>(mEnd - pos)) {
+        mPos = pos + size;
+        mAllocatedSize += size;
+        return pos;
+    }
+
+    size_t needed = size + alignment - 1U;
+    Chunk* chunk;
+    if (needed > mChunkSize / 4U) {
+        // Large allocation, use a dedicated chunk and keep the current
+        // one for the next allocations.
+        chunk = newChunk(needed);
+        if (mChunks) {
+            chunk->next = mChunks->next;
+            mChunks->next = chunk;
+        } else {
+            mChunks = chunk;
+        }
+        pos = alignUp(reinterpret_cast<char*>(chunk) + kChunkHeaderSize,
+                      alignment);
+    } else {
+        chunk = newChunk(mChunkSize);
+        chunk->next = mChunks;
+        mChunks = chunk;
+        char* data = reinterpret_cast<char*>(chunk) + kChunkHeaderSize;
+        pos = alignUp(data, alignment);
+        mPos = pos + size;
+        mEnd = data + mChunkSize;
+    }
+    mAllocatedSize += size;
+    return pos;
+}
+
+char* Arena::strDup(const char* str) {
+    return strDup(str, ::strlen(str));
+}
+
+char* Arena::strDup(const char* str, size_t len) {
+    char* result = static_cast<char*>(alloc(len + 1U, 1U));
+    ::memcpy(result, str, len);
+    result[len] = '\0';
+    return result;
+}
+
+char* Arena::strDup(const StringView& view) {
+    return strDup(view.str(), view.size());
+}
+
+void Arena::reset() {
+    Chunk* keep = NULL;
+    if (mChunks && mChunks->size == mChunkSize) {
+        keep = mChunks;
+        mChunks = keep->next;
+    }
+    while (mChunks) {
+        Chunk* chunk = mChunks;
+        mChunks = chunk->next;
+        ::free(chunk);
+        mChunkCount--;
+    }
+    mAllocatedSize = 0;
+    if (keep) {
+        keep->next = NULL;
+        mChunks = keep;
+        mPos = reinterpret_cast<char*>(keep) + kChunkHeaderSize;
+        mEnd = mPos + mChunkSize;
+    } else {
+        mPos = NULL;
+        mEnd = NULL;
+    }
+}
+
+}  // namespace base
+}  // namespace android
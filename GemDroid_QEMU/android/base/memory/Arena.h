@@ -0,0 +1,105 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_BASE_MEMORY_ARENA_H
+#define ANDROID_BASE_MEMORY_ARENA_H
+
+#include "android/base/Compiler.h"
+
+#include <stddef.h>
+
+namespace android {
+namespace base {
+
+class StringView;
+
+// A bump-pointer allocator for transient data, e.g. the many small strings
+// created while parsing a configuration file.
+//
+// Memory is carved sequentially from large chunks, so each allocation is
+// a pointer increment, and only one heap allocation is performed per
+// chunk. Individual allocations cannot be freed: everything is released
+// at once by reset() or the destructor. Allocations larger than a quarter
+// of the chunk size get a dedicated chunk, to avoid wasting the end of
+// the current one.
+//
+// Usage example:
+//
+//     Arena arena;
+//     char* key = arena.strDup(line, keyLen);
+//     Foo* foo = static_cast<Foo*>(arena.alloc(sizeof(Foo)));
+//     ...
+//     arena.reset();   // releases |key| and |foo|.
+//
+class Arena {
+public:
+    enum {
+        // Default size of each chunk, in bytes.
+        kDefaultChunkSize = 4096,
+        // Default alignment of allocations, suitable for any pointer or
+        // scalar type.
+        kDefaultAlignment = sizeof(double) > sizeof(void*) ?
+                sizeof(double) : sizeof(void*),
+    };
+
+    // Create a new empty arena using chunks of |chunkSize| bytes.
+    explicit Arena(size_t chunkSize = kDefaultChunkSize);
+
+    // Destructor releases all memory.
+    ~Arena();
+
+    // Allocate |size| bytes, aligned to |alignment|, which must be a
+    // power of 2. The content is not initialized. Never returns NULL.
+    void* alloc(size_t size, size_t alignment = kDefaultAlignment);
+
+    // Copy a zero-terminated string into the arena.
+    char* strDup(const char* str);
+
+    // Copy |len| bytes from |str| into the arena, followed by a
+    // terminating zero.
+    char* strDup(const char* str, size_t len);
+
+    char* strDup(const StringView& view);
+
+    // Release all allocations. The current chunk is kept for reuse if it
+    // has the default size.
+    void reset();
+
+    // Return the number of chunks currently allocated from the heap.
+    size_t chunkCount() const { return mChunkCount; }
+
+    // Return the total number of bytes allocated through alloc(),
+    // not including alignment padding.
+    size_t allocatedSize() const { return mAllocatedSize; }
+
+private:
+    struct Chunk {
+        Chunk* next;
+        size_t size;
+    };
+
+    // Allocate a new chunk that can hold at least |size| bytes.
+    Chunk* newChunk(size_t size);
+
+    Chunk* mChunks;     // Current chunk first, then older ones.
+    char* mPos;         // Next free byte in the current chunk.
+    char* mEnd;         // End of the current chunk.
+    size_t mChunkSize;
+    size_t mChunkCount;
+    size_t mAllocatedSize;
+
+    DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+}  // namespace base
+}  // namespace android
+
+#endif  // ANDROID_BASE_MEMORY_ARENA_H
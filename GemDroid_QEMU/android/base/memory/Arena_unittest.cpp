@@ -0,0 +1,178 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/base/memory/Arena.h"
+
+#include "android/base/containers/PodVector.h"
+#include "android/base/StringView.h"
+#include "android/base/system/System.h"
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace android {
+namespace base {
+
+namespace {
+
+bool isAligned(const void* ptr, size_t alignment) {
+    return (reinterpret_cast<uintptr_t>(ptr) & (alignment - 1U)) == 0;
+}
+
+}  // namespace
+
+TEST(Arena, DefaultConstructor) {
+    Arena arena;
+    EXPECT_EQ(0U, arena.chunkCount());
+    EXPECT_EQ(0U, arena.allocatedSize());
+}
+
+TEST(Arena, SmallAllocationsShareChunks) {
+    Arena arena(1024);
+    char* prev = NULL;
+    for (int n = 0; n < 100; ++n) {
+        char* ptr = static_cast<char*>(arena.alloc(10));
+        ASSERT_TRUE(ptr);
+        EXPECT_TRUE(isAligned(ptr, Arena::kDefaultAlignment));
+        ::memset(ptr, n, 10);
+        if (prev) {
+            EXPECT_NE(prev, ptr);
+        }
+        prev = ptr;
+    }
+    EXPECT_EQ(1000U, arena.allocatedSize());
+    // 16 bytes per allocation with the default alignment of 8 or 16.
+    EXPECT_LE(2U, arena.chunkCount());
+    EXPECT_GE(3U, arena.chunkCount());
+}
+
+TEST(Arena, Alignment) {
+    Arena arena;
+    static const size_t kAlignments[] = { 1, 2, 4, 8, 16, 64, 256 };
+    for (size_t n = 0; n < sizeof(kAlignments) / sizeof(kAlignments[0]);
+         ++n) {
+        arena.alloc(1, 1);
+        void* ptr = arena.alloc(3, kAlignments[n]);
+        EXPECT_TRUE(isAligned(ptr, kAlignments[n]))
+                << "For alignment " << kAlignments[n];
+    }
+    EXPECT_EQ(1U, arena.chunkCount());
+}
+
+TEST(Arena, LargeAllocationsUseDedicatedChunks) {
+    Arena arena(1024);
+    char* small1 = static_cast<char*>(arena.alloc(8));
+    EXPECT_EQ(1U, arena.chunkCount());
+
+    char* large = static_cast<char*>(arena.alloc(10000));
+    ::memset(large, 0x55, 10000);
+    EXPECT_EQ(2U, arena.chunkCount());
+
+    // The current chunk is still used for small allocations.
+    char* small2 = static_cast<char*>(arena.alloc(8));
+    EXPECT_EQ(2U, arena.chunkCount());
+    EXPECT_LT(small1, small2);
+    EXPECT_GT(small1 + 1024, small2);
+}
+
+TEST(Arena, StrDup) {
+    Arena arena;
+    const char* kString = "Hello World";
+    char* copy1 = arena.strDup(kString);
+    EXPECT_NE(kString, copy1);
+    EXPECT_STREQ(kString, copy1);
+
+    char* copy2 = arena.strDup(kString, 5);
+    EXPECT_STREQ("Hello", copy2);
+
+    char* copy3 = arena.strDup(StringView(kString + 6, 3));
+    EXPECT_STREQ("Wor", copy3);
+
+    // The copies don't overlap.
+    EXPECT_STREQ(kString, copy1);
+    EXPECT_STREQ("Hello", copy2);
+
+    char* copy4 = arena.strDup("");
+    EXPECT_STREQ("", copy4);
+}
+
+TEST(Arena, Reset) {
+    Arena arena(1024);
+    for (int n = 0; n < 1000; ++n) {
+        arena.strDup("some configuration key");
+    }
+    arena.alloc(100000);
+    EXPECT_LT(10U, arena.chunkCount());
+
+    arena.reset();
+    EXPECT_EQ(0U, arena.allocatedSize());
+    EXPECT_EQ(1U, arena.chunkCount());
+
+    // The remaining chunk is reused.
+    arena.strDup("another key");
+    EXPECT_EQ(1U, arena.chunkCount());
+
+    // Reset when the only chunk is a large one.
+    Arena arena2(1024);
+    arena2.alloc(100000);
+    EXPECT_EQ(1U, arena2.chunkCount());
+    arena2.reset();
+    EXPECT_EQ(0U, arena2.chunkCount());
+    EXPECT_STREQ("x", arena2.strDup("x"));
+}
+
+// Time to copy many short strings, like the keys and values of a
+// configuration file, with the arena and with individual heap allocations.
+TEST(Arena, DISABLED_StrDupBenchmark) {
+    const int kStrings = 10000;
+    const int kRounds = 100;
+    static const char* const kKeys[] = {
+        "hw.lcd.density", "hw.ramSize", "disk.dataPartition.size",
+        "hw.initialOrientation", "image.sysdir.1", "skin.path",
+        "hw.keyboard.charmap", "hw.device.manufacturer",
+    };
+    const int kNumKeys = sizeof(kKeys) / sizeof(kKeys[0]);
+
+    double start = System::getHighResTimeUs();
+    size_t chunks = 0;
+    for (int r = 0; r < kRounds; ++r) {
+        Arena arena;
+        for (int n = 0; n < kStrings; ++n) {
+            arena.strDup(kKeys[n % kNumKeys]);
+        }
+        chunks = arena.chunkCount();
+    }
+    double arenaNs = (System::getHighResTimeUs() - start) * 1e3 / (kRounds * kStrings);
+
+    PodVector<char*> copies;
+    copies.resize(kStrings);
+    start = System::getHighResTimeUs();
+    for (int r = 0; r < kRounds; ++r) {
+        for (int n = 0; n < kStrings; ++n) {
+            copies[n] = ::strdup(kKeys[n % kNumKeys]);
+        }
+        for (int n = 0; n < kStrings; ++n) {
+            ::free(copies[n]);
+        }
+    }
+    double mallocNs = (System::getHighResTimeUs() - start) * 1e3 / (kRounds * kStrings);
+
+    printf("%d strings: arena %5.1f ns/string (%d heap allocations)   "
+           "strdup %5.1f ns/string (%d heap allocations)\n",
+           kStrings, arenaNs, (int)chunks, mallocNs, kStrings);
+}
+
+}  // namespace base
+}  // namespace android
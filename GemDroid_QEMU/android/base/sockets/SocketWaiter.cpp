@@ -13,6 +13,7 @@
 #include "android/base/Limits.h"
 #include "android/base/sockets/SocketWaiter.h"
 
+#include "android/base/containers/PodVector.h"
 #include "android/base/Log.h"
 #include "android/base/sockets/SocketErrors.h"
 
@@ -22,9 +23,14 @@
 #  include <sys/types.h>
 #  include <sys/select.h>
 #endif
+#ifdef __linux__
+#  include <sys/epoll.h>
+#  include <unistd.h>
+#endif
 
 
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 
 namespace android {
@@ -249,10 +255,262 @@ private:
     int mPendingFd;
 };
 
+#ifdef __linux__
+
+// Linux implementation based on epoll. Unlike select(), the cost of a
+// wait() doesn't depend on the number or the values of the watched file
+// descriptors, only on the number of ready ones, and there is no
+// FD_SETSIZE limit. The kernel keeps the interest list between calls,
+// so update() only makes a system call when the wanted events change.
+class EpollSocketWaiter : public SocketWaiter {
+public:
+    // Return a new instance, or NULL if epoll is not available.
+    static EpollSocketWaiter* create() {
+        int epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) {
+            return NULL;
+        }
+        return new EpollSocketWaiter(epollFd);
+    }
+
+    virtual ~EpollSocketWaiter() {
+        ::close(mEpollFd);
+    }
+
+    virtual void reset() {
+        for (size_t fd = 0; fd < mWanted.size(); ++fd) {
+            if (mWanted[fd] & kEventMask) {
+                update(static_cast<int>(fd), 0);
+            }
+        }
+        mWanted.resize(0);
+        clearPending();
+    }
+
+    virtual unsigned wantedEventsFor(int fd) const {
+        return (fd >= 0 && (size_t)fd < mWanted.size())
+                ? (mWanted[fd] & kEventMask) : 0U;
+    }
+
+    virtual unsigned pendingEventsFor(int fd) const {
+        return (fd >= 0 && (size_t)fd < mPending.size())
+                ? mPending[fd] : 0U;
+    }
+
+    virtual bool hasFds() const {
+        return mFdCount > 0;
+    }
+
+    virtual void update(int fd, unsigned events) {
+        DCHECK(fd >= 0) << "fd " << fd;
+        events &= kEventMask;
+
+        unsigned oldEvents = wantedEventsFor(fd);
+        if (events == oldEvents) {
+            return;
+        }
+        if ((size_t)fd >= mWanted.size()) {
+            size_t oldSize = mWanted.size();
+            mWanted.resize(fd + 1);
+            ::memset(&mWanted[oldSize], 0, fd + 1 - oldSize);
+        }
+
+        unsigned char flags = mWanted[fd] & kNotPollable;
+        if (events == 0) {
+            if (!(flags & kNotPollable)) {
+                // Fails harmlessly if |fd| was already closed.
+                struct epoll_event ev = {};
+                ::epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, &ev);
+            } else {
+                mNotPollableCount--;
+            }
+            mWanted[fd] = 0;
+            mFdCount--;
+            return;
+        }
+
+        if (oldEvents == 0) {
+            mFdCount++;
+            flags = 0;
+        }
+
+        if (!(flags & kNotPollable)) {
+            struct epoll_event ev = {};
+            ev.events = toEpollEvents(events);
+            ev.data.fd = fd;
+            // If |fd| was closed and reused since the last update(), the
+            // kernel already dropped it from the interest list, and the
+            // reverse can happen after a reset().
+            int op = (oldEvents == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+            int ret = ::epoll_ctl(mEpollFd, op, fd, &ev);
+            if (ret < 0 && errno == ENOENT) {
+                ret = ::epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev);
+            } else if (ret < 0 && errno == EEXIST) {
+                ret = ::epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, &ev);
+            }
+            if (ret < 0 && errno == EPERM) {
+                // Regular files and directories can't be polled, but
+                // select() always reports them as ready, do the same.
+                flags |= kNotPollable;
+                mNotPollableCount++;
+            } else if (ret < 0) {
+                LOG(ERROR) << LogString("epoll_ctl(%d): %s\n", fd,
+                                        strerror(errno));
+            }
+        }
+        mWanted[fd] = flags | events;
+    }
+
+    virtual int wait(int64_t timeout_ms) {
+        clearPending();
+
+        // Nothing to wait on.
+        if (mFdCount <= 0) {
+            return 0;
+        }
+
+        int timeout;
+        if (mNotPollableCount > 0) {
+            timeout = 0;
+        } else if (timeout_ms < 0 || timeout_ms == INT64_MAX) {
+            timeout = -1;
+        } else if (timeout_ms > INT_MAX) {
+            timeout = INT_MAX;
+        } else {
+            timeout = static_cast<int>(timeout_ms);
+        }
+
+        if (mEvents.size() < (size_t)mFdCount) {
+            mEvents.resize(mFdCount);
+        }
+
+        int ret;
+        do {
+            ret = ::epoll_wait(mEpollFd, &mEvents[0],
+                               static_cast<int>(mEvents.size()), timeout);
+        } while (ret < 0 && errno == EINTR);
+
+        if (ret < 0) {
+            LOG(ERROR) << LogString("Error: %s\n", strerror(errno));
+            return ret;
+        }
+
+        for (int n = 0; n < ret; ++n) {
+            int fd = mEvents[n].data.fd;
+            addPending(fd, fromEpollEvents(mEvents[n].events) &
+                           wantedEventsFor(fd));
+        }
+        if (mNotPollableCount > 0) {
+            for (size_t fd = 0; fd < mWanted.size(); ++fd) {
+                if (mWanted[fd] & kNotPollable) {
+                    addPending(static_cast<int>(fd),
+                               mWanted[fd] & kEventMask);
+                }
+            }
+        }
+
+        ret = static_cast<int>(mPendingFds.size());
+        if (ret == 0) {
+            errno = ETIMEDOUT;
+        }
+        return ret;
+    }
+
+    virtual int nextPendingFd(unsigned* fdEvents) {
+        if (mNextPending < mPendingFds.size()) {
+            int fd = mPendingFds[mNextPending++];
+            *fdEvents = mPending[fd];
+            return fd;
+        }
+        *fdEvents = 0;
+        return -1;
+    }
+
+private:
+    enum {
+        kEventMask = kEventRead | kEventWrite,
+        // Set in mWanted[fd] for descriptors that epoll rejected.
+        kNotPollable = (1U << 7),
+    };
+
+    explicit EpollSocketWaiter(int epollFd) :
+            SocketWaiter(),
+            mEpollFd(epollFd),
+            mFdCount(0),
+            mNotPollableCount(0),
+            mWanted(),
+            mPending(),
+            mPendingFds(),
+            mNextPending(0U),
+            mEvents() {}
+
+    static uint32_t toEpollEvents(unsigned events) {
+        uint32_t result = 0;
+        if (events & kEventRead) {
+            result |= EPOLLIN;
+        }
+        if (events & kEventWrite) {
+            result |= EPOLLOUT;
+        }
+        return result;
+    }
+
+    // Like select(), report errors and hang-ups as both readable and
+    // writable, so that the next read() or write() returns them.
+    static unsigned fromEpollEvents(uint32_t events) {
+        unsigned result = 0;
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            result |= kEventRead;
+        }
+        if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            result |= kEventWrite;
+        }
+        return result;
+    }
+
+    void addPending(int fd, unsigned events) {
+        if (!events) {
+            return;
+        }
+        if ((size_t)fd >= mPending.size()) {
+            size_t oldSize = mPending.size();
+            mPending.resize(fd + 1);
+            ::memset(&mPending[oldSize], 0, fd + 1 - oldSize);
+        }
+        mPending[fd] = events;
+        mPendingFds.append(fd);
+    }
+
+    void clearPending() {
+        for (size_t n = 0; n < mPendingFds.size(); ++n) {
+            mPending[mPendingFds[n]] = 0;
+        }
+        mPendingFds.resize(0);
+        mNextPending = 0U;
+    }
+
+    int mEpollFd;
+    int mFdCount;           // Number of descriptors with wanted events.
+    int mNotPollableCount;  // Number of them that epoll rejected.
+    PodVector<unsigned char> mWanted;   // Wanted events, indexed by fd.
+    PodVector<unsigned char> mPending;  // Pending events, indexed by fd.
+    PodVector<int> mPendingFds;         // Descriptors with pending events.
+    size_t mNextPending;
+    PodVector<struct epoll_event> mEvents;
+};
+
+#endif  // __linux__
+
 }  // namespace
 
 // static
 SocketWaiter* SocketWaiter::create() {
+#ifdef __linux__
+    SocketWaiter* waiter = EpollSocketWaiter::create();
+    if (waiter) {
+        return waiter;
+    }
+#endif
     return new SelectSocketWaiter();
 }
 
@@ -57,6 +57,10 @@ public:
     // waiting thread that is blocked on wait().
     void signal();
 
+    // Signal that a condition was reached. This will wake all threads
+    // that are blocked on wait().
+    void broadcast();
+
 private:
     PodVector<HANDLE> mWaiters;
     Lock mLock;
@@ -81,6 +85,10 @@ private:
         pthread_cond_signal(&mCond);
     }
 
+    void broadcast() {
+        pthread_cond_broadcast(&mCond);
+    }
+
 private:
     pthread_cond_t mCond;
 
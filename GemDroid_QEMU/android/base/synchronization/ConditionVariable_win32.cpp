@@ -112,5 +112,15 @@ void ConditionVariable::signal() {
     mLock.unlock();
 }
 
+void ConditionVariable::broadcast() {
+    mLock.lock();
+    for (size_t n = 0; n < mWaiters.size(); ++n) {
+        SetEvent(mWaiters[n]);
+        // NOTE: The handles will be closed/recycled by the waiters.
+    }
+    mWaiters.resize(0U);
+    mLock.unlock();
+}
+
 }  // namespace base
 }  // namespace android
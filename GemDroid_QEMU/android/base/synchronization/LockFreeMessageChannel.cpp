@@ -0,0 +1,155 @@
+// Copyright 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "android/base/synchronization/LockFreeMessageChannel.h"
+
+#include "android/base/EintrWrapper.h"
+
+#include <errno.h>
+#include <limits.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace android {
+namespace base {
+
+LockFreeChannelBase::LockFreeChannelBase() :
+        mCanRead(),
+        mCanWrite(),
+        mEventFdArmed(0U) {
+    mEventFds[0] = mEventFds[1] = -1;
+}
+
+LockFreeChannelBase::~LockFreeChannelBase() {
+#ifndef _WIN32
+    if (mEventFds[0] >= 0) {
+        ::close(mEventFds[0]);
+    }
+    if (mEventFds[1] >= 0 && mEventFds[1] != mEventFds[0]) {
+        ::close(mEventFds[1]);
+    }
+#endif
+}
+
+int LockFreeChannelBase::eventFd() {
+    if (mEventFds[0] >= 0) {
+        return mEventFds[0];
+    }
+#if defined(__linux__)
+    int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    mEventFds[0] = mEventFds[1] = fd;
+#elif !defined(_WIN32)
+    int fds[2];
+    if (::pipe(fds) < 0) {
+        return -1;
+    }
+    for (int n = 0; n < 2; n++) {
+        ::fcntl(fds[n], F_SETFL, ::fcntl(fds[n], F_GETFL) | O_NONBLOCK);
+        ::fcntl(fds[n], F_SETFD, FD_CLOEXEC);
+    }
+    mEventFds[0] = fds[0];
+    mEventFds[1] = fds[1];
+#endif
+    // Armed from the start, since the channel is empty.
+    __atomic_store_n(&mEventFdArmed, 1U, __ATOMIC_SEQ_CST);
+    return mEventFds[0];
+}
+
+bool LockFreeChannelBase::armEventFd() {
+#ifndef _WIN32
+    if (mEventFds[0] < 0) {
+        return false;
+    }
+    // Drain the descriptor before arming it again, then tell the caller
+    // to look at the queue again, since a message may have been sent in
+    // between.
+    uint64_t buf[16];
+    while (HANDLE_EINTR(::read(mEventFds[0], buf, sizeof(buf))) > 0) {}
+    __atomic_store_n(&mEventFdArmed, 1U, __ATOMIC_SEQ_CST);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void LockFreeChannelBase::signalEventFd() {
+#ifndef _WIN32
+    if (__atomic_exchange_n(&mEventFdArmed, 0U, __ATOMIC_SEQ_CST) != 0U) {
+        // The value doesn't matter, only the readability of the descriptor.
+        uint64_t value = 1;
+        HANDLE_EINTR(::write(mEventFds[1], &value, sizeof(value)));
+    }
+#endif
+}
+
+uint32_t LockFreeChannelBase::beginWait(Waiter* w) {
+    __atomic_store_n(&w->sleeping, 1U, __ATOMIC_SEQ_CST);
+    return atomicLoad(&w->event);
+}
+
+#ifdef __linux__
+
+void LockFreeChannelBase::wait(Waiter* w, uint32_t event) {
+    // Returns immediately if |w->event| was already changed by signal().
+    syscall(SYS_futex, &w->event, FUTEX_WAIT_PRIVATE, event, NULL, NULL, 0);
+}
+
+void LockFreeChannelBase::signal(Waiter* w) {
+    if (__atomic_exchange_n(&w->sleeping, 0U, __ATOMIC_SEQ_CST) == 0U) {
+        return;  // Another thread already woke everyone up.
+    }
+    __atomic_add_fetch(&w->event, 1U, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &w->event, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+#else  // !__linux__
+
+void LockFreeChannelBase::wait(Waiter* w, uint32_t event) {
+    w->lock.lock();
+    w->count++;
+    while (atomicLoad(&w->event) == event) {
+        w->cond.wait(&w->lock);
+    }
+    w->count--;
+    w->lock.unlock();
+}
+
+void LockFreeChannelBase::signal(Waiter* w) {
+    if (__atomic_exchange_n(&w->sleeping, 0U, __ATOMIC_SEQ_CST) == 0U) {
+        return;
+    }
+    // ConditionVariable only wakes one thread at a time.
+    w->lock.lock();
+    __atomic_add_fetch(&w->event, 1U, __ATOMIC_SEQ_CST);
+    for (int n = 0; n < w->count; n++) {
+        w->cond.signal();
+    }
+    w->lock.unlock();
+}
+
+#endif  // !__linux__
+
+}  // namespace base
+}  // namespace android
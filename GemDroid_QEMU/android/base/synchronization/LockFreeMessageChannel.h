@@ -0,0 +1,306 @@
+// Copyright 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANDROID_BASE_SYNCHRONIZATION_LOCK_FREE_MESSAGE_CHANNEL_H
+#define ANDROID_BASE_SYNCHRONIZATION_LOCK_FREE_MESSAGE_CHANNEL_H
+
+#include "android/base/Compiler.h"
+
+#ifndef __linux__
+#include "android/base/synchronization/ConditionVariable.h"
+#include "android/base/synchronization/Lock.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+namespace base {
+
+// Base non-templated class of SpscMessageChannel and MpscMessageChannel,
+// which implements the sleeping and wakeup parts. Both sides only touch
+// the queue with atomic operations, and only make a system call when the
+// other side actually sleeps: a futex on Linux, a condition variable
+// elsewhere.
+class LockFreeChannelBase {
+public:
+    // Return a file descriptor that becomes readable when messages are
+    // available, so that the receiver can use a Looper::FdWatch instead
+    // of blocking in receive(). In the watch's callback, call tryReceive()
+    // until it returns false: this also re-arms the descriptor. Must be
+    // called before the first message is sent. Return -1 if this is not
+    // supported on this platform. The channel owns the descriptor.
+    int eventFd();
+
+protected:
+    LockFreeChannelBase();
+    ~LockFreeChannelBase();
+
+    // Helper to let one side wait for the other one.
+    struct Waiter {
+        Waiter() : event(0U), sleeping(0U) {
+#ifndef __linux__
+            count = 0;
+#endif
+        }
+
+        uint32_t event;     // Incremented on each wakeup.
+        uint32_t sleeping;  // Non-zero if a thread may be sleeping.
+#ifndef __linux__
+        Lock lock;
+        ConditionVariable cond;
+        int count;          // Number of threads in wait(), under |lock|.
+#endif
+    };
+
+    // Call these after a failed tryReceive() / trySend() in the blocking
+    // versions, as in:
+    //
+    //    uint32_t event = beginWait(&mCanRead);
+    //    if (<queue still empty>) {
+    //        wait(&mCanRead, event);
+    //    }
+    //
+    // The other side only makes a system call when |sleeping| is set, and
+    // clears it when doing so, so a thread that was just woken up doesn't
+    // make each new message or free slot cost another wakeup.
+    uint32_t beginWait(Waiter* w);
+    void wait(Waiter* w, uint32_t event);
+
+    // Called by the sender after it added a message.
+    void notifyReadable() {
+        if (atomicLoad(&mCanRead.sleeping) != 0U) {
+            signal(&mCanRead);
+        }
+        if (atomicLoad(&mEventFdArmed) != 0U) {
+            signalEventFd();
+        }
+    }
+
+    // Called by the receiver after it removed a message.
+    void notifyWritable() {
+        if (atomicLoad(&mCanWrite.sleeping) != 0U) {
+            signal(&mCanWrite);
+        }
+    }
+
+    // Called by the receiver when the queue looks empty. Return true if
+    // the caller must check the queue again, because the event descriptor
+    // was just re-armed.
+    bool armEventFd();
+
+    static uint32_t atomicLoad(const uint32_t* p) {
+        return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+    }
+
+    Waiter mCanRead;
+    Waiter mCanWrite;
+
+private:
+    void signal(Waiter* w);
+    void signalEventFd();
+
+    int mEventFds[2];
+    uint32_t mEventFdArmed;
+
+    DISALLOW_COPY_AND_ASSIGN(LockFreeChannelBase);
+};
+
+// A lock-free channel with a single sender thread and a single receiver
+// thread, with the same API as MessageChannel<T, CAPACITY>. Messages are
+// copied into a ring, and the sender and receiver only share the ring's
+// head and tail positions.
+//
+// Use this when both sides are known to be single threads, e.g. to hand
+// over data from a render thread to the main loop.
+template <typename T, size_t CAPACITY>
+class SpscMessageChannel : public LockFreeChannelBase {
+public:
+    SpscMessageChannel() : LockFreeChannelBase(), mHead(0U), mTail(0U) {}
+
+    // Send a message, blocking while the channel is full.
+    void send(const T& msg) {
+        while (!trySend(msg)) {
+            uint32_t event = beginWait(&mCanWrite);
+            if (isFull()) {
+                wait(&mCanWrite, event);
+            }
+        }
+    }
+
+    // Send a message if the channel isn't full. Return true on success.
+    bool trySend(const T& msg) {
+        size_t head = mHead;
+        if (isFull()) {
+            return false;
+        }
+        mItems[head % CAPACITY] = msg;
+        __atomic_store_n(&mHead, head + 1U, __ATOMIC_SEQ_CST);
+        notifyReadable();
+        return true;
+    }
+
+    // Receive a message, blocking while the channel is empty.
+    void receive(T* msg) {
+        while (!tryReceive(msg)) {
+            uint32_t event = beginWait(&mCanRead);
+            if (isEmpty()) {
+                wait(&mCanRead, event);
+            }
+        }
+    }
+
+    // Receive a message if one is available. Return true on success.
+    bool tryReceive(T* msg) {
+        if (isEmpty() && !(armEventFd() && !isEmpty())) {
+            return false;
+        }
+        size_t tail = mTail;
+        *msg = mItems[tail % CAPACITY];
+        __atomic_store_n(&mTail, tail + 1U, __ATOMIC_SEQ_CST);
+        notifyWritable();
+        return true;
+    }
+
+private:
+    bool isFull() const {
+        return __atomic_load_n(&mHead, __ATOMIC_SEQ_CST) -
+                __atomic_load_n(&mTail, __ATOMIC_SEQ_CST) >= CAPACITY;
+    }
+
+    bool isEmpty() const {
+        return __atomic_load_n(&mHead, __ATOMIC_SEQ_CST) ==
+                __atomic_load_n(&mTail, __ATOMIC_SEQ_CST);
+    }
+
+    // Keep the positions apart so each side mostly writes its own
+    // cache line.
+    size_t mHead;
+    char mPad1[64 - sizeof(size_t)];
+    size_t mTail;
+    char mPad2[64 - sizeof(size_t)];
+    T mItems[CAPACITY];
+};
+
+// A lock-free channel with any number of sender threads and a single
+// receiver thread, with the same API as MessageChannel<T, CAPACITY>.
+//
+// Each ring slot has a sequence number that tells whether it is free for
+// the sender that claimed its position, or ready for the receiver. Senders
+// claim positions with a compare-and-swap, so they never wait for each
+// other, except for the short time between the claim and the copy.
+template <typename T, size_t CAPACITY>
+class MpscMessageChannel : public LockFreeChannelBase {
+public:
+    MpscMessageChannel() : LockFreeChannelBase(), mHead(0U), mTail(0U) {
+        for (size_t n = 0; n < CAPACITY; ++n) {
+            mSlots[n].seq = n;
+        }
+    }
+
+    // Send a message, blocking while the channel is full.
+    void send(const T& msg) {
+        while (!trySend(msg)) {
+            uint32_t event = beginWait(&mCanWrite);
+            if (isFull()) {
+                wait(&mCanWrite, event);
+            }
+        }
+    }
+
+    // Send a message if the channel isn't full. Return true on success.
+    bool trySend(const T& msg) {
+        size_t pos = __atomic_load_n(&mHead, __ATOMIC_RELAXED);
+        Slot* slot;
+        for (;;) {
+            slot = &mSlots[pos % CAPACITY];
+            size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (__atomic_compare_exchange_n(&mHead, &pos, pos + 1U, true,
+                                                __ATOMIC_RELAXED,
+                                                __ATOMIC_RELAXED)) {
+                    break;
+                }
+                // |pos| was updated by the failed exchange.
+            } else if (diff < 0) {
+                return false;  // Full.
+            } else {
+                pos = __atomic_load_n(&mHead, __ATOMIC_RELAXED);
+            }
+        }
+        slot->item = msg;
+        __atomic_store_n(&slot->seq, pos + 1U, __ATOMIC_SEQ_CST);
+        notifyReadable();
+        return true;
+    }
+
+    // Receive a message, blocking while the channel is empty.
+    void receive(T* msg) {
+        while (!tryReceive(msg)) {
+            uint32_t event = beginWait(&mCanRead);
+            if (isEmpty()) {
+                wait(&mCanRead, event);
+            }
+        }
+    }
+
+    // Receive a message if one is available. Return true on success.
+    bool tryReceive(T* msg) {
+        if (isEmpty() && !(armEventFd() && !isEmpty())) {
+            return false;
+        }
+        size_t pos = mTail;
+        Slot* slot = &mSlots[pos % CAPACITY];
+        *msg = slot->item;
+        // Free the slot for the sender that will claim it next.
+        __atomic_store_n(&slot->seq, pos + CAPACITY, __ATOMIC_SEQ_CST);
+        mTail = pos + 1U;
+        notifyWritable();
+        return true;
+    }
+
+private:
+    struct Slot {
+        size_t seq;
+        T item;
+    };
+
+    // Return true iff the next message isn't ready. Receiver thread only.
+    bool isEmpty() const {
+        size_t pos = mTail;
+        return __atomic_load_n(&mSlots[pos % CAPACITY].seq,
+                               __ATOMIC_SEQ_CST) != pos + 1U;
+    }
+
+    // Return true iff the slot at the current head position still holds
+    // a message from the previous round.
+    bool isFull() const {
+        size_t pos = __atomic_load_n(&mHead, __ATOMIC_SEQ_CST);
+        size_t seq = __atomic_load_n(&mSlots[pos % CAPACITY].seq,
+                                     __ATOMIC_SEQ_CST);
+        return (intptr_t)seq - (intptr_t)pos < 0;
+    }
+
+    size_t mHead;  // Shared by senders.
+    char mPad1[64 - sizeof(size_t)];
+    size_t mTail;  // Receiver only.
+    char mPad2[64 - sizeof(size_t)];
+    Slot mSlots[CAPACITY];
+};
+
+}  // namespace base
+}  // namespace android
+
+#endif  // ANDROID_BASE_SYNCHRONIZATION_LOCK_FREE_MESSAGE_CHANNEL_H
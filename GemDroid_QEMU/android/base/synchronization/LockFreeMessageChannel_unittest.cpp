@@ -0,0 +1,249 @@
+// Copyright 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "android/base/synchronization/LockFreeMessageChannel.h"
+
+#include "android/base/async/Looper.h"
+#include "android/base/memory/ScopedPtr.h"
+#include "android/base/synchronization/MessageChannel.h"
+#include "android/base/system/System.h"
+#include "android/base/testing/TestThread.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <string>
+
+namespace android {
+namespace base {
+
+namespace {
+
+template <class Channel>
+void checkSingleThread() {
+    Channel channel;
+    int ret = 0;
+    EXPECT_FALSE(channel.tryReceive(&ret));
+
+    // Several rounds, so that positions wrap around.
+    for (int round = 0; round < 5; round++) {
+        EXPECT_TRUE(channel.trySend(1));
+        channel.send(2);
+        EXPECT_TRUE(channel.trySend(3));
+        EXPECT_FALSE(channel.trySend(4));
+
+        channel.receive(&ret);
+        EXPECT_EQ(1, ret);
+        EXPECT_TRUE(channel.tryReceive(&ret));
+        EXPECT_EQ(2, ret);
+        EXPECT_TRUE(channel.trySend(4));
+        channel.receive(&ret);
+        EXPECT_EQ(3, ret);
+        channel.receive(&ret);
+        EXPECT_EQ(4, ret);
+        EXPECT_FALSE(channel.tryReceive(&ret));
+    }
+}
+
+// Each sender sends |kCount| increasing values tagged with its index, the
+// receiver checks that each sender's values arrive in order.
+const int kMaxSenders = 4;
+
+template <class Channel>
+struct StreamState {
+    Channel channel;
+    int count;
+};
+
+template <class Channel>
+struct SenderParam {
+    StreamState<Channel>* state;
+    int index;
+};
+
+template <class Channel>
+void* senderFunction(void* param) {
+    SenderParam<Channel>* p = static_cast<SenderParam<Channel>*>(param);
+    for (int n = 0; n < p->state->count; n++) {
+        p->state->channel.send(p->index * p->state->count + n);
+    }
+    return NULL;
+}
+
+template <class Channel>
+bool checkStream(int numSenders, int count) {
+    StreamState<Channel>* state = new StreamState<Channel>();
+    state->count = count;
+    SenderParam<Channel> params[kMaxSenders];
+    TestThread* threads[kMaxSenders];
+    for (int n = 0; n < numSenders; n++) {
+        params[n].state = state;
+        params[n].index = n;
+        threads[n] = new TestThread(senderFunction<Channel>, &params[n]);
+    }
+
+    bool ok = true;
+    int next[kMaxSenders] = { 0 };
+    for (int n = 0; n < numSenders * count; n++) {
+        int value;
+        state->channel.receive(&value);
+        int sender = value / count;
+        if (sender >= numSenders || value % count != next[sender]) {
+            ok = false;
+        } else {
+            next[sender]++;
+        }
+    }
+
+    for (int n = 0; n < numSenders; n++) {
+        threads[n]->join();
+        delete threads[n];
+    }
+    delete state;
+    return ok;
+}
+
+}  // namespace
+
+TEST(SpscMessageChannel, SingleThread) {
+    checkSingleThread<SpscMessageChannel<int, 3U> >();
+}
+
+TEST(MpscMessageChannel, SingleThread) {
+    checkSingleThread<MpscMessageChannel<int, 3U> >();
+}
+
+TEST(SpscMessageChannel, StdString) {
+    SpscMessageChannel<std::string, 2U> channel;
+    channel.send(std::string("foo"));
+    channel.send(std::string("bar"));
+    std::string str;
+    channel.receive(&str);
+    EXPECT_STREQ("foo", str.c_str());
+    channel.receive(&str);
+    EXPECT_STREQ("bar", str.c_str());
+}
+
+TEST(SpscMessageChannel, TwoThreadsStream) {
+    EXPECT_TRUE((checkStream<SpscMessageChannel<int, 16U> >(1, 100000)));
+}
+
+TEST(MpscMessageChannel, TwoThreadsStream) {
+    EXPECT_TRUE((checkStream<MpscMessageChannel<int, 16U> >(1, 100000)));
+}
+
+TEST(MpscMessageChannel, ManySendersStream) {
+    EXPECT_TRUE((checkStream<MpscMessageChannel<int, 16U> >(kMaxSenders,
+                                                            50000)));
+}
+
+#ifndef _WIN32
+
+namespace {
+
+typedef MpscMessageChannel<int, 8U> EventChannel;
+
+struct EventFdState {
+    Looper* looper;
+    EventChannel channel;
+    int received;
+    int total;
+    bool inOrder;
+};
+
+void* eventFdSenderFunction(void* param) {
+    EventFdState* s = static_cast<EventFdState*>(param);
+    for (int n = 0; n < s->total; n++) {
+        s->channel.send(n);
+    }
+    return NULL;
+}
+
+void onEventFd(void* opaque, int fd, unsigned events) {
+    EventFdState* s = static_cast<EventFdState*>(opaque);
+    int value;
+    while (s->channel.tryReceive(&value)) {
+        if (value != s->received) {
+            s->inOrder = false;
+        }
+        s->received++;
+    }
+    if (s->received == s->total) {
+        s->looper->forceQuit();
+    }
+}
+
+}  // namespace
+
+TEST(MpscMessageChannel, EventFdWithLooper) {
+    ScopedPtr<Looper> looper(Looper::create());
+    EventFdState* state = new EventFdState();
+    state->looper = looper.get();
+    state->received = 0;
+    state->total = 10000;
+    state->inOrder = true;
+
+    int fd = state->channel.eventFd();
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(fd, state->channel.eventFd());
+    Looper::FdWatch* watch = looper->createFdWatch(fd, onEventFd, state);
+    watch->wantRead();
+
+    TestThread* thread = new TestThread(eventFdSenderFunction, state);
+    EXPECT_EQ(0, looper->runWithTimeoutMs(60000));
+    thread->join();
+    delete thread;
+
+    EXPECT_EQ(state->total, state->received);
+    EXPECT_TRUE(state->inOrder);
+    delete watch;
+    delete state;
+}
+
+namespace {
+
+template <class Channel>
+double benchmarkUs(int numSenders, int count) {
+    double start = System::getHighResTimeUs();
+    EXPECT_TRUE(checkStream<Channel>(numSenders, count));
+    return System::getHighResTimeUs() - start;
+}
+
+}  // namespace
+
+// Compare the mutex-based channel with the lock-free ones, with one sender
+// (latency-sensitive handoff) and several contending senders.
+TEST(MpscMessageChannel, DISABLED_ContentionBenchmark) {
+    const int kCount = 1 << 20;
+    for (int senders = 1; senders <= kMaxSenders; senders *= 2) {
+        int count = kCount / senders;
+        double mutexUs =
+                benchmarkUs<MessageChannel<int, 256U> >(senders, count);
+        double mpscUs =
+                benchmarkUs<MpscMessageChannel<int, 256U> >(senders, count);
+        printf("%d sender(s): mutex %6.1f ns/msg   mpsc %6.1f ns/msg",
+               senders, mutexUs * 1e3 / kCount, mpscUs * 1e3 / kCount);
+        if (senders == 1) {
+            double spscUs =
+                    benchmarkUs<SpscMessageChannel<int, 256U> >(1, kCount);
+            printf("   spsc %6.1f ns/msg", spscUs * 1e3 / kCount);
+        }
+        printf("\n");
+    }
+}
+
+#endif  // !_WIN32
+
+}  // namespace base
+}  // namespace android
@@ -39,6 +39,19 @@ size_t MessageChannelBase::beforeWrite() {
     return result;
 }
 
+bool MessageChannelBase::beforeTryWrite(size_t* pos) {
+    mLock.lock();
+    if (mCount >= mCapacity) {
+        mLock.unlock();
+        return false;
+    }
+    *pos = mPos + mCount;
+    if (*pos >= mCapacity) {
+        *pos -= mCapacity;
+    }
+    return true;
+}
+
 void MessageChannelBase::afterWrite() {
     mCount++;
     mCanRead.signal();
@@ -53,6 +66,16 @@ size_t MessageChannelBase::beforeRead() {
     return mPos;
 }
 
+bool MessageChannelBase::beforeTryRead(size_t* pos) {
+    mLock.lock();
+    if (mCount == 0) {
+        mLock.unlock();
+        return false;
+    }
+    *pos = mPos;
+    return true;
+}
+
 void MessageChannelBase::afterRead() {
     if (++mPos == mCapacity) {
         mPos = 0U;
@@ -40,6 +40,10 @@ protected:
     // afterWrite().
     size_t beforeWrite();
 
+    // Same as beforeWrite(), but return false, without waiting, if there
+    // is no available slot. On success, set |*pos| and return true.
+    bool beforeTryWrite(size_t* pos);
+
     // To be called after beforeWrite() and copying a new fixed-size message
     // into the array. This signal the receiver thread that there is a new
     // incoming message.
@@ -50,6 +54,10 @@ protected:
     // can be read. Caller must process the message, then call afterRead().
     size_t beforeRead();
 
+    // Same as beforeRead(), but return false, without waiting, if there
+    // is no message. On success, set |*pos| and return true.
+    bool beforeTryRead(size_t* pos);
+
     // To be called in the receiver thread after beforeRead() and processing
     // the corresponding message.
     void afterRead();
@@ -65,14 +73,16 @@ private:
 
 // Helper class used to implement an uni-directional IPC channel between
 // two threads. The channel can be used to send fixed-size messages of type
-// |T|, with an internal buffer size of |CAPACITY| items. All calls are
-// blocking.
+// |T|, with an internal buffer size of |CAPACITY| items. send() and
+// receive() are blocking, trySend() and tryReceive() are not.
 //
 // Usage is pretty straightforward:
 //
 //   - From the sender thread, call send(msg);
 //   - From the receiver thread, call receive(&msg);
 //
+// See LockFreeMessageChannel.h for lock-free variants with the same API.
+//
 template <typename T, size_t CAPACITY>
 class MessageChannel : public MessageChannelBase {
 public:
@@ -84,12 +94,32 @@ public:
         afterWrite();
     }
 
+    bool trySend(const T& msg) {
+        size_t pos;
+        if (!beforeTryWrite(&pos)) {
+            return false;
+        }
+        mItems[pos] = msg;
+        afterWrite();
+        return true;
+    }
+
     void receive(T* msg) {
         size_t pos = beforeRead();
         *msg = mItems[pos];
         afterRead();
     }
 
+    bool tryReceive(T* msg) {
+        size_t pos;
+        if (!beforeTryRead(&pos)) {
+            return false;
+        }
+        *msg = mItems[pos];
+        afterRead();
+        return true;
+    }
+
 private:
     T mItems[CAPACITY];
 };
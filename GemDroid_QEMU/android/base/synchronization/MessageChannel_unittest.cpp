@@ -75,6 +75,24 @@ TEST(MessageChannel, SingleThreadWithStdString) {
     EXPECT_STREQ("zoo", str.c_str());
 }
 
+TEST(MessageChannel, TrySendTryReceive) {
+    MessageChannel<int, 2U> channel;
+    int ret = 0;
+    EXPECT_FALSE(channel.tryReceive(&ret));
+    EXPECT_TRUE(channel.trySend(1));
+    EXPECT_TRUE(channel.trySend(2));
+    EXPECT_FALSE(channel.trySend(3));
+
+    EXPECT_TRUE(channel.tryReceive(&ret));
+    EXPECT_EQ(1, ret);
+    EXPECT_TRUE(channel.trySend(3));
+    EXPECT_TRUE(channel.tryReceive(&ret));
+    EXPECT_EQ(2, ret);
+    EXPECT_TRUE(channel.tryReceive(&ret));
+    EXPECT_EQ(3, ret);
+    EXPECT_FALSE(channel.tryReceive(&ret));
+}
+
 TEST(MessageChannel, TwoThreadsPingPong) {
     PingPongState state;
     TestThread* thread = new TestThread(pingPongFunction, &state);
@@ -26,6 +26,7 @@
 
 #ifdef __APPLE__
 #import <Carbon/Carbon.h>
+#include <mach/mach_time.h>
 #endif  // __APPLE__
 
 #ifndef _WIN32
@@ -35,6 +36,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 namespace android {
@@ -370,5 +372,26 @@ String System::findBundledExecutable(const char* programName) {
     return executablePath;
 }
 
+// static
+int64_t System::getHighResTimeUs() {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return static_cast<int64_t>(now.QuadPart * 1000000.0 / freq.QuadPart);
+#elif defined(__APPLE__)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    uint64_t ns = mach_absolute_time() * timebase.numer / timebase.denom;
+    return static_cast<int64_t>(ns / 1000);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000LL + ts.tv_nsec / 1000;
+#endif
+}
+
 }  // namespace base
 }  // namespace android
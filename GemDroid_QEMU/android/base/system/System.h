@@ -20,6 +20,8 @@
 #include "android/base/String.h"
 #include "android/base/containers/StringVector.h"
 
+#include <stdint.h>
+
 namespace android {
 namespace base {
 
@@ -88,6 +90,10 @@ public:
     // Return an empty string if the file doesn't exist.
     static String findBundledExecutable(const char* programName);
 
+    // Return a monotonic timestamp in microseconds, suitable to measure
+    // elapsed time. Its origin is unspecified.
+    static int64_t getHighResTimeUs();
+
     // Retrieve the value of a given environment variable.
     // Equivalent to getenv().
     virtual const char* envGet(const char* varname) const = 0;
@@ -185,5 +185,19 @@ TEST(System, findBundledExecutable) {
     EXPECT_FALSE(path.size());
 }
 
+TEST(System, getHighResTimeUs) {
+    int64_t start = System::getHighResTimeUs();
+    int64_t prev = start;
+    // Spin for at least a millisecond, the clock must never go backwards.
+    for (;;) {
+        int64_t now = System::getHighResTimeUs();
+        EXPECT_LE(prev, now);
+        prev = now;
+        if (now - start >= 1000) {
+            break;
+        }
+    }
+}
+
 }  // namespace base
 }  // namespace android
@@ -0,0 +1,242 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/base/threads/TaskGraph.h"
+
+#include "android/base/system/System.h"
+#include "android/base/threads/Thread.h"
+
+namespace android {
+namespace base {
+
+const TaskGraph::TaskId TaskGraph::kInvalidTaskId;
+
+struct TaskGraph::Task {
+    enum State {
+        kBlocked,
+        kReady,
+        kRunning,
+        kDone,
+    };
+
+    Task(const char* name_, TaskFunction func_, void* opaque_) :
+            name(name_),
+            func(func_),
+            opaque(opaque_),
+            state(kBlocked),
+            numBlockers(0),
+            dependents(),
+            startUs(0),
+            endUs(0),
+            worker(-1) {}
+
+    const char* name;
+    TaskFunction func;
+    void* opaque;
+    State state;
+    // Number of dependencies that have not completed yet.
+    size_t numBlockers;
+    // Tasks that depend on this one.
+    PodVector<TaskId> dependents;
+    int64_t startUs;
+    int64_t endUs;
+    int worker;
+};
+
+class TaskGraph::Worker : public Thread {
+public:
+    Worker(TaskGraph* graph, int index) :
+            Thread(), mGraph(graph), mIndex(index) {}
+
+    virtual intptr_t main() {
+        mGraph->workerLoop(mIndex);
+        return 0;
+    }
+
+private:
+    TaskGraph* mGraph;
+    int mIndex;
+};
+
+TaskGraph::TaskGraph(int numThreads) :
+        mLock(),
+        mReadyCond(),
+        mDoneCond(),
+        mTasks(),
+        mReady(),
+        mReadyHead(0U),
+        mPending(0U),
+        mStopping(false),
+        mWorkers(),
+        mStartUs(System::getHighResTimeUs()) {
+    for (int n = 0; n < numThreads; ++n) {
+        Worker* worker = new Worker(this, n);
+        if (!worker->start()) {
+            delete worker;
+            break;
+        }
+        mWorkers.push_back(worker);
+    }
+}
+
+TaskGraph::~TaskGraph() {
+    waitAll();
+
+    mLock.lock();
+    mStopping = true;
+    mReadyCond.broadcast();
+    mLock.unlock();
+
+    for (size_t n = 0; n < mWorkers.size(); ++n) {
+        mWorkers[n]->wait(NULL);
+        delete mWorkers[n];
+    }
+    for (size_t n = 0; n < mTasks.size(); ++n) {
+        delete mTasks[n];
+    }
+}
+
+TaskGraph::TaskId TaskGraph::add(const char* name,
+                                 TaskFunction func,
+                                 void* opaque,
+                                 const TaskId* deps,
+                                 size_t numDeps) {
+    AutoLock lock(mLock);
+    TaskId id = static_cast<TaskId>(mTasks.size());
+    for (size_t n = 0; n < numDeps; ++n) {
+        if (deps[n] < 0 || deps[n] >= id) {
+            return kInvalidTaskId;
+        }
+    }
+
+    Task* task = new Task(name, func, opaque);
+    for (size_t n = 0; n < numDeps; ++n) {
+        Task* dep = mTasks[deps[n]];
+        if (dep->state != Task::kDone) {
+            dep->dependents.push_back(id);
+            task->numBlockers++;
+        }
+    }
+    mTasks.push_back(task);
+    mPending++;
+
+    if (!task->numBlockers) {
+        task->state = Task::kReady;
+        mReady.push_back(id);
+        mReadyCond.signal();
+    }
+    return id;
+}
+
+void TaskGraph::wait(TaskId id) {
+    AutoLock lock(mLock);
+    if (id < 0 || static_cast<size_t>(id) >= mTasks.size()) {
+        return;
+    }
+    while (mTasks[id]->state != Task::kDone) {
+        Task* task = mWorkers.empty() ? popReadyTaskLocked() : NULL;
+        if (task) {
+            runTaskLocked(task, -1);
+        } else {
+            mDoneCond.wait(&mLock);
+        }
+    }
+}
+
+void TaskGraph::waitAll() {
+    AutoLock lock(mLock);
+    while (mPending > 0) {
+        Task* task = mWorkers.empty() ? popReadyTaskLocked() : NULL;
+        if (task) {
+            runTaskLocked(task, -1);
+        } else {
+            mDoneCond.wait(&mLock);
+        }
+    }
+}
+
+size_t TaskGraph::size() const {
+    AutoLock lock(mLock);
+    return mTasks.size();
+}
+
+bool TaskGraph::getTaskInfo(TaskId id, TaskInfo* info) const {
+    AutoLock lock(mLock);
+    if (id < 0 || static_cast<size_t>(id) >= mTasks.size()) {
+        return false;
+    }
+    const Task* task = mTasks[id];
+    if (task->state != Task::kDone) {
+        return false;
+    }
+    info->name = task->name;
+    info->startUs = task->startUs;
+    info->endUs = task->endUs;
+    info->worker = task->worker;
+    return true;
+}
+
+int64_t TaskGraph::elapsedUs() const {
+    return System::getHighResTimeUs() - mStartUs;
+}
+
+void TaskGraph::workerLoop(int worker) {
+    AutoLock lock(mLock);
+    for (;;) {
+        Task* task = popReadyTaskLocked();
+        if (task) {
+            runTaskLocked(task, worker);
+        } else if (mStopping) {
+            break;
+        } else {
+            mReadyCond.wait(&mLock);
+        }
+    }
+}
+
+TaskGraph::Task* TaskGraph::popReadyTaskLocked() {
+    if (mReadyHead == mReady.size()) {
+        return NULL;
+    }
+    Task* task = mTasks[mReady[mReadyHead++]];
+    if (mReadyHead == mReady.size()) {
+        mReady.resize(0U);
+        mReadyHead = 0U;
+    }
+    return task;
+}
+
+void TaskGraph::runTaskLocked(Task* task, int worker) {
+    task->state = Task::kRunning;
+    task->worker = worker;
+    task->startUs = System::getHighResTimeUs() - mStartUs;
+    mLock.unlock();
+
+    task->func(task->opaque);
+    int64_t endUs = System::getHighResTimeUs() - mStartUs;
+
+    mLock.lock();
+    task->endUs = endUs;
+    task->state = Task::kDone;
+    mPending--;
+    for (size_t n = 0; n < task->dependents.size(); ++n) {
+        Task* dependent = mTasks[task->dependents[n]];
+        if (--dependent->numBlockers == 0) {
+            dependent->state = Task::kReady;
+            mReady.push_back(task->dependents[n]);
+            mReadyCond.signal();
+        }
+    }
+    mDoneCond.broadcast();
+}
+
+}  // namespace base
+}  // namespace android
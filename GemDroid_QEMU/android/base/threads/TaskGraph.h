@@ -0,0 +1,134 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_BASE_THREADS_TASK_GRAPH_H
+#define ANDROID_BASE_THREADS_TASK_GRAPH_H
+
+#include "android/base/Compiler.h"
+#include "android/base/containers/PodVector.h"
+#include "android/base/synchronization/ConditionVariable.h"
+#include "android/base/synchronization/Lock.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+namespace base {
+
+// A TaskGraph runs a set of tasks with explicit dependencies on a small
+// pool of worker threads. A task only starts once all the tasks it
+// depends on have completed, and independent tasks run concurrently.
+//
+// The start and end time of each task is recorded, to make it easy to
+// see where time is spent, e.g. during emulator startup.
+//
+// Usage example:
+//
+//    TaskGraph graph(2);
+//    TaskGraph::TaskId kernel = graph.add("kernel", probeKernel, &state);
+//    TaskGraph::TaskId fstab = graph.add("fstab", readFstab, &state);
+//    TaskGraph::TaskId deps[2] = { kernel, fstab };
+//    graph.add("partitions", checkPartitions, &state, deps, 2);
+//    ... do something else in the current thread.
+//    graph.waitAll();
+//
+// Tasks can only depend on tasks that were added before them, which
+// makes cycles impossible. All methods can be called from any thread,
+// including from a task function, except that a task must not wait for
+// itself or for a task that depends on it.
+class TaskGraph {
+public:
+    typedef void (*TaskFunction)(void* opaque);
+    typedef int TaskId;
+
+    static const TaskId kInvalidTaskId = -1;
+
+    // Timing information for a given task. |startUs| and |endUs| are
+    // relative to the creation of the graph, and |worker| is the index
+    // of the worker thread that ran the task, or -1 for the thread that
+    // called wait() when the graph has no worker thread.
+    struct TaskInfo {
+        const char* name;
+        int64_t startUs;
+        int64_t endUs;
+        int worker;
+    };
+
+    // Create a new graph with |numThreads| worker threads. If this is 0,
+    // or the threads cannot be started, tasks are run from wait() and
+    // waitAll() instead.
+    explicit TaskGraph(int numThreads);
+
+    // Wait for all tasks to complete, then stop the worker threads.
+    ~TaskGraph();
+
+    // Add a new task named |name| that will call |func(opaque)| once all
+    // the |numDeps| tasks in |deps| have completed. |name| must remain
+    // valid until the graph is destroyed, e.g. be a string literal.
+    // Return the new task's identifier, or kInvalidTaskId if one of the
+    // dependencies is invalid.
+    TaskId add(const char* name,
+               TaskFunction func,
+               void* opaque,
+               const TaskId* deps = NULL,
+               size_t numDeps = 0);
+
+    // Wait until task |id| has completed.
+    void wait(TaskId id);
+
+    // Wait until all tasks added so far have completed.
+    void waitAll();
+
+    // Return the number of tasks added so far.
+    size_t size() const;
+
+    // Return the number of worker threads.
+    int numThreads() const { return static_cast<int>(mWorkers.size()); }
+
+    // Retrieve the timing information of completed task |id| into
+    // |*info|. Return false if the task is invalid or not completed yet.
+    bool getTaskInfo(TaskId id, TaskInfo* info) const;
+
+    // Return the time elapsed since the creation of the graph, in
+    // microseconds, with the same origin as TaskInfo timestamps.
+    int64_t elapsedUs() const;
+
+private:
+    struct Task;
+    class Worker;
+
+    // Main loop of worker thread |worker|.
+    void workerLoop(int worker);
+
+    // Pop the first ready task, or return NULL if there is none.
+    Task* popReadyTaskLocked();
+
+    // Run |task| with |mLock| released, then mark it as completed.
+    void runTaskLocked(Task* task, int worker);
+
+    mutable Lock mLock;
+    ConditionVariable mReadyCond;
+    ConditionVariable mDoneCond;
+    PodVector<Task*> mTasks;
+    PodVector<TaskId> mReady;
+    size_t mReadyHead;
+    size_t mPending;
+    bool mStopping;
+    PodVector<Worker*> mWorkers;
+    int64_t mStartUs;
+
+    DISALLOW_COPY_AND_ASSIGN(TaskGraph);
+};
+
+}  // namespace base
+}  // namespace android
+
+#endif  // ANDROID_BASE_THREADS_TASK_GRAPH_H
@@ -0,0 +1,220 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/base/threads/TaskGraph.h"
+
+#include "android/base/synchronization/Lock.h"
+
+#include <gtest/gtest.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace android {
+namespace base {
+
+namespace {
+
+void sleepMs(int ms) {
+#ifdef _WIN32
+    ::Sleep(ms);
+#else
+    ::usleep(ms * 1000);
+#endif
+}
+
+// Records the order in which tasks complete.
+class Recorder {
+public:
+    Recorder() : mLock(), mCount(0) {}
+
+    void record(int value) {
+        AutoLock lock(mLock);
+        mOrder[mCount++] = value;
+    }
+
+    int count() const {
+        AutoLock lock(mLock);
+        return mCount;
+    }
+
+    // Return the position of |value| in the completion order, or -1.
+    int position(int value) const {
+        AutoLock lock(mLock);
+        for (int n = 0; n < mCount; ++n) {
+            if (mOrder[n] == value) {
+                return n;
+            }
+        }
+        return -1;
+    }
+
+private:
+    mutable Lock mLock;
+    int mOrder[64];
+    int mCount;
+};
+
+struct Step {
+    Recorder* recorder;
+    int value;
+    int sleepMs;
+};
+
+void runStep(void* opaque) {
+    Step* step = static_cast<Step*>(opaque);
+    if (step->sleepMs) {
+        sleepMs(step->sleepMs);
+    }
+    step->recorder->record(step->value);
+}
+
+}  // namespace
+
+TEST(TaskGraph, Empty) {
+    TaskGraph graph(2);
+    EXPECT_EQ(2, graph.numThreads());
+    EXPECT_EQ(0U, graph.size());
+    graph.waitAll();
+    TaskGraph::TaskInfo info;
+    EXPECT_FALSE(graph.getTaskInfo(0, &info));
+}
+
+TEST(TaskGraph, InvalidDependency) {
+    TaskGraph graph(1);
+    Recorder recorder;
+    Step step = { &recorder, 0, 0 };
+    TaskGraph::TaskId deps[1] = { 0 };
+    // A task can't depend on itself, or on a task added after it.
+    EXPECT_EQ(TaskGraph::kInvalidTaskId,
+              graph.add("bad", runStep, &step, deps, 1));
+    EXPECT_EQ(0, graph.add("good", runStep, &step, deps, 0));
+    deps[0] = -1;
+    EXPECT_EQ(TaskGraph::kInvalidTaskId,
+              graph.add("bad", runStep, &step, deps, 1));
+    graph.waitAll();
+    EXPECT_EQ(1, recorder.count());
+    EXPECT_EQ(1U, graph.size());
+}
+
+// Check that a diamond of tasks runs in dependency order, with any number
+// of worker threads.
+TEST(TaskGraph, DependencyOrder) {
+    for (int numThreads = 0; numThreads < 4; ++numThreads) {
+        Recorder recorder;
+        // The first task sleeps to make sure dependents really wait.
+        Step steps[4] = {
+            { &recorder, 0, 20 },
+            { &recorder, 1, 10 },
+            { &recorder, 2, 0 },
+            { &recorder, 3, 0 },
+        };
+        TaskGraph graph(numThreads);
+        TaskGraph::TaskId root = graph.add("root", runStep, &steps[0]);
+        TaskGraph::TaskId left = graph.add("left", runStep, &steps[1],
+                                           &root, 1);
+        TaskGraph::TaskId right = graph.add("right", runStep, &steps[2],
+                                            &root, 1);
+        TaskGraph::TaskId deps[2] = { left, right };
+        TaskGraph::TaskId last = graph.add("last", runStep, &steps[3],
+                                           deps, 2);
+        graph.wait(last);
+
+        EXPECT_EQ(4, recorder.count()) << numThreads << " threads";
+        EXPECT_EQ(0, recorder.position(0));
+        EXPECT_EQ(3, recorder.position(3));
+
+        TaskGraph::TaskInfo rootInfo, lastInfo;
+        ASSERT_TRUE(graph.getTaskInfo(root, &rootInfo));
+        ASSERT_TRUE(graph.getTaskInfo(last, &lastInfo));
+        EXPECT_STREQ("root", rootInfo.name);
+        EXPECT_STREQ("last", lastInfo.name);
+        EXPECT_LE(rootInfo.startUs, rootInfo.endUs);
+        EXPECT_LE(rootInfo.endUs, lastInfo.startUs);
+        EXPECT_LE(lastInfo.endUs, graph.elapsedUs());
+        if (numThreads == 0) {
+            EXPECT_EQ(-1, lastInfo.worker);
+        } else {
+            EXPECT_LE(0, lastInfo.worker);
+            EXPECT_GT(numThreads, lastInfo.worker);
+        }
+    }
+}
+
+TEST(TaskGraph, DependencyAlreadyDone) {
+    TaskGraph graph(1);
+    Recorder recorder;
+    Step steps[2] = { { &recorder, 0, 0 }, { &recorder, 1, 0 } };
+    TaskGraph::TaskId first = graph.add("first", runStep, &steps[0]);
+    graph.wait(first);
+    TaskGraph::TaskId second = graph.add("second", runStep, &steps[1],
+                                         &first, 1);
+    graph.wait(second);
+    EXPECT_EQ(1, recorder.position(1));
+}
+
+// Independent tasks must overlap when there are enough threads.
+TEST(TaskGraph, IndependentTasksRunConcurrently) {
+    const int kCount = 4;
+    Recorder recorder;
+    Step steps[kCount];
+    TaskGraph graph(kCount);
+    for (int n = 0; n < kCount; ++n) {
+        steps[n].recorder = &recorder;
+        steps[n].value = n;
+        steps[n].sleepMs = 100;
+        graph.add("sleep", runStep, &steps[n]);
+    }
+    graph.waitAll();
+    EXPECT_EQ(kCount, recorder.count());
+
+    // The last task to start must have started before the first one
+    // completed.
+    int64_t lastStartUs = 0;
+    int64_t firstEndUs = graph.elapsedUs();
+    for (int n = 0; n < kCount; ++n) {
+        TaskGraph::TaskInfo info;
+        ASSERT_TRUE(graph.getTaskInfo(n, &info));
+        if (info.startUs > lastStartUs) {
+            lastStartUs = info.startUs;
+        }
+        if (info.endUs < firstEndUs) {
+            firstEndUs = info.endUs;
+        }
+    }
+    EXPECT_LT(lastStartUs, firstEndUs);
+}
+
+TEST(TaskGraph, ManyTasksChain) {
+    const int kCount = 64;
+    Recorder recorder;
+    Step steps[kCount];
+    TaskGraph graph(3);
+    TaskGraph::TaskId prev = TaskGraph::kInvalidTaskId;
+    for (int n = 0; n < kCount; ++n) {
+        steps[n].recorder = &recorder;
+        steps[n].value = n;
+        steps[n].sleepMs = 0;
+        prev = graph.add("chain", runStep, &steps[n], &prev, n > 0 ? 1 : 0);
+        ASSERT_EQ(n, prev);
+    }
+    // Waiting for the last task is enough, since it depends on all others.
+    graph.wait(prev);
+    for (int n = 0; n < kCount; ++n) {
+        EXPECT_EQ(n, recorder.position(n));
+    }
+}
+
+}  // namespace base
+}  // namespace android
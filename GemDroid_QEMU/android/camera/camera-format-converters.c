@@ -17,6 +17,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef _WIN32
 #elif _DARWIN_C_SOURCE
 #else
@@ -260,15 +261,6 @@ _change_exposure(uint8_t inputY, float exp_comp)
     return (uint8_t)clamp((float)inputY * exp_comp);
 }
 
-/* Adjusts an RGB pixel for the given exposure compensation. */
-static __inline__ void
-_change_exposure_RGB(uint8_t* r, uint8_t* g, uint8_t* b, float exp_comp)
-{
-    uint8_t y, u, v;
-    R8G8B8ToYUV(*r, *g, *b, &y, &u, &v);
-    YUVToRGBPix(_change_exposure(y, exp_comp), u, v, r, g, b);
-}
-
 /* Adjusts an RGB pixel for the given exposure compensation. */
 static __inline__ void
 _change_exposure_RGB_i(int* r, int* g, int* b, float exp_comp)
@@ -281,27 +273,6 @@ _change_exposure_RGB_i(int* r, int* g, int* b, float exp_comp)
     *b = YUV2BO(y,u,v);
 }
 
-/* Computes the pixel value after adjusting the white balance to the current
- * one. The input the y, u, v channel of the pixel and the adjusted value will
- * be stored in place. The adjustment is done in RGB space.
- */
-static __inline__ void
-_change_white_balance_YUV(uint8_t* y,
-                          uint8_t* u,
-                          uint8_t* v,
-                          float r_scale,
-                          float g_scale,
-                          float b_scale)
-{
-    int r = (float)(YUV2R((int)*y, (int)*u, (int)*v)) / r_scale;
-    int g = (float)(YUV2G((int)*y, (int)*u, (int)*v)) / g_scale;
-    int b = (float)(YUV2B((int)*y, (int)*u, (int)*v)) / b_scale;
-
-    *y = RGB2Y(r, g, b);
-    *u = RGB2U(r, g, b);
-    *v = RGB2V(r, g, b);
-}
-
 /* Computes the pixel value after adjusting the white balance to the current
  * one. The input the r, and b channels of the pixel and the adjusted value will
  * be stored in place.
@@ -319,21 +290,266 @@ _change_white_balance_RGB(int* r,
     *b = (float)*b / b_scale;
 }
 
-/* Computes the pixel value after adjusting the white balance to the current
- * one. The input the r, and b channels of the pixel and the adjusted value will
- * be stored in place.
+/********************************************************************************
+ * Fixed-point color adjustment
+ *******************************************************************************/
+
+/* White balance and exposure compensation only depend on an 8-bit input
+ * value and on parameters that are constant for the whole frame, so they are
+ * tabulated once per frame instead of being computed with floats for every
+ * pixel. The tables are built with the very same float expressions as the
+ * per-pixel helpers above, so the results are identical.
  */
+typedef struct ColorAdjust {
+    /* (int)((float)x / scale), for each white balance channel. */
+    int         wb_r[256];
+    int         wb_g[256];
+    int         wb_b[256];
+    /* Same, stored in a byte. */
+    uint8_t     wb8_r[256];
+    uint8_t     wb8_g[256];
+    uint8_t     wb8_b[256];
+    /* _change_exposure() for each luminance value. */
+    uint8_t     exp_y[256];
+    /* Non-zero when the white balance tables are identities. */
+    int         wb_identity;
+    /* Non-zero when the exposure table is an identity. */
+    int         exp_identity;
+} ColorAdjust;
+
+static void
+_color_adjust_init(ColorAdjust* adj,
+                   float r_scale,
+                   float g_scale,
+                   float b_scale,
+                   float exp_comp)
+{
+    int n;
+
+    adj->wb_identity = 1;
+    adj->exp_identity = 1;
+    for (n = 0; n < 256; n++) {
+        adj->wb_r[n] = (float)n / r_scale;
+        adj->wb_g[n] = (float)n / g_scale;
+        adj->wb_b[n] = (float)n / b_scale;
+        adj->wb8_r[n] = (uint8_t)adj->wb_r[n];
+        adj->wb8_g[n] = (uint8_t)adj->wb_g[n];
+        adj->wb8_b[n] = (uint8_t)adj->wb_b[n];
+        adj->exp_y[n] = _change_exposure(n, exp_comp);
+        if (adj->wb_r[n] != n || adj->wb_g[n] != n || adj->wb_b[n] != n) {
+            adj->wb_identity = 0;
+        }
+        if (adj->exp_y[n] != n) {
+            adj->exp_identity = 0;
+        }
+    }
+}
+
+/* Maps a line of bytes through a table, in place. */
+static void
+_lut_line(uint8_t* p, const uint8_t* table, int count)
+{
+    int n;
+    for (n = 0; n < count; n++) {
+        p[n] = table[p[n]];
+    }
+}
+
+/*
+ * Color space conversion of whole lines.
+ *
+ * Lines are kept as separate planes of 8-bit values, and the routines below
+ * process 'count' values rounded up to a multiple of 8, so line buffers must
+ * be padded accordingly.
+ */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+/* Expands 8 bytes into 8 16-bit lanes. */
+static __inline__ __m128i
+_load8_epi16(const uint8_t* p)
+{
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p),
+                             _mm_setzero_si128());
+}
+
+/* Packs two vectors of 4 32-bit values into 8 bytes, saturating to 0-255
+ * exactly like clamp() does. */
 static __inline__ void
-_change_white_balance_RGB_b(uint8_t* r,
-                            uint8_t* g,
-                            uint8_t* b,
-                            float r_scale,
-                            float g_scale,
-                            float b_scale)
+_store8_epi32(uint8_t* p, __m128i lo, __m128i hi)
 {
-    *r = (float)*r / r_scale;
-    *g = (float)*g / g_scale;
-    *b = (float)*b / b_scale;
+    const __m128i w = _mm_packs_epi32(lo, hi);
+    _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(w, w));
+}
+
+/* Computes a*x + b*y + c for 8 pairs of 16-bit values, as two vectors of
+ * 4 32-bit sums. The coefficients are set up by the caller as 16-bit pairs:
+ * 'xy' holds (a, b), and 'c' is added to the products. */
+#define MADD2(x, y, xy, c, lo, hi) do { \
+        lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x, y), xy), c); \
+        hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x, y), xy), c); \
+    } while (0)
+
+/* Same as MADD2, for three values: a*x + b*y + c*z + d. */
+#define MADD3(x, y, z, one, xy, zd, lo, hi) do { \
+        lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x, y), xy), \
+                           _mm_madd_epi16(_mm_unpacklo_epi16(z, one), zd)); \
+        hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x, y), xy), \
+                           _mm_madd_epi16(_mm_unpackhi_epi16(z, one), zd)); \
+    } while (0)
+
+/* Converts a line of R8G8B8 values to YUV, as R8G8B8ToYUV() does. */
+static void
+_rgb_to_yuv_line(const uint8_t* r, const uint8_t* g, const uint8_t* b,
+                 uint8_t* y, uint8_t* u, uint8_t* v, int count)
+{
+    const __m128i one  = _mm_set1_epi16(1);
+    const __m128i k16  = _mm_set1_epi32(16);
+    const __m128i k128 = _mm_set1_epi32(128);
+    const __m128i y_rg = _mm_set_epi16(129, 66, 129, 66, 129, 66, 129, 66);
+    const __m128i y_b  = _mm_set_epi16(128, 25, 128, 25, 128, 25, 128, 25);
+    const __m128i u_rg = _mm_set_epi16(-74, -38, -74, -38, -74, -38, -74, -38);
+    const __m128i u_b  = _mm_set_epi16(128, 112, 128, 112, 128, 112, 128, 112);
+    const __m128i v_rg = _mm_set_epi16(-94, 112, -94, 112, -94, 112, -94, 112);
+    const __m128i v_b  = _mm_set_epi16(128, -18, 128, -18, 128, -18, 128, -18);
+    int n;
+
+    for (n = 0; n < count; n += 8) {
+        const __m128i R = _load8_epi16(r + n);
+        const __m128i G = _load8_epi16(g + n);
+        const __m128i B = _load8_epi16(b + n);
+        __m128i lo, hi;
+
+        MADD3(R, G, B, one, y_rg, y_b, lo, hi);
+        _store8_epi32(y + n, _mm_add_epi32(_mm_srai_epi32(lo, 8), k16),
+                             _mm_add_epi32(_mm_srai_epi32(hi, 8), k16));
+        MADD3(R, G, B, one, u_rg, u_b, lo, hi);
+        _store8_epi32(u + n, _mm_add_epi32(_mm_srai_epi32(lo, 8), k128),
+                             _mm_add_epi32(_mm_srai_epi32(hi, 8), k128));
+        MADD3(R, G, B, one, v_rg, v_b, lo, hi);
+        _store8_epi32(v + n, _mm_add_epi32(_mm_srai_epi32(lo, 8), k128),
+                             _mm_add_epi32(_mm_srai_epi32(hi, 8), k128));
+    }
+}
+
+/* Converts a line of YUV values to R8G8B8, as YUVToRGBPix() does. */
+static void
+_yuv_to_rgb_line(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                 uint8_t* r, uint8_t* g, uint8_t* b, int count)
+{
+    const __m128i one  = _mm_set1_epi16(1);
+    const __m128i k16  = _mm_set1_epi16(16);
+    const __m128i k128 = _mm_set1_epi16(128);
+    const __m128i r128 = _mm_set1_epi32(128);
+    const __m128i r_ce = _mm_set_epi16(409, 298, 409, 298, 409, 298, 409, 298);
+    const __m128i g_cd = _mm_set_epi16(-100, 298, -100, 298, -100, 298, -100, 298);
+    const __m128i g_e  = _mm_set_epi16(128, -208, 128, -208, 128, -208, 128, -208);
+    const __m128i b_cd = _mm_set_epi16(516, 298, 516, 298, 516, 298, 516, 298);
+    int n;
+
+    for (n = 0; n < count; n += 8) {
+        const __m128i C = _mm_sub_epi16(_load8_epi16(y + n), k16);
+        const __m128i D = _mm_sub_epi16(_load8_epi16(u + n), k128);
+        const __m128i E = _mm_sub_epi16(_load8_epi16(v + n), k128);
+        __m128i lo, hi;
+
+        MADD2(C, E, r_ce, r128, lo, hi);
+        _store8_epi32(r + n, _mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+        MADD3(C, D, E, one, g_cd, g_e, lo, hi);
+        _store8_epi32(g + n, _mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+        MADD2(C, D, b_cd, r128, lo, hi);
+        _store8_epi32(b + n, _mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+    }
+}
+
+#else   /* !__SSE2__ */
+
+/* Converts a line of R8G8B8 values to YUV, as R8G8B8ToYUV() does. */
+static void
+_rgb_to_yuv_line(const uint8_t* r, const uint8_t* g, const uint8_t* b,
+                 uint8_t* y, uint8_t* u, uint8_t* v, int count)
+{
+    int n;
+    for (n = 0; n < count; n++) {
+        R8G8B8ToYUV(r[n], g[n], b[n], &y[n], &u[n], &v[n]);
+    }
+}
+
+/* Converts a line of YUV values to R8G8B8, as YUVToRGBPix() does. */
+static void
+_yuv_to_rgb_line(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                 uint8_t* r, uint8_t* g, uint8_t* b, int count)
+{
+    int n;
+    for (n = 0; n < count; n++) {
+        YUVToRGBPix(y[n], u[n], v[n], &r[n], &g[n], &b[n]);
+    }
+}
+
+#endif  /* !__SSE2__ */
+
+/* Line buffers used by the converters: three planes for RGB values, and
+ * three planes for YUV values. */
+typedef struct LineBuffers {
+    uint8_t*    r;
+    uint8_t*    g;
+    uint8_t*    b;
+    uint8_t*    y;
+    uint8_t*    u;
+    uint8_t*    v;
+    /* Backing store for all planes. */
+    uint8_t*    mem;
+} LineBuffers;
+
+/* Allocates line buffers for lines of up to 'width' pixels. Returns 0 on
+ * success, or -1 on failure. */
+static int
+_line_buffers_init(LineBuffers* lb, int width)
+{
+    /* Round up to full SIMD groups, for an extra pixel when the width is
+     * odd, see the YUV converters. */
+    const size_t plane = ((size_t)width + 1 + 7) & ~(size_t)7;
+
+    lb->mem = calloc(plane, 6);
+    if (lb->mem == NULL) {
+        return -1;
+    }
+    lb->r = lb->mem;
+    lb->g = lb->r + plane;
+    lb->b = lb->g + plane;
+    lb->y = lb->b + plane;
+    lb->u = lb->y + plane;
+    lb->v = lb->u + plane;
+    return 0;
+}
+
+static void
+_line_buffers_fini(LineBuffers* lb)
+{
+    free(lb->mem);
+    lb->mem = NULL;
+}
+
+/* Applies white balance and exposure compensation to a line of RGB values in
+ * 'lb' (r, g, b planes). The y, u, and v planes are used as scratch space.
+ *
+ * Exposure is applied to the luminance, so the pixels make a round trip
+ * through YUV - even when exposure is not compensated, to preserve the
+ * output of the original per-pixel converters. */
+static void
+_adjust_rgb_line(LineBuffers* lb, const ColorAdjust* adj, int count)
+{
+    if (!adj->wb_identity) {
+        _lut_line(lb->r, adj->wb8_r, count);
+        _lut_line(lb->g, adj->wb8_g, count);
+        _lut_line(lb->b, adj->wb8_b, count);
+    }
+    _rgb_to_yuv_line(lb->r, lb->g, lb->b, lb->y, lb->u, lb->v, count);
+    if (!adj->exp_identity) {
+        _lut_line(lb->y, adj->exp_y, count);
+    }
+    _yuv_to_rgb_line(lb->y, lb->u, lb->v, lb->r, lb->g, lb->b, count);
 }
 
 /********************************************************************************
@@ -347,9 +563,9 @@ _change_white_balance_RGB_b(uint8_t* r,
  * format from another are:
  * - Is it an RGB, or BRG (i.e. color ordering)
  * - Is it 16, 24, or 32 bits format.
- * All these differences are addressed by load_rgb / save_rgb routines, provided
- * for each format in the RGB descriptor to load / save RGB color bytes from / to
- * the buffer. As far as moving from one RGB pixel to the next, there
+ * All these differences are addressed by load_line / save_line routines,
+ * provided for each format in the RGB descriptor to load / save a line of RGB
+ * color bytes from / to the buffer. As far as moving from one RGB pixel to the next, there
  * are two question to consider:
  * - How many bytes it takes to encode one RGB pixel (could be 2, 3, or 4)
  * - How many bytes it takes to encode a line (i.e. line alignment issue, which
@@ -420,28 +636,51 @@ _change_white_balance_RGB_b(uint8_t* r,
  * calculated.
  *
  * Performance considerations:
- * Since converters implemented here are intended to work as part of the camera
- * emulation, making the code super performant is not a priority at all. There
- * will be enough loses in other parts of the emultion to overlook any slight
- * inefficiences in the conversion algorithm as neglectable.
+ * Every captured frame goes through these converters, once per client
+ * framebuffer, so they are on the camera's critical path. RGB and YUV frames are
+ * converted a line at a time: a line is unpacked into separate R, G, B (or Y,
+ * U, V) planes, processed by the whole-line color space routines above (SSE2
+ * when available), and packed back. White balance and exposure compensation
+ * come from tables built once per frame, and a frame is only converted once
+ * per distinct destination format. BAYER converters still go pixel by pixel,
+ * since they are only used with the webcams that deliver BAYER frames.
  */
 
 typedef struct RGBDesc RGBDesc;
 typedef struct YUVDesc YUVDesc;
 typedef struct BayerDesc BayerDesc;
 
-/* Prototype for a routine that loads RGB colors from an RGB/BRG stream.
+/* Prototype for a routine that loads a line of RGB colors from an RGB/BRG
+ * stream.
  * Param:
  *  rgb - Pointer to a pixel inside the stream where to load colors from.
- *  r, g, b - Upon return will contain red, green, and blue colors for the pixel
- *      addressed by 'rgb' pointer.
+ *  r, g, b - Upon return will contain red, green, and blue colors for 'count'
+ *      pixels starting at the one addressed by 'rgb' pointer.
+ *  count - Number of pixels to load.
  * Return:
- *  Pointer to the next pixel in the stream.
+ *  Pointer to the pixel that follows the last loaded pixel in the stream.
+ */
+typedef const void* (*load_line_func)(const void* rgb,
+                                      uint8_t* r,
+                                      uint8_t* g,
+                                      uint8_t* b,
+                                      int count);
+
+/* Prototype for a routine that saves a line of RGB colors to an RGB/BRG
+ * stream.
+ * Param:
+ *  rgb - Pointer to a pixel inside the stream where to save colors.
+ *  r, g, b - Red, green, and blue colors of 'count' pixels to save, starting at
+ *      the pixel addressed by 'rgb' pointer.
+ *  count - Number of pixels to save.
+ * Return:
+ *  Pointer to the pixel that follows the last saved pixel in the stream.
  */
-typedef const void* (*load_rgb_func)(const void* rgb,
-                                     uint8_t* r,
-                                     uint8_t* g,
-                                     uint8_t* b);
+typedef void* (*save_line_func)(void* rgb,
+                                const uint8_t* r,
+                                const uint8_t* g,
+                                const uint8_t* b,
+                                int count);
 
 /* Prototype for a routine that saves RGB colors to an RGB/BRG stream.
  * Param:
@@ -479,8 +718,10 @@ typedef int (*v_offset_func)(const YUVDesc* desc, int line, int width, int heigh
 
 /* RGB/BRG format descriptor. */
 struct RGBDesc {
-    /* Routine that loads RGB colors from a buffer. */
-    load_rgb_func   load_rgb;
+    /* Routine that loads a line of RGB colors from a buffer. */
+    load_line_func  load_line;
+    /* Routine that saves a line of RGB colors into a buffer. */
+    save_line_func  save_line;
     /* Routine that saves RGB colors into a buffer. */
     save_rgb_func   save_rgb;
     /* Byte size of an encoded RGB pixel. */
@@ -542,93 +783,74 @@ struct BayerDesc {
  * RGB/BRG load / save routines.
  *******************************************************************************/
 
-/* Loads R, G, and B colors from a RGB32 framebuffer. */
-static const void*
-_load_RGB32(const void* rgb, uint8_t* r, uint8_t* g, uint8_t* b)
-{
-    const uint8_t* rgb_ptr = (const uint8_t*)rgb;
-    *r = rgb_ptr[0]; *g = rgb_ptr[1]; *b = rgb_ptr[2];
-    return rgb_ptr + 4;
-}
-
-/* Saves R, G, and B colors to a RGB32 framebuffer. */
-static void*
-_save_RGB32(void* rgb, uint8_t r, uint8_t g, uint8_t b)
-{
-    uint8_t* rgb_ptr = (uint8_t*)rgb;
-    rgb_ptr[0] = r; rgb_ptr[1] = g; rgb_ptr[2] = b;
-    return rgb_ptr + 4;
-}
-
-/* Loads R, G, and B colors from a BRG32 framebuffer. */
-static const void*
-_load_BRG32(const void* rgb, uint8_t* r, uint8_t* g, uint8_t* b)
-{
-    const uint8_t* rgb_ptr = (const uint8_t*)rgb;
-    *r = rgb_ptr[2]; *g = rgb_ptr[1]; *b = rgb_ptr[0];
-    return rgb_ptr + 4;
-}
-
-/* Saves R, G, and B colors to a BRG32 framebuffer. */
-static void*
-_save_BRG32(void* rgb, uint8_t r, uint8_t g, uint8_t b)
-{
-    uint8_t* rgb_ptr = (uint8_t*)rgb;
-    rgb_ptr[2] = r; rgb_ptr[1] = g; rgb_ptr[0] = b;
-    return rgb_ptr + 4;
-}
-
-/* Loads R, G, and B colors from a RGB24 framebuffer.
+/* Defines routines that load and save lines of pixels in a byte-oriented RGB/BRG
+ * format, where a pixel takes 'inc' bytes, and red, green, and blue colors are
+ * at offsets 'ri', 'gi', and 'bi' inside the pixel.
  * Note that it's the caller's responsibility to ensure proper alignment of the
- * returned pointer at the line's break. */
-static const void*
-_load_RGB24(const void* rgb, uint8_t* r, uint8_t* g, uint8_t* b)
-{
-    const uint8_t* rgb_ptr = (const uint8_t*)rgb;
-    *r = rgb_ptr[0]; *g = rgb_ptr[1]; *b = rgb_ptr[2];
-    return rgb_ptr + 3;
+ * returned pointers at the line's break. */
+#define DEFINE_RGB_LINE_FUNCS(name, inc, ri, gi, bi)                            \
+static const void*                                                              \
+_load_line_##name(const void* rgb, uint8_t* r, uint8_t* g, uint8_t* b, int count) \
+{                                                                               \
+    const uint8_t* rgb_ptr = (const uint8_t*)rgb;                               \
+    int n;                                                                      \
+    for (n = 0; n < count; n++, rgb_ptr += inc) {                               \
+        r[n] = rgb_ptr[ri]; g[n] = rgb_ptr[gi]; b[n] = rgb_ptr[bi];             \
+    }                                                                           \
+    return rgb_ptr;                                                             \
+}                                                                               \
+                                                                                \
+static void*                                                                    \
+_save_line_##name(void* rgb,                                                    \
+                  const uint8_t* r, const uint8_t* g, const uint8_t* b,         \
+                  int count)                                                    \
+{                                                                               \
+    uint8_t* rgb_ptr = (uint8_t*)rgb;                                           \
+    int n;                                                                      \
+    for (n = 0; n < count; n++, rgb_ptr += inc) {                               \
+        rgb_ptr[ri] = r[n]; rgb_ptr[gi] = g[n]; rgb_ptr[bi] = b[n];             \
+    }                                                                           \
+    return rgb_ptr;                                                             \
+}                                                                               \
+                                                                                \
+static void*                                                                    \
+_save_##name(void* rgb, uint8_t r, uint8_t g, uint8_t b)                        \
+{                                                                               \
+    uint8_t* rgb_ptr = (uint8_t*)rgb;                                           \
+    rgb_ptr[ri] = r; rgb_ptr[gi] = g; rgb_ptr[bi] = b;                          \
+    return rgb_ptr + inc;                                                       \
 }
 
-/* Saves R, G, and B colors to a RGB24 framebuffer.
- * Note that it's the caller's responsibility to ensure proper alignment of the
- * returned pointer at the line's break. */
-static void*
-_save_RGB24(void* rgb, uint8_t r, uint8_t g, uint8_t b)
-{
-    uint8_t* rgb_ptr = (uint8_t*)rgb;
-    rgb_ptr[0] = r; rgb_ptr[1] = g; rgb_ptr[2] = b;
-    return rgb_ptr + 3;
-}
+DEFINE_RGB_LINE_FUNCS(RGB32, 4, 0, 1, 2)
+DEFINE_RGB_LINE_FUNCS(BRG32, 4, 2, 1, 0)
+DEFINE_RGB_LINE_FUNCS(RGB24, 3, 0, 1, 2)
+DEFINE_RGB_LINE_FUNCS(BRG24, 3, 2, 1, 0)
 
-/* Loads R, G, and B colors from a BRG32 framebuffer.
- * Note that it's the caller's responsibility to ensure proper alignment of the
- * returned pointer at the line's break. */
+/* Loads a line of R, G, and B colors from a RGB565 framebuffer. */
 static const void*
-_load_BRG24(const void* rgb, uint8_t* r, uint8_t* g, uint8_t* b)
+_load_line_RGB16(const void* rgb, uint8_t* r, uint8_t* g, uint8_t* b, int count)
 {
-    const uint8_t* rgb_ptr = (const uint8_t*)rgb;
-    *r = rgb_ptr[2]; *g = rgb_ptr[1]; *b = rgb_ptr[0];
-    return rgb_ptr + 3;
+    const uint16_t* rgb_ptr = (const uint16_t*)rgb;
+    int n;
+    for (n = 0; n < count; n++) {
+        const uint16_t rgb16 = rgb_ptr[n];
+        r[n] = R16(rgb16); g[n] = G16(rgb16); b[n] = B16(rgb16);
+    }
+    return rgb_ptr + count;
 }
 
-/* Saves R, G, and B colors to a BRG24 framebuffer.
- * Note that it's the caller's responsibility to ensure proper alignment of the
- * returned pointer at the line's break. */
+/* Saves a line of R, G, and B colors to a RGB565 framebuffer. */
 static void*
-_save_BRG24(void* rgb, uint8_t r, uint8_t g, uint8_t b)
-{
-    uint8_t* rgb_ptr = (uint8_t*)rgb;
-    rgb_ptr[2] = r; rgb_ptr[1] = g; rgb_ptr[0] = b;
-    return rgb_ptr + 3;
-}
-
-/* Loads R, G, and B colors from a RGB565 framebuffer. */
-static const void*
-_load_RGB16(const void* rgb, uint8_t* r, uint8_t* g, uint8_t* b)
+_save_line_RGB16(void* rgb,
+                 const uint8_t* r, const uint8_t* g, const uint8_t* b,
+                 int count)
 {
-    const uint16_t rgb16 = *(const uint16_t*)rgb;
-    *r = R16(rgb16); *g = G16(rgb16); *b = B16(rgb16);
-    return (const uint8_t*)rgb + 2;
+    uint16_t* rgb_ptr = (uint16_t*)rgb;
+    int n;
+    for (n = 0; n < count; n++) {
+        rgb_ptr[n] = RGB565(r[n] & 0x1f, g[n] & 0x3f, b[n] & 0x1f);
+    }
+    return rgb_ptr + count;
 }
 
 /* Saves R, G, and B colors to a RGB565 framebuffer. */
@@ -639,25 +861,6 @@ _save_RGB16(void* rgb, uint8_t r, uint8_t g, uint8_t b)
     return (uint8_t*)rgb + 2;
 }
 
-#if 0
-/* Loads R, G, and B colors from a BRG565 framebuffer. */
-static const void*
-_load_BRG16(const void* rgb, uint8_t* r, uint8_t* g, uint8_t* b)
-{
-    const uint16_t rgb16 = *(const uint16_t*)rgb;
-    *r = B16(rgb16); *g = G16(rgb16); *b = R16(rgb16);
-    return (const uint8_t*)rgb + 2;
-}
-
-/* Saves R, G, and B colors to a BRG565 framebuffer. */
-static void*
-_save_BRG16(void* rgb, uint8_t r, uint8_t g, uint8_t b)
-{
-    *(uint16_t*)rgb = RGB565(b & 0x1f, g & 0x3f, r & 0x1f);
-    return (uint8_t*)rgb + 2;
-}
-#endif
-
 /********************************************************************************
  * YUV's U/V offset calculation routines.
  *******************************************************************************/
@@ -1009,32 +1212,30 @@ RGBToYUV(const RGBDesc* rgb_fmt,
          void* yuv,
          int width,
          int height,
-         float r_scale,
-         float g_scale,
-         float b_scale,
-         float exp_comp)
+         const ColorAdjust* adj,
+         LineBuffers* lb)
 {
     int y, x;
     const int Y_Inc = yuv_fmt->Y_inc;
     const int UV_inc = yuv_fmt->UV_inc;
     const int Y_next_pair = yuv_fmt->Y_next_pair;
+    /* Pixels go in pairs, so an odd width takes an extra pixel per line. */
+    const int count = (width + 1) & ~1;
     uint8_t* pY = (uint8_t*)yuv + yuv_fmt->Y_offset;
     for (y = 0; y < height; y++) {
         uint8_t* pU =
             (uint8_t*)yuv + yuv_fmt->u_offset(yuv_fmt, y, width, height);
         uint8_t* pV =
             (uint8_t*)yuv + yuv_fmt->v_offset(yuv_fmt, y, width, height);
-        for (x = 0; x < width; x += 2,
+        rgb = rgb_fmt->load_line(rgb, lb->r, lb->g, lb->b, count);
+        _adjust_rgb_line(lb, adj, count);
+        _rgb_to_yuv_line(lb->r, lb->g, lb->b, lb->y, lb->u, lb->v, count);
+        for (x = 0; x < count; x += 2,
                                pY += Y_next_pair, pU += UV_inc, pV += UV_inc) {
-            uint8_t r, g, b;
-            rgb = rgb_fmt->load_rgb(rgb, &r, &g, &b);
-            _change_white_balance_RGB_b(&r, &g, &b, r_scale, g_scale, b_scale);
-            _change_exposure_RGB(&r, &g, &b, exp_comp);
-            R8G8B8ToYUV(r, g, b, pY, pU, pV);
-            rgb = rgb_fmt->load_rgb(rgb, &r, &g, &b);
-            _change_white_balance_RGB_b(&r, &g, &b, r_scale, g_scale, b_scale);
-            _change_exposure_RGB(&r, &g, &b, exp_comp);
-            pY[Y_Inc] = RGB2Y((int)r, (int)g, (int)b);
+            *pY = lb->y[x];
+            *pU = lb->u[x];
+            *pV = lb->v[x];
+            pY[Y_Inc] = lb->y[x + 1];
         }
         /* Aling rgb_ptr to 16 bit */
         if (((uintptr_t)rgb & 1) != 0) rgb = (const uint8_t*)rgb + 1;
@@ -1049,20 +1250,14 @@ RGBToRGB(const RGBDesc* src_rgb_fmt,
          void* dst_rgb,
          int width,
          int height,
-         float r_scale,
-         float g_scale,
-         float b_scale,
-         float exp_comp)
+         const ColorAdjust* adj,
+         LineBuffers* lb)
 {
-    int x, y;
+    int y;
     for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-            uint8_t r, g, b;
-            src_rgb = src_rgb_fmt->load_rgb(src_rgb, &r, &g, &b);
-            _change_white_balance_RGB_b(&r, &g, &b, r_scale, g_scale, b_scale);
-            _change_exposure_RGB(&r, &g, &b, exp_comp);
-            dst_rgb = dst_rgb_fmt->save_rgb(dst_rgb, r, g, b);
-        }
+        src_rgb = src_rgb_fmt->load_line(src_rgb, lb->r, lb->g, lb->b, width);
+        _adjust_rgb_line(lb, adj, width);
+        dst_rgb = dst_rgb_fmt->save_line(dst_rgb, lb->r, lb->g, lb->b, width);
         /* Aling rgb pinters to 16 bit */
         if (((uintptr_t)src_rgb & 1) != 0) src_rgb = (uint8_t*)src_rgb + 1;
         if (((uintptr_t)dst_rgb & 1) != 0) dst_rgb = (uint8_t*)dst_rgb + 1;
@@ -1077,35 +1272,31 @@ YUVToRGB(const YUVDesc* yuv_fmt,
          void* rgb,
          int width,
          int height,
-         float r_scale,
-         float g_scale,
-         float b_scale,
-         float exp_comp)
+         const ColorAdjust* adj,
+         LineBuffers* lb)
 {
     int y, x;
     const int Y_Inc = yuv_fmt->Y_inc;
     const int UV_inc = yuv_fmt->UV_inc;
     const int Y_next_pair = yuv_fmt->Y_next_pair;
+    /* Pixels go in pairs, so an odd width takes an extra pixel per line. */
+    const int count = (width + 1) & ~1;
     const uint8_t* pY = (const uint8_t*)yuv + yuv_fmt->Y_offset;
     for (y = 0; y < height; y++) {
         const uint8_t* pU =
             (const uint8_t*)yuv + yuv_fmt->u_offset(yuv_fmt, y, width, height);
         const uint8_t* pV =
             (const uint8_t*)yuv + yuv_fmt->v_offset(yuv_fmt, y, width, height);
-        for (x = 0; x < width; x += 2,
+        for (x = 0; x < count; x += 2,
                                pY += Y_next_pair, pU += UV_inc, pV += UV_inc) {
-            uint8_t r, g, b;
-            const uint8_t U = *pU;
-            const uint8_t V = *pV;
-            YUVToRGBPix(*pY, U, V, &r, &g, &b);
-            _change_white_balance_RGB_b(&r, &g, &b, r_scale, g_scale, b_scale);
-            _change_exposure_RGB(&r, &g, &b, exp_comp);
-            rgb = rgb_fmt->save_rgb(rgb, r, g, b);
-            YUVToRGBPix(pY[Y_Inc], U, V, &r, &g, &b);
-            _change_white_balance_RGB_b(&r, &g, &b, r_scale, g_scale, b_scale);
-            _change_exposure_RGB(&r, &g, &b, exp_comp);
-            rgb = rgb_fmt->save_rgb(rgb, r, g, b);
+            lb->y[x] = *pY;
+            lb->y[x + 1] = pY[Y_Inc];
+            lb->u[x] = lb->u[x + 1] = *pU;
+            lb->v[x] = lb->v[x + 1] = *pV;
         }
+        _yuv_to_rgb_line(lb->y, lb->u, lb->v, lb->r, lb->g, lb->b, count);
+        _adjust_rgb_line(lb, adj, count);
+        rgb = rgb_fmt->save_line(rgb, lb->r, lb->g, lb->b, count);
         /* Aling rgb_ptr to 16 bit */
         if (((uintptr_t)rgb & 1) != 0) rgb = (uint8_t*)rgb + 1;
     }
@@ -1119,10 +1310,7 @@ YUVToYUV(const YUVDesc* src_fmt,
          void* dst,
          int width,
          int height,
-         float r_scale,
-         float g_scale,
-         float b_scale,
-         float exp_comp)
+         const ColorAdjust* adj)
 {
     int y, x;
     const int Y_Inc_src = src_fmt->Y_inc;
@@ -1148,10 +1336,19 @@ YUVToYUV(const YUVDesc* src_fmt,
                                        pYdst += Y_next_pair_dst,
                                        pUdst += UV_inc_dst,
                                        pVdst += UV_inc_dst) {
+            /* Copy the pair, and adjust white balance in place, in RGB space.
+             * Note that with odd widths the destination values can overlap. */
+            int Y, U, V, r, g, b;
             *pYdst = *pYsrc; *pUdst = *pUsrc; *pVdst = *pVsrc;
-            _change_white_balance_YUV(pYdst, pUdst, pVdst, r_scale, g_scale, b_scale);
-            *pYdst = _change_exposure(*pYdst, exp_comp);
-            pYdst[Y_Inc_dst] = _change_exposure(pYsrc[Y_Inc_src], exp_comp);
+            Y = *pYdst; U = *pUdst; V = *pVdst;
+            r = adj->wb_r[YUV2R(Y, U, V)];
+            g = adj->wb_g[YUV2G(Y, U, V)];
+            b = adj->wb_b[YUV2B(Y, U, V)];
+            *pYdst = RGB2Y(r, g, b);
+            *pUdst = RGB2U(r, g, b);
+            *pVdst = RGB2V(r, g, b);
+            *pYdst = adj->exp_y[*pYdst];
+            pYdst[Y_Inc_dst] = adj->exp_y[pYsrc[Y_Inc_src]];
         }
     }
 }
@@ -1233,7 +1430,8 @@ BAYERToYUV(const BayerDesc* bayer_fmt,
 /* Describes RGB32 format. */
 static const RGBDesc _RGB32 =
 {
-    .load_rgb   = _load_RGB32,
+    .load_line  = _load_line_RGB32,
+    .save_line  = _save_line_RGB32,
     .save_rgb   = _save_RGB32,
     .rgb_inc    = 4
 };
@@ -1241,7 +1439,8 @@ static const RGBDesc _RGB32 =
 /* Describes BRG32 format. */
 static const RGBDesc _BRG32 =
 {
-    .load_rgb   = _load_BRG32,
+    .load_line  = _load_line_BRG32,
+    .save_line  = _save_line_BRG32,
     .save_rgb   = _save_BRG32,
     .rgb_inc    = 4
 };
@@ -1249,7 +1448,8 @@ static const RGBDesc _BRG32 =
 /* Describes RGB24 format. */
 static const RGBDesc _RGB24 =
 {
-    .load_rgb   = _load_RGB24,
+    .load_line  = _load_line_RGB24,
+    .save_line  = _save_line_RGB24,
     .save_rgb   = _save_RGB24,
     .rgb_inc    = 3
 };
@@ -1257,7 +1457,8 @@ static const RGBDesc _RGB24 =
 /* Describes BRG24 format. */
 static const RGBDesc _BRG24 =
 {
-    .load_rgb   = _load_BRG24,
+    .load_line  = _load_line_BRG24,
+    .save_line  = _save_line_BRG24,
     .save_rgb   = _save_BRG24,
     .rgb_inc    = 3
 };
@@ -1265,20 +1466,12 @@ static const RGBDesc _BRG24 =
 /* Describes RGB16 format. */
 static const RGBDesc _RGB16 =
 {
-    .load_rgb   = _load_RGB16,
+    .load_line  = _load_line_RGB16,
+    .save_line  = _save_line_RGB16,
     .save_rgb   = _save_RGB16,
     .rgb_inc    = 2
 };
 
-#if 0
-/* Describes BRG16 format. */
-static const RGBDesc _BRG16 =
-{
-    .load_rgb   = _load_BRG16,
-    .save_rgb   = _save_BRG16,
-    .rgb_inc    = 2
-};
-#endif
 
 /********************************************************************************
  * YUV 4:2:2 format descriptors.
@@ -1617,6 +1810,29 @@ has_converter(uint32_t from, uint32_t to)
            _get_pixel_format_descriptor(to) != NULL;
 }
 
+/* Returns the byte size of a frame in a RGB or YUV format, or 0 if the size
+ * can't be safely determined. With odd dimensions, the converters pad lines
+ * depending on the pixel pairs and the buffer address, so those frames are not
+ * sized. */
+static size_t
+_get_frame_size(const PIXFormat* desc, int width, int height)
+{
+    if ((width & 1) || (height & 1)) {
+        return 0;
+    }
+    if (desc->format_sel == PIX_FMT_RGB) {
+        return (size_t)width * height * desc->desc.rgb_desc->rgb_inc;
+    }
+    if (desc->format_sel == PIX_FMT_YUV) {
+        /* Fully interleaved formats are 4:2:2, others are 4:2:0. */
+        if (desc->desc.yuv_desc->Y_next_pair == 4) {
+            return (size_t)width * height * 2;
+        }
+        return (size_t)width * height * 3 / 2;
+    }
+    return 0;
+}
+
 int
 convert_frame(const void* frame,
               uint32_t pixel_format,
@@ -1630,7 +1846,9 @@ convert_frame(const void* frame,
               float b_scale,
               float exp_comp)
 {
-    int n;
+    int n, m, res = 0;
+    ColorAdjust adj;
+    LineBuffers lb;
     const PIXFormat* src_desc = _get_pixel_format_descriptor(pixel_format);
     if (src_desc == NULL) {
         E("%s: Source pixel format %.4s is unknown",
@@ -1638,47 +1856,69 @@ convert_frame(const void* frame,
         return -1;
     }
 
-    for (n = 0; n < fbs_num; n++) {
+    _color_adjust_init(&adj, r_scale, g_scale, b_scale, exp_comp);
+    if (_line_buffers_init(&lb, width)) {
+        E("%s: Unable to allocate line buffers for width %d",
+          __FUNCTION__, width);
+        return -1;
+    }
+
+    for (n = 0; n < fbs_num && res == 0; n++) {
         /* Note that we need to apply white balance, exposure compensation, etc.
          * when we transfer the captured frame to the user framebuffer. So, even
          * if source and destination formats are the same, we will have to go
          * thrugh the converters to apply these things. */
         const PIXFormat* dst_desc =
             _get_pixel_format_descriptor(framebuffers[n].pixel_format);
+        size_t frame_size;
         if (dst_desc == NULL) {
             E("%s: Destination pixel format %.4s is unknown",
               __FUNCTION__, (const char*)&framebuffers[n].pixel_format);
-            return -1;
+            res = -1;
+            break;
+        }
+        /* If the frame has already been converted to this format for another
+         * client, just copy the result over. */
+        frame_size = _get_frame_size(dst_desc, width, height);
+        for (m = 0; m < n && frame_size != 0; m++) {
+            if (framebuffers[m].pixel_format == framebuffers[n].pixel_format) {
+                memcpy(framebuffers[n].framebuffer, framebuffers[m].framebuffer,
+                       frame_size);
+                break;
+            }
+        }
+        if (m < n && frame_size != 0) {
+            continue;
         }
         switch (src_desc->format_sel) {
             case PIX_FMT_RGB:
                 if (dst_desc->format_sel == PIX_FMT_RGB) {
                     RGBToRGB(src_desc->desc.rgb_desc, dst_desc->desc.rgb_desc,
                              frame, framebuffers[n].framebuffer, width, height,
-                             r_scale, g_scale, b_scale, exp_comp);
+                             &adj, &lb);
                 } else if (dst_desc->format_sel == PIX_FMT_YUV) {
                     RGBToYUV(src_desc->desc.rgb_desc, dst_desc->desc.yuv_desc,
                              frame, framebuffers[n].framebuffer, width, height,
-                             r_scale, g_scale, b_scale, exp_comp);
+                             &adj, &lb);
                 } else {
                     E("%s: Unexpected destination pixel format %d",
                       __FUNCTION__, dst_desc->format_sel);
-                    return -1;
+                    res = -1;
                 }
                 break;
             case PIX_FMT_YUV:
                 if (dst_desc->format_sel == PIX_FMT_RGB) {
                     YUVToRGB(src_desc->desc.yuv_desc, dst_desc->desc.rgb_desc,
                              frame, framebuffers[n].framebuffer, width, height,
-                             r_scale, g_scale, b_scale, exp_comp);
+                             &adj, &lb);
                 } else if (dst_desc->format_sel == PIX_FMT_YUV) {
                     YUVToYUV(src_desc->desc.yuv_desc, dst_desc->desc.yuv_desc,
                              frame, framebuffers[n].framebuffer, width, height,
-                             r_scale, g_scale, b_scale, exp_comp);
+                             &adj);
                 } else {
                     E("%s: Unexpected destination pixel format %d",
                       __FUNCTION__, dst_desc->format_sel);
-                    return -1;
+                    res = -1;
                 }
                 break;
             case PIX_FMT_BAYER:
@@ -1693,15 +1933,16 @@ convert_frame(const void* frame,
                 } else {
                     E("%s: Unexpected destination pixel format %d",
                       __FUNCTION__, dst_desc->format_sel);
-                    return -1;
+                    res = -1;
                 }
                 break;
             default:
                 E("%s: Unexpected source pixel format %d",
                   __FUNCTION__, dst_desc->format_sel);
-                return -1;
+                res = -1;
         }
     }
 
-    return 0;
+    _line_buffers_fini(&lb);
+    return res;
 }
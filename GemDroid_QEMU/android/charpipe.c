@@ -26,52 +26,69 @@
  * between two QEMU character drivers that merge well into the
  * QEMU event loop.
  *
- * each half of the channel has its own object and buffer, and
- * we implement communication through charpipe_poll() which
- * must be called by the main event loop after its call to select()
+ * each half of the channel has its own object and ring buffer. Data
+ * is only buffered when the receiver can't accept it immediately, in
+ * which case a bottom half is scheduled to deliver it later. Nothing
+ * is polled while the buffers are empty.
  *
+ * the bottom half is rescheduled as an idle one as long as the receiver
+ * doesn't accept the pending data. It is run immediately when the receiver
+ * installs new handlers or signals through qemu_chr_accept_input() that
+ * it can accept more data.
  */
 
-#define  BIP_BUFFER_SIZE  512
+/* initial size of a ring buffer, must be a power of 2 */
+#define  CHARPIPE_BUFFER_SIZE  4096
 
-typedef struct BipBuffer {
-    struct BipBuffer*  next;
-    CBuffer            cb[1];
-    char               buff[ BIP_BUFFER_SIZE ];
-} BipBuffer;
+/* ring buffers grow by powers of 2 to hold all pending data, so each
+ * write is at most two contiguous copies. Buffers that grew beyond the
+ * initial size are released as soon as they are drained.
+ */
+static void
+charpipe_buffer_write( CBuffer*  cb, const uint8_t*  buf, int  len )
+{
+    if (cbuffer_write_avail(cb) < len) {
+        int       size = cb->size ? cb->size : CHARPIPE_BUFFER_SIZE;
+        int       count = cbuffer_read_avail(cb);
+        uint8_t*  buff;
 
-static BipBuffer*  _free_bip_buffers;
+        while (size - count < len)
+            size *= 2;
 
-static BipBuffer*
-bip_buffer_alloc( void )
-{
-    BipBuffer*  bip = _free_bip_buffers;
-    if (bip != NULL) {
-        _free_bip_buffers = bip->next;
-    } else {
-        bip = malloc( sizeof(*bip) );
-        if (bip == NULL) {
+        buff = malloc( size );
+        if (buff == NULL) {
             derror( "%s: not enough memory", __FUNCTION__ );
             exit(1);
         }
+        cbuffer_read( cb, buff, count );
+        free( cb->buff );
+        cbuffer_reset( cb, buff, size );
+        cbuffer_write_step( cb, count );
+    }
+    cbuffer_write( cb, buf, len );
+}
+
+static void
+charpipe_buffer_trim( CBuffer*  cb )
+{
+    if (cbuffer_read_avail(cb) == 0 && cb->size > CHARPIPE_BUFFER_SIZE) {
+        free( cb->buff );
+        cbuffer_reset( cb, NULL, 0 );
     }
-    bip->next = NULL;
-    cbuffer_reset( bip->cb, bip->buff, sizeof(bip->buff) );
-    return bip;
 }
 
 static void
-bip_buffer_free( BipBuffer*  bip )
+charpipe_buffer_free( CBuffer*  cb )
 {
-    bip->next         = _free_bip_buffers;
-    _free_bip_buffers = bip;
+    free( cb->buff );
+    cbuffer_reset( cb, NULL, 0 );
 }
 
 /* this models each half of the charpipe */
 typedef struct CharPipeHalf {
     CharDriverState       cs[1];
-    BipBuffer*            bip_first;
-    BipBuffer*            bip_last;
+    CBuffer               ring[1];      /* data pending for the peer */
+    QEMUBH*               bh;           /* delivers pending data */
     struct CharPipeHalf*  peer;         /* NULL if closed */
 } CharPipeHalf;
 
@@ -82,12 +99,8 @@ charpipehalf_close( CharDriverState*  cs )
 {
     CharPipeHalf*  ph = cs->opaque;
 
-    while (ph->bip_first) {
-        BipBuffer*  bip = ph->bip_first;
-        ph->bip_first = bip->next;
-        bip_buffer_free(bip);
-    }
-    ph->bip_last    = NULL;
+    qemu_bh_cancel( ph->bh );
+    charpipe_buffer_free( ph->ring );
     ph->peer        = NULL;
 }
 
@@ -97,13 +110,13 @@ charpipehalf_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
 {
     CharPipeHalf*  ph   = cs->opaque;
     CharPipeHalf*  peer = ph->peer;
-    BipBuffer*     bip  = ph->bip_last;
     int            ret  = 0;
 
     D("%s: writing %d bytes to %p: '%s'", __FUNCTION__,
       len, ph, quote_bytes( buf, len ));
 
-    if (bip == NULL && peer != NULL && peer->cs->chr_read != NULL) {
+    if (cbuffer_read_avail(ph->ring) == 0 &&
+        peer != NULL && peer->cs->chr_read != NULL) {
         /* no buffered data, try to write directly to the peer */
         while (len > 0) {
             int  size;
@@ -123,79 +136,72 @@ charpipehalf_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
             len -= size;
             ret += size;
         }
+        if (len > 0) {
+            /* the peer is full, retry later */
+            qemu_bh_schedule_idle( ph->bh );
+        }
     }
 
     if (len == 0)
         return ret;
 
     /* buffer the remaining data */
-    if (bip == NULL) {
-        bip = bip_buffer_alloc();
-        ph->bip_first = ph->bip_last = bip;
-    }
-
-    while (len > 0) {
-        int  len2 = cbuffer_write( bip->cb, buf, len );
-
-        buf += len2;
-        ret += len2;
-        len -= len2;
-        if (len == 0)
-            break;
-
-        /* ok, we need another buffer */
-        ph->bip_last = bip_buffer_alloc();
-        bip->next = ph->bip_last;
-        bip       = ph->bip_last;
-    }
-    return  ret;
+    charpipe_buffer_write( ph->ring, buf, len );
+    return  ret + len;
 }
 
 
 static void
-charpipehalf_poll( CharPipeHalf*  ph )
+charpipehalf_flush( void*  opaque )
 {
+    CharPipeHalf*   ph   = opaque;
     CharPipeHalf*   peer = ph->peer;
-    int             size;
 
     if (peer == NULL || peer->cs->chr_read == NULL)
         return;
 
-    while (1) {
-        BipBuffer*  bip = ph->bip_first;
+    while (cbuffer_read_avail(ph->ring) > 0) {
         uint8_t*    base;
-        int         avail;
-
-        if (bip == NULL)
-            break;
-
-        size = cbuffer_read_avail(bip->cb);
-        if (size == 0) {
-            ph->bip_first = bip->next;
-            if (ph->bip_first == NULL)
-                ph->bip_last = NULL;
-            bip_buffer_free(bip);
-            continue;
-        }
+        int         avail = cbuffer_read_peek( ph->ring, &base );
 
-        if (ph->cs->chr_can_read) {
-            int  size2 = qemu_chr_can_read(peer->cs);
+        if (peer->cs->chr_can_read) {
+            int  size = qemu_chr_can_read(peer->cs);
 
-            if (size2 == 0)
-                break;
+            if (size == 0) {
+                /* the peer is full, retry later */
+                qemu_bh_schedule_idle( ph->bh );
+                return;
+            }
 
-            if (size > size2)
-                size = size2;
+            if (avail > size)
+                avail = size;
         }
 
-        avail = cbuffer_read_peek( bip->cb, &base );
-        if (avail > size)
-            avail = size;
         D("%s: sending %d bytes from %p: '%s'", __FUNCTION__,
             avail, ph, quote_bytes( base, avail ));
 
         qemu_chr_read( peer->cs, base, avail );
-        cbuffer_read_step( bip->cb, avail );
+        cbuffer_read_step( ph->ring, avail );
+    }
+    charpipe_buffer_trim( ph->ring );
+}
+
+
+/* called when the driver's user installs new handlers, or is ready to
+ * receive more data: deliver what the peer has pending as soon as possible.
+ */
+static void
+charpipehalf_wake( CharDriverState*  cs )
+{
+    CharPipeHalf*  ph   = cs->opaque;
+    CharPipeHalf*  peer = ph->peer;
+
+    if (peer != NULL && cbuffer_read_avail(peer->ring) > 0) {
+        /* qemu_bh_schedule() does nothing if the bottom half is already
+         * scheduled, even as idle, which is the case whenever data was
+         * left pending. Cancel it first to upgrade it to a normal one. */
+        qemu_bh_cancel( peer->bh );
+        qemu_bh_schedule( peer->bh );
     }
 }
 
@@ -205,15 +211,18 @@ charpipehalf_init( CharPipeHalf*  ph, CharPipeHalf*  peer )
 {
     CharDriverState*  cs = ph->cs;
 
-    ph->bip_first   = NULL;
-    ph->bip_last    = NULL;
+    cbuffer_reset( ph->ring, NULL, 0 );
     ph->peer        = peer;
+    if (ph->bh == NULL)
+        ph->bh = qemu_bh_new( charpipehalf_flush, ph );
 
-    cs->chr_write            = charpipehalf_write;
-    cs->chr_ioctl            = NULL;
-    cs->chr_send_event       = NULL;
-    cs->chr_close            = charpipehalf_close;
-    cs->opaque               = ph;
+    cs->chr_write               = charpipehalf_write;
+    cs->chr_ioctl               = NULL;
+    cs->chr_send_event          = NULL;
+    cs->chr_close               = charpipehalf_close;
+    cs->chr_update_read_handler = charpipehalf_wake;
+    cs->chr_accept_input        = charpipehalf_wake;
+    cs->opaque                  = ph;
 }
 
 
@@ -264,8 +273,8 @@ qemu_chr_open_charpipe( CharDriverState*  *pfirst, CharDriverState*  *psecond )
 
 typedef struct CharBuffer {
     CharDriverState  cs[1];
-    BipBuffer*       bip_first;
-    BipBuffer*       bip_last;
+    CBuffer          ring[1];   /* data pending for the endpoint */
+    QEMUBH*          bh;        /* delivers pending data */
     CharDriverState* endpoint;  /* NULL if closed */
     char             closing;
 } CharBuffer;
@@ -276,12 +285,8 @@ charbuffer_close( CharDriverState*  cs )
 {
     CharBuffer*  cbuf = cs->opaque;
 
-    while (cbuf->bip_first) {
-        BipBuffer*  bip = cbuf->bip_first;
-        cbuf->bip_first = bip->next;
-        bip_buffer_free(bip);
-    }
-    cbuf->bip_last = NULL;
+    qemu_bh_cancel( cbuf->bh );
+    charpipe_buffer_free( cbuf->ring );
     cbuf->endpoint = NULL;
 
     if (cbuf->endpoint != NULL) {
@@ -295,13 +300,12 @@ charbuffer_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
 {
     CharBuffer*       cbuf = cs->opaque;
     CharDriverState*  peer = cbuf->endpoint;
-    BipBuffer*        bip  = cbuf->bip_last;
     int               ret  = 0;
 
     D("%s: writing %d bytes to %p: '%s'", __FUNCTION__,
       len, cbuf, quote_bytes( buf, len ));
 
-    if (bip == NULL && peer != NULL) {
+    if (cbuffer_read_avail(cbuf->ring) == 0 && peer != NULL) {
         /* no buffered data, try to write directly to the peer */
         int  size = qemu_chr_write(peer, buf, len);
 
@@ -313,73 +317,50 @@ charbuffer_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
         buf += size;
         ret += size;
         len -= size;
+
+        if (len > 0) {
+            /* the endpoint is full, retry later */
+            qemu_bh_schedule_idle( cbuf->bh );
+        }
     }
 
     if (len == 0)
         return ret;
 
     /* buffer the remaining data */
-    if (bip == NULL) {
-        bip = bip_buffer_alloc();
-        cbuf->bip_first = cbuf->bip_last = bip;
-    }
-
-    while (len > 0) {
-        int  len2 = cbuffer_write( bip->cb, buf, len );
-
-        buf += len2;
-        ret += len2;
-        len -= len2;
-        if (len == 0)
-            break;
-
-        /* ok, we need another buffer */
-        cbuf->bip_last = bip_buffer_alloc();
-        bip->next = cbuf->bip_last;
-        bip       = cbuf->bip_last;
-    }
-    return  ret;
+    charpipe_buffer_write( cbuf->ring, buf, len );
+    return  ret + len;
 }
 
 
 static void
-charbuffer_poll( CharBuffer*  cbuf )
+charbuffer_flush( void*  opaque )
 {
+    CharBuffer*       cbuf = opaque;
     CharDriverState*  peer = cbuf->endpoint;
 
     if (peer == NULL)
         return;
 
-    while (1) {
-        BipBuffer*  bip = cbuf->bip_first;
+    while (cbuffer_read_avail(cbuf->ring) > 0) {
         uint8_t*    base;
-        int         avail;
-        int         size;
-
-        if (bip == NULL)
-            break;
-
-        avail = cbuffer_read_peek( bip->cb, &base );
-        if (avail == 0) {
-            cbuf->bip_first = bip->next;
-            if (cbuf->bip_first == NULL)
-                cbuf->bip_last = NULL;
-            bip_buffer_free(bip);
-            continue;
-        }
-
-        size = qemu_chr_write( peer, base, avail );
+        int         avail = cbuffer_read_peek( cbuf->ring, &base );
+        int         size  = qemu_chr_write( peer, base, avail );
 
         if (size < 0)  /* just to be safe */
             size = 0;
         else if (size > avail)
             size = avail;
 
-        cbuffer_read_step( bip->cb, size );
+        cbuffer_read_step( cbuf->ring, size );
 
-        if (size < avail)
-            break;
+        if (size < avail) {
+            /* the endpoint is full, retry later */
+            qemu_bh_schedule_idle( cbuf->bh );
+            return;
+        }
     }
+    charpipe_buffer_trim( cbuf->ring );
 }
 
 
@@ -401,9 +382,10 @@ charbuffer_init( CharBuffer*  cbuf, CharDriverState*  endpoint )
 {
     CharDriverState*  cs = cbuf->cs;
 
-    cbuf->bip_first   = NULL;
-    cbuf->bip_last    = NULL;
+    cbuffer_reset( cbuf->ring, NULL, 0 );
     cbuf->endpoint    = endpoint;
+    if (cbuf->bh == NULL)
+        cbuf->bh = qemu_bh_new( charbuffer_flush, cbuf );
 
     cs->chr_write               = charbuffer_write;
     cs->chr_ioctl               = NULL;
@@ -437,33 +419,3 @@ qemu_chr_open_buffer( CharDriverState*  endpoint )
     charbuffer_init(cbuf, endpoint);
     return cbuf->cs;
 }
-
-
-void
-charpipe_poll( void )
-{
-    CharPipeState*  cp     = _s_charpipes;
-    CharPipeState*  cp_end = cp + MAX_CHAR_PIPES;
-
-    CharBuffer*     cb     = _s_charbuffers;
-    CharBuffer*     cb_end = cb + MAX_CHAR_BUFFERS;
-
-    /* poll the charpipes */
-    for ( ; cp < cp_end; cp++ ) {
-        CharPipeHalf*  half;
-
-        half = cp->a;
-        if (half->peer != NULL)
-            charpipehalf_poll(half);
-
-        half = cp->b;
-        if (half->peer != NULL)
-            charpipehalf_poll(half);
-    }
-
-    /* poll the charbuffers */
-    for ( ; cb < cb_end; cb++ ) {
-        if (cb->endpoint != NULL)
-            charbuffer_poll(cb);
-    }
-}
@@ -132,6 +132,7 @@ OPT_PARAM( cpu_delay, "<cpudelay>", "throttle CPU emulation" )
 OPT_FLAG ( no_boot_anim, "disable animation for faster boot" )
 
 OPT_FLAG( no_window, "disable graphical window display" )
+OPT_PARAM( shm_display, "<name>", "publish the emulated display to a shared memory object" )
 OPT_FLAG( version, "display emulator version number" )
 
 OPT_PARAM( report_console, "<socket>", "report console port to remote socket" )
@@ -141,6 +142,7 @@ OPT_PARAM( shell_serial, "<device>", "specific character device for root shell"
 OPT_PARAM( tcpdump, "<file>", "capture network packets to file" )
 
 OPT_PARAM( bootchart, "<timeout>", "enable bootcharting")
+OPT_PARAM( startup_trace, "<file>", "write emulator startup timings to file")
 
 OPT_PARAM( charmap, "<file>", "use specific key character map")
 
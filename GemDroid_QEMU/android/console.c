@@ -42,6 +42,7 @@
 #include "android/tcpdump.h"
 #include "net/net.h"
 #include "monitor/monitor.h"
+#include "block/block.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -56,6 +57,7 @@
 #include "android/skin/charmap.h"
 #include "android/skin/keycode-buffer.h"
 #include "android/display-core.h"
+#include "android/gpu_frame.h"
 
 #if defined(CONFIG_SLIRP)
 #include "libslirp.h"
@@ -1847,6 +1849,8 @@ do_event_send( ControlClient  client, char*  args )
         return -1;
     }
 
+    /* Send all events at once, they usually form a single frame. */
+    user_event_begin_batch();
     p = args;
     while (*p) {
         char*  q;
@@ -1878,12 +1882,35 @@ do_event_send( ControlClient  client, char*  args )
                                "KO: invalid event value in '%.*s', must be an integer\r\n",
                                q-p, p);
             }
+            user_event_end_batch();
             return -1;
         }
 
         user_event_generic( type, code, value );
         p = q;
     }
+    user_event_end_batch();
+    return 0;
+}
+
+static int
+do_event_replay( ControlClient  client, char*  args )
+{
+    if (!args) {
+        control_write( client, "KO: Usage: event replay <file>|stop\r\n" );
+        return -1;
+    }
+
+    if (!strcmp( args, "stop" )) {
+        user_event_replay_stop();
+        return 0;
+    }
+
+    if (user_event_replay_start( args ) < 0) {
+        control_write( client, "KO: could not open '%s': %s\r\n",
+                       args, strerror(errno) );
+        return -1;
+    }
     return 0;
 }
 
@@ -2041,6 +2068,12 @@ static const CommandDefRec  event_commands[] =
     "according to the current device keyboard. unsupported characters will be discarded\r\n"
     "silently\r\n", NULL, do_event_text, NULL },
 
+    { "replay", "replay events recorded with 'getevent -t'",
+    "'event replay <file>' sends the events recorded in <file> with 'getevent -t' in\r\n"
+    "the emulated system to the kernel, with their original timing. <file> is a path\r\n"
+    "on the host. 'event replay stop' stops the current replay\r\n", NULL,
+    do_event_replay, NULL },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
@@ -2206,6 +2239,50 @@ do_avd_name( ControlClient  client, char*  args )
     return 0;
 }
 
+static void
+avd_cache_stats_it( void*  opaque, BlockDriverState*  bs )
+{
+    ControlClient    client = opaque;
+    BlockDriverInfo  bdi;
+
+    if (bdrv_get_info(bs, &bdi) < 0 || bdi.l2_cache_size == 0)
+        return;
+
+    control_write( client, "%s: l2 %lldKB hits %llu misses %llu, "
+                   "refcount %lldKB hits %llu misses %llu\r\n",
+                   bdrv_get_device_name(bs),
+                   (long long)(bdi.l2_cache_size >> 10),
+                   (unsigned long long)bdi.l2_cache_hits,
+                   (unsigned long long)bdi.l2_cache_misses,
+                   (long long)(bdi.refcount_cache_size >> 10),
+                   (unsigned long long)bdi.refcount_cache_hits,
+                   (unsigned long long)bdi.refcount_cache_misses );
+}
+
+static int
+do_avd_cache( ControlClient  client, char*  args )
+{
+    bdrv_iterate(avd_cache_stats_it, client);
+    return 0;
+}
+
+static int
+do_avd_gpuframes( ControlClient  client, char*  args )
+{
+    GpuFrameStats  stats;
+
+    if (gpu_frame_get_stats(&stats) < 0) {
+        control_write( client, "KO: GPU frames are not posted to the UI\r\n" );
+        return -1;
+    }
+    control_write( client, "posted %u delivered %u dropped %u, "
+                   "latency last %uus max %uus\r\n",
+                   stats.posted_frames, stats.delivered_frames,
+                   stats.dropped_frames, stats.last_latency_us,
+                   stats.max_latency_us );
+    return 0;
+}
+
 static const CommandDefRec  vm_commands[] =
 {
     { "stop", "stop the virtual device",
@@ -2224,6 +2301,16 @@ static const CommandDefRec  vm_commands[] =
     "'avd name' will return the name of this virtual device\r\n",
     NULL, do_avd_name, NULL },
 
+    { "cache", "query disk image metadata cache statistics",
+    "'avd cache' will list the qcow2 L2 table and refcount block cache sizes\r\n"
+    "and hit/miss counts for every open disk image\r\n",
+    NULL, do_avd_cache, NULL },
+
+    { "gpuframes", "query GPU frame delivery statistics",
+    "'avd gpuframes' will report how many GPU frames were posted, delivered to\r\n"
+    "the UI and dropped, and the latest and maximum delivery latencies\r\n",
+    NULL, do_avd_gpuframes, NULL },
+
     { "snapshot", "state snapshot commands",
     "allows you to save and restore the virtual device state in snapshots\r\n",
     NULL, NULL, snapshot_commands },
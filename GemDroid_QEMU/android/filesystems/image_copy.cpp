@@ -0,0 +1,497 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/filesystems/image_copy.h"
+
+#include "android/base/Log.h"
+#include "android/base/files/ScopedFd.h"
+#include "android/utils/eintr_wrapper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// Not defined by older <linux/fs.h> headers.
+#if defined(__linux__) && !defined(FICLONE)
+#define FICLONE  _IOW(0x94, 9, int)
+#endif
+
+#define DEBUG_IMAGE_COPY  0
+
+#define IMAGE_COPY_LOG   LOG_IF(INFO, DEBUG_IMAGE_COPY)
+#define IMAGE_COPY_PLOG  PLOG_IF(INFO, DEBUG_IMAGE_COPY)
+
+using android::base::ScopedFd;
+
+namespace {
+
+// See system/core/libsparse/sparse_format.h in the Android sources.
+// All fields are little-endian.
+//
+// File header:
+//    0  magic (u32)
+//    4  major version (u16), must be 1
+//    6  minor version (u16)
+//    8  file header size (u16), at least 28
+//   10  chunk header size (u16), at least 12
+//   12  block size in bytes (u32), a multiple of 4
+//   16  total blocks in the raw image (u32)
+//   20  total chunks (u32)
+//   24  image checksum (u32), ignored
+//
+// Chunk header, followed by the chunk's data:
+//    0  chunk type (u16)
+//    2  reserved (u16)
+//    4  chunk size in blocks of the raw image (u32)
+//    8  total size in bytes, including the chunk header (u32)
+const uint32_t kSparseMagic = 0xed26ff3aU;
+const size_t kSparseHeaderSize = 28U;
+const size_t kChunkHeaderSize = 12U;
+
+const uint16_t kChunkTypeRaw = 0xcac1U;       // Followed by the blocks' data.
+const uint16_t kChunkTypeFill = 0xcac2U;      // Followed by a 32-bit value.
+const uint16_t kChunkTypeDontCare = 0xcac3U;  // No data.
+const uint16_t kChunkTypeCrc32 = 0xcac4U;     // Followed by a 32-bit CRC.
+
+// Size of the buffer used when the kernel cannot copy the data itself.
+const size_t kBufferSize = 256 * 1024;
+
+// All-zero blocks of this size are not written to the destination.
+const size_t kZeroBlockSize = 4096;
+
+uint16_t readLe16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t readLe32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) |
+           (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) |
+           (static_cast<uint32_t>(p[3]) << 24);
+}
+
+struct SparseHeader {
+    size_t fileHeaderSize;
+    size_t chunkHeaderSize;
+    uint32_t blockSize;
+    uint32_t totalBlocks;
+    uint32_t totalChunks;
+};
+
+bool parseSparseHeader(const uint8_t* data, SparseHeader* header) {
+    if (readLe32(data) != kSparseMagic || readLe16(data + 4) != 1U) {
+        return false;
+    }
+    header->fileHeaderSize = readLe16(data + 8);
+    header->chunkHeaderSize = readLe16(data + 10);
+    header->blockSize = readLe32(data + 12);
+    header->totalBlocks = readLe32(data + 16);
+    header->totalChunks = readLe32(data + 20);
+    return header->fileHeaderSize >= kSparseHeaderSize &&
+           header->chunkHeaderSize >= kChunkHeaderSize &&
+           header->blockSize > 0 &&
+           (header->blockSize % 4U) == 0;
+}
+
+// Read exactly |size| bytes at |offset| from |fd|.
+// Return 0 on success, or -errno on failure (-EIO for a short file).
+int readAt(int fd, off_t offset, void* buffer, size_t size) {
+    if (::lseek(fd, offset, SEEK_SET) != offset) {
+        return -errno;
+    }
+    uint8_t* p = static_cast<uint8_t*>(buffer);
+    while (size > 0) {
+        ssize_t ret = HANDLE_EINTR(::read(fd, p, size));
+        if (ret < 0) {
+            return -errno;
+        }
+        if (ret == 0) {
+            return -EIO;
+        }
+        p += ret;
+        size -= static_cast<size_t>(ret);
+    }
+    return 0;
+}
+
+// Write exactly |size| bytes at |offset| to |fd|.
+// Return 0 on success, or -errno on failure.
+int writeAt(int fd, off_t offset, const void* buffer, size_t size) {
+    if (::lseek(fd, offset, SEEK_SET) != offset) {
+        return -errno;
+    }
+    const uint8_t* p = static_cast<const uint8_t*>(buffer);
+    while (size > 0) {
+        ssize_t ret = HANDLE_EINTR(::write(fd, p, size));
+        if (ret < 0) {
+            return -errno;
+        }
+        p += ret;
+        size -= static_cast<size_t>(ret);
+    }
+    return 0;
+}
+
+bool isZeroBlock(const uint8_t* data, size_t size) {
+    for (size_t n = 0; n < size; ++n) {
+        if (data[n]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Copies one image file into another. The destination must be empty,
+// so that ranges that are not written read as zeros.
+class ImageCopier {
+public:
+    ImageCopier(int dstFd, int srcFd) :
+            mDstFd(dstFd),
+            mSrcFd(srcFd),
+            mBuffer(NULL),
+            mUsedKernelCopy(false),
+            mCanUseKernelCopy(true) {}
+
+    ~ImageCopier() {
+        ::free(mBuffer);
+    }
+
+    // Try to share the source's blocks. Return true on success.
+    bool reflink() {
+#ifdef __linux__
+        if (::ioctl(mDstFd, FICLONE, mSrcFd) == 0) {
+            return true;
+        }
+        IMAGE_COPY_PLOG << "Could not reflink image file";
+#endif
+        return false;
+    }
+
+    // Copy the first |size| bytes of a regular (non-sparse) image.
+    int copyRegular(off_t size) {
+        off_t pos = 0;
+#ifdef SEEK_DATA
+        // Only copy the source's data segments, the holes are recreated
+        // by the final ftruncate() call.
+        while (pos < size) {
+            off_t dataPos = ::lseek(mSrcFd, pos, SEEK_DATA);
+            if (dataPos < 0) {
+                if (errno == ENXIO) {
+                    // Only a hole after |pos|.
+                    pos = size;
+                }
+                // Otherwise, SEEK_DATA is not supported, copy the rest.
+                break;
+            }
+            if (dataPos >= size) {
+                pos = size;
+                break;
+            }
+            off_t holePos = ::lseek(mSrcFd, dataPos, SEEK_HOLE);
+            if (holePos < 0 || holePos > size) {
+                holePos = size;
+            }
+            int ret = copyRange(dataPos, dataPos, holePos - dataPos);
+            if (ret < 0) {
+                return ret;
+            }
+            pos = holePos;
+        }
+#endif
+        if (pos < size) {
+            int ret = copyRange(pos, pos, size - pos);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        return resize(size);
+    }
+
+    // Expand the Android sparse image described by |header|.
+    int expandSparse(const SparseHeader& header) {
+        const uint64_t blockSize = header.blockSize;
+        off_t srcPos = static_cast<off_t>(header.fileHeaderSize);
+        uint64_t block = 0;
+        for (uint32_t n = 0; n < header.totalChunks; ++n) {
+            uint8_t chunk[kChunkHeaderSize];
+            int ret = readAt(mSrcFd, srcPos, chunk, sizeof(chunk));
+            if (ret < 0) {
+                return ret;
+            }
+            uint16_t type = readLe16(chunk);
+            uint32_t numBlocks = readLe32(chunk + 4);
+            uint32_t totalSize = readLe32(chunk + 8);
+            if (totalSize < header.chunkHeaderSize ||
+                block + numBlocks > header.totalBlocks) {
+                IMAGE_COPY_LOG << "Invalid sparse image chunk #" << n;
+                return -EINVAL;
+            }
+            off_t dataPos = srcPos + static_cast<off_t>(header.chunkHeaderSize);
+            uint64_t dataSize = totalSize - header.chunkHeaderSize;
+            off_t dstPos = static_cast<off_t>(block * blockSize);
+            uint64_t size = numBlocks * blockSize;
+
+            switch (type) {
+                case kChunkTypeRaw:
+                    if (dataSize != size) {
+                        return -EINVAL;
+                    }
+                    ret = copyRange(dataPos, dstPos, static_cast<off_t>(size));
+                    break;
+
+                case kChunkTypeFill: {
+                    uint8_t value[4];
+                    if (dataSize != sizeof(value)) {
+                        return -EINVAL;
+                    }
+                    ret = readAt(mSrcFd, dataPos, value, sizeof(value));
+                    if (ret == 0 && readLe32(value) != 0) {
+                        ret = fill(dstPos, static_cast<off_t>(size), value);
+                    }
+                    break;
+                }
+
+                case kChunkTypeDontCare:
+                case kChunkTypeCrc32:
+                    // Nothing to write for these.
+                    break;
+
+                default:
+                    IMAGE_COPY_LOG << "Unknown sparse image chunk type "
+                                   << type;
+                    return -EINVAL;
+            }
+            if (ret < 0) {
+                return ret;
+            }
+            srcPos += static_cast<off_t>(totalSize);
+            block += numBlocks;
+        }
+        return resize(static_cast<off_t>(header.totalBlocks * blockSize));
+    }
+
+    bool usedKernelCopy() const { return mUsedKernelCopy; }
+
+private:
+    int resize(off_t size) {
+        return (::ftruncate(mDstFd, size) < 0) ? -errno : 0;
+    }
+
+    bool allocBuffer() {
+        if (!mBuffer) {
+            mBuffer = static_cast<uint8_t*>(::malloc(kBufferSize));
+        }
+        return mBuffer != NULL;
+    }
+
+    // Copy |size| bytes from |srcPos| in the source to |dstPos| in the
+    // destination, in the kernel if possible.
+    int copyRange(off_t srcPos, off_t dstPos, off_t size) {
+#if defined(__linux__) && defined(__NR_copy_file_range)
+        while (size > 0 && mCanUseKernelCopy) {
+            loff_t srcOff = srcPos;
+            loff_t dstOff = dstPos;
+            ssize_t ret = ::syscall(__NR_copy_file_range,
+                                    mSrcFd, &srcOff, mDstFd, &dstOff,
+                                    static_cast<size_t>(size), 0U);
+            if (ret > 0) {
+                mUsedKernelCopy = true;
+                srcPos += ret;
+                dstPos += ret;
+                size -= ret;
+            } else if (ret == 0) {
+                // Source is shorter than expected.
+                return -EIO;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno == ENOSYS || errno == EXDEV ||
+                       errno == EINVAL || errno == EOPNOTSUPP) {
+                // Not supported for these files, don't try again.
+                IMAGE_COPY_PLOG << "Can't use copy_file_range()";
+                mCanUseKernelCopy = false;
+            } else {
+                return -errno;
+            }
+        }
+#endif
+        if (size > 0 && !allocBuffer()) {
+            return -ENOMEM;
+        }
+        while (size > 0) {
+            size_t chunkSize = (size > static_cast<off_t>(kBufferSize))
+                    ? kBufferSize : static_cast<size_t>(size);
+            int ret = readAt(mSrcFd, srcPos, mBuffer, chunkSize);
+            if (ret < 0) {
+                return ret;
+            }
+            ret = writeNonZero(dstPos, mBuffer, chunkSize);
+            if (ret < 0) {
+                return ret;
+            }
+            srcPos += static_cast<off_t>(chunkSize);
+            dstPos += static_cast<off_t>(chunkSize);
+            size -= static_cast<off_t>(chunkSize);
+        }
+        return 0;
+    }
+
+    // Write |size| bytes at |dstPos|, skipping all-zero blocks.
+    int writeNonZero(off_t dstPos, const uint8_t* data, size_t size) {
+        size_t start = 0;
+        while (start < size) {
+            // Skip zero blocks, then find the end of the non-zero ones.
+            size_t blockSize = size - start;
+            if (blockSize > kZeroBlockSize) {
+                blockSize = kZeroBlockSize;
+            }
+            if (isZeroBlock(data + start, blockSize)) {
+                start += blockSize;
+                continue;
+            }
+            size_t end = start + blockSize;
+            while (end < size) {
+                size_t nextSize = size - end;
+                if (nextSize > kZeroBlockSize) {
+                    nextSize = kZeroBlockSize;
+                }
+                if (isZeroBlock(data + end, nextSize)) {
+                    break;
+                }
+                end += nextSize;
+            }
+            int ret = writeAt(mDstFd, dstPos + static_cast<off_t>(start),
+                              data + start, end - start);
+            if (ret < 0) {
+                return ret;
+            }
+            start = end;
+        }
+        return 0;
+    }
+
+    // Fill |size| bytes at |dstPos| with the 4-byte |value|.
+    int fill(off_t dstPos, off_t size, const uint8_t value[4]) {
+        if (!allocBuffer()) {
+            return -ENOMEM;
+        }
+        for (size_t n = 0; n < kBufferSize; n += 4) {
+            ::memcpy(mBuffer + n, value, 4);
+        }
+        while (size > 0) {
+            size_t chunkSize = (size > static_cast<off_t>(kBufferSize))
+                    ? kBufferSize : static_cast<size_t>(size);
+            int ret = writeAt(mDstFd, dstPos, mBuffer, chunkSize);
+            if (ret < 0) {
+                return ret;
+            }
+            dstPos += static_cast<off_t>(chunkSize);
+            size -= static_cast<off_t>(chunkSize);
+        }
+        return 0;
+    }
+
+    int mDstFd;
+    int mSrcFd;
+    uint8_t* mBuffer;
+    bool mUsedKernelCopy;
+    bool mCanUseKernelCopy;
+};
+
+}  // namespace
+
+bool android_pathIsSparseImage(const char* path) {
+    ScopedFd fd(::open(path, O_RDONLY | O_BINARY));
+    if (!fd.valid()) {
+        return false;
+    }
+    uint8_t data[kSparseHeaderSize];
+    SparseHeader header;
+    return readAt(fd.get(), 0, data, sizeof(data)) == 0 &&
+           parseSparseHeader(data, &header);
+}
+
+int android_copyImageFd(int dstFd, int srcFd, AndroidImageCopyMethod* method) {
+    struct stat st;
+    if (::fstat(srcFd, &st) < 0) {
+        return -errno;
+    }
+    if (::ftruncate(dstFd, 0) < 0) {
+        return -errno;
+    }
+
+    ImageCopier copier(dstFd, srcFd);
+    AndroidImageCopyMethod result;
+    int ret = 0;
+
+    uint8_t data[kSparseHeaderSize];
+    SparseHeader header;
+    if (st.st_size >= static_cast<off_t>(kSparseHeaderSize) &&
+        readAt(srcFd, 0, data, sizeof(data)) == 0 &&
+        parseSparseHeader(data, &header)) {
+        ret = copier.expandSparse(header);
+        result = ANDROID_IMAGE_COPY_EXPANDED;
+    } else if (copier.reflink()) {
+        result = ANDROID_IMAGE_COPY_REFLINK;
+    } else {
+        ret = copier.copyRegular(st.st_size);
+        result = copier.usedKernelCopy() ? ANDROID_IMAGE_COPY_KERNEL
+                                         : ANDROID_IMAGE_COPY_SPARSE;
+    }
+    if (ret < 0) {
+        return ret;
+    }
+    if (method) {
+        *method = result;
+    }
+    return 0;
+}
+
+int android_copyImageFile(const char* dstPath,
+                          const char* srcPath,
+                          AndroidImageCopyMethod* method) {
+    ScopedFd srcFd(::open(srcPath, O_RDONLY | O_BINARY));
+    if (!srcFd.valid()) {
+        return -errno;
+    }
+#ifdef _WIN32
+    const int kMode = _S_IREAD | _S_IWRITE;
+#else
+    const int kMode = S_IRUSR | S_IWUSR;
+#endif
+    ScopedFd dstFd(::open(dstPath, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+                          kMode));
+    if (!dstFd.valid()) {
+        return -errno;
+    }
+    int ret = android_copyImageFd(dstFd.get(), srcFd.get(), method);
+    if (ret == 0 && ::close(dstFd.release()) < 0) {
+        ret = -errno;
+    }
+    return ret;
+}
@@ -0,0 +1,61 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_FILESYSTEMS_IMAGE_COPY_H
+#define ANDROID_FILESYSTEMS_IMAGE_COPY_H
+
+#include "android/utils/compiler.h"
+
+#include <stdbool.h>
+
+ANDROID_BEGIN_HEADER
+
+// Functions used to provision a partition image (e.g. userdata-qemu.img)
+// from its initial version (e.g. userdata.img) without copying more data
+// than needed.
+
+// How a partition image was copied by android_copyImageFd().
+typedef enum {
+    // The destination shares the source's blocks (Linux FICLONE), which
+    // is nearly instant on copy-on-write filesystems (e.g. Btrfs or XFS).
+    ANDROID_IMAGE_COPY_REFLINK,
+    // The data was copied in the kernel with copy_file_range(), skipping
+    // the source's holes.
+    ANDROID_IMAGE_COPY_KERNEL,
+    // The data was read and written by the emulator, but the source's
+    // holes and all-zero blocks were not written.
+    ANDROID_IMAGE_COPY_SPARSE,
+    // The source was an Android sparse image (as created by make_ext4fs -s),
+    // which was expanded into a raw image, with holes for its 'don't care'
+    // and zero-filled chunks.
+    ANDROID_IMAGE_COPY_EXPANDED,
+} AndroidImageCopyMethod;
+
+// Returns true iff the file at |path| is an Android sparse image.
+bool android_pathIsSparseImage(const char* path);
+
+// Copy the content of the image file opened as |srcFd| to the file opened
+// as |dstFd|, which is truncated first. Both offsets are ignored, and the
+// destination will have the size of the raw image. If |method| is not
+// NULL, sets |*method| to the method used on success.
+// Returns 0 on success, or -errno on failure.
+int android_copyImageFd(int dstFd, int srcFd, AndroidImageCopyMethod* method);
+
+// Same as android_copyImageFd(), but creates or truncates the file at
+// |dstPath| from the one at |srcPath|. The new file can only be read and
+// written by the current user.
+int android_copyImageFile(const char* dstPath,
+                          const char* srcPath,
+                          AndroidImageCopyMethod* method);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_FILESYSTEMS_IMAGE_COPY_H
@@ -0,0 +1,256 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/filesystems/image_copy.h"
+
+#include "android/base/EintrWrapper.h"
+#include "android/base/files/ScopedStdioFile.h"
+#include "android/filesystems/testing/TestSupport.h"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+using android::base::ScopedStdioFile;
+
+class TempFile {
+public:
+    TempFile() : mPath(android::testing::CreateTempFilePath()) {}
+
+    ~TempFile() {
+        HANDLE_EINTR(::unlink(mPath.c_str()));
+    }
+
+    const char* path() const { return mPath.c_str(); }
+
+    // Replace the file's content with |data|, then make its size |size|
+    // if it is larger, which leaves a hole at the end.
+    bool write(const std::string& data, size_t size = 0) {
+        ScopedStdioFile file(::fopen(path(), "wb"));
+        if (!file.get() ||
+            (!data.empty() &&
+             ::fwrite(data.data(), data.size(), 1, file.get()) != 1)) {
+            return false;
+        }
+        if (size > data.size()) {
+            ::fflush(file.get());
+            return ::ftruncate(::fileno(file.get()), size) == 0;
+        }
+        return true;
+    }
+
+    std::string read() const {
+        std::string result;
+        ScopedStdioFile file(::fopen(path(), "rb"));
+        if (file.get()) {
+            char buffer[4096];
+            size_t len;
+            while ((len = ::fread(buffer, 1, sizeof(buffer),
+                                  file.get())) > 0) {
+                result.append(buffer, len);
+            }
+        }
+        return result;
+    }
+
+private:
+    std::string mPath;
+};
+
+void appendLe16(std::string* out, uint16_t value) {
+    out->push_back(static_cast<char>(value & 0xff));
+    out->push_back(static_cast<char>(value >> 8));
+}
+
+void appendLe32(std::string* out, uint32_t value) {
+    appendLe16(out, static_cast<uint16_t>(value & 0xffff));
+    appendLe16(out, static_cast<uint16_t>(value >> 16));
+}
+
+// Helper to build Android sparse images.
+class SparseImageBuilder {
+public:
+    explicit SparseImageBuilder(uint32_t blockSize) :
+            mBlockSize(blockSize), mNumBlocks(0), mNumChunks(0),
+            mChunks(), mExpected() {}
+
+    void addRaw(const std::string& data) {
+        addChunkHeader(0xcac1, data.size() / mBlockSize, data.size());
+        mChunks += data;
+        mExpected += data;
+    }
+
+    void addFill(uint32_t numBlocks, uint32_t value) {
+        addChunkHeader(0xcac2, numBlocks, 4);
+        appendLe32(&mChunks, value);
+        std::string pattern;
+        appendLe32(&pattern, value);
+        for (size_t n = 0; n < numBlocks * mBlockSize / 4; ++n) {
+            mExpected += pattern;
+        }
+    }
+
+    void addDontCare(uint32_t numBlocks) {
+        addChunkHeader(0xcac3, numBlocks, 0);
+        mExpected.append(numBlocks * mBlockSize, '\0');
+    }
+
+    void addCrc32(uint32_t crc) {
+        addChunkHeader(0xcac4, 0, 4);
+        appendLe32(&mChunks, crc);
+    }
+
+    std::string image() const {
+        std::string result;
+        appendLe32(&result, 0xed26ff3aU);
+        appendLe16(&result, 1);   // major version
+        appendLe16(&result, 0);   // minor version
+        appendLe16(&result, 28);  // file header size
+        appendLe16(&result, 12);  // chunk header size
+        appendLe32(&result, mBlockSize);
+        appendLe32(&result, mNumBlocks);
+        appendLe32(&result, mNumChunks);
+        appendLe32(&result, 0);   // checksum
+        return result + mChunks;
+    }
+
+    const std::string& expected() const { return mExpected; }
+
+private:
+    void addChunkHeader(uint16_t type, uint32_t numBlocks, size_t dataSize) {
+        appendLe16(&mChunks, type);
+        appendLe16(&mChunks, 0);
+        appendLe32(&mChunks, numBlocks);
+        appendLe32(&mChunks, static_cast<uint32_t>(12 + dataSize));
+        mNumBlocks += numBlocks;
+        mNumChunks++;
+    }
+
+    uint32_t mBlockSize;
+    uint32_t mNumBlocks;
+    uint32_t mNumChunks;
+    std::string mChunks;
+    std::string mExpected;
+};
+
+std::string makePattern(size_t size, int seed) {
+    std::string result(size, '\0');
+    for (size_t n = 0; n < size; ++n) {
+        result[n] = static_cast<char>((n * 7 + seed) & 0xff);
+    }
+    return result;
+}
+
+}  // namespace
+
+TEST(ImageCopy, MissingSource) {
+    TempFile src, dst;
+    ASSERT_EQ(0, HANDLE_EINTR(::unlink(src.path())));
+    EXPECT_EQ(-ENOENT, android_copyImageFile(dst.path(), src.path(), NULL));
+}
+
+TEST(ImageCopy, EmptyFile) {
+    TempFile src, dst;
+    ASSERT_TRUE(src.write(""));
+    AndroidImageCopyMethod method;
+    EXPECT_EQ(0, android_copyImageFile(dst.path(), src.path(), &method));
+    EXPECT_NE(ANDROID_IMAGE_COPY_EXPANDED, method);
+    EXPECT_EQ(std::string(), dst.read());
+}
+
+TEST(ImageCopy, RegularFileWithHoles) {
+    TempFile src, dst;
+    // Data, then zeros, then data, then a hole at the end.
+    std::string data = makePattern(100000, 1);
+    data.append(300000, '\0');
+    data += makePattern(5000, 2);
+    const size_t kSize = 3 * 1024 * 1024;
+    ASSERT_TRUE(src.write(data, kSize));
+
+    // Make the destination larger, with content that must disappear.
+    ASSERT_TRUE(dst.write(std::string(kSize + 100000, '\xff')));
+
+    AndroidImageCopyMethod method;
+    EXPECT_EQ(0, android_copyImageFile(dst.path(), src.path(), &method));
+    EXPECT_NE(ANDROID_IMAGE_COPY_EXPANDED, method);
+    EXPECT_FALSE(android_pathIsSparseImage(src.path()));
+
+    data.append(kSize - data.size(), '\0');
+    std::string result = dst.read();
+    ASSERT_EQ(kSize, result.size());
+    EXPECT_TRUE(data == result);
+}
+
+TEST(ImageCopy, ExpandSparseImage) {
+    const uint32_t kBlockSize = 4096;
+    SparseImageBuilder builder(kBlockSize);
+    builder.addRaw(makePattern(2 * kBlockSize, 3));
+    builder.addFill(1, 0x11223344U);
+    builder.addDontCare(3);
+    builder.addFill(2, 0);
+    builder.addCrc32(0x12345678U);
+    builder.addRaw(makePattern(kBlockSize, 4));
+    builder.addDontCare(2);
+
+    TempFile src, dst;
+    ASSERT_TRUE(src.write(builder.image()));
+    EXPECT_TRUE(android_pathIsSparseImage(src.path()));
+
+    AndroidImageCopyMethod method;
+    EXPECT_EQ(0, android_copyImageFile(dst.path(), src.path(), &method));
+    EXPECT_EQ(ANDROID_IMAGE_COPY_EXPANDED, method);
+
+    std::string result = dst.read();
+    ASSERT_EQ(11U * kBlockSize, result.size());
+    EXPECT_TRUE(builder.expected() == result);
+}
+
+TEST(ImageCopy, InvalidSparseImages) {
+    const uint32_t kBlockSize = 1024;
+    TempFile src, dst;
+
+    // Truncated raw chunk.
+    {
+        SparseImageBuilder builder(kBlockSize);
+        builder.addRaw(makePattern(4 * kBlockSize, 5));
+        std::string image = builder.image();
+        ASSERT_TRUE(src.write(image.substr(0, image.size() - 100)));
+        EXPECT_EQ(-EIO, android_copyImageFile(dst.path(), src.path(), NULL));
+    }
+
+    // Unknown chunk type.
+    {
+        SparseImageBuilder builder(kBlockSize);
+        builder.addDontCare(1);
+        std::string image = builder.image();
+        image[28] = '\x42';
+        ASSERT_TRUE(src.write(image));
+        EXPECT_EQ(-EINVAL,
+                  android_copyImageFile(dst.path(), src.path(), NULL));
+    }
+
+    // More chunk blocks than the total in the file header.
+    {
+        SparseImageBuilder builder(kBlockSize);
+        builder.addDontCare(2);
+        std::string image = builder.image();
+        image[16] = '\x01';
+        ASSERT_TRUE(src.write(image));
+        EXPECT_EQ(-EINVAL,
+                  android_copyImageFile(dst.path(), src.path(), NULL));
+    }
+}
@@ -12,6 +12,7 @@
 #include "android/filesystems/partition_types.h"
 
 #include "android/filesystems/ext4_utils.h"
+#include "android/filesystems/image_copy.h"
 #include "android/utils/panic.h"
 #include "android/utils/path.h"
 
@@ -59,6 +60,11 @@ AndroidPartitionType androidPartitionType_probeFile(const char* image_file) {
     if (android_pathIsExt4PartitionImage(image_file)) {
         return ANDROID_PARTITION_TYPE_EXT4;
     }
+    // Android sparse images are only generated for ext4 partitions, and
+    // are expanded when copied (see android/filesystems/image_copy.h).
+    if (android_pathIsSparseImage(image_file)) {
+        return ANDROID_PARTITION_TYPE_EXT4;
+    }
     // Assume YAFFS2, since there is little way to be sure for now.
     // NOTE: An empty file is a valid Yaffs2 file!
     return ANDROID_PARTITION_TYPE_YAFFS2;
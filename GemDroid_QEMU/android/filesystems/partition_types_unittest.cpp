@@ -94,6 +94,27 @@ TEST(AndroidPartitionType, ProbeFileExt4) {
               androidPartitionType_probeFile(part.GetPath()));
 }
 
+TEST(AndroidPartitionType, ProbeFileSparseExt4) {
+    TempPartition part;
+
+    // A sparse image header with no chunks.
+    static const unsigned char kSparseHeader[28] = {
+        0x3a, 0xff, 0x26, 0xed,  // magic
+        0x01, 0x00, 0x00, 0x00,  // major and minor versions
+        0x1c, 0x00, 0x0c, 0x00,  // file and chunk header sizes
+        0x00, 0x10, 0x00, 0x00,  // block size
+    };
+    {
+        ScopedStdioFile file(::fopen(part.GetPath(), "wb"));
+        ASSERT_TRUE(file.get());
+        ASSERT_EQ(1U, ::fwrite(kSparseHeader, sizeof(kSparseHeader), 1,
+                               file.get()));
+    }
+
+    EXPECT_EQ(ANDROID_PARTITION_TYPE_EXT4,
+              androidPartitionType_probeFile(part.GetPath()));
+}
+
 TEST(AndroidPartitionType, MakeEmptyFileYaffs2) {
     TempPartition part;
 
@@ -14,7 +14,9 @@
 #include "android/base/Compiler.h"
 #include "android/base/Log.h"
 #include "android/base/String.h"
+#include "android/utils/startup_cache.h"
 
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -186,14 +188,17 @@ bool parse_hex8(const char* input, uint32_t* value) {
     return true;
 }
 
-}  // namespace
-
-bool android_extractRamdiskFile(const char* ramdiskPath,
-                                const char* fileName,
-                                char** out,
-                                size_t* outSize) {
+// Extract |fileName| from the ramdisk image at |ramdiskPath|. On failure,
+// set |*missing| to true if the whole archive was read without finding
+// the file.
+bool extractRamdiskFile(const char* ramdiskPath,
+                        const char* fileName,
+                        char** out,
+                        size_t* outSize,
+                        bool* missing) {
     *out = NULL;
     *outSize = 0;
+    *missing = false;
 
     GZipInputStream input(ramdiskPath);
     if (input.error()) {
@@ -226,6 +231,7 @@ bool android_extractRamdiskFile(const char* ramdiskPath,
         cpio_newc_header header;
         if (!input.doRead(&header, sizeof header)) {
             // Assume end of input here.
+            *missing = (input.error() == 0);
             D("Could not find %s in ramdisk image at %s\n",
               fileName, ramdiskPath);
             return false;
@@ -284,6 +290,7 @@ bool android_extractRamdiskFile(const char* ramdiskPath,
                 !strcmp(entryName.c_str(), kTrailer)) {
                 D("End of archive reached. Could not find %s in ramdisk image at %s",
                   fileName, ramdiskPath);
+                *missing = true;
                 return false;
             }
 
@@ -312,3 +319,51 @@ bool android_extractRamdiskFile(const char* ramdiskPath,
     errno = input.error();
     return false;
 }
+
+}  // namespace
+
+bool android_extractRamdiskFile(const char* ramdiskPath,
+                                const char* fileName,
+                                char** out,
+                                size_t* outSize) {
+    // Cached values are the file content prefixed with '+', or a single
+    // '-' if the file is not in the ramdisk, which is common for older
+    // system images without fstab.goldfish.
+    android::base::String kind("ramdisk-file:");
+    kind += fileName;
+
+    char* cached = NULL;
+    size_t cachedSize = 0;
+    if (android_startupCache_get(ramdiskPath, kind.c_str(),
+                                 &cached, &cachedSize)) {
+        if (cachedSize >= 1U && cached[0] == '+') {
+            ::memmove(cached, cached + 1, cachedSize - 1U);
+            *out = cached;
+            *outSize = cachedSize - 1U;
+            return true;
+        }
+        bool missing = (cachedSize == 1U && cached[0] == '-');
+        free(cached);
+        if (missing) {
+            *out = NULL;
+            *outSize = 0;
+            errno = ENOENT;
+            return false;
+        }
+    }
+
+    bool missing = false;
+    if (extractRamdiskFile(ramdiskPath, fileName, out, outSize, &missing)) {
+        char* value = static_cast<char*>(malloc(*outSize + 1U));
+        value[0] = '+';
+        ::memcpy(value + 1, *out, *outSize);
+        android_startupCache_put(ramdiskPath, kind.c_str(),
+                                 value, *outSize + 1U);
+        free(value);
+        return true;
+    }
+    if (missing) {
+        android_startupCache_put(ramdiskPath, kind.c_str(), "-", 1U);
+    }
+    return false;
+}
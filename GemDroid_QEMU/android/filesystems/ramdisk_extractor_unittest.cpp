@@ -12,7 +12,9 @@
 #include "android/filesystems/ramdisk_extractor.h"
 
 #include "android/base/EintrWrapper.h"
+#include "android/base/testing/TestTempDir.h"
 #include "android/filesystems/testing/TestSupport.h"
+#include "android/utils/startup_cache.h"
 
 #include <gtest/gtest.h>
 
@@ -100,3 +102,37 @@ TEST_F(RamdiskExtractorTest, MissingFile) {
     EXPECT_TRUE(fillData(kTestRamdiskImage, kTestRamdiskImageSize));
     EXPECT_FALSE(android_extractRamdiskFile(path(), "zoolander", &out, &outSize));
 }
+
+TEST_F(RamdiskExtractorTest, CachedResults) {
+    static const char kExpected[] = "Meow!!\n";
+    static const size_t kExpectedSize = sizeof(kExpected) - 1U;
+    android::base::TestTempDir cacheDir("ramdiskcache");
+    android_startupCache_setDirectory(cacheDir.path());
+
+    EXPECT_TRUE(fillData(kTestRamdiskImage, kTestRamdiskImageSize));
+    // The first calls fill the cache, the next ones use it.
+    for (int n = 0; n < 2; n++) {
+        char* out = NULL;
+        size_t outSize = 0;
+        EXPECT_TRUE(android_extractRamdiskFile(path(), "zoo", &out, &outSize));
+        EXPECT_EQ(kExpectedSize, outSize);
+        EXPECT_TRUE(out);
+        EXPECT_TRUE(!memcmp(out, kExpected, outSize));
+        free(out);
+
+        out = NULL;
+        EXPECT_FALSE(android_extractRamdiskFile(path(), "zoolander",
+                                                &out, &outSize));
+        EXPECT_FALSE(out);
+    }
+
+    // A different image must not use the cached values.
+    static const uint8_t kNotGzip[] = "not a ramdisk";
+    EXPECT_TRUE(fillData(kNotGzip, sizeof(kNotGzip)));
+    char* out = NULL;
+    size_t outSize = 0;
+    EXPECT_FALSE(android_extractRamdiskFile(path(), "zoo", &out, &outSize));
+    free(out);
+
+    android_startupCache_setDirectory(NULL);
+}
@@ -0,0 +1,326 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "android/framebuffer-shm.h"
+
+#include <errno.h>
+
+#ifdef _WIN32
+
+int
+qframebuffer_shm_add_client( QFrameBuffer*  qfbuff, const char*  name )
+{
+    (void)qfbuff;
+    (void)name;
+    errno = ENOSYS;
+    return -1;
+}
+
+#else /* !_WIN32 */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define  FB_SHM_ALIGN  4096
+
+/* a rectangle in framebuffer pixels, x1/y1 are exclusive. empty when
+ * x0 >= x1 */
+typedef struct {
+    int  x0, y0, x1, y1;
+} FbShmRect;
+
+typedef struct {
+    QFrameBuffer*  qfbuff;
+    char*          name;
+    FbShmHeader*   header;
+    size_t         map_size;
+    uint32_t       next_slot;
+    uint64_t       frame;
+
+    /* pixels updated since the last published frame */
+    FbShmRect      pending;
+
+    /* for each slot, the pixels that changed since it was last written,
+     * i.e. what must be copied to bring it up to date */
+    FbShmRect      stale[ FB_SHM_SLOTS ];
+} FbShm;
+
+static void
+_rect_set_full( FbShmRect*  r, const QFrameBuffer*  qfbuff )
+{
+    r->x0 = 0;
+    r->y0 = 0;
+    r->x1 = qfbuff->width;
+    r->y1 = qfbuff->height;
+}
+
+static void
+_rect_union( FbShmRect*  r, const FbShmRect*  other )
+{
+    if (other->x0 >= other->x1 || other->y0 >= other->y1)
+        return;
+
+    if (r->x0 >= r->x1 || r->y0 >= r->y1) {
+        *r = *other;
+        return;
+    }
+    if (other->x0 < r->x0) r->x0 = other->x0;
+    if (other->y0 < r->y0) r->y0 = other->y0;
+    if (other->x1 > r->x1) r->x1 = other->x1;
+    if (other->y1 > r->y1) r->y1 = other->y1;
+}
+
+static uint8_t*
+_slot_pixels( FbShm*  shm, uint32_t  index )
+{
+    return (uint8_t*)shm->header + shm->header->header_size
+         + (size_t)index * shm->header->slot_size;
+}
+
+static uint64_t
+_now_ns( void )
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* copy the changed pixels into the next slot and make it the latest one */
+static void
+_fb_shm_publish( FbShm*  shm )
+{
+    QFrameBuffer*  qfbuff = shm->qfbuff;
+    FbShmHeader*   header = shm->header;
+    uint32_t       index  = shm->next_slot;
+    FbShmSlot*     slot   = &header->slots[index];
+    FbShmRect      rect   = shm->stale[index];
+    uint32_t       nn;
+
+    /* the slot misses everything published since it was last written,
+     * plus the current update; other slots now miss the current update */
+    _rect_union(&rect, &shm->pending);
+    for (nn = 0; nn < FB_SHM_SLOTS; nn++) {
+        if (nn == index)
+            shm->stale[nn].x0 = shm->stale[nn].x1 = 0;
+        else
+            _rect_union(&shm->stale[nn], &shm->pending);
+    }
+    shm->pending.x0 = shm->pending.x1 = 0;
+
+    slot->seq++;
+    FB_SHM_BARRIER();
+
+    if (rect.x0 < rect.x1 && rect.y0 < rect.y1) {
+        const uint8_t*  src   = qfbuff->pixels;
+        uint8_t*        dst   = _slot_pixels(shm, index);
+        int             pitch = qfbuff->pitch;
+        int             bpp   = qfbuff->bytes_per_pixel;
+        size_t          start = (size_t)rect.y0 * pitch + rect.x0 * bpp;
+        int             y;
+
+        if (rect.x0 == 0 && rect.x1 == qfbuff->width) {
+            memcpy(dst + start, src + start, (size_t)(rect.y1 - rect.y0) * pitch);
+        } else {
+            size_t  len = (size_t)(rect.x1 - rect.x0) * bpp;
+            for (y = rect.y0; y < rect.y1; y++, start += pitch)
+                memcpy(dst + start, src + start, len);
+        }
+    }
+
+    slot->width        = qfbuff->width;
+    slot->height       = qfbuff->height;
+    slot->pitch        = qfbuff->pitch;
+    slot->format       = qfbuff->format;
+    slot->rotation     = qfbuff->rotation;
+    slot->frame        = ++shm->frame;
+    slot->timestamp_ns = _now_ns();
+
+    FB_SHM_BARRIER();
+    slot->seq++;
+    header->latest = index;
+
+    shm->next_slot = (index + 1) % FB_SHM_SLOTS;
+}
+
+static void
+_fb_shm_update( void*  opaque, int  x, int  y, int  w, int  h )
+{
+    FbShm*     shm = opaque;
+    FbShmRect  r;
+
+    r.x0 = x < 0 ? 0 : x;
+    r.y0 = y < 0 ? 0 : y;
+    r.x1 = x + w > shm->qfbuff->width  ? shm->qfbuff->width  : x + w;
+    r.y1 = y + h > shm->qfbuff->height ? shm->qfbuff->height : y + h;
+    _rect_union(&shm->pending, &r);
+}
+
+static void
+_fb_shm_rotate( void*  opaque, int  rotation )
+{
+    FbShm*  shm = opaque;
+    int     nn;
+
+    (void)rotation;
+
+    /* the pixel layout changed, every slot must be rewritten entirely */
+    _rect_set_full(&shm->pending, shm->qfbuff);
+    for (nn = 0; nn < FB_SHM_SLOTS; nn++)
+        _rect_set_full(&shm->stale[nn], shm->qfbuff);
+}
+
+static void
+_fb_shm_poll( void*  opaque )
+{
+    FbShm*  shm = opaque;
+
+    if (shm->pending.x0 < shm->pending.x1 && shm->pending.y0 < shm->pending.y1)
+        _fb_shm_publish(shm);
+}
+
+static void
+_fb_shm_done( void*  opaque )
+{
+    FbShm*  shm = opaque;
+
+    shm->header->writer_pid = 0;
+    munmap(shm->header, shm->map_size);
+    shm_unlink(shm->name);
+    free(shm->name);
+    free(shm);
+}
+
+/* returns 1 if the shared memory object 'name' holds a display that was
+ * left behind by an emulator which is no longer running, 0 otherwise
+ * (including when the object is not one of ours) */
+static int
+_fb_shm_is_stale( const char*  name )
+{
+    const FbShmHeader*  header;
+    struct stat         st;
+    int                 fd, stale = 0;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return 0;
+
+    if (fstat(fd, &st) < 0 || st.st_uid != getuid() ||
+        st.st_size < (off_t)sizeof(FbShmHeader)) {
+        close(fd);
+        return 0;
+    }
+    header = mmap(NULL, sizeof(*header), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+        return 0;
+
+    if (header->magic == FB_SHM_MAGIC) {
+        pid_t  pid = (pid_t)header->writer_pid;
+
+        stale = (pid == 0 || (kill(pid, 0) < 0 && errno == ESRCH));
+    }
+    munmap((void*)header, sizeof(*header));
+    return stale;
+}
+
+int
+qframebuffer_shm_add_client( QFrameBuffer*  qfbuff, const char*  name )
+{
+    FbShm*        shm;
+    FbShmHeader*  header;
+    size_t        header_size, slot_size, map_size;
+    void*         base;
+    int           fd, nn, err;
+
+    if (qfbuff == NULL || qfbuff->extra == NULL || name == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* the slots are sized once: a rotation swaps width and height but
+     * keeps pitch*height constant */
+    header_size = (sizeof(FbShmHeader) + FB_SHM_ALIGN - 1) & ~(size_t)(FB_SHM_ALIGN - 1);
+    slot_size   = ((size_t)qfbuff->pitch * qfbuff->height + FB_SHM_ALIGN - 1) & ~(size_t)(FB_SHM_ALIGN - 1);
+    map_size    = header_size + FB_SHM_SLOTS * slot_size;
+
+    /* the pixels are only for the current user, and an object that is
+     * still owned by another emulator is never taken over */
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST && _fb_shm_is_stale(name)) {
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, map_size) < 0) {
+        err = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = err;
+        return -1;
+    }
+
+    base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    err  = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(name);
+        errno = err;
+        return -1;
+    }
+
+    shm = calloc(1, sizeof(*shm));
+    if (shm != NULL)
+        shm->name = strdup(name);
+    if (shm == NULL || shm->name == NULL) {
+        free(shm);
+        munmap(base, map_size);
+        shm_unlink(name);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    header = base;
+    header->magic       = FB_SHM_MAGIC;
+    header->version     = FB_SHM_VERSION;
+    header->header_size = header_size;
+    header->slot_count  = FB_SHM_SLOTS;
+    header->slot_size   = slot_size;
+    header->latest      = FB_SHM_NO_FRAME;
+    header->writer_pid  = getpid();
+
+    shm->qfbuff   = qfbuff;
+    shm->header   = header;
+    shm->map_size = map_size;
+
+    /* publish the current content on the first poll */
+    _rect_set_full(&shm->pending, qfbuff);
+    for (nn = 0; nn < FB_SHM_SLOTS; nn++)
+        _rect_set_full(&shm->stale[nn], qfbuff);
+
+    qframebuffer_add_client(qfbuff, shm,
+                            _fb_shm_update,
+                            _fb_shm_rotate,
+                            _fb_shm_poll,
+                            _fb_shm_done);
+    return 0;
+}
+
+#endif /* !_WIN32 */
@@ -0,0 +1,161 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef _ANDROID_FRAMEBUFFER_SHM_H_
+#define _ANDROID_FRAMEBUFFER_SHM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "android/framebuffer.h"
+
+/* A headless QFrameBuffer client that publishes the emulated display into
+ * a POSIX shared memory object, so that screenshot, video capture or test
+ * tools can read frames directly without the emulator scaling, composing
+ * or encoding anything.
+ *
+ * The object starts with an FbShmHeader, followed by FB_SHM_SLOTS pixel
+ * slots. The emulator writes each new frame into the slot after the most
+ * recently published one, then updates 'latest'. Each slot is protected by
+ * a sequence lock: 'seq' is odd while the slot is being written, and is
+ * bumped again once the pixels and metadata are consistent. A reader thus
+ * copies (or consumes) a frame with:
+ *
+ *     FbShmFrame  frame;
+ *     if (fb_shm_read_begin(header, &frame) == 0) {
+ *         ... use frame.info and frame.pixels ...
+ *         if (!fb_shm_read_end(&frame))
+ *             ... the slot was overwritten meanwhile, retry ...
+ *     }
+ *
+ * With three slots, a reader has two full frame periods to consume the
+ * latest frame before the writer can reuse its slot.
+ *
+ * Pixels are stored unrotated, exactly like QFrameBuffer::pixels, with
+ * 'pitch' bytes per line; 'rotation' tells how they must be rotated before
+ * display. See docs/ANDROID-FRAMEBUFFER.TXT for a complete reader.
+ *
+ * This header only depends on the C library and android/framebuffer.h, and can
+ * be copied as-is into external tools.
+ */
+
+#define  FB_SHM_MAGIC     0x48534246   /* 'FBSH' in little-endian order */
+#define  FB_SHM_VERSION   1
+#define  FB_SHM_SLOTS     3
+#define  FB_SHM_NO_FRAME  0xffffffffU
+
+typedef struct {
+    volatile uint32_t  seq;           /* odd while the slot is being written */
+    uint32_t           width;         /* in pixels */
+    uint32_t           height;        /* in pixels */
+    uint32_t           pitch;         /* bytes per line */
+    uint32_t           format;        /* a QFrameBufferFormat value */
+    uint32_t           rotation;      /* 0..3, see QFrameBuffer::rotation */
+    uint64_t           frame;         /* frame number, starting at 1 */
+    uint64_t           timestamp_ns;  /* CLOCK_MONOTONIC publication time */
+} FbShmSlot;
+
+typedef struct {
+    uint32_t           magic;         /* FB_SHM_MAGIC */
+    uint32_t           version;       /* FB_SHM_VERSION */
+    uint32_t           header_size;   /* offset of the first slot's pixels */
+    uint32_t           slot_count;    /* FB_SHM_SLOTS */
+    uint32_t           slot_size;     /* distance between two slots' pixels */
+    volatile uint32_t  latest;        /* last published slot, or FB_SHM_NO_FRAME */
+    volatile uint32_t  writer_pid;    /* emulator process, 0 once it is gone */
+    uint32_t           reserved;
+    FbShmSlot          slots[ FB_SHM_SLOTS ];
+} FbShmHeader;
+
+#if defined(__GNUC__)
+#  define  FB_SHM_BARRIER()  __sync_synchronize()
+#else
+#  error "FB_SHM_BARRIER() is not implemented for this compiler"
+#endif
+
+/* A reader's view of one published frame */
+typedef struct {
+    const FbShmHeader*  header;
+    uint32_t            slot;
+    uint32_t            seq;
+    FbShmSlot           info;    /* snapshot of the slot metadata */
+    const uint8_t*      pixels;  /* first pixel of the slot */
+} FbShmFrame;
+
+/* start reading the most recently published frame. returns 0 on success,
+ * or -1 if nothing was published yet or the writer is reusing the slot
+ * right now (just try again). The frame's content can only be trusted
+ * after fb_shm_read_end() returned 1.
+ */
+static __inline__ int
+fb_shm_read_begin( const FbShmHeader*  header, FbShmFrame*  frame )
+{
+    const FbShmSlot*  slot;
+    uint32_t          index = header->latest;
+
+    if (index >= header->slot_count || index >= FB_SHM_SLOTS)
+        return -1;
+
+    slot = &header->slots[index];
+    frame->seq = slot->seq;
+    if (frame->seq & 1)
+        return -1;
+
+    FB_SHM_BARRIER();
+
+    frame->header            = header;
+    frame->slot              = index;
+    frame->info.seq          = frame->seq;
+    frame->info.width        = slot->width;
+    frame->info.height       = slot->height;
+    frame->info.pitch        = slot->pitch;
+    frame->info.format       = slot->format;
+    frame->info.rotation     = slot->rotation;
+    frame->info.frame        = slot->frame;
+    frame->info.timestamp_ns = slot->timestamp_ns;
+    frame->pixels = (const uint8_t*)header + header->header_size
+                  + (size_t)index * header->slot_size;
+    return 0;
+}
+
+/* finish reading a frame, returns 1 if its metadata and pixels were not
+ * modified since fb_shm_read_begin(), 0 otherwise */
+static __inline__ int
+fb_shm_read_end( const FbShmFrame*  frame )
+{
+    FB_SHM_BARRIER();
+    return frame->header->slots[frame->slot].seq == frame->seq;
+}
+
+/* register a shared memory display client on 'qfbuff', publishing its
+ * content into the POSIX shared memory object 'name' (e.g. "/emulator-fb").
+ * frames are published from the client's Poll method, so several updates
+ * between two polls are coalesced into a single frame.
+ *
+ * the object is created with mode 0600, so only processes of the same user
+ * can read it. it is unlinked when the framebuffer is finalized.
+ * an existing object with the same name is only replaced if it was left
+ * behind by an emulator that is no longer running, otherwise this fails
+ * with errno set to EEXIST.
+ * returns 0 on success, or -1 on failure (with errno set).
+ */
+extern int
+qframebuffer_shm_add_client( QFrameBuffer*  qfbuff, const char*  name );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ANDROID_FRAMEBUFFER_SHM_H_ */
@@ -0,0 +1,294 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+#include "android/framebuffer-shm.h"
+
+#include "android/base/system/System.h"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using android::base::System;
+
+namespace {
+
+// A framebuffer with a shared memory client, plus a read-only mapping of
+// the shared memory object, as an external tool would see it.
+class ShmDisplay {
+public:
+    ShmDisplay(int width, int height, QFrameBufferFormat format)
+            : mHeader(NULL), mSize(0) {
+        snprintf(mName, sizeof(mName), "/fbshm-unittest-%d", getpid());
+        EXPECT_EQ(0, qframebuffer_init(&mFb, width, height, 0, format));
+        EXPECT_EQ(0, qframebuffer_shm_add_client(&mFb, mName));
+
+        int fd = shm_open(mName, O_RDONLY, 0);
+        EXPECT_LE(0, fd);
+        struct stat st;
+        EXPECT_EQ(0, fstat(fd, &st));
+        mSize = st.st_size;
+        void* base = mmap(NULL, mSize, PROT_READ, MAP_SHARED, fd, 0);
+        EXPECT_NE(MAP_FAILED, base);
+        mHeader = static_cast<const FbShmHeader*>(base);
+        close(fd);
+    }
+
+    ~ShmDisplay() {
+        qframebuffer_done(&mFb);
+        munmap(const_cast<FbShmHeader*>(mHeader), mSize);
+    }
+
+    QFrameBuffer* fb() { return &mFb; }
+    const FbShmHeader* header() const { return mHeader; }
+    const char* name() const { return mName; }
+
+    // Fill a rectangle with pseudo-random bytes and notify the clients.
+    void draw(int x, int y, int w, int h, uint32_t seed) {
+        uint8_t* pixels = static_cast<uint8_t*>(mFb.pixels);
+        for (int yy = y; yy < y + h; yy++) {
+            uint8_t* line = pixels + yy * mFb.pitch + x * mFb.bytes_per_pixel;
+            for (int n = 0; n < w * mFb.bytes_per_pixel; n++) {
+                seed = seed * 1103515245 + 12345;
+                line[n] = seed >> 16;
+            }
+        }
+        qframebuffer_update(&mFb, x, y, w, h);
+    }
+
+    // Return true if the latest published frame matches the framebuffer.
+    bool latestMatches(FbShmFrame* frame) {
+        if (fb_shm_read_begin(mHeader, frame) < 0) {
+            return false;
+        }
+        bool same = frame->info.width == (uint32_t)mFb.width &&
+                    frame->info.height == (uint32_t)mFb.height &&
+                    frame->info.pitch == (uint32_t)mFb.pitch &&
+                    frame->info.format == (uint32_t)mFb.format &&
+                    frame->info.rotation == (uint32_t)mFb.rotation &&
+                    !memcmp(frame->pixels, mFb.pixels,
+                            (size_t)mFb.pitch * mFb.height);
+        return fb_shm_read_end(frame) && same;
+    }
+
+private:
+    QFrameBuffer mFb;
+    char mName[64];
+    const FbShmHeader* mHeader;
+    size_t mSize;
+};
+
+}  // namespace
+
+TEST(FrameBufferShm, Header) {
+    ShmDisplay display(64, 48, QFRAME_BUFFER_RGB565);
+    const FbShmHeader* header = display.header();
+
+    EXPECT_EQ((uint32_t)FB_SHM_MAGIC, header->magic);
+    EXPECT_EQ((uint32_t)FB_SHM_VERSION, header->version);
+    EXPECT_EQ((uint32_t)FB_SHM_SLOTS, header->slot_count);
+    EXPECT_LE(sizeof(FbShmHeader), header->header_size);
+    EXPECT_LE(64U * 2 * 48, header->slot_size);
+    EXPECT_EQ((uint32_t)getpid(), header->writer_pid);
+
+    // Nothing is published before the first poll.
+    FbShmFrame frame;
+    EXPECT_EQ(FB_SHM_NO_FRAME, header->latest);
+    EXPECT_EQ(-1, fb_shm_read_begin(header, &frame));
+}
+
+TEST(FrameBufferShm, FirstPollPublishesFullFrame) {
+    ShmDisplay display(64, 48, QFRAME_BUFFER_RGBX_8888);
+    display.draw(0, 0, 64, 48, 1);
+    qframebuffer_poll(display.fb());
+
+    FbShmFrame frame;
+    EXPECT_TRUE(display.latestMatches(&frame));
+    EXPECT_EQ(1U, frame.info.frame);
+    EXPECT_NE(0U, frame.info.timestamp_ns);
+}
+
+TEST(FrameBufferShm, UpdatesAreCoalesced) {
+    ShmDisplay display(64, 48, QFRAME_BUFFER_RGB565);
+    qframebuffer_poll(display.fb());
+
+    display.draw(1, 2, 3, 4, 10);
+    display.draw(40, 30, 10, 10, 11);
+    qframebuffer_poll(display.fb());
+
+    FbShmFrame frame;
+    EXPECT_TRUE(display.latestMatches(&frame));
+    EXPECT_EQ(2U, frame.info.frame);
+
+    // Polling without any update doesn't publish anything.
+    qframebuffer_poll(display.fb());
+    EXPECT_TRUE(display.latestMatches(&frame));
+    EXPECT_EQ(2U, frame.info.frame);
+}
+
+TEST(FrameBufferShm, PartialUpdatesKeepAllSlotsCurrent) {
+    ShmDisplay display(97, 61, QFRAME_BUFFER_RGB565);
+    display.draw(0, 0, 97, 61, 1);
+    qframebuffer_poll(display.fb());
+
+    // Only the updated rectangles are copied, so each slot must catch up
+    // with all the updates it missed while the other slots were written.
+    uint32_t seed = 42;
+    for (int n = 0; n < 100; n++) {
+        seed = seed * 1103515245 + 12345;
+        int x = (seed >> 8) % 97;
+        int y = (seed >> 16) % 61;
+        int w = 1 + (seed >> 4) % (97 - x);
+        int h = 1 + (seed >> 12) % (61 - y);
+        display.draw(x, y, w, h, seed);
+        qframebuffer_poll(display.fb());
+
+        FbShmFrame frame;
+        ASSERT_TRUE(display.latestMatches(&frame)) << "frame " << n;
+        EXPECT_EQ((uint32_t)(n + 1) % FB_SHM_SLOTS, frame.slot);
+        EXPECT_EQ((uint64_t)n + 2, frame.info.frame);
+    }
+}
+
+TEST(FrameBufferShm, Rotation) {
+    ShmDisplay display(64, 48, QFRAME_BUFFER_RGB565);
+    display.draw(0, 0, 64, 48, 1);
+    qframebuffer_poll(display.fb());
+
+    qframebuffer_rotate(display.fb(), 1);
+    display.draw(0, 0, 48, 64, 2);
+    qframebuffer_poll(display.fb());
+
+    FbShmFrame frame;
+    EXPECT_TRUE(display.latestMatches(&frame));
+    EXPECT_EQ(48U, frame.info.width);
+    EXPECT_EQ(64U, frame.info.height);
+    EXPECT_EQ(1U, frame.info.rotation);
+}
+
+TEST(FrameBufferShm, ReaderDetectsOverwrite) {
+    ShmDisplay display(64, 48, QFRAME_BUFFER_RGB565);
+    qframebuffer_poll(display.fb());
+
+    FbShmFrame frame;
+    ASSERT_EQ(0, fb_shm_read_begin(display.header(), &frame));
+
+    // Publish enough frames for the writer to wrap around to our slot.
+    for (int n = 0; n < FB_SHM_SLOTS; n++) {
+        display.draw(0, 0, 8, 8, n);
+        qframebuffer_poll(display.fb());
+    }
+    EXPECT_FALSE(fb_shm_read_end(&frame));
+}
+
+TEST(FrameBufferShm, DoneUnlinksObject) {
+    char name[64];
+    {
+        ShmDisplay display(16, 16, QFRAME_BUFFER_RGB565);
+        snprintf(name, sizeof(name), "%s", display.name());
+    }
+    EXPECT_EQ(-1, shm_open(name, O_RDONLY, 0));
+}
+
+TEST(FrameBufferShm, ObjectIsPrivate) {
+    ShmDisplay display(16, 16, QFRAME_BUFFER_RGB565);
+    int fd = shm_open(display.name(), O_RDONLY, 0);
+    ASSERT_LE(0, fd);
+    struct stat st;
+    EXPECT_EQ(0, fstat(fd, &st));
+    EXPECT_EQ(0600, (int)(st.st_mode & 0777));
+    close(fd);
+}
+
+TEST(FrameBufferShm, NameInUseFails) {
+    ShmDisplay display(16, 16, QFRAME_BUFFER_RGB565);
+    QFrameBuffer fb;
+    ASSERT_EQ(0, qframebuffer_init(&fb, 16, 16, 0, QFRAME_BUFFER_RGB565));
+    errno = 0;
+    EXPECT_EQ(-1, qframebuffer_shm_add_client(&fb, display.name()));
+    EXPECT_EQ(EEXIST, errno);
+    qframebuffer_done(&fb);
+
+    // The first display is left untouched.
+    EXPECT_EQ(FB_SHM_MAGIC, display.header()->magic);
+    EXPECT_EQ((uint32_t)getpid(), display.header()->writer_pid);
+}
+
+TEST(FrameBufferShm, StaleObjectIsReplaced) {
+    char name[64];
+    snprintf(name, sizeof(name), "/fbshm-unittest-stale-%d", getpid());
+
+    // An object left behind by a crashed emulator.
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    ASSERT_LE(0, fd);
+    ASSERT_EQ(0, ftruncate(fd, sizeof(FbShmHeader)));
+    FbShmHeader* header = static_cast<FbShmHeader*>(
+            mmap(NULL, sizeof(FbShmHeader), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0));
+    ASSERT_NE(MAP_FAILED, (void*)header);
+    close(fd);
+    header->magic = FB_SHM_MAGIC;
+    header->writer_pid = 0;
+    munmap(header, sizeof(FbShmHeader));
+
+    QFrameBuffer fb;
+    ASSERT_EQ(0, qframebuffer_init(&fb, 16, 16, 0, QFRAME_BUFFER_RGB565));
+    EXPECT_EQ(0, qframebuffer_shm_add_client(&fb, name));
+    qframebuffer_done(&fb);
+    EXPECT_EQ(-1, shm_open(name, O_RDONLY, 0));
+}
+
+TEST(FrameBufferShm, DISABLED_FramesPerSecondBenchmark) {
+    static const struct {
+        const char* name;
+        int w;
+        int h;
+    } kScreens[] = {
+        { "phone 720x1280", 720, 1280 },
+        { "phone 1080x1920", 1080, 1920 },
+        { "tablet 1600x2560", 1600, 2560 },
+    };
+    const int kFrames = 200;
+
+    for (size_t n = 0; n < sizeof(kScreens) / sizeof(kScreens[0]); n++) {
+        ShmDisplay display(kScreens[n].w, kScreens[n].h,
+                           QFRAME_BUFFER_RGBX_8888);
+        QFrameBuffer* fb = display.fb();
+        qframebuffer_poll(fb);
+
+        // Full screen updates, e.g. scrolling or video playback.
+        double start = System::getHighResTimeUs() / 1000.;
+        for (int i = 0; i < kFrames; i++) {
+            qframebuffer_update(fb, 0, 0, fb->width, fb->height);
+            qframebuffer_poll(fb);
+        }
+        double full = System::getHighResTimeUs() / 1000. - start;
+
+        // A small animated area, e.g. a progress bar or blinking cursor.
+        start = System::getHighResTimeUs() / 1000.;
+        for (int i = 0; i < kFrames; i++) {
+            qframebuffer_update(fb, 16, 16, 128, 128);
+            qframebuffer_poll(fb);
+        }
+        double partial = System::getHighResTimeUs() / 1000. - start;
+
+        printf("%-18s full: %8.1f frames/s   128x128: %9.1f frames/s\n",
+               kScreens[n].name, kFrames * 1000. / full,
+               kFrames * 1000. / partial);
+    }
+}
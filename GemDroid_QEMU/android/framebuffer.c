@@ -14,14 +14,19 @@
 #include <stdlib.h>
 #include<stdio.h>
 
+/* client fields, these correspond to code that waits for updates before displaying them */
 typedef struct {
-    /* client fields, these correspond to code that waits for updates before displaying them */
-    /* at the moment, only one client is supported */
     void*                        fb_opaque;
     QFrameBufferUpdateFunc       fb_update;
     QFrameBufferRotateFunc       fb_rotate;
     QFrameBufferPollFunc         fb_poll;
     QFrameBufferDoneFunc         fb_done;
+} QFrameBufferClient;
+
+typedef struct {
+    /* clients are notified in registration order */
+    QFrameBufferClient           clients[ QFRAMEBUFFER_MAX_CLIENTS ];
+    int                          num_clients;
 
     void*                        pr_opaque;
     QFrameBufferCheckUpdateFunc  pr_check;
@@ -164,9 +169,13 @@ void
 qframebuffer_update( QFrameBuffer*  qfbuff, int  x, int  y, int  w, int  h )
 {
     QFrameBufferExtra*  extra = qfbuff->extra;
+    int                 nn;
 
-    if (extra->fb_update)
-        extra->fb_update( extra->fb_opaque, x, y, w, h );
+    for (nn = 0; nn < extra->num_clients; nn++) {
+        QFrameBufferClient*  client = &extra->clients[nn];
+        if (client->fb_update)
+            client->fb_update( client->fb_opaque, x, y, w, h );
+    }
 	//pras
 	//printf("pras debug: %s %s %ld\n", __FILE__, __FUNCTION__, __LINE__);
 }
@@ -180,13 +189,20 @@ qframebuffer_add_client( QFrameBuffer*           qfbuff,
                          QFrameBufferPollFunc    fb_poll,
                          QFrameBufferDoneFunc    fb_done )
 {
-    QFrameBufferExtra*  extra = qfbuff->extra;
+    QFrameBufferExtra*   extra = qfbuff->extra;
+    QFrameBufferClient*  client;
 
-    extra->fb_opaque = fb_opaque;
-    extra->fb_update = fb_update;
-    extra->fb_rotate = fb_rotate;
-    extra->fb_poll   = fb_poll;
-    extra->fb_done   = fb_done;
+    if (extra->num_clients >= QFRAMEBUFFER_MAX_CLIENTS) {
+        fprintf(stderr, "emulator: too many framebuffer clients, ignoring new one\n");
+        return;
+    }
+    client = &extra->clients[ extra->num_clients++ ];
+
+    client->fb_opaque = fb_opaque;
+    client->fb_update = fb_update;
+    client->fb_rotate = fb_rotate;
+    client->fb_poll   = fb_poll;
+    client->fb_done   = fb_done;
 	//pras
 	//printf("pras debug: %s %s %ld\n", __FILE__, __FUNCTION__, __LINE__);
 }
@@ -213,6 +229,7 @@ void
 qframebuffer_rotate( QFrameBuffer*  qfbuff, int  rotation )
 {
     QFrameBufferExtra*  extra = qfbuff->extra;
+    int                 nn;
 
     if ((rotation ^ qfbuff->rotation) & 1) {
         /* swap width and height if new rotation requires it */
@@ -227,8 +244,11 @@ qframebuffer_rotate( QFrameBuffer*  qfbuff, int  rotation )
     }
     qfbuff->rotation = rotation;
 
-    if (extra->fb_rotate)
-        extra->fb_rotate( extra->fb_opaque, rotation );
+    for (nn = 0; nn < extra->num_clients; nn++) {
+        QFrameBufferClient*  client = &extra->clients[nn];
+        if (client->fb_rotate)
+            client->fb_rotate( client->fb_opaque, rotation );
+    }
 	//pras
 	//printf("pras debug: %s %s %ld\n", __FILE__, __FUNCTION__, __LINE__);
 }
@@ -237,9 +257,16 @@ void
 qframebuffer_poll( QFrameBuffer* qfbuff )
 {
     QFrameBufferExtra*  extra = qfbuff->extra;
+    int                 nn;
 
-    if (extra && extra->fb_poll)
-        extra->fb_poll( extra->fb_opaque );
+    if (extra == NULL)
+        return;
+
+    for (nn = 0; nn < extra->num_clients; nn++) {
+        QFrameBufferClient*  client = &extra->clients[nn];
+        if (client->fb_poll)
+            client->fb_poll( client->fb_opaque );
+    }
 	//pras
 	//printf("pras debug: %s %s %ld\n", __FILE__, __FUNCTION__, __LINE__);
 }
@@ -249,13 +276,17 @@ extern void
 qframebuffer_done( QFrameBuffer*   qfbuff )
 {
     QFrameBufferExtra*  extra = qfbuff->extra;
+    int                 nn;
 
     if (extra) {
         if (extra->pr_detach)
             extra->pr_detach( extra->pr_opaque );
 
-        if (extra->fb_done)
-            extra->fb_done( extra->fb_opaque );
+        for (nn = 0; nn < extra->num_clients; nn++) {
+            QFrameBufferClient*  client = &extra->clients[nn];
+            if (client->fb_done)
+                client->fb_done( client->fb_opaque );
+        }
     }
 
     free( qfbuff->pixels );
@@ -121,10 +121,14 @@ typedef void (*QFrameBufferPollFunc)( void* opaque );
  */
 typedef void (*QFrameBufferDoneFunc)  ( void*  opaque );
 
+/* maximum number of clients that can be attached to a single framebuffer */
+#define  QFRAMEBUFFER_MAX_CLIENTS  4
+
 /* add one client to a given framebuffer.
- * the current implementation only allows one client per frame-buffer,
- * but we could allow more for various reasons (e.g. displaying the
- * framebuffer + dispatching it through VNC at the same time)
+ * several clients can listen to the same framebuffer (e.g. the emulator
+ * window and the shared memory display of android/framebuffer-shm.h), each
+ * callback is invoked for every client in registration order. Clients
+ * beyond QFRAMEBUFFER_MAX_CLIENTS are ignored.
  */
 extern void
 qframebuffer_add_client( QFrameBuffer*           qfbuff,
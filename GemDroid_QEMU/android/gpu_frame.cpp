@@ -66,3 +66,17 @@ void gpu_frame_set_post_callback(
 	//pras
 	//printf("pras debug: %s %s %ld\n", __FILE__, __FUNCTION__, __LINE__);
 }
+
+int gpu_frame_get_stats(GpuFrameStats* stats) {
+    if (!sBridge) {
+        return -1;
+    }
+    GpuFrameBridge::Stats bridgeStats;
+    sBridge->getStats(&bridgeStats);
+    stats->posted_frames = bridgeStats.postedFrames;
+    stats->delivered_frames = bridgeStats.deliveredFrames;
+    stats->dropped_frames = bridgeStats.droppedFrames;
+    stats->last_latency_us = bridgeStats.lastLatencyUs;
+    stats->max_latency_us = bridgeStats.maxLatencyUs;
+    return 0;
+}
@@ -18,6 +18,8 @@
 #include "android/utils/compiler.h"
 #include "android/looper.h"
 
+#include <stdint.h>
+
 ANDROID_BEGIN_HEADER
 
 // Initialize state to ensure that new GPU frame data is passed to the caller
@@ -32,6 +34,19 @@ void gpu_frame_set_post_callback(
                          int height,
                          const void* pixels));
 
+// GPU frame delivery counters, see GpuFrameBridge::Stats.
+typedef struct {
+    uint32_t posted_frames;
+    uint32_t delivered_frames;
+    uint32_t dropped_frames;
+    uint32_t last_latency_us;
+    uint32_t max_latency_us;
+} GpuFrameStats;
+
+// Retrieve the current GPU frame delivery counters into |*stats|. Return 0
+// on success, or -1 if GPU frames are not being posted to the main loop.
+int gpu_frame_get_stats(GpuFrameStats* stats);
+
 ANDROID_END_HEADER
 
 #endif  // ANDROID_GPU_FRAME_H
@@ -1223,6 +1223,21 @@ help_onion_rotation(stralloc_t*  out)
     );
 }
 
+static void
+help_shm_display(stralloc_t*  out)
+{
+    PRINTF(
+    "  use '-shm-display <name>' to publish every frame of the emulated display\n"
+    "  into the POSIX shared memory object <name> (e.g. '/emulator-5554-fb').\n"
+    "  screenshot, video capture or test tools can then map it and read frames\n"
+    "  directly, without any scaling or encoding done by the emulator. This is\n"
+    "  typically used together with '-no-window'.\n\n"
+
+    "  see docs/ANDROID-FRAMEBUFFER.TXT for the memory layout and a sample reader.\n"
+    "  this option is not supported on Windows.\n\n"
+    );
+}
+
 
 static void
 help_timezone(stralloc_t*  out)
@@ -1380,6 +1395,21 @@ help_bootchart(stralloc_t  *out)
     );
 }
 
+static void
+help_startup_trace(stralloc_t  *out)
+{
+    PRINTF(
+    "  use '-startup-trace <file>' to record how long each step of the emulator's\n"
+    "  startup takes, before the emulation itself begins. independent steps,\n"
+    "  like probing the kernel image and scanning for GPU emulation libraries,\n"
+    "  run in parallel, and the trace shows how they overlap.\n\n"
+
+    "  <file> is written in the Chrome trace event format, and can be opened\n"
+    "  with chrome://tracing. the same timings are also printed with\n"
+    "  '-verbose' or '-debug-init'.\n\n"
+    );
+}
+
 static void
 help_tcpdump(stralloc_t  *out)
 {
@@ -27,6 +27,10 @@
 #include "android/looper.h"
 #include "hw/android/goldfish/pipe.h"
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 /* Implement the OpenGL fast-pipe */
 
 /* Set to 1 or 2 for debug traces */
@@ -473,6 +477,204 @@ static const GoldfishPipeFuncs  netPipeUnix_funcs = {
 };
 #endif
 
+#ifndef _WIN32
+/**********************************************************************
+ **********************************************************************
+ *****
+ *****  R E N D E R   C H A N N E L   P I P E S
+ *****
+ *****/
+
+/* A ChannelPipe connects an 'opengles' pipe to an in-process render
+ * channel instead of a socket, see android_openglesOpenChannel(). Guest
+ * buffers are copied straight into the channel's ring buffers, and the
+ * render thread only signals the channel's wake descriptor when the guest
+ * actually waits for it, so a busy pipe doesn't generate any wake-up.
+ */
+typedef struct {
+    void*   hwpipe;
+    void*   channel;
+    int     wakeWanted;
+    LoopIo  io[1];
+} ChannelPipe;
+
+/* GoldfishPipeBuffer and AndroidGlesChannelBuffer have the same layout,
+ * so buffers are passed to the channel as is. */
+typedef char channelPipe_buffer_size_check[
+        (sizeof(GoldfishPipeBuffer) == sizeof(AndroidGlesChannelBuffer)) ? 1 : -1];
+
+static void
+channelPipe_wakeOnChannel( ChannelPipe* pipe )
+{
+    unsigned  events = 0;
+
+    if ((pipe->wakeWanted & PIPE_WAKE_READ) != 0)
+        events |= ANDROID_GLES_CHANNEL_CAN_READ;
+    if ((pipe->wakeWanted & PIPE_WAKE_WRITE) != 0)
+        events |= ANDROID_GLES_CHANNEL_CAN_WRITE;
+
+    if (events != 0)
+        android_openglesChannelWakeOn(pipe->channel, events);
+}
+
+static void
+channelPipe_io_func( void* opaque, int fd, unsigned events )
+{
+    ChannelPipe*  pipe = opaque;
+    unsigned      state;
+    int           wakeFlags = 0;
+    uint64_t      value;
+
+    /* Drain the wake descriptor, whether it is an eventfd or a pipe */
+    for (;;) {
+        ssize_t  len = read(fd, &value, sizeof(value));
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break;
+    }
+
+    state = android_openglesChannelPoll(pipe->channel);
+
+    if ((state & ANDROID_GLES_CHANNEL_STOPPED) != 0 &&
+        (state & ANDROID_GLES_CHANNEL_CAN_READ) == 0) {
+        /* The render thread is gone and there is nothing left to read,
+         * tell our client by closing the channel. */
+        if (pipe->hwpipe != NULL) {
+            goldfish_pipe_close(pipe->hwpipe);
+            pipe->hwpipe = NULL;
+        }
+        loopIo_dontWantRead(pipe->io);
+        return;
+    }
+
+    if ((state & ANDROID_GLES_CHANNEL_CAN_READ) != 0)
+        wakeFlags |= pipe->wakeWanted & PIPE_WAKE_READ;
+    if ((state & ANDROID_GLES_CHANNEL_CAN_WRITE) != 0)
+        wakeFlags |= pipe->wakeWanted & PIPE_WAKE_WRITE;
+
+    if (wakeFlags != 0 && pipe->hwpipe != NULL) {
+        goldfish_pipe_wake(pipe->hwpipe, wakeFlags);
+        pipe->wakeWanted &= ~wakeFlags;
+    }
+
+    /* Re-arm the doorbell for whatever the guest still waits for */
+    channelPipe_wakeOnChannel(pipe);
+}
+
+static void*
+channelPipe_init( void* hwpipe, Looper* looper )
+{
+    ChannelPipe*  pipe;
+    int           wakeFd;
+    void*         channel = android_openglesOpenChannel(&wakeFd);
+
+    if (channel == NULL)
+        return NULL;
+
+    ANEW0(pipe);
+    pipe->hwpipe  = hwpipe;
+    pipe->channel = channel;
+    loopIo_init(pipe->io, looper, wakeFd, channelPipe_io_func, pipe);
+    loopIo_wantRead(pipe->io);
+    return pipe;
+}
+
+static void
+channelPipe_closeFromGuest( void* opaque )
+{
+    ChannelPipe*  pipe = opaque;
+
+    /* The wake descriptor belongs to the channel, don't close it here */
+    loopIo_done(pipe->io);
+    android_openglesCloseChannel(pipe->channel);
+    AFREE(pipe);
+}
+
+static int
+channelPipe_sendBuffers( void* opaque, const GoldfishPipeBuffer* buffers, int numBuffers )
+{
+    ChannelPipe*  pipe = opaque;
+    int  ret = android_openglesChannelSend(
+            pipe->channel, (const AndroidGlesChannelBuffer*)buffers, numBuffers);
+
+    if (ret < 0)
+        return PIPE_ERROR_IO;
+    if (ret == 0)
+        return PIPE_ERROR_AGAIN;
+    return ret;
+}
+
+static int
+channelPipe_recvBuffers( void* opaque, GoldfishPipeBuffer* buffers, int numBuffers )
+{
+    ChannelPipe*  pipe = opaque;
+    int  ret = android_openglesChannelRecv(
+            pipe->channel, (AndroidGlesChannelBuffer*)buffers, numBuffers);
+
+    if (ret < 0)
+        return PIPE_ERROR_IO;
+    if (ret == 0)
+        return PIPE_ERROR_AGAIN;
+    return ret;
+}
+
+static unsigned
+channelPipe_poll( void* opaque )
+{
+    ChannelPipe*  pipe  = opaque;
+    unsigned      state = android_openglesChannelPoll(pipe->channel);
+    unsigned      ret   = 0;
+
+    if (state & ANDROID_GLES_CHANNEL_CAN_READ)
+        ret |= PIPE_POLL_IN;
+    if (state & ANDROID_GLES_CHANNEL_CAN_WRITE)
+        ret |= PIPE_POLL_OUT;
+    if (state & ANDROID_GLES_CHANNEL_STOPPED)
+        ret |= PIPE_POLL_HUP;
+
+    return ret;
+}
+
+static void
+channelPipe_wakeOn( void* opaque, int flags )
+{
+    ChannelPipe*  pipe = opaque;
+
+    DD("%s: flags=%d", __FUNCTION__, flags);
+
+    pipe->wakeWanted |= flags;
+    channelPipe_wakeOnChannel(pipe);
+}
+
+static const GoldfishPipeFuncs  channelPipe_funcs = {
+    NULL,  /* created by openglesPipe_init() */
+    channelPipe_closeFromGuest,
+    channelPipe_sendBuffers,
+    channelPipe_recvBuffers,
+    channelPipe_poll,
+    channelPipe_wakeOn,
+    NULL,  /* we can't save these */
+    NULL,  /* we can't load these */
+};
+#endif /* !_WIN32 */
+
+/**********************************************************************
+ **********************************************************************
+ *****
+ *****  O P E N G L E S   P I P E S
+ *****
+ *****/
+
+/* An 'opengles' pipe is backed either by a render channel, or by a
+ * socket connection to the renderer as a fallback, so its callbacks
+ * simply forward to the implementation picked at creation time.
+ */
+typedef struct {
+    const GoldfishPipeFuncs*  funcs;
+    void*                     impl;
+} OpenglesPipe;
+
 /* This is set to 1 in android_init_opengles() below, and tested
  * by openglesPipe_init() to refuse a pipe connection if the function
  * was never called.
@@ -480,17 +682,10 @@ static const GoldfishPipeFuncs  netPipeUnix_funcs = {
 static int  _opengles_init;
 
 static void*
-openglesPipe_init( void* hwpipe, void* _looper, const char* args )
+openglesNetPipe_init( void* hwpipe, void* _looper )
 {
     NetPipe *pipe;
 
-    if (!_opengles_init) {
-        /* This should never happen, unless there is a bug in the
-         * emulator's initialization, or the system image. */
-        D("Trying to open the OpenGLES pipe without GPU emulation!");
-        return NULL;
-    }
-
     char server_addr[PATH_MAX];
     android_gles_server_path(server_addr, sizeof(server_addr));
 #ifndef _WIN32
@@ -526,13 +721,86 @@ openglesPipe_init( void* hwpipe, void* _looper, const char* args )
     return pipe;
 }
 
+static void*
+openglesPipe_init( void* hwpipe, void* _looper, const char* args )
+{
+    OpenglesPipe*  pipe;
+    void*          impl = NULL;
+    const GoldfishPipeFuncs*  funcs = NULL;
+
+    if (!_opengles_init) {
+        /* This should never happen, unless there is a bug in the
+         * emulator's initialization, or the system image. */
+        D("Trying to open the OpenGLES pipe without GPU emulation!");
+        return NULL;
+    }
+
+#ifndef _WIN32
+    if (android_gles_fast_pipes) {
+        impl = channelPipe_init(hwpipe, _looper);
+        if (impl != NULL) {
+            D("Creating render channel OpenGLES pipe for GPU emulation");
+            funcs = &channelPipe_funcs;
+        }
+    }
+#endif
+    if (impl == NULL) {
+        impl = openglesNetPipe_init(hwpipe, _looper);
+        if (impl == NULL)
+            return NULL;
+        funcs = &netPipeTcp_funcs;
+    }
+
+    ANEW0(pipe);
+    pipe->funcs = funcs;
+    pipe->impl  = impl;
+    return pipe;
+}
+
+static void
+openglesPipe_closeFromGuest( void* opaque )
+{
+    OpenglesPipe*  pipe = opaque;
+
+    pipe->funcs->close(pipe->impl);
+    AFREE(pipe);
+}
+
+static int
+openglesPipe_sendBuffers( void* opaque, const GoldfishPipeBuffer* buffers, int numBuffers )
+{
+    OpenglesPipe*  pipe = opaque;
+    return pipe->funcs->sendBuffers(pipe->impl, buffers, numBuffers);
+}
+
+static int
+openglesPipe_recvBuffers( void* opaque, GoldfishPipeBuffer* buffers, int numBuffers )
+{
+    OpenglesPipe*  pipe = opaque;
+    return pipe->funcs->recvBuffers(pipe->impl, buffers, numBuffers);
+}
+
+static unsigned
+openglesPipe_poll( void* opaque )
+{
+    OpenglesPipe*  pipe = opaque;
+    return pipe->funcs->poll(pipe->impl);
+}
+
+static void
+openglesPipe_wakeOn( void* opaque, int flags )
+{
+    OpenglesPipe*  pipe = opaque;
+    pipe->funcs->wakeOn(pipe->impl, flags);
+}
+
 static const GoldfishPipeFuncs  openglesPipe_funcs = {
     openglesPipe_init,
-    netPipe_closeFromGuest,
-    netPipe_sendBuffers,
-    netPipe_recvBuffers,
-    netPipe_poll,
-    netPipe_wakeOn,
+    openglesPipe_closeFromGuest,
+    openglesPipe_sendBuffers,
+    openglesPipe_recvBuffers,
+    openglesPipe_poll,
+    openglesPipe_wakeOn,
     NULL,  /* we can't save these */
     NULL,  /* we can't load these */
 };
@@ -11,6 +11,7 @@
 */
 #include "android/hw-qemud.h"
 #include "android/utils/debug.h"
+#include "android/utils/intmap.h"
 #include "android/utils/misc.h"
 #include "android/utils/system.h"
 #include "android/utils/bufprint.h"
@@ -46,7 +47,7 @@
 /* Version number of snapshots code. Increment whenever the data saved
  * or the layout in which it is saved is changed.
  */
-#define QEMUD_SAVE_VERSION 2
+#define QEMUD_SAVE_VERSION 3
 
 #ifndef min
 #define min(a, b) (((a) < (b)) ? (a) : (b))
@@ -187,6 +188,13 @@ qemud_sink_needed( QemudSink*  ss )
  * It parses the header to extract the channel id and payload length,
  * then the message itself.
  *
+ * Incoming bytes are appended to a single input buffer, where headers
+ * are parsed in place and complete payloads are passed to the receiver
+ * by reference, without any intermediate copy. Consumed bytes are only
+ * reclaimed by moving the pending partial frame back to the start of
+ * the buffer, which is large enough for two complete frames, so this
+ * happens at most once per frame.
+ *
  * Incoming messages are sent to a generic receiver identified by
  * the 'recv_opaque' and 'recv_func' parameters to qemud_serial_init()
  *
@@ -218,6 +226,12 @@ typedef enum {
 
 #define  BUFFER_SIZE    MAX_SERIAL_PAYLOAD
 
+/* size of the largest frame accepted from the serial port */
+#define  SERIAL_FRAME_MAX    (HEADER_SIZE + MAX_SERIAL_PAYLOAD)
+
+/* size of the serial input buffer */
+#define  SERIAL_BUFFER_SIZE  (2*SERIAL_FRAME_MAX)
+
 /* out of convenience, the incoming message is zero-terminated
  * and can be modified by the receiver (e.g. for tokenization).
  */
@@ -227,16 +241,17 @@ typedef struct QemudSerial {
     CharDriverState*  cs;  /* serial charpipe endpoint */
 
     /* managing incoming packets from the serial port */
-    ABool         need_header;
-    int           overflow;
-    int           in_size;
-    int           in_channel;
+    int           overflow;   /* payload bytes left to skip */
+    int           in_pos;     /* offset of the first unparsed byte */
+    int           in_count;   /* number of unparsed bytes */
 #if SUPPORT_LEGACY_QEMUD
     QemudVersion  version;
 #endif
-    QemudSink     header[1];
-    QemudSink     payload[1];
-    uint8_t       data0[MAX_SERIAL_PAYLOAD+1];
+    /* +1 for the terminating zero of a payload ending the buffer */
+    uint8_t       in_buf[SERIAL_BUFFER_SIZE+1];
+
+    /* serial clients, indexed by channel id */
+    AIntMap*      clients;
 
     /* receiver */
     QemudSerialReceive  recv_func;    /* receiver callback */
@@ -244,6 +259,62 @@ typedef struct QemudSerial {
 } QemudSerial;
 
 
+/* write the header of a 'size' bytes message for 'channel' into 'header'
+ */
+static void
+qemud_serial_format_header( QemudSerial*  s,
+                            uint8_t*      header,
+                            int           channel,
+                            int           size )
+{
+#if SUPPORT_LEGACY_QEMUD
+    if (s->version == QEMUD_VERSION_LEGACY) {
+        int2hex(header + LEGACY_LENGTH_OFFSET,  LENGTH_SIZE,  size);
+        int2hex(header + LEGACY_CHANNEL_OFFSET, CHANNEL_SIZE, channel);
+        return;
+    }
+#endif
+    int2hex(header + LENGTH_OFFSET,  LENGTH_SIZE,  size);
+    int2hex(header + CHANNEL_OFFSET, CHANNEL_SIZE, channel);
+}
+
+/* extract the channel id and payload size from an incoming 'header'.
+ * The first header received is also used to detect a legacy daemon.
+ */
+static void
+qemud_serial_parse_header( QemudSerial*    s,
+                           const uint8_t*  header,
+                           int*            pchannel,
+                           int*            psize )
+{
+#if SUPPORT_LEGACY_QEMUD
+    if (s->version == QEMUD_VERSION_UNKNOWN) {
+        /* if we receive "001200" as the first header, then we
+         * detected a legacy qemud daemon. See the comments
+         * in qemud_serial_send_legacy_probe() for details.
+         */
+        if ( !memcmp(header, "001200", 6) ) {
+            D("%s: legacy qemud detected.", __FUNCTION__);
+            s->version = QEMUD_VERSION_LEGACY;
+            /* tell the modem to use legacy emulation mode */
+            amodem_set_legacy(android_modem);
+        } else {
+            D("%s: normal qemud detected.", __FUNCTION__);
+            s->version = QEMUD_VERSION_NORMAL;
+        }
+    }
+
+    if (s->version == QEMUD_VERSION_LEGACY) {
+        *psize    = hex2int( header + LEGACY_LENGTH_OFFSET,  LENGTH_SIZE );
+        *pchannel = hex2int( header + LEGACY_CHANNEL_OFFSET, CHANNEL_SIZE );
+        return;
+    }
+#endif
+    *psize    = hex2int( header + LENGTH_OFFSET,  LENGTH_SIZE );
+    *pchannel = hex2int( header + CHANNEL_OFFSET, CHANNEL_SIZE );
+}
+
+
 /* Save the state of a QemudSerial to a snapshot file.
  */
 static void
@@ -255,37 +326,34 @@ qemud_serial_save(QEMUFile* f, QemudSerial* s)
      */
 
     /* state of incoming packets from the serial port */
-    qemu_put_be32(f, s->need_header);
     qemu_put_be32(f, s->overflow);
-    qemu_put_be32(f, s->in_size);
-    qemu_put_be32(f, s->in_channel);
 #if SUPPORT_LEGACY_QEMUD
     qemu_put_be32(f, s->version);
 #endif
-    qemud_sink_save(f, s->header);
-    qemud_sink_save(f, s->payload);
-    qemu_put_be32(f, MAX_SERIAL_PAYLOAD+1);
-    qemu_put_buffer(f, s->data0, MAX_SERIAL_PAYLOAD+1);
+    qemu_put_be32(f, s->in_count);
+    qemu_put_buffer(f, s->in_buf + s->in_pos, s->in_count);
 }
 
-/* Load the state of a QemudSerial from a snapshot file.
+/* Load the state of a QemudSerial from a version 2 snapshot file, which
+ * saved the partial header or payload being received with their sinks.
+ * The header of a partial payload is rebuilt, so that it can be parsed
+ * again from the input buffer.
  */
 static int
-qemud_serial_load(QEMUFile* f, QemudSerial* s)
+qemud_serial_load_v2(QEMUFile* f, QemudSerial* s)
 {
-    /* state of incoming packets from the serial port */
-    s->need_header = qemu_get_be32(f);
-    s->overflow    = qemu_get_be32(f);
-    s->in_size     = qemu_get_be32(f);
-    s->in_channel  = qemu_get_be32(f);
+    QemudSink  header[1], payload[1];
+    uint8_t*   data0 = s->in_buf + HEADER_SIZE;
+
+    int need_header = qemu_get_be32(f);
+    s->overflow     = qemu_get_be32(f);
+    int in_size     = qemu_get_be32(f);
+    int in_channel  = qemu_get_be32(f);
 #if SUPPORT_LEGACY_QEMUD
     s->version = qemu_get_be32(f);
 #endif
-    qemud_sink_load(f, s->header);
-    qemud_sink_load(f, s->payload);
-
-    /* s->header and s->payload are only ever connected to s->data0 */
-    s->header->buff = s->payload->buff = s->data0;
+    qemud_sink_load(f, header);
+    qemud_sink_load(f, payload);
 
     int len = qemu_get_be32(f);
     if (len - 1 > MAX_SERIAL_PAYLOAD) {
@@ -295,12 +363,57 @@ qemud_serial_load(QEMUFile* f, QemudSerial* s)
         return -EIO;
     }
     int ret;
-    if ((ret = qemu_get_buffer(f, s->data0, len)) != len) {
+    if ((ret = qemu_get_buffer(f, data0, len)) != len) {
         D("%s: failed to load serial buffer contents (tried reading %d bytes, got %d)\n",
           __FUNCTION__, len, ret);
         return -EIO;
     }
 
+    s->in_pos = 0;
+    if (need_header) {
+        if (header->used < 0 || header->used > HEADER_SIZE)
+            return -EIO;
+        memmove(s->in_buf, data0, header->used);
+        s->in_count = header->used;
+    } else {
+        if (in_size > MAX_SERIAL_PAYLOAD ||
+            payload->used < 0 || payload->used > in_size)
+            return -EIO;
+        qemud_serial_format_header(s, s->in_buf, in_channel, in_size);
+        s->in_count = HEADER_SIZE + payload->used;
+    }
+    return 0;
+}
+
+/* Load the state of a QemudSerial from a snapshot file.
+ */
+static int
+qemud_serial_load(QEMUFile* f, QemudSerial* s, int version)
+{
+    if (version < 3)
+        return qemud_serial_load_v2(f, s);
+
+    /* state of incoming packets from the serial port */
+    s->overflow = qemu_get_be32(f);
+#if SUPPORT_LEGACY_QEMUD
+    s->version = qemu_get_be32(f);
+#endif
+    int len = qemu_get_be32(f);
+    if (len < 0 || len > SERIAL_FRAME_MAX) {
+        D("%s: load failed: size of saved input (%d) exceeds "
+          "current maximum (%d)\n",
+          __FUNCTION__, len, SERIAL_FRAME_MAX);
+        return -EIO;
+    }
+    int ret;
+    if ((ret = qemu_get_buffer(f, s->in_buf, len)) != len) {
+        D("%s: failed to load serial buffer contents (tried reading %d bytes, got %d)\n",
+          __FUNCTION__, len, ret);
+        return -EIO;
+    }
+    s->in_pos   = 0;
+    s->in_count = len;
+
     return 0;
 }
 
@@ -312,16 +425,10 @@ qemud_serial_can_read( void*  opaque )
 {
     QemudSerial*  s = opaque;
 
-    if (s->overflow > 0) {
-        return s->overflow;
-    }
-
-    /* if in_size is 0, we're reading the header */
-    if (s->need_header)
-        return qemud_sink_needed(s->header);
-
-    /* otherwise, we're reading the payload */
-    return qemud_sink_needed(s->payload);
+    /* never zero, since the input buffer is compacted whenever the
+     * pending partial frame could not be completed at its end.
+     */
+    return SERIAL_BUFFER_SIZE - s->in_pos - s->in_count;
 }
 
 /* called by the charpipe to read data from the serial
@@ -335,87 +442,76 @@ qemud_serial_read( void*  opaque, const uint8_t*  from, int  len )
 
     T("%s: received %3d bytes: '%s'", __FUNCTION__, len, quote_bytes((const void*)from, len));
 
-    while (len > 0) {
-        int  avail;
+    memcpy(s->in_buf + s->in_pos + s->in_count, from, len);
+    s->in_count += len;
+
+    while (s->in_count > 0) {
+        uint8_t*  frame = s->in_buf + s->in_pos;
+        uint8_t*  msg;
+        uint8_t   saved;
+        int       channel, size;
 
         /* skip overflow bytes */
         if (s->overflow > 0) {
-            avail = s->overflow;
-            if (avail > len)
-                avail = len;
+            int  avail = min(s->overflow, s->in_count);
 
-            from += avail;
-            len  -= avail;
+            s->overflow -= avail;
+            s->in_pos   += avail;
+            s->in_count -= avail;
             continue;
         }
 
-        /* read header if needed */
-        if (s->need_header) {
-            if (!qemud_sink_fill(s->header, (const uint8_t**)&from, &len))
-                break;
-
-#if SUPPORT_LEGACY_QEMUD
-            if (s->version == QEMUD_VERSION_UNKNOWN) {
-                /* if we receive "001200" as the first header, then we
-                 * detected a legacy qemud daemon. See the comments
-                 * in qemud_serial_send_legacy_probe() for details.
-                 */
-                if ( !memcmp(s->data0, "001200", 6) ) {
-                    D("%s: legacy qemud detected.", __FUNCTION__);
-                    s->version = QEMUD_VERSION_LEGACY;
-                    /* tell the modem to use legacy emulation mode */
-                    amodem_set_legacy(android_modem);
-                } else {
-                    D("%s: normal qemud detected.", __FUNCTION__);
-                    s->version = QEMUD_VERSION_NORMAL;
-                }
-            }
-
-            if (s->version == QEMUD_VERSION_LEGACY) {
-                s->in_size     = hex2int( s->data0 + LEGACY_LENGTH_OFFSET,  LENGTH_SIZE );
-                s->in_channel  = hex2int( s->data0 + LEGACY_CHANNEL_OFFSET, CHANNEL_SIZE );
-            } else {
-                s->in_size     = hex2int( s->data0 + LENGTH_OFFSET,  LENGTH_SIZE );
-                s->in_channel  = hex2int( s->data0 + CHANNEL_OFFSET, CHANNEL_SIZE );
-            }
-#else
-            /* extract payload length + channel id */
-            s->in_size     = hex2int( s->data0 + LENGTH_OFFSET,  LENGTH_SIZE );
-            s->in_channel  = hex2int( s->data0 + CHANNEL_OFFSET, CHANNEL_SIZE );
-#endif
-            s->header->used = 0;
+        /* wait for a complete header */
+        if (s->in_count < HEADER_SIZE)
+            break;
 
-            if (s->in_size <= 0 || s->in_channel < 0) {
-                D("%s: bad header: '%.*s'", __FUNCTION__, HEADER_SIZE, s->data0);
-                continue;
-            }
+        qemud_serial_parse_header(s, frame, &channel, &size);
 
-            if (s->in_size > MAX_SERIAL_PAYLOAD) {
-                D("%s: ignoring huge serial packet: length=%d channel=%1",
-                  __FUNCTION__, s->in_size, s->in_channel);
-                s->overflow = s->in_size;
-                continue;
-            }
+        if (size <= 0 || channel < 0) {
+            D("%s: bad header: '%.*s'", __FUNCTION__, HEADER_SIZE, frame);
+            s->in_pos   += HEADER_SIZE;
+            s->in_count -= HEADER_SIZE;
+            continue;
+        }
 
-            /* prepare 'in_data' for payload */
-            s->need_header = 0;
-            qemud_sink_reset(s->payload, s->in_size, s->data0);
+        if (size > MAX_SERIAL_PAYLOAD) {
+            D("%s: ignoring huge serial packet: length=%d channel=%d",
+              __FUNCTION__, size, channel);
+            s->in_pos   += HEADER_SIZE;
+            s->in_count -= HEADER_SIZE;
+            s->overflow  = size;
+            continue;
         }
 
-        /* read payload bytes */
-        if (!qemud_sink_fill(s->payload, &from, &len))
+        /* wait for the complete payload */
+        if (s->in_count < HEADER_SIZE + size)
             break;
 
-        /* zero-terminate payload, then send it to receiver */
-        s->payload->buff[s->payload->size] = 0;
+        s->in_pos   += HEADER_SIZE + size;
+        s->in_count -= HEADER_SIZE + size;
+
+        /* zero-terminate payload in place, then send it to receiver.
+         * The byte after the payload may be the start of the next header.
+         */
+        msg        = frame + HEADER_SIZE;
+        saved      = msg[size];
+        msg[size]  = 0;
         D("%s: channel=%2d len=%3d '%s'", __FUNCTION__,
-          s->in_channel, s->payload->size,
-          quote_bytes((const void*)s->payload->buff, s->payload->size));
+          channel, size, quote_bytes((const void*)msg, size));
 
-        s->recv_func( s->recv_opaque, s->in_channel, s->payload->buff, s->payload->size );
+        s->recv_func( s->recv_opaque, channel, msg, size );
+
+        msg[size] = saved;
+    }
 
-        /* prepare for new header */
-        s->need_header = 1;
+    /* move the pending partial frame to the start of the buffer
+     * when it could not be completed at its current position.
+     */
+    if (s->in_count == 0) {
+        s->in_pos = 0;
+    } else if (s->in_pos > SERIAL_BUFFER_SIZE - SERIAL_FRAME_MAX) {
+        memmove(s->in_buf, s->in_buf + s->in_pos, s->in_count);
+        s->in_pos = 0;
     }
 }
 
@@ -493,12 +589,10 @@ qemud_serial_init( QemudSerial*        s,
     s->cs           = cs;
     s->recv_func    = recv_func;
     s->recv_opaque  = recv_opaque;
-    s->need_header  = 1;
     s->overflow     = 0;
-
-    qemud_sink_reset( s->header, HEADER_SIZE, s->data0 );
-    s->in_size      = 0;
-    s->in_channel   = -1;
+    s->in_pos       = 0;
+    s->in_count     = 0;
+    s->clients      = aintMap_new();
 
 #if SUPPORT_LEGACY_QEMUD
     s->version = QEMUD_VERSION_UNKNOWN;
@@ -545,18 +639,7 @@ qemud_serial_send( QemudSerial*    s,
             avail = MAX_SERIAL_PAYLOAD;
 
         /* write this packet's header */
-#if SUPPORT_LEGACY_QEMUD
-        if (s->version == QEMUD_VERSION_LEGACY) {
-            int2hex(header + LEGACY_LENGTH_OFFSET,  LENGTH_SIZE,  avail);
-            int2hex(header + LEGACY_CHANNEL_OFFSET, CHANNEL_SIZE, channel);
-        } else {
-            int2hex(header + LENGTH_OFFSET,  LENGTH_SIZE,  avail);
-            int2hex(header + CHANNEL_OFFSET, CHANNEL_SIZE, channel);
-        }
-#else
-        int2hex(header + LENGTH_OFFSET,  LENGTH_SIZE,  avail);
-        int2hex(header + CHANNEL_OFFSET, CHANNEL_SIZE, channel);
-#endif
+        qemud_serial_format_header(s, header, channel, avail);
         T("%s: '%.*s'", __FUNCTION__, HEADER_SIZE, header);
         qemu_chr_write(s->cs, header, HEADER_SIZE);
 
@@ -648,6 +731,7 @@ struct QemudClient {
     char*             param;
     void*             clie_opaque;
     QemudClientRecv   clie_recv;
+    QemudClientRecvBuffers  clie_recv_buffers;
     QemudClientClose  clie_close;
     QemudClientSave   clie_save;
     QemudClientLoad   clie_load;
@@ -711,6 +795,17 @@ qemud_client_prepend( QemudClient*  c, QemudClient** plist )
         c->next->pref = &c->next;
 }
 
+/* remove a serial QemudClient from its serial port's channel index */
+static void
+qemud_serial_client_unbind( QemudClient*  c )
+{
+    QemudSerial*  serial  = c->ProtocolSelector.Serial.serial;
+    int           channel = c->ProtocolSelector.Serial.channel;
+
+    if (channel >= 0 && aintMap_get(serial->clients, channel) == c)
+        aintMap_del(serial->clients, channel);
+}
+
 /* receive a new message from a client, and dispatch it to
  * the real service implementation.
  */
@@ -858,6 +953,8 @@ qemud_client_disconnect( void*  opaque, int guest_close )
 
     /* remove from current list */
     qemud_client_remove(c);
+    if (!_is_pipe_client(c))
+        qemud_serial_client_unbind(c);
 
     if (_is_pipe_client(c)) {
         /* We must NULL the client reference in the QemuPipe for this connection,
@@ -878,6 +975,7 @@ qemud_client_disconnect( void*  opaque, int guest_close )
         c->clie_close = NULL;
     }
     c->clie_recv = NULL;
+    c->clie_recv_buffers = NULL;
 
     /* remove from service list, if any */
     if (c->service) {
@@ -917,6 +1015,7 @@ qemud_client_alloc( int               channel_id,
         c->protocol = QEMUD_PROTOCOL_SERIAL;
         c->ProtocolSelector.Serial.serial   = serial;
         c->ProtocolSelector.Serial.channel  = channel_id;
+        aintMap_set(serial->clients, channel_id, c);
     }
     c->param       = client_param ? ASTRDUP(client_param) : NULL;
     c->clie_opaque = clie_opaque;
@@ -1305,17 +1404,15 @@ qemud_multiplexer_serial_recv( void*     opaque,
                                int       msglen )
 {
     QemudMultiplexer*  m = opaque;
-    QemudClient*       c = m->clients;
+    QemudClient*       c = aintMap_get(m->serial->clients, channel);
 
     /* dispatch to an existing client if possible
      * note that channel 0 is handled by a special
      * QemudClient that is setup in qemud_multiplexer_init()
      */
-    for ( ; c != NULL; c = c->next ) {
-        if (!_is_pipe_client(c) && c->ProtocolSelector.Serial.channel == channel) {
-            qemud_client_recv(c, msg, msglen);
-            return;
-        }
+    if (c != NULL) {
+        qemud_client_recv(c, msg, msglen);
+        return;
     }
 
     D("%s: ignoring %d bytes for unknown channel %d",
@@ -1358,20 +1455,19 @@ static void
 qemud_multiplexer_disconnect( QemudMultiplexer*  m,
                               int                channel )
 {
-    QemudClient*  c;
-
     /* find the client by its channel id, then disconnect it */
-    for (c = m->clients; c; c = c->next) {
-        if (!_is_pipe_client(c) && c->ProtocolSelector.Serial.channel == channel) {
-            D("%s: disconnecting client %d",
-              __FUNCTION__, channel);
-            /* note thatt this removes the client from
-             * m->clients automatically.
-             */
-            c->ProtocolSelector.Serial.channel = -1; /* no need to send disconnect:<id> */
-            qemud_client_disconnect(c, 0);
-            return;
-        }
+    QemudClient*  c = aintMap_get(m->serial->clients, channel);
+
+    if (c != NULL) {
+        D("%s: disconnecting client %d",
+          __FUNCTION__, channel);
+        /* note thatt this removes the client from
+         * m->clients automatically.
+         */
+        qemud_serial_client_unbind(c);
+        c->ProtocolSelector.Serial.channel = -1; /* no need to send disconnect:<id> */
+        qemud_client_disconnect(c, 0);
+        return;
     }
     D("%s: disconnecting unknown channel %d",
       __FUNCTION__, channel);
@@ -1398,6 +1494,7 @@ qemud_multiplexer_disconnect_noncontrol( QemudMultiplexer*  m )
               __FUNCTION__, c->ProtocolSelector.Serial.channel);
             D("%s: disconnecting client %d\n",
               __FUNCTION__, c->ProtocolSelector.Serial.channel);
+            qemud_serial_client_unbind(c);
             c->ProtocolSelector.Serial.channel = -1; /* do not send disconnect:<id> */
             qemud_client_disconnect(c, 0);
         }
@@ -1603,23 +1700,27 @@ qemud_client_new( QemudService*     service,
     return c;
 }
 
-/* Caches a service message into the client's descriptor.
+/* Caches a service message into the client's descriptor, after an
+ * optional 'header' of 'header_len' bytes.
  *
  * See comments on QemudPipeMessage structure for more info.
  */
 static void
-_qemud_pipe_cache_buffer(QemudClient* client, const uint8_t*  msg, int  msglen)
+_qemud_pipe_cache_buffer(QemudClient* client,
+                         const uint8_t*  header, int  header_len,
+                         const uint8_t*  msg, int  msglen)
 {
     QemudPipeMessage* buf;
     QemudPipeMessage** ins_at = &client->ProtocolSelector.Pipe.messages;
 
     /* Allocate descriptor big enough to contain message as well. */
-    buf = (QemudPipeMessage*)malloc(msglen + sizeof(QemudPipeMessage));
+    buf = (QemudPipeMessage*)malloc(header_len + msglen + sizeof(QemudPipeMessage));
     if (buf != NULL) {
         /* Message starts right after the descriptor. */
         buf->message = (uint8_t*)buf + sizeof(QemudPipeMessage);
-        buf->size = msglen;
-        memcpy(buf->message, msg, msglen);
+        buf->size = header_len + msglen;
+        memcpy(buf->message, header, header_len);
+        memcpy(buf->message + header_len, msg, msglen);
         buf->offset = 0;
         buf->next = NULL;
         while (*ins_at != NULL) {
@@ -1633,13 +1734,14 @@ _qemud_pipe_cache_buffer(QemudClient* client, const uint8_t*  msg, int  msglen)
 }
 
 /* Sends service message to the client.
+ * Unlike the serial port, pipes have no MTU, so the message and its frame
+ * header are queued as a single buffer that the guest can read at once.
  */
 static void
 _qemud_pipe_send(QemudClient*  client, const uint8_t*  msg, int  msglen)
 {
     uint8_t   frame[FRAME_HEADER_SIZE];
-    int       avail, len = msglen;
-    int framing = client->framing;
+    int       frame_len = 0;
 
     if (msglen <= 0)
         return;
@@ -1647,33 +1749,16 @@ _qemud_pipe_send(QemudClient*  client, const uint8_t*  msg, int  msglen)
     D("%s: len=%3d '%s'",
       __FUNCTION__, msglen, quote_bytes((const void*)msg, msglen));
 
-    if (framing) {
-        len += FRAME_HEADER_SIZE;
+    /* insert frame header when needed */
+    if (client->framing) {
+        int2hex(frame, FRAME_HEADER_SIZE, msglen);
+        T("%s: '%.*s'", __FUNCTION__, FRAME_HEADER_SIZE, frame);
+        frame_len = FRAME_HEADER_SIZE;
     }
 
-    /* packetize the payload for the serial MTU */
-    while (len > 0)
-    {
-        avail = len;
-        if (avail > MAX_SERIAL_PAYLOAD)
-            avail = MAX_SERIAL_PAYLOAD;
-
-        /* insert frame header when needed */
-        if (framing) {
-            int2hex(frame, FRAME_HEADER_SIZE, msglen);
-            T("%s: '%.*s'", __FUNCTION__, FRAME_HEADER_SIZE, frame);
-            _qemud_pipe_cache_buffer(client, frame, FRAME_HEADER_SIZE);
-            avail  -= FRAME_HEADER_SIZE;
-            len    -= FRAME_HEADER_SIZE;
-            framing = 0;
-        }
-
-        /* write message content */
-        T("%s: '%.*s'", __FUNCTION__, avail, msg);
-        _qemud_pipe_cache_buffer(client, msg, avail);
-        msg += avail;
-        len -= avail;
-    }
+    /* write message content */
+    T("%s: '%.*s'", __FUNCTION__, msglen, msg);
+    _qemud_pipe_cache_buffer(client, frame, frame_len, msg, msglen);
 }
 
 /* this can be used by a service implementation to send an answer
@@ -1691,6 +1776,22 @@ qemud_client_send ( QemudClient*  client, const uint8_t*  msg, int  msglen )
     }
 }
 
+void
+qemud_client_set_recv_buffers( QemudClient*  client, QemudClientRecvBuffers  recv_buffers )
+{
+    client->clie_recv_buffers = recv_buffers;
+}
+
+void
+qemud_client_wake_writer( QemudClient*  client )
+{
+    if (_is_pipe_client(client) &&
+        client->ProtocolSelector.Pipe.qemud_pipe != NULL) {
+        goldfish_pipe_wake(client->ProtocolSelector.Pipe.qemud_pipe->hwpipe,
+                           PIPE_WAKE_WRITE);
+    }
+}
+
 /* enable framing for this client. When TRUE, this will
  * use internally a simple 4-hexchar header before each
  * message exchanged through the serial port.
@@ -1835,7 +1936,7 @@ qemud_load(QEMUFile *f, void* opaque, int version)
 
     int ret;
 
-    if ((ret = qemud_serial_load(f, m->serial)))
+    if ((ret = qemud_serial_load(f, m->serial, version)))
         return ret;
     if ((ret = qemud_load_services(f, m->services)))
         return ret;
@@ -1969,6 +2070,10 @@ _qemudPipe_closeFromGuest( void* opaque )
     }
 }
 
+/* Maximum number of guest buffers passed to a QemudClientRecvBuffers at once.
+ */
+#define  QEMUD_PIPE_MAX_BUFFERS  32
+
 /* Called when the guest has sent some data to the client.
  */
 static int
@@ -1985,6 +2090,33 @@ _qemudPipe_sendBuffers(void* opaque,
         return -1;
     }
 
+    if (client->clie_recv_buffers != NULL && !client->framing) {
+        /* Hand the guest buffers to the service without copying them. */
+        struct iovec iov[QEMUD_PIPE_MAX_BUFFERS];
+        int n, ret;
+        if (numBuffers > QEMUD_PIPE_MAX_BUFFERS) {
+            /* The guest will send the rest again. */
+            numBuffers = QEMUD_PIPE_MAX_BUFFERS;
+        }
+        for (n = 0; n < numBuffers; n++) {
+            iov[n].iov_base = buffers[n].data;
+            iov[n].iov_len  = buffers[n].size;
+            transferred += buffers[n].size;
+        }
+        if (transferred == 0) {
+            return 0;
+        }
+        ret = client->clie_recv_buffers(client->clie_opaque, iov, numBuffers,
+                                        client);
+        if (ret < 0) {
+            return PIPE_ERROR_IO;
+        }
+        if (ret == 0) {
+            return PIPE_ERROR_AGAIN;
+        }
+        return ret;
+    }
+
     if (numBuffers == 1) {
         /* Simple case: all data are in one buffer. */
         D("%s: %s", __FUNCTION__, quote_bytes((char*)buffers->data, buffers->size));
@@ -72,6 +72,16 @@ typedef void (*QemudClientClose)( void*  opaque );
  */
 typedef void (*QemudClientRecv) ( void*  opaque, uint8_t*  msg, int  msglen, QemudClient*  client );
 
+/* A function that can be called instead of QemudClientRecv when a pipe
+ * client sends data to the service (see qemud_client_set_recv_buffers()).
+ * 'iov' describes 'iovcnt' buffers in guest memory, which are only valid
+ * during the call. Returns the number of bytes consumed, which can be less
+ * than the total, or 0 to make the guest wait until the service calls
+ * qemud_client_wake_writer(), or -1 on error.
+ */
+struct iovec;
+typedef int (*QemudClientRecvBuffers)( void*  opaque, const struct iovec*  iov, int  iovcnt, QemudClient*  client );
+
 /* A function that will be called when the state of the client should be
  * saved to a snapshot.
  */
@@ -102,6 +112,17 @@ extern QemudClient*  qemud_client_new( QemudService*      service,
  */
 extern void           qemud_client_set_framing( QemudClient*  client, int  enabled );
 
+/* Receive the data of a pipe client directly from the guest's buffers,
+ * instead of through the client's QemudClientRecv, as long as framing is
+ * disabled. This is ignored for serial clients.
+ */
+extern void           qemud_client_set_recv_buffers( QemudClient*  client, QemudClientRecvBuffers  recv_buffers );
+
+/* Tell a pipe client that was told to wait by its QemudClientRecvBuffers
+ * that the service can consume data again. Does nothing for serial clients.
+ */
+extern void           qemud_client_wake_writer( QemudClient*  client );
+
 /* Send a message to a given qemud client
  */
 extern void   qemud_client_send ( QemudClient*  client, const uint8_t*  msg, int  msglen );
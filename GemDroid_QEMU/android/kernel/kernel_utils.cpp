@@ -16,6 +16,7 @@
 #include "android/kernel/kernel_utils_testing.h"
 #include "android/utils/file_data.h"
 #include "android/utils/path.h"
+#include "android/utils/startup_cache.h"
 #include "android/utils/string.h"
 #include "android/utils/uncompress.h"
 
@@ -205,6 +206,23 @@ bool android_imageProbeKernelVersionString(const uint8_t* kernelFileData,
 bool android_pathProbeKernelVersionString(const char* kernelPath,
                                           char* dst/*[dstLen]*/,
                                           size_t dstLen) {
+    static const char kCacheKind[] = "kernel-version";
+
+    // The version string is cached with its terminating zero.
+    char* cached = NULL;
+    size_t cachedSize = 0;
+    if (android_startupCache_get(kernelPath, kCacheKind,
+                                 &cached, &cachedSize)) {
+        bool valid = cachedSize > 0 && cached[cachedSize - 1] == '\0';
+        if (valid) {
+            strlcpy(dst, cached, dstLen);
+        }
+        free(cached);
+        if (valid) {
+            return true;
+        }
+    }
+
     FileData kernelFileData;
 	//pras
 	//printf("pras debug: %s %s %ld\n", __FILE__, __FUNCTION__, __LINE__);
@@ -213,8 +231,19 @@ bool android_pathProbeKernelVersionString(const char* kernelPath,
         return false;
     }
 
-    return android_imageProbeKernelVersionString(kernelFileData.data,
-                                                 kernelFileData.size,
-                                                 dst,
-                                                 dstLen);
+    // Probe into a buffer large enough for any version string, so that
+    // the cached value doesn't depend on |dstLen|.
+    char version[1024];
+    bool result = android_imageProbeKernelVersionString(kernelFileData.data,
+                                                        kernelFileData.size,
+                                                        version,
+                                                        sizeof(version));
+    fileData_done(&kernelFileData);
+    if (!result) {
+        return false;
+    }
+    android_startupCache_put(kernelPath, kCacheKind,
+                             version, strlen(version) + 1U);
+    strlcpy(dst, version, dstLen);
+    return true;
 }
@@ -14,6 +14,7 @@
 #include "android/display.h"
 #include "android/emulator-window.h"
 #include "android/framebuffer.h"
+#include "android/framebuffer-shm.h"
 #include "android/globals.h"
 #include "android/main-common.h"
 #include "android/resource.h"
@@ -32,7 +33,9 @@
 
 #include "ui/console.h"
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define  D(...)  do {  if (VERBOSE_CHECK(init)) dprint(__VA_ARGS__); } while (0)
 
@@ -661,6 +664,18 @@ init_sdl_ui(AConfig*         skinConfig,
         exit(1);
     }
 
+    /* publish the display to a shared memory object if needed */
+    if (opts->shm_display) {
+        QFrameBuffer*  qfbuff = emulator_window_get_first_framebuffer(emulator_window_get());
+
+        if (qfbuff == NULL ||
+            qframebuffer_shm_add_client(qfbuff, opts->shm_display) < 0) {
+            fprintf(stderr, "### Error: could not publish display to shared memory '%s': %s\n",
+                    opts->shm_display, qfbuff ? strerror(errno) : "no display");
+            exit(1);
+        }
+    }
+
     /* add an onion overlay image if needed */
     if (opts->onion) {
         SkinImage*  onion = skin_image_find_simple( opts->onion );
@@ -17,6 +17,7 @@
 #include "android/utils/eintr_wrapper.h"
 #include "android/utils/path.h"
 #include "android/utils/dirscanner.h"
+#include "android/utils/startup_tasks.h"
 #include "android/utils/x86_cpuid.h"
 #include "android/cpu_accelerator.h"
 #include "android/main-common.h"
@@ -470,10 +471,29 @@ AvdInfo* createAVD(AndroidOptions* opts, int* inAndroidBuild)
     return ret;
 }
 
+/* State of the kernel version probe, which can take a while for compressed
+ * kernel images, so runs in a startup task while the partitions are being
+ * configured. */
+typedef struct {
+    const char* kernelPath;
+    int found;
+    char versionString[256];
+} KernelVersionProbe;
+
+static void probeKernelVersion(void* opaque) {
+    KernelVersionProbe* probe = opaque;
+    probe->found = android_pathProbeKernelVersionString(
+            probe->kernelPath,
+            probe->versionString,
+            sizeof(probe->versionString));
+}
+
 void handleCommonEmulatorOptions(AndroidOptions* opts,
                                  AndroidHwConfig* hw,
                                  AvdInfo* avd) {
     int forceArmv7 = 0;
+    KernelVersionProbe kernelProbe;
+    AndroidStartupTask kernelProbeTask;
 
     // Kernel options
     {
@@ -503,6 +523,11 @@ void handleCommonEmulatorOptions(AndroidOptions* opts,
 
         hw->kernel_path = kernelFile;
 
+        kernelProbe.kernelPath = kernelFile;
+        kernelProbeTask = android_startup_addTask("kernel-version",
+                                                  probeKernelVersion,
+                                                  &kernelProbe, NULL, 0);
+
         /* If the kernel image name ends in "-armv7", then change the cpu
          * type automatically. This is a poor man's approach to configuration
          * management, but should allow us to get past building ARMv7
@@ -542,34 +567,6 @@ void handleCommonEmulatorOptions(AndroidOptions* opts,
         D("Auto-config: -qemu -cpu %s", hw->hw_cpu_model);
     }
 
-    char versionString[256];
-    if (!android_pathProbeKernelVersionString(hw->kernel_path,
-                                              versionString,
-                                              sizeof(versionString))) {
-        derror("Can't find 'Linux version ' string in kernel image file: %s",
-               hw->kernel_path);
-        exit(2);
-    }
-
-    KernelVersion kernelVersion = 0;
-    if (!android_parseLinuxVersionString(versionString, &kernelVersion)) {
-        derror("Can't parse 'Linux version ' string in kernel image file: '%s'",
-               versionString);
-        exit(2);
-    }
-
-    // Auto-detect kernel device naming scheme if needed.
-    if (androidHwConfig_getKernelDeviceNaming(hw) < 0) {
-        const char* newDeviceNaming = "no";
-        if (kernelVersion >= KERNEL_VERSION_3_10_0) {
-            D("Auto-detect: Kernel image requires new device naming scheme.");
-            newDeviceNaming = "yes";
-        } else {
-            D("Auto-detect: Kernel image requires legacy device naming scheme.");
-        }
-        reassign_string(&hw->kernel_newDeviceNaming, newDeviceNaming);
-    }
-
     // Auto-detect YAFFS2 partition support if needed.
     if (androidHwConfig_getKernelYaffs2Support(hw) < 0) {
         // Essentially, anything before API level 20 supports Yaffs2
@@ -943,6 +940,33 @@ void handleCommonEmulatorOptions(AndroidOptions* opts,
     }
 
     D("Physical RAM size: %dMB\n", hw->hw_ramSize);
+
+    android_startup_waitTask(kernelProbeTask);
+    if (!kernelProbe.found) {
+        derror("Can't find 'Linux version ' string in kernel image file: %s",
+               hw->kernel_path);
+        exit(2);
+    }
+
+    KernelVersion kernelVersion = 0;
+    if (!android_parseLinuxVersionString(kernelProbe.versionString,
+                                         &kernelVersion)) {
+        derror("Can't parse 'Linux version ' string in kernel image file: '%s'",
+               kernelProbe.versionString);
+        exit(2);
+    }
+
+    // Auto-detect kernel device naming scheme if needed.
+    if (androidHwConfig_getKernelDeviceNaming(hw) < 0) {
+        const char* newDeviceNaming = "no";
+        if (kernelVersion >= KERNEL_VERSION_3_10_0) {
+            D("Auto-detect: Kernel image requires new device naming scheme.");
+            newDeviceNaming = "yes";
+        } else {
+            D("Auto-detect: Kernel image requires legacy device naming scheme.");
+        }
+        reassign_string(&hw->kernel_newDeviceNaming, newDeviceNaming);
+    }
 }
 
 bool handleCpuAcceleration(AndroidOptions* opts, AvdInfo* avd,
@@ -39,6 +39,7 @@
 #include "math.h"
 
 #include "android/config/config.h"
+#include "android/cpu_accelerator.h"
 
 #include "android/kernel/kernel_utils.h"
 #include "android/skin/charmap.h"
@@ -51,6 +52,8 @@
 #include "android/utils/lineinput.h"
 #include "android/utils/path.h"
 #include "android/utils/property_file.h"
+#include "android/utils/startup_cache.h"
+#include "android/utils/startup_tasks.h"
 #include "android/utils/tempfile.h"
 
 #include "android/main-common.h"
@@ -149,6 +152,14 @@ _findQemuInformationalOption( int qemu_argc, char** qemu_argv )
     return NULL;
 }
 
+#if defined(TARGET_I386) || defined(TARGET_X86_64)
+/* The result is cached, and reused by handleCpuAcceleration(). */
+static void probeCpuAcceleration(void* opaque) {
+    (void)opaque;
+    android_hasCpuAcceleration(NULL);
+}
+#endif
+
 void enter_qemu_main_loop(int argc, char **argv) {
 #ifndef _WIN32
     sigset_t set;
@@ -203,6 +214,10 @@ int main(int argc, char **argv) {
     socket_init();
 #endif
 
+    /* Reuse the kernel version and ramdisk files probed by previous
+     * launches with the same images. */
+    android_startupCache_init();
+
     while (argc-- > 1) {
         opt = (++argv)[0];
 
@@ -315,6 +330,27 @@ int main(int argc, char **argv) {
         return 0;
     }
 
+    /* Run the independent startup steps below in parallel, and trace how
+     * long each of them takes.
+     *
+     * Only the launcher's steps are covered. Partition type probing, the
+     * ext4 resize, the userdata copy and the snapshot config check are done
+     * by the core in vl-android.c and the NAND device, after the workers
+     * are stopped, and each of them needs the result of the previous one.
+     * Skin images are decoded by the UI thread, through an image cache that
+     * isn't thread-safe. */
+    android_startup_init(opts->startup_trace);
+    android_startup_phase("avd");
+
+    /* Scanning the GPU emulation libraries and probing the host's CPU
+     * accelerator don't depend on the AVD, so start them right away. */
+    emuglConfig_prefetchBackends(0);
+#if defined(TARGET_I386) || defined(TARGET_X86_64)
+    AndroidStartupTask accelTask =
+            android_startup_addTask("cpu-acceleration", probeCpuAcceleration,
+                                    NULL, NULL, 0);
+#endif
+
     sanitizeOptions(opts);
 
     /* Initialization of UI started with -attach-core should work differently
@@ -353,6 +389,8 @@ int main(int argc, char **argv) {
         opts->skindir = skinDir;
         D("autoconfig: -skindir %s", opts->skindir);
     }
+    android_startup_phase("hw-config");
+
     /* update the avd hw config from this new skin */
     avdInfo_getSkinHardwareIni(avd, opts->skin, opts->skindir);
 
@@ -407,6 +445,7 @@ int main(int argc, char **argv) {
     }
 
 
+    android_startup_phase("skin");
     user_config_init();
     parse_skin_files(opts->skindir, opts->skin, opts, hw,
                      &skinConfig, &skinPath);
@@ -453,8 +492,10 @@ int main(int argc, char **argv) {
 #endif
     }
 
+    android_startup_phase("common-options");
     handleCommonEmulatorOptions(opts, hw, avd);
 
+    android_startup_phase("qemu-options");
     n = 1;
 
     if (boot_prop_ip[0]) {
@@ -786,6 +827,7 @@ int main(int argc, char **argv) {
         reassign_string(&hw->hw_keyboard_charmap, charmap_name);
     }
 
+    android_startup_phase("gpu-config");
     {
         EmuglConfig config;
 
@@ -866,6 +908,9 @@ int main(int argc, char **argv) {
     }
 
 #if defined(TARGET_I386) || defined(TARGET_X86_64)
+    android_startup_phase("cpu-acceleration");
+    android_startup_waitTask(accelTask);
+
     char* accel_status = NULL;
     CpuAccelMode accel_mode = ACCEL_AUTO;
     bool accel_ok = handleCpuAcceleration(opts, avd, &accel_mode, accel_status);
@@ -919,6 +964,7 @@ int main(int argc, char **argv) {
      * The new file will group all definitions and will be used to
      * launch the core with the -android-hw <file> option.
      */
+    android_startup_phase("hardware-ini");
     {
         const char* coreHwIniPath = avdInfo_getCoreHwIniPath(avd);
         IniFile*    hwIni         = iniFile_newFromMemory("", NULL);
@@ -984,6 +1030,10 @@ int main(int argc, char **argv) {
         printf("\n");
     }
 
+    /* Stop the startup worker threads before the UI and core threads are
+     * started, and report the startup timings. */
+    android_startup_finish();
+
     /* Setup SDL UI just before calling the code */
 #if defined(CONFIG_SDL)
     init_sdl_ui(skinConfig, skinPath, opts);
@@ -373,6 +373,9 @@ mts_port_create(void* opaque)
      * transmitted to the device. */
     mtsp->jpeg_compressor =
         jpeg_compressor_create(sdkctl_message_get_header_size() + sizeof(MTFrameHeader), 4096);
+    /* Full screen updates are large enough to be worth compressing in
+     * parallel strips, one per CPU. */
+    jpeg_compressor_set_workers(mtsp->jpeg_compressor, 0);
 
     mtsp->sdkctl = sdkctl_socket_new(SDKCTL_MT_TIMEOUT, "multi-touch",
                                      _on_multitouch_socket_connection,
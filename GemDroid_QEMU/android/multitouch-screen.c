@@ -518,13 +518,19 @@ multitouch_update_pointer(MTESource source,
         }
 
         /* This is a "pointer down" event */
+        user_event_begin_batch();
         _mts_pointer_down(mts_state, tracking_id, x, y, pressure);
+        user_event_end_batch();
     } else if (pressure == 0) {
         /* This is a "pointer up" event */
+        user_event_begin_batch();
         _mts_pointer_up(mts_state, slot_index);
+        user_event_end_batch();
     } else {
         /* This is a "pointer move" event */
+        user_event_begin_batch();
         _mts_pointer_move(mts_state, slot_index, x, y, pressure);
+        user_event_end_batch();
     }
 }
 
@@ -16,48 +16,85 @@
 
 #include "android/base/async/Looper.h"
 #include "android/base/Log.h"
-#include "android/base/synchronization/Lock.h"
 #include "android/base/sockets/SocketUtils.h"
-#include "android/base/synchronization/MessageChannel.h"
 
 #include <stdlib.h>
 #include <string.h>
-
-#include <stdio.h>
+#include <sys/time.h>
 
 #ifdef _WIN32
-#undef ERROR
+#  define WIN32_LEAN_AND_MEAN 1
+#  include <windows.h>
+#  undef ERROR
 #endif
 
 namespace android {
 namespace opengl {
 
 using android::base::Looper;
-using android::base::MessageChannel;
 
 namespace {
 
-// A small structure to model a single frame of the GPU display,
-// as passed between the EmuGL and main loop thread.
+static uint64_t nowUs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+// Atomically replace |*ptr| with |value| and return its previous value.
+// This is a full memory barrier, which orders the frame contents written
+// by one thread before the index published to the other one.
+static inline int atomicExchange(volatile long* ptr, long value) {
+#ifdef _WIN32
+    return (int)InterlockedExchange(ptr, value);
+#else
+    __sync_synchronize();
+    return (int)__sync_lock_test_and_set(ptr, value);
+#endif
+}
+
+// A single frame buffer of the GPU display. Buffers are allocated lazily
+// and only grow, so steady-state frames reuse them as-is.
 struct Frame {
     int width;
     int height;
+    size_t capacity;
     void* pixels;
+    uint64_t postTimeUs;
 
-    Frame(int w, int h, const void* pixels) :
-            width(w), height(h), pixels(NULL) {
-        this->pixels = ::calloc(w * 4, h);
-        ::memcpy(this->pixels, pixels, w * 4 * h);
-		//pras
-		printf("frame:pixels: w=%d,d=%d\n",w,h);
-    }
+    Frame() : width(0), height(0), capacity(0), pixels(NULL), postTimeUs(0) {}
 
     ~Frame() {
         ::free(pixels);
     }
+
+    bool reserve(size_t size) {
+        if (size <= capacity) {
+            return true;
+        }
+        void* newPixels = ::realloc(pixels, size);
+        if (!newPixels) {
+            return false;
+        }
+        pixels = newPixels;
+        capacity = size;
+        return true;
+    }
 };
 
 // Real implementation of GpuFrameBridge interface.
+//
+// Frames are passed between the EmuGL and main loop threads through a
+// triple buffer: at any time the EmuGL thread owns one Frame (mBackIndex),
+// the main loop owns another one (mFrontIndex), and the third one sits in
+// between (mMiddle). Publishing a frame or picking up the latest one is a
+// single atomic exchange of the middle index with one's own, and
+// kFreshFrame tells whether the middle frame has been published but not
+// delivered yet.
+//
+// The socket pair is only used to wake up the looper. A byte is sent only
+// when the middle slot goes from stale to fresh, so the socket never holds
+// more than one pending byte and postFrame() never blocks.
 class Bridge : public GpuFrameBridge {
 public:
     // Constructor.
@@ -67,9 +104,13 @@ public:
             mInSocket(-1),
             mOutSocket(-1),
             mFdWatch(NULL),
-            mFrames(),
+            mBackIndex(0),
+            mMiddle(1),
+            mFrontIndex(2),
             mCallback(callback),
             mCallbackOpaque(callbackOpaque) {
+        ::memset(&mStats, 0, sizeof(mStats));
+
         if (::android::base::socketCreatePair(&mInSocket, &mOutSocket) < 0) {
             PLOG(ERROR) << "Could not create socket pair";
             return;
@@ -101,41 +142,78 @@ public:
         if (mInSocket < 0) {
             return;
         }
-        Frame* frame = new Frame(width, height, pixels);
-        ::memcpy(frame->pixels, pixels, width * 4 * height);
-        mFrames.send(frame);
+        Frame* frame = &mFrames[mBackIndex];
+        size_t size = (size_t)width * 4 * height;
+        if (!frame->reserve(size)) {
+            LOG(ERROR) << "Could not allocate " << width << "x" << height
+                       << " frame buffer";
+            return;
+        }
+        ::memcpy(frame->pixels, pixels, size);
+        frame->width = width;
+        frame->height = height;
+        frame->postTimeUs = nowUs();
+        mStats.postedFrames++;
+
+        int old = atomicExchange(&mMiddle, mBackIndex | kFreshFrame);
+        mBackIndex = old & kIndexMask;
+        if (old & kFreshFrame) {
+            // The main loop hasn't picked up the previous frame yet, and
+            // has already been woken up for it.
+            mStats.droppedFrames++;
+            return;
+        }
         char c = 1;
         android::base::socketSend(mInSocket, &c, 1);
     }
 
+    virtual void getStats(Stats* stats) const {
+        *stats = mStats;
+    }
+
 private:
     enum {
-        kMaxFrames = 16
+        kIndexMask = 3,
+        kFreshFrame = 4
     };
 
     // Called from the looper thread when a new Frame instance is available.
-    static void onSocketEvent(void* opaque, int fd, unsigned events) {
+    static void onSocketEvent(void* opaque, int /* fd */, unsigned events) {
         Bridge* bridge = reinterpret_cast<Bridge*>(opaque);
         if (events & Looper::FdWatch::kEventRead) {
             char c = 0;
             android::base::socketRecv(bridge->mOutSocket, &c, 1);
-            Frame* frame = NULL;
-            bridge->mFrames.receive(&frame);
-            if (frame) {
-                bridge->mCallback(bridge->mCallbackOpaque,
-                                  frame->width,
-                                  frame->height,
-                                  frame->pixels);
-                delete frame;
-            }
+            bridge->deliverFrame();
         }
     }
 
+    void deliverFrame() {
+        if (!(mMiddle & kFreshFrame)) {
+            return;
+        }
+        int old = atomicExchange(&mMiddle, mFrontIndex);
+        mFrontIndex = old & kIndexMask;
+
+        const Frame& frame = mFrames[mFrontIndex];
+        uint64_t latencyUs = nowUs() - frame.postTimeUs;
+        mStats.lastLatencyUs = (uint32_t)latencyUs;
+        if (mStats.lastLatencyUs > mStats.maxLatencyUs) {
+            mStats.maxLatencyUs = mStats.lastLatencyUs;
+        }
+        mStats.deliveredFrames++;
+
+        mCallback(mCallbackOpaque, frame.width, frame.height, frame.pixels);
+    }
+
     Looper* mLooper;
     int mInSocket;
     int mOutSocket;
     Looper::FdWatch* mFdWatch;
-    MessageChannel<Frame*, kMaxFrames> mFrames;
+    Frame mFrames[3];
+    int mBackIndex;             // EmuGL thread only.
+    volatile long mMiddle;      // Shared, see class comment.
+    int mFrontIndex;            // Looper thread only.
+    Stats mStats;
     Callback* mCallback;
     void* mCallbackOpaque;
 };
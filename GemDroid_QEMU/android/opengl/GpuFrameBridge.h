@@ -15,6 +15,8 @@
 #ifndef ANDROID_OPENGL_GPU_FRAME_BRIDGE_H
 #define ANDROID_OPENGL_GPU_FRAME_BRIDGE_H
 
+#include <stdint.h>
+
 namespace android {
 
 namespace base {
@@ -38,13 +40,18 @@ namespace opengl {
 //  2) In the EmuGL callback, which runs in its own EmuGL thread, call the
 //     postFrame() method.
 //
+// Only the most recent frame matters to the UI, so postFrame() never
+// blocks: if the main loop hasn't picked up the previous frame yet, it is
+// simply replaced by the new one and counted as dropped. Frame buffers are
+// recycled between the two threads, so there is no per-frame allocation.
+//
 class GpuFrameBridge {
 public:
     // Type of function that is called to transfer the content of a new
     // GPU frame to the main thread. |opaque| is a user-provided pointer,
     // |width| and |height| are dimensions in pixels, and |pixels| is
-    // the memory buffer of 32-bit RGBA image data. This buffer is freed
-    // when the function returns.
+    // the memory buffer of 32-bit RGBA image data. This buffer is owned by
+    // the bridge and only valid until the function returns.
     typedef void (Callback)(void* opaque,
                             int width,
                             int height,
@@ -63,6 +70,23 @@ public:
     // Post a new frame from the EmuGL thread.
     virtual void postFrame(int width, int height, const void* pixels) = 0;
 
+    // Frame delivery counters. |postedFrames| counts calls to postFrame(),
+    // |deliveredFrames| frames passed to the callback, and |droppedFrames|
+    // frames that were replaced by a newer one before the main loop could
+    // deliver them. Latencies are measured from postFrame() to the
+    // callback invocation, in microseconds.
+    struct Stats {
+        uint32_t postedFrames;
+        uint32_t deliveredFrames;
+        uint32_t droppedFrames;
+        uint32_t lastLatencyUs;
+        uint32_t maxLatencyUs;
+    };
+
+    // Retrieve a snapshot of the counters. Can be called from any thread,
+    // the values are only approximate while frames are being posted.
+    virtual void getStats(Stats* stats) const = 0;
+
 protected:
     GpuFrameBridge() {}
     GpuFrameBridge(const GpuFrameBridge& other);
@@ -17,6 +17,7 @@
 #include "android/base/async/Looper.h"
 #include "android/base/Log.h"
 #include "android/base/memory/ScopedPtr.h"
+#include "android/base/threads/Thread.h"
 
 #include <gtest/gtest.h>
 
@@ -29,6 +30,7 @@ namespace opengl {
 
 using android::base::ScopedPtr;
 using android::base::Looper;
+using android::base::Thread;
 
 namespace {
 
@@ -126,5 +128,115 @@ TEST(GpuFrameBridge, postFrameWithinSingleThread) {
     }
 }
 
+TEST(GpuFrameBridge, postFrameDropsStaleFrames) {
+    ScopedPtr<Looper> looper(Looper::create());
+    ASSERT_TRUE(looper.get());
+
+    FrameList list;
+    ScopedPtr<GpuFrameBridge> bridge(
+            GpuFrameBridge::create(looper.get(), FrameList::add, &list));
+    EXPECT_TRUE(bridge.get());
+
+    // Only the last frame posted before the looper runs is delivered.
+    for (unsigned char n = 0; n < 5; ++n) {
+        const unsigned char pixels[8] = {
+            n, n, n, n, n, n, n, n,
+        };
+        bridge->postFrame(2, 1, pixels);
+    }
+
+    EXPECT_EQ(ETIMEDOUT, looper->runWithTimeoutMs(100));
+
+    EXPECT_EQ(1, list.count());
+    const Frame* frame = list.get(0);
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(2, frame->width);
+    EXPECT_EQ(1, frame->height);
+    for (size_t n = 0; n < 8; ++n) {
+        EXPECT_EQ(4U, reinterpret_cast<unsigned char*>(frame->pixels)[n]);
+    }
+
+    GpuFrameBridge::Stats stats;
+    bridge->getStats(&stats);
+    EXPECT_EQ(5U, stats.postedFrames);
+    EXPECT_EQ(1U, stats.deliveredFrames);
+    EXPECT_EQ(4U, stats.droppedFrames);
+}
+
+namespace {
+
+// A thread that posts a sequence of 1x1 frames whose single pixel holds
+// the frame number.
+class FramePoster : public Thread {
+public:
+    FramePoster(GpuFrameBridge* bridge, int count) :
+            Thread(), mBridge(bridge), mCount(count) {}
+
+    virtual intptr_t main() {
+        for (int n = 1; n <= mCount; ++n) {
+            uint32_t pixel = static_cast<uint32_t>(n);
+            mBridge->postFrame(1, 1, &pixel);
+        }
+        return 0;
+    }
+
+private:
+    GpuFrameBridge* mBridge;
+    int mCount;
+};
+
+struct LastFrame {
+    LastFrame() : count(0), last(0), ordered(true) {}
+
+    static void onFrame(void* context, int w, int h, const void* pixels) {
+        LastFrame* self = reinterpret_cast<LastFrame*>(context);
+        uint32_t value;
+        ::memcpy(&value, pixels, sizeof(value));
+        if (value <= self->last) {
+            self->ordered = false;
+        }
+        self->last = value;
+        self->count++;
+    }
+
+    int count;
+    uint32_t last;
+    bool ordered;
+};
+
+}  // namespace
+
+TEST(GpuFrameBridge, postFrameFromOtherThread) {
+    ScopedPtr<Looper> looper(Looper::create());
+    ASSERT_TRUE(looper.get());
+
+    LastFrame result;
+    ScopedPtr<GpuFrameBridge> bridge(
+            GpuFrameBridge::create(looper.get(), LastFrame::onFrame, &result));
+    EXPECT_TRUE(bridge.get());
+
+    const int kCount = 10000;
+    FramePoster poster(bridge.get(), kCount);
+    ASSERT_TRUE(poster.start());
+    for (int n = 0; n < 500; ++n) {
+        if (result.last == static_cast<uint32_t>(kCount)) {
+            break;
+        }
+        EXPECT_EQ(ETIMEDOUT, looper->runWithTimeoutMs(10));
+    }
+    EXPECT_EQ(static_cast<uint32_t>(kCount), result.last);
+    intptr_t status;
+    EXPECT_TRUE(poster.wait(&status));
+
+    // Frames are never delivered out of order, and every posted frame is
+    // either delivered or counted as dropped.
+    EXPECT_TRUE(result.ordered);
+    GpuFrameBridge::Stats stats;
+    bridge->getStats(&stats);
+    EXPECT_EQ(static_cast<uint32_t>(kCount), stats.postedFrames);
+    EXPECT_EQ(static_cast<uint32_t>(result.count), stats.deliveredFrames);
+    EXPECT_EQ(stats.postedFrames, stats.deliveredFrames + stats.droppedFrames);
+}
+
 }  // namespace opengl
 }  // namespace android
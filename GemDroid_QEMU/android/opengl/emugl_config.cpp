@@ -15,6 +15,7 @@
 #include "android/base/StringFormat.h"
 #include "android/base/system/System.h"
 #include "android/opengl/EmuglBackendList.h"
+#include "android/utils/startup_tasks.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,8 +38,57 @@ using android::opengl::EmuglBackendList;
 
 static EmuglBackendList* sBackendList = NULL;
 
+// State of the backend scan started by emuglConfig_prefetchBackends().
+// |sPrefetchList| is only written by the task, and only read after
+// waiting for it.
+static AndroidStartupTask sPrefetchTask = -1;
+static int sPrefetchBitness = 0;
+static String* sPrefetchExecDir = NULL;
+static EmuglBackendList* sPrefetchList = NULL;
+
+static void prefetchBackendList(void* /* opaque */) {
+    sPrefetchList = new EmuglBackendList(sPrefetchExecDir->c_str(),
+                                         sPrefetchBitness);
+}
+
+void emuglConfig_prefetchBackends(int bitness) {
+    if (sPrefetchExecDir) {
+        return;
+    }
+    if (!bitness) {
+        bitness = System::kProgramBitness;
+    }
+    sPrefetchBitness = bitness;
+    // Resolve the program directory in this thread, since System caches it.
+    sPrefetchExecDir = new String(System::get()->getProgramDirectory());
+    sPrefetchTask = android_startup_addTask("gpu-backends",
+                                            prefetchBackendList,
+                                            NULL, NULL, 0);
+}
+
 static void resetBackendList(int bitness) {
     delete sBackendList;
+    sBackendList = NULL;
+
+    // Use the prefetched list if it matches, then discard it, so that
+    // later calls always scan the current directory content.
+    if (sPrefetchExecDir) {
+        android_startup_waitTask(sPrefetchTask);
+        if (sPrefetchBitness == bitness &&
+            *sPrefetchExecDir == System::get()->getProgramDirectory()) {
+            sBackendList = sPrefetchList;
+        } else {
+            delete sPrefetchList;
+        }
+        sPrefetchTask = -1;
+        sPrefetchList = NULL;
+        delete sPrefetchExecDir;
+        sPrefetchExecDir = NULL;
+        if (sBackendList) {
+            return;
+        }
+    }
+
 	//pras
 	//printf("pras debug: %s %s %ld\n", __FILE__, __FUNCTION__, __LINE__);
     sBackendList = new EmuglBackendList(
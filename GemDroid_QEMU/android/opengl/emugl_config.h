@@ -53,6 +53,14 @@ bool emuglConfig_init(EmuglConfig* config,
                       int bitness,
                       bool no_window);
 
+// Start scanning the GPU emulation backends available for |bitness| (0,
+// 32 or 64) in a startup task (see android/utils/startup_tasks.h), since
+// this needs to look at the content of the program's directory. The next
+// call to emuglConfig_init() with the same bitness waits for the task and
+// uses its result instead of scanning again. Must be called from the main
+// thread.
+void emuglConfig_prefetchBackends(int bitness);
+
 // Setup GPU emulation according to a given |backend|.
 // |bitness| is the host bitness, and can be 0 (autodetect), 32 or 64.
 void emuglConfig_setupEnv(const EmuglConfig* config);
@@ -240,6 +240,33 @@ TEST(EmuglConfig, initNoWindowWithoutMesa) {
                  config.status);
 }
 
+TEST(EmuglConfig, prefetchBackends) {
+    TestSystem testSys("foo", System::kProgramBitness);
+    TestTempDir* myDir = testSys.getTempRoot();
+    myDir->makeSubDir(System::get()->getProgramDirectory().c_str());
+    makeLibSubDir(myDir, "");
+
+    // Without android_startup_init(), the scan happens synchronously.
+    emuglConfig_prefetchBackends(0);
+
+    makeLibSubDir(myDir, "gles_mesa");
+    makeLibSubFile(myDir, "gles_mesa/libGLES.so");
+
+    // The prefetched list is used once, and doesn't have 'mesa' yet.
+    {
+        EmuglConfig config;
+        EXPECT_FALSE(emuglConfig_init(&config, true, "mesa", NULL, 0, false));
+        EXPECT_STREQ("Invalid GPU mode 'mesa', use one of: on off host",
+                     config.status);
+    }
+
+    {
+        EmuglConfig config;
+        EXPECT_TRUE(emuglConfig_init(&config, true, "mesa", NULL, 0, false));
+        EXPECT_STREQ("mesa", config.backend);
+    }
+}
+
 TEST(EmuglConfig, setupEnv) {
 }
 
@@ -48,6 +48,10 @@ typedef void* FBNativeWindowType;
 #define STREAM_MODE_UNIX      2
 #define STREAM_MODE_PIPE      3
 
+/* The ANDROID_GLES_CHANNEL_XXX flags of android/opengles.h have the same
+ * values as the RENDER_CHANNEL_XXX ones returned by renderChannelPoll(). */
+typedef AndroidGlesChannelBuffer RenderChannelBuffer;
+
 #define RENDERER_FUNCTIONS_LIST \
   FUNCTION_(int, initLibrary, (void), ()) \
   FUNCTION_(int, setStreamMode, (int mode), (mode)) \
@@ -60,6 +64,15 @@ typedef void* FBNativeWindowType;
   FUNCTION_VOID_(repaintOpenGLDisplay, (void), ()) \
   FUNCTION_(int, stopOpenGLRenderer, (void), ()) \
 
+// Optional functions, older renderer libraries don't provide them.
+#define RENDERER_CHANNEL_FUNCTIONS_LIST \
+  FUNCTION_(void*, openRenderChannel, (int* wakeFd), (wakeFd)) \
+  FUNCTION_(int, renderChannelSend, (void* channel, const RenderChannelBuffer* buffers, int numBuffers), (channel, buffers, numBuffers)) \
+  FUNCTION_(int, renderChannelRecv, (void* channel, RenderChannelBuffer* buffers, int numBuffers), (channel, buffers, numBuffers)) \
+  FUNCTION_(unsigned, renderChannelPoll, (void* channel), (channel)) \
+  FUNCTION_VOID_(renderChannelWakeOn, (void* channel, unsigned events), (channel, events)) \
+  FUNCTION_VOID_(closeRenderChannel, (void* channel), (channel)) \
+
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -81,6 +94,7 @@ typedef void* FBNativeWindowType;
 #define FUNCTION_VOID_(name, sig, params) \
         static void (*name) sig = NULL;
 RENDERER_FUNCTIONS_LIST
+RENDERER_CHANNEL_FUNCTIONS_LIST
 #undef FUNCTION_
 #undef FUNCTION_VOID_
 
@@ -109,6 +123,31 @@ RENDERER_FUNCTIONS_LIST
     return 0;
 }
 
+// Same for the optional functions. Return 0 if all of them were found,
+// -1 otherwise, in which case none of them can be used.
+static int
+initOpenglesChannelFuncs(ADynamicLibrary* rendererLib)
+{
+    void*  symbol;
+    char*  error;
+
+#define FUNCTION_(ret, name, sig, params) \
+    symbol = adynamicLibrary_findSymbol(rendererLib, #name, &error); \
+    if (symbol != NULL) { \
+        name = symbol; \
+    } else { \
+        D("GLES emulation: No render channel support (%s): %s", #name, error); \
+        free(error); \
+        return -1; \
+    }
+#define FUNCTION_VOID_(name, sig, params) FUNCTION_(void, name, sig, params)
+RENDERER_CHANNEL_FUNCTIONS_LIST
+#undef FUNCTION_VOID_
+#undef FUNCTION_
+
+    return 0;
+}
+
 
 /* Defined in android/hw-pipe-net.c */
 extern int android_init_opengles_pipes(void);
@@ -117,6 +156,7 @@ static ADynamicLibrary*  rendererLib;
 static bool              rendererUsesSubWindow;
 static int               rendererStarted;
 static char              rendererAddress[256];
+static bool              rendererHasChannels;
 
 int
 android_initOpenglesEmulation(void)
@@ -164,6 +204,13 @@ android_initOpenglesEmulation(void)
     } else {
         setStreamMode(STREAM_MODE_TCP);
     }
+
+    rendererHasChannels = (initOpenglesChannelFuncs(rendererLib) == 0);
+    env = getenv("ANDROID_GLES_SOCKET_PIPES");
+    if (env && env[0] != '\0' && env[0] != '0') {
+        D("OpenGLES render channels disabled by ANDROID_GLES_SOCKET_PIPES");
+        rendererHasChannels = false;
+    }
     return 0;
 
 BAD_EXIT:
@@ -318,3 +365,46 @@ android_gles_server_path(char* buff, size_t buffsize)
 {
     strncpy_safe(buff, rendererAddress, buffsize);
 }
+
+void*
+android_openglesOpenChannel(int* wakeFd)
+{
+    if (!rendererStarted || !rendererHasChannels) {
+        return NULL;
+    }
+    return openRenderChannel(wakeFd);
+}
+
+int
+android_openglesChannelSend(void* channel,
+                            const AndroidGlesChannelBuffer* buffers,
+                            int numBuffers)
+{
+    return renderChannelSend(channel, buffers, numBuffers);
+}
+
+int
+android_openglesChannelRecv(void* channel,
+                            AndroidGlesChannelBuffer* buffers,
+                            int numBuffers)
+{
+    return renderChannelRecv(channel, buffers, numBuffers);
+}
+
+unsigned
+android_openglesChannelPoll(void* channel)
+{
+    return renderChannelPoll(channel);
+}
+
+void
+android_openglesChannelWakeOn(void* channel, unsigned events)
+{
+    renderChannelWakeOn(channel, events);
+}
+
+void
+android_openglesCloseChannel(void* channel)
+{
+    closeRenderChannel(channel);
+}
@@ -67,6 +67,53 @@ extern int  android_gles_fast_pipes;
  */
 void android_gles_server_path(char* buff, size_t buffsize);
 
+/* In-process channels to the renderer, an alternative to connecting to
+ * android_gles_server_path() that moves the GLES command stream through
+ * shared memory ring buffers instead of a local socket. See the
+ * description of openRenderChannel() in render_api.entries.
+ */
+
+/* Flags returned by android_openglesChannelPoll() */
+#define ANDROID_GLES_CHANNEL_CAN_READ   (1 << 0)
+#define ANDROID_GLES_CHANNEL_CAN_WRITE  (1 << 1)
+#define ANDROID_GLES_CHANNEL_STOPPED    (1 << 2)
+
+/* Same layout as GoldfishPipeBuffer */
+typedef struct {
+    void*   data;
+    size_t  size;
+} AndroidGlesChannelBuffer;
+
+/* Open a new channel to a new render thread. On success, return an opaque
+ * handle and set |*wakeFd| to a file descriptor that becomes readable
+ * after an android_openglesChannelWakeOn() condition is met, or when the
+ * render thread stops; it must be drained then polled. Return NULL if
+ * the renderer isn't started, doesn't support channels, or if channels
+ * were disabled with ANDROID_GLES_SOCKET_PIPES=1.
+ */
+void* android_openglesOpenChannel(int* wakeFd);
+
+/* Send or receive bytes without blocking. Return the number of bytes
+ * copied, 0 if the operation would block, or -1 if the render thread
+ * stopped.
+ */
+int android_openglesChannelSend(void* channel,
+                                const AndroidGlesChannelBuffer* buffers,
+                                int numBuffers);
+int android_openglesChannelRecv(void* channel,
+                                AndroidGlesChannelBuffer* buffers,
+                                int numBuffers);
+
+/* Return a combination of ANDROID_GLES_CHANNEL_XXX flags. */
+unsigned android_openglesChannelPoll(void* channel);
+
+/* Ask for the channel's wake descriptor to be signaled once one of the
+ * ANDROID_GLES_CHANNEL_CAN_READ / CAN_WRITE |events| occurs. */
+void android_openglesChannelWakeOn(void* channel, unsigned events);
+
+/* Close a channel returned by android_openglesOpenChannel(). */
+void android_openglesCloseChannel(void* channel);
+
 ANDROID_END_HEADER
 
 #endif /* ANDROID_OPENGLES_H */
@@ -24,6 +24,7 @@
 #include "android/globals.h"
 #include "android/help.h"
 #include "android/filesystems/ext4_utils.h"
+#include "android/filesystems/image_copy.h"
 #include "android/kernel/kernel_utils.h"
 #include "android/main-common.h"
 #include "android/utils/bufprint.h"
@@ -424,10 +425,12 @@ extern "C" int main(int argc, char **argv, char **envp) {
         }
         D("Creating: %s\n", hw->disk_dataPartition_path);
 
-        if (path_copy_file(hw->disk_dataPartition_path,
-                           hw->disk_dataPartition_initPath) < 0) {
+        int ret = android_copyImageFile(hw->disk_dataPartition_path,
+                                        hw->disk_dataPartition_initPath,
+                                        NULL);
+        if (ret < 0) {
             derror("Could not create %s: %s", hw->disk_dataPartition_path,
-                   strerror(errno));
+                   strerror(-ret));
             exit(1);
         }
     }
@@ -14,7 +14,124 @@
 #ifndef ARGB_T_DEFINED
 #define ARGB_T_DEFINED
 
-#if USE_MMX
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+/* same layout as the MMX version below: one pixel in the low 64 bits of a
+ * register, as four 16-bit channels [ a | r | g | b ]. the arithmetic is the
+ * one of the portable version at the end, so that both give the same
+ * results */
+typedef __m128i  argb_t;
+
+static inline __m128i
+sse2_load8888( unsigned  value, __m128i  zero )
+{
+    return _mm_unpacklo_epi8( _mm_cvtsi32_si128( (int)value ), zero );
+}
+
+static inline unsigned
+sse2_save8888( __m128i  argb )
+{
+    return (unsigned) _mm_cvtsi128_si32( _mm_packus_epi16( argb, argb ) );
+}
+
+static inline __m128i
+sse2_mulshift( __m128i  argb, int  multiplier, int  rshift, __m128i  zero )
+{
+    /* all four channels go through a single madd: [ c | 0 ] x [ m | 0 ] */
+    __m128i  t = _mm_unpacklo_epi16( argb, zero );
+
+    t = _mm_madd_epi16( t, _mm_set1_epi32( multiplier ) );
+    t = _mm_srl_epi32( t, _mm_cvtsi32_si128( rshift ) );
+    t = _mm_and_si128( t, _mm_set1_epi32( 0xff ) );
+    return _mm_packs_epi32( t, zero );
+}
+
+/* (channel * multiplier) >> 8, truncated to 8 bits, for multipliers up to
+ * 256: the 24-bit products are put back together from their 16-bit halves */
+static inline __m128i
+sse2_mulshift8( __m128i  argb, int  multiplier )
+{
+    __m128i  mult = _mm_set1_epi16( (short)multiplier );
+    __m128i  lo   = _mm_srli_epi16( _mm_mullo_epi16( argb, mult ), 8 );
+    __m128i  hi   = _mm_slli_epi16( _mm_mulhi_epu16( argb, mult ), 8 );
+
+    return _mm_and_si128( _mm_or_si128( lo, hi ), _mm_set1_epi16( 0xff ) );
+}
+
+static inline __m128i
+sse2_interp255( __m128i  m1, __m128i  m2, __m128i  zero, int  alpha )
+{
+    // t    = [ a2 | a1 | r2 | r1 | g2 | g1 | b2 | b1 ]
+    // mult = [  a | 1-a|  a | 1-a|  a | 1-a|  a | 1-a]
+    __m128i  mult, t;
+
+    alpha += alpha >> 8;
+    mult = _mm_set1_epi32( (alpha << 16) | (256 - alpha) );
+    t    = _mm_unpacklo_epi16( m1, m2 );
+
+    t = _mm_srli_epi32( _mm_madd_epi16( t, mult ), 8 );
+    return _mm_packs_epi32( t, zero );
+}
+
+#define   ARGB_DECL_ZERO()      __m128i  _zero = _mm_setzero_si128()
+#define   ARGB_DECL(x)          __m128i  x
+#define   ARGB_DECL2(x1,x2)     __m128i  x1, x2
+#define   ARGB_ZERO(x)          x = _zero
+#define   ARGB_UNPACK(x,v)      x = sse2_load8888((v), _zero)
+#define   ARGB_PACK(x)          sse2_save8888(x)
+#define   ARGB_COPY(x,y)        x = y
+#define   ARGB_SUM(x1,x2,x3)    x1 = _mm_add_epi16(x2, x3)
+#define   ARGB_REDUCE(x,red)   \
+    ({ \
+        int  _red = (red) >> 8;  \
+        if (_red < 256) \
+            x = sse2_mulshift8( x, _red ); \
+    })
+
+#define  ARGB_INTERP255(x1,x2,x3,alpha)  \
+    x1 = sse2_interp255( x2, x3, _zero, (alpha))
+
+#define    ARGB_ADDW_11(x1,x2,x3)  \
+    ARGB_SUM(x1,x2,x3)
+
+#define    ARGB_ADDW_31(x1,x2,x3)  \
+    ({ \
+        __m128i  _t1 = _mm_add_epi16(x2, x3);  \
+        __m128i  _t2 = _mm_slli_epi16(x2, 1);  \
+        x1 = _mm_add_epi16(_t1, _t2);  \
+    })
+
+#define    ARGB_ADDW_13(x1,x2,x3)  \
+    ({ \
+        __m128i  _t1 = _mm_add_epi16(x2, x3);  \
+        __m128i  _t2 = _mm_slli_epi16(x3, 1);  \
+        x1 = _mm_add_epi16(_t1, _t2);  \
+    })
+
+#define    ARGB_SHR(x1,x2,s)   \
+    x1 = _mm_srli_epi16(x2, s)
+
+#define    ARGB_MULSHIFT(x1,x2,v,s)   \
+    x1 = sse2_mulshift(x2, v, s, _zero)
+
+#define   ARGB_BEGIN ((void)0)
+#define   ARGB_DONE  ((void)0)
+
+#define   ARGB_RESCALE_SHIFT      8
+#define   ARGB_DECL_SCALE(s2,s)   int   s2 = (int)((s)*(s)*(1 << ARGB_RESCALE_SHIFT))
+#define   ARGB_RESCALE(x,s2)      x = sse2_mulshift8( x, s2 )
+
+#ifdef __SSSE3__
+/* the channels of a packed pixel are moved around with a single pshufb,
+ * see ARGB_WRITE_REORDER below */
+#define   ARGB_REORDER_BYTES      1
+#endif
+
+#elif USE_MMX
 #include <mmintrin.h>
 
 typedef __m64   mmx_t;
@@ -214,8 +331,51 @@ typedef uint32_t    argb_t;
 #define   ARGB_READ(x,p)      ARGB_UNPACK(x,*(uint32_t*)(p))
 #define   ARGB_WRITE(x,p)     *(uint32_t*)(p) = ARGB_PACK(x)
 
+/* ARGB_WRITE_REORDER stores a pixel into a destination that is not ARGB,
+ * placing each channel where the ScaleOp's reorder fields say. With
+ * ARGB_REORDER_BYTES, only whole-byte moves are supported, described by
+ * 'reorder_mask'; otherwise 'r_shift', 'g_shift', 'b_shift', 'a_shift' and
+ * 'a_mask' are used, like SDL pixel formats. */
+#if ARGB_REORDER_BYTES
+#define   ARGB_DECL_REORDER(op)  \
+    __m128i  _reorder = _mm_loadu_si128( (const __m128i*)(op)->reorder_mask )
+#define   ARGB_WRITE_REORDER(x,p)  \
+    *(uint32_t*)(p) = (uint32_t) _mm_cvtsi128_si32( \
+            _mm_shuffle_epi8( _mm_packus_epi16( x, x ), _reorder ) )
+#else
+static inline uint32_t
+argb_reorder( uint32_t  argb, const ScaleOp*  op )
+{
+    uint32_t  r = (argb >> 16) & 0xff;
+    uint32_t  g = (argb >>  8) & 0xff;
+    uint32_t  b =  argb        & 0xff;
+    uint32_t  a =  argb >> 24;
+
+    return (r << op->r_shift) | (g << op->g_shift) | (b << op->b_shift) |
+           ((a << op->a_shift) & op->a_mask);
+}
+
+#define   ARGB_DECL_REORDER(op)    const ScaleOp*  _reorder_op = (op)
+#define   ARGB_WRITE_REORDER(x,p)  \
+    *(uint32_t*)(p) = argb_reorder( ARGB_PACK(x), _reorder_op )
+#endif
+
+static inline int cross( int  x, int  y ) {
+    if (x == 65536 && y == 65536)
+        return 65536;
+
+    return (int)((unsigned)x * (unsigned)y >> 16U);
+}
+
 #endif /* !ARGB_T_DEFINED */
 
+/* the includer can redefine these to change how the scalers store their
+ * destination pixels, e.g. with ARGB_DECL_REORDER / ARGB_WRITE_REORDER */
+#ifndef ARGB_WRITE_OUT
+#define   ARGB_DECL_OUT(op)     (void)(op)
+#define   ARGB_WRITE_OUT(x,p)   ARGB_WRITE(x,p)
+#endif
+
 
 
 #ifdef ARGB_SCALE_GENERIC
@@ -234,6 +394,7 @@ ARGB_SCALE_GENERIC( ScaleOp*   op )
     int        iy = op->iy;
 
     ARGB_BEGIN;
+    ARGB_DECL_OUT(op);
 
     src_line += (sx >> 16)*4 + (sy >> 16)*src_pitch;
     sx       &= 0xffff;
@@ -287,7 +448,7 @@ ARGB_SCALE_GENERIC( ScaleOp*   op )
             }
 
             ARGB_RESCALE(pix,scale2);
-            ARGB_WRITE(pix,dst);
+            ARGB_WRITE_OUT(pix,dst);
 
             sx1  = sx2;
             src += (sx1 >> 16)*4;
@@ -308,15 +469,8 @@ ARGB_SCALE_GENERIC( ScaleOp*   op )
 
 
 #ifdef ARGB_SCALE_05_TO_10
-static inline int cross( int  x, int  y ) {
-    if (x == 65536 && y == 65536)
-        return 65536;
-
-    return (int)((unsigned)x * (unsigned)y >> 16U);
-}
-
 static void
-scale_05_to_10( ScaleOp*   op )
+ARGB_SCALE_05_TO_10( ScaleOp*   op )
 {
     int        dst_pitch = op->dst_pitch;
     int        src_pitch = op->src_pitch;
@@ -330,6 +484,7 @@ scale_05_to_10( ScaleOp*   op )
     int        iy = op->iy;
 
     ARGB_BEGIN;
+    ARGB_DECL_OUT(op);
 
     src_line += (sx >> 16)*4 + (sy >> 16)*src_pitch;
     sx       &= 0xffff;
@@ -433,7 +588,7 @@ scale_05_to_10( ScaleOp*   op )
             /** WRITE IT
              **/
             ARGB_RESCALE(pix,scale2);
-            ARGB_WRITE(pix,dst);
+            ARGB_WRITE_OUT(pix,dst);
 
             sx1  = sx2;
             src += (sx1 >> 16)*4;
@@ -455,7 +610,7 @@ scale_05_to_10( ScaleOp*   op )
 
 #ifdef ARGB_SCALE_UP_BILINEAR
 static void
-scale_up_bilinear( ScaleOp*  op )
+ARGB_SCALE_UP_BILINEAR( ScaleOp*  op )
 {
     int        dst_pitch = op->dst_pitch;
     int        src_pitch = op->src_pitch;
@@ -469,6 +624,7 @@ scale_up_bilinear( ScaleOp*  op )
     int        h, sx0;
 
     ARGB_BEGIN;
+    ARGB_DECL_OUT(op);
 
     /* the center pixel is at (sx+ix/2, sy+iy/2), we then want to get */
     /* the four nearest source pixels, which are at (0.5,0.5) offsets */
@@ -526,7 +682,7 @@ scale_up_bilinear( ScaleOp*  op )
             alpha = (sy >> 8) & 0xff;
             ARGB_INTERP255(pix,pix3,pix4,alpha);
 
-            ARGB_WRITE(pix,dst);
+            ARGB_WRITE_OUT(pix,dst);
 
             sx  += ix;
             dst += 4;
@@ -556,6 +712,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
     int        h, sx0;
 
     ARGB_BEGIN;
+    ARGB_DECL_OUT(op);
 
     /* the center pixel is at (sx+ix/2, sy+iy/2), we then want to get */
     /* the four nearest source pixels, which are at (0.5,0.5) offsets */
@@ -600,7 +757,8 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
 
             switch (((sx >> 14) & 3) | ((sy >> 12) & 12)) {
                 case 0:
-                    *(uint32_t*)dst = *(uint32_t*)p;
+                    ARGB_READ(pix, p);
+                    ARGB_WRITE_OUT(pix, dst);
                     break;
 
                 /* top-line is easy */
@@ -609,7 +767,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
                     ARGB_READ(spix2, p+ex2);
                     ARGB_ADDW_31(pix,spix1,spix2);
                     ARGB_SHR(pix,pix,2);
-                    ARGB_WRITE(pix, dst);
+                    ARGB_WRITE_OUT(pix, dst);
                     break;
 
                 case 2:
@@ -617,7 +775,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
                     ARGB_READ(spix2, p+ex2);
                     ARGB_ADDW_11(pix, spix1, spix2);
                     ARGB_SHR(pix,pix,1);
-                    ARGB_WRITE(pix, dst);
+                    ARGB_WRITE_OUT(pix, dst);
                     break;
 
                 case 3:
@@ -625,7 +783,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
                     ARGB_READ(spix2, p+ex2);
                     ARGB_ADDW_13(pix,spix1,spix2);
                     ARGB_SHR(pix,pix,2);
-                    ARGB_WRITE(pix, dst);
+                    ARGB_WRITE_OUT(pix, dst);
                     break;
 
                 /* second line is harder */
@@ -634,7 +792,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
                     ARGB_READ(spix2, p+ey2);
                     ARGB_ADDW_31(pix,spix1,spix2);
                     ARGB_SHR(pix,pix,2);
-                    ARGB_WRITE(pix, dst);
+                    ARGB_WRITE_OUT(pix, dst);
                     break;
 
                 case 5:
@@ -648,7 +806,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
 
                     ARGB_ADDW_31(pix,pix3,pix4);
                     ARGB_SHR(pix,pix,4);
-                    ARGB_WRITE(pix,dst);
+                    ARGB_WRITE_OUT(pix,dst);
                     break;
 
                 case 6:
@@ -662,7 +820,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
 
                     ARGB_ADDW_31(pix,pix3,pix4);
                     ARGB_SHR(pix,pix,3);
-                    ARGB_WRITE(pix,dst);
+                    ARGB_WRITE_OUT(pix,dst);
                     break;
 
                 case 7:
@@ -676,7 +834,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
 
                     ARGB_ADDW_31(pix,pix3,pix4);
                     ARGB_SHR(pix,pix,4);
-                    ARGB_WRITE(pix,dst);
+                    ARGB_WRITE_OUT(pix,dst);
                     break;
 
                  /* third line */
@@ -685,7 +843,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
                     ARGB_READ(spix2, p+ey2);
                     ARGB_ADDW_11(pix,spix1,spix2);
                     ARGB_SHR(pix,pix,1);
-                    ARGB_WRITE(pix, dst);
+                    ARGB_WRITE_OUT(pix, dst);
                     break;
 
                 case 9:
@@ -699,7 +857,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
 
                     ARGB_ADDW_11(pix,pix3,pix4);
                     ARGB_SHR(pix,pix,3);
-                    ARGB_WRITE(pix,dst);
+                    ARGB_WRITE_OUT(pix,dst);
                     break;
 
                 case 10:
@@ -713,7 +871,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
 
                     ARGB_ADDW_11(pix,pix3,pix4);
                     ARGB_SHR(pix,pix,2);
-                    ARGB_WRITE(pix,dst);
+                    ARGB_WRITE_OUT(pix,dst);
                     break;
 
                 case 11:
@@ -727,7 +885,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
 
                     ARGB_ADDW_11(pix,pix3,pix4);
                     ARGB_SHR(pix,pix,3);
-                    ARGB_WRITE(pix,dst);
+                    ARGB_WRITE_OUT(pix,dst);
                     break;
 
                  /* last line */
@@ -736,7 +894,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
                     ARGB_READ(spix2, p+ey2);
                     ARGB_ADDW_13(pix,spix1,spix2);
                     ARGB_SHR(pix,pix,2);
-                    ARGB_WRITE(pix, dst);
+                    ARGB_WRITE_OUT(pix, dst);
                     break;
 
                 case 13:
@@ -750,7 +908,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
 
                     ARGB_ADDW_13(pix,pix3,pix4);
                     ARGB_SHR(pix,pix,4);
-                    ARGB_WRITE(pix,dst);
+                    ARGB_WRITE_OUT(pix,dst);
                     break;
 
                 case 14:
@@ -764,7 +922,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
 
                     ARGB_ADDW_13(pix,pix3,pix4);
                     ARGB_SHR(pix,pix,3);
-                    ARGB_WRITE(pix,dst);
+                    ARGB_WRITE_OUT(pix,dst);
                     break;
 
                 default:
@@ -778,7 +936,7 @@ ARGB_SCALE_UP_QUICK_4x4( ScaleOp*  op )
 
                     ARGB_ADDW_13(pix,pix3,pix4);
                     ARGB_SHR(pix,pix,4);
-                    ARGB_WRITE(pix,dst);
+                    ARGB_WRITE_OUT(pix,dst);
             }
             sx  += ix;
             dst += 4;
@@ -860,3 +1018,6 @@ ARGB_SCALE_NEAREST( ScaleOp*  op )
 }
 #endif
 #undef  ARGB_SCALE_NEAREST
+
+#undef  ARGB_DECL_OUT
+#undef  ARGB_WRITE_OUT
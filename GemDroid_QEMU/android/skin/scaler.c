@@ -13,6 +13,7 @@
 
 #include <stdint.h>
 #include <math.h>
+#include <string.h>
 
 struct SkinScaler {
     double  scale;
@@ -70,9 +71,13 @@ typedef struct {
     uint8_t*    dst_line;
     uint8_t*    src_line;
     double      scale;
+    /* destination channel layout, used when it isn't ARGB */
+    uint32_t    r_shift, g_shift, b_shift, a_shift, a_mask;
+    uint8_t     reorder_mask[16];   /* pshufb control, see argb.h */
 } ScaleOp;
 
 
+/* scalers for ARGB destinations */
 #define  ARGB_SCALE_GENERIC       scale_generic
 #define  ARGB_SCALE_05_TO_10      scale_05_to_10
 #define  ARGB_SCALE_UP_BILINEAR   scale_up_bilinear
@@ -80,6 +85,79 @@ typedef struct {
 
 #include "android/skin/argb.h"
 
+/* same scalers, reordering the channels as they write each pixel, for
+ * other destinations */
+#define  ARGB_SCALE_GENERIC       scale_generic_reorder
+#define  ARGB_SCALE_05_TO_10      scale_05_to_10_reorder
+#define  ARGB_SCALE_UP_BILINEAR   scale_up_bilinear_reorder
+#define  ARGB_DECL_OUT(op)        ARGB_DECL_REORDER(op)
+#define  ARGB_WRITE_OUT(x,p)      ARGB_WRITE_REORDER(x,p)
+
+#include "android/skin/argb.h"
+
+/* setup the reorder fields of |op| for |format|. returns 0 if the reorder
+ * scalers can write that format, or -1 otherwise */
+static int
+scale_op_set_format( ScaleOp*  op, const SkinSurfacePixelFormat*  format )
+{
+    op->r_shift = format->r_shift;
+    op->g_shift = format->g_shift;
+    op->b_shift = format->b_shift;
+    op->a_shift = format->a_shift;
+    op->a_mask  = format->a_mask; // may be 0x00
+
+#if ARGB_REORDER_BYTES
+    {
+        /* source byte of each channel in an ARGB pixel, and its shift in
+         * the destination one */
+        const uint32_t  shifts[4] = { op->b_shift, op->g_shift,
+                                      op->r_shift, op->a_shift };
+        int  nn;
+
+        memset(op->reorder_mask, 0x80, sizeof(op->reorder_mask));
+        for (nn = 0; nn < 4; nn++) {
+            uint32_t  shift = shifts[nn];
+
+            if (nn == 3 && op->a_mask == 0)
+                break;
+            if ((shift & 7) != 0 || shift > 24 ||
+                op->reorder_mask[shift >> 3] != 0x80)
+                return -1;
+            if (nn == 3 && op->a_mask != (0xffU << shift))
+                return -1;
+            op->reorder_mask[shift >> 3] = (uint8_t)nn;
+        }
+    }
+#endif
+    return 0;
+}
+
+/* reorder the channels of the ARGB pixels in the destination rectangle
+ * of |op|, for the formats the reorder scalers can't write directly */
+static void
+scale_op_reorder( ScaleOp*  op )
+{
+    uint32_t rshift = op->r_shift;
+    uint32_t gshift = op->g_shift;
+    uint32_t bshift = op->b_shift;
+    uint32_t ashift = op->a_shift;
+    uint32_t amask  = op->a_mask;
+    int x, y;
+
+    for (y = 0; y < op->rd.size.h; y++)
+    {
+        uint32_t* line = (uint32_t*)(op->dst_line + y*op->dst_pitch);
+        for (x = 0; x < op->rd.size.w; x++) {
+            uint32_t r = (line[x] & 0x00ff0000) >> 16;
+            uint32_t g = (line[x] & 0x0000ff00) >>  8;
+            uint32_t b = (line[x] & 0x000000ff) >>  0;
+            uint32_t a = (line[x] & 0xff000000) >> 24;
+            line[x] = (r << rshift) | (g << gshift) | (b << bshift) |
+                      ((a << ashift) & amask);
+        }
+    }
+}
+
 
 void
 skin_scaler_reverse_map(SkinScaler* scaler,
@@ -112,6 +190,23 @@ skin_scaler_get_scaled_rect( SkinScaler*     scaler,
     drect->size.h = (int)(ceil((sy + sh) * scale + scaler->ydisp)) - drect->pos.y;
 }
 
+typedef void (*ScaleFunc)( ScaleOp*  op );
+
+/* run the scaler that matches the scale of |op| */
+static void
+scale_op_run( ScaleOp*   op,
+              ScaleFunc  generic,
+              ScaleFunc  scale_05_to_10,
+              ScaleFunc  scale_up )
+{
+    if (op->scale >= 0.5 && op->scale <= 1.0)
+        scale_05_to_10( op );
+    else if (op->scale > 1.0)
+        scale_up( op );
+    else
+        generic( op );
+}
+
 void
 skin_scaler_scale( SkinScaler*   scaler,
                    const SkinSurfacePixels* dst_pix,
@@ -147,38 +242,23 @@ skin_scaler_scale( SkinScaler*   scaler,
 
         op.dst_line += op.rd.pos.x * 4 + op.rd.pos.y * op.dst_pitch;
 
-        if (op.scale >= 0.5 && op.scale <= 1.0)
-            scale_05_to_10( &op );
-        else if (op.scale > 1.0)
-            scale_up_bilinear( &op );
+        if (dst_format->r_shift == 16 &&
+            dst_format->g_shift ==  8 &&
+            dst_format->b_shift ==  0)
+        {
+            scale_op_run( &op, scale_generic, scale_05_to_10,
+                          scale_up_bilinear );
+        }
+        else if (scale_op_set_format( &op, dst_format ) == 0)
+        {
+            scale_op_run( &op, scale_generic_reorder, scale_05_to_10_reorder,
+                          scale_up_bilinear_reorder );
+        }
         else
-            scale_generic( &op );
-    }
-
-    // The optimized scale functions in argb.h assume the destination is ARGB.
-    // If that's not the case, do a channel reorder now.
-    if (dst_format->r_shift != 16 ||
-        dst_format->g_shift !=  8 ||
-        dst_format->b_shift !=  0)
-    {
-        uint32_t rshift = dst_format->r_shift;
-        uint32_t gshift = dst_format->g_shift;
-        uint32_t bshift = dst_format->b_shift;
-        uint32_t ashift = dst_format->a_shift;
-        uint32_t amask  = dst_format->a_mask; // may be 0x00
-        int x, y;
-
-        for (y = 0; y < op.rd.size.h; y++)
         {
-            uint32_t* line = (uint32_t*)(op.dst_line + y*op.dst_pitch);
-            for (x = 0; x < op.rd.size.w; x++) {
-                uint32_t r = (line[x] & 0x00ff0000) >> 16;
-                uint32_t g = (line[x] & 0x0000ff00) >>  8;
-                uint32_t b = (line[x] & 0x000000ff) >>  0;
-                uint32_t a = (line[x] & 0xff000000) >> 24;
-                line[x] = (r << rshift) | (g << gshift) | (b << bshift) |
-                          ((a << ashift) & amask);
-            }
+            scale_op_run( &op, scale_generic, scale_05_to_10,
+                          scale_up_bilinear );
+            scale_op_reorder( &op );
         }
     }
 }
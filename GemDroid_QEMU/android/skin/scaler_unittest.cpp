@@ -0,0 +1,194 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+#include "android/skin/scaler.h"
+
+#include "android/base/system/System.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <vector>
+
+#define ARRAYLEN(x)  (sizeof(x)/sizeof((x)[0]))
+
+using android::base::System;
+
+namespace android_skin {
+
+namespace {
+
+const SkinSurfacePixelFormat kArgbFormat = {
+    16, 0x00ff0000, 8, 0x0000ff00, 0, 0x000000ff, 24, 0xff000000,
+};
+
+const SkinSurfacePixelFormat kAbgrFormat = {
+    0, 0x000000ff, 8, 0x0000ff00, 16, 0x00ff0000, 24, 0xff000000,
+};
+
+const SkinSurfacePixelFormat kBgrxFormat = {
+    8, 0x0000ff00, 16, 0x00ff0000, 24, 0xff000000, 0, 0,
+};
+
+// Not made of whole bytes, so it can't be reordered with a byte shuffle.
+const SkinSurfacePixelFormat kOddFormat = {
+    4, 0x00000ff0, 12, 0x000ff000, 20, 0x0ff00000, 0, 0,
+};
+
+const double kScales[] = { 0.3, 0.5, 0.75, 1.0, 1.5, 2.0 };
+
+// A source image filled with noise. Note that the scalers read a few pixels
+// past the edges of the scaled rectangle, so the rectangles used below keep
+// away from the borders.
+struct Image {
+    Image(int width, int height) : pixels(width * height) {
+        pix.w = width;
+        pix.h = height;
+        pix.pitch = width * 4;
+        uint32_t seed = 12345;
+        for (size_t n = 0; n < pixels.size(); n++) {
+            seed = seed * 1103515245 + 12345;
+            pixels[n] = seed ^ (seed >> 16);
+        }
+        pix.pixels = &pixels[0];
+    }
+
+    std::vector<uint32_t> pixels;
+    SkinSurfacePixels pix;
+};
+
+// A destination surface large enough for |src| scaled by up to 2.0.
+struct Target {
+    explicit Target(const Image& src) {
+        pix.w = src.pix.w * 2 + 4;
+        pix.h = src.pix.h * 2 + 4;
+        pix.pitch = pix.w * 4;
+        pixels.assign(pix.w * pix.h, 0);
+        pix.pixels = &pixels[0];
+    }
+
+    std::vector<uint32_t> pixels;
+    SkinSurfacePixels pix;
+};
+
+void scaleImage(double scale,
+                const SkinSurfacePixelFormat& format,
+                const Image& src,
+                const SkinRect& rect,
+                Target* dst) {
+    SkinScaler* scaler = skin_scaler_create();
+    skin_scaler_set(scaler, scale, 0., 0.);
+    skin_scaler_scale(scaler, &dst->pix, &format, &src.pix, &rect);
+    skin_scaler_free(scaler);
+}
+
+uint32_t reorder(uint32_t argb, const SkinSurfacePixelFormat& format) {
+    uint32_t r = (argb >> 16) & 0xff;
+    uint32_t g = (argb >> 8) & 0xff;
+    uint32_t b = argb & 0xff;
+    uint32_t a = argb >> 24;
+    return (r << format.r_shift) | (g << format.g_shift) |
+           (b << format.b_shift) | ((a << format.a_shift) & format.a_mask);
+}
+
+}  // namespace
+
+TEST(scaler, skin_scaler_scale_solid_color) {
+    // Only these scales are exact, others lose a bit of precision.
+    static const double kExactScales[] = { 0.5, 1.5, 2.0 };
+    Image src(64, 48);
+    for (size_t n = 0; n < src.pixels.size(); n++) {
+        src.pixels[n] = 0x80402010;
+    }
+    SkinRect rect = { { 6, 6 }, { 52, 36 } };
+
+    for (size_t s = 0; s < ARRAYLEN(kExactScales); s++) {
+        Target out(src);
+        scaleImage(kExactScales[s], kArgbFormat, src, rect, &out);
+
+        SkinScaler* scaler = skin_scaler_create();
+        skin_scaler_set(scaler, kExactScales[s], 0., 0.);
+        SkinRect drect;
+        skin_scaler_get_scaled_rect(scaler, &rect, &drect);
+        skin_scaler_free(scaler);
+
+        for (int y = drect.pos.y; y < drect.pos.y + drect.size.h; y++) {
+            for (int x = drect.pos.x; x < drect.pos.x + drect.size.w; x++) {
+                ASSERT_EQ(0x80402010U, out.pixels[y * out.pix.w + x])
+                        << "scale " << kExactScales[s]
+                        << " at " << x << "," << y;
+            }
+        }
+    }
+}
+
+TEST(scaler, skin_scaler_scale_reorder) {
+    static const SkinSurfacePixelFormat* const kFormats[] = {
+        &kAbgrFormat, &kBgrxFormat, &kOddFormat,
+    };
+    Image src(64, 48);
+    SkinRect rect = { { 6, 6 }, { 52, 36 } };
+
+    for (size_t s = 0; s < ARRAYLEN(kScales); s++) {
+        Target expected(src);
+        scaleImage(kScales[s], kArgbFormat, src, rect, &expected);
+        for (size_t f = 0; f < ARRAYLEN(kFormats); f++) {
+            Target out(src);
+            scaleImage(kScales[s], *kFormats[f], src, rect, &out);
+            for (size_t n = 0; n < out.pixels.size(); n++) {
+                ASSERT_EQ(reorder(expected.pixels[n], *kFormats[f]),
+                          out.pixels[n]) << "scale " << kScales[s]
+                                         << " format " << f
+                                         << " pixel " << n;
+            }
+        }
+    }
+}
+
+// Not a test: prints the time taken to scale typical device screens.
+// Run with --gtest_also_run_disabled_tests.
+TEST(scaler, DISABLED_skin_scaler_scale_benchmark) {
+    static const struct {
+        const char* name;
+        int w;
+        int h;
+    } kScreens[] = {
+        { "phone 720x1280", 720, 1280 },
+        { "phone 1080x1920", 1080, 1920 },
+        { "tablet 1600x2560", 1600, 2560 },
+    };
+    static const SkinSurfacePixelFormat* const kFormats[] = {
+        &kArgbFormat, &kAbgrFormat,
+    };
+    static const char* const kFormatNames[] = { "ARGB", "ABGR" };
+    const int kFrames = 10;
+
+    for (size_t n = 0; n < ARRAYLEN(kScreens); n++) {
+        Image src(kScreens[n].w + 8, kScreens[n].h + 8);
+        SkinRect rect = { { 4, 4 }, { kScreens[n].w, kScreens[n].h } };
+        for (size_t s = 1; s < ARRAYLEN(kScales); s++) {
+            for (size_t f = 0; f < ARRAYLEN(kFormats); f++) {
+                Target out(src);
+                scaleImage(kScales[s], *kFormats[f], src, rect, &out);
+                double start = System::getHighResTimeUs() / 1000.;
+                for (int i = 0; i < kFrames; i++) {
+                    scaleImage(kScales[s], *kFormats[f], src, rect, &out);
+                }
+                printf("%-18s scale %.2f %s: %7.2f ms/frame\n",
+                       kScreens[n].name, kScales[s], kFormatNames[f],
+                       (System::getHighResTimeUs() / 1000. - start) / kFrames);
+            }
+        }
+    }
+}
+
+}  // namespace android_skin
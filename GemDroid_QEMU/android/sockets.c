@@ -38,6 +38,7 @@
 #else /* !_WIN32 */
 #  include <sys/ioctl.h>
 #  include <sys/socket.h>
+#  include <sys/uio.h>
 #  include <netinet/in.h>
 #  include <netinet/tcp.h>
 #  include <netdb.h>
@@ -968,6 +969,42 @@ socket_send(int  fd, const void*  buf, int  buflen)
     SOCKET_CALL(send(fd, buf, buflen, 0))
 }
 
+int
+socket_sendv(int  fd, const struct iovec*  iov, int  iovcnt)
+{
+#ifdef _WIN32
+    WSABUF  buffers[SOCKET_SENDV_MAX];
+    DWORD   sent = 0;
+    int     nn, ret;
+
+    if (iovcnt > SOCKET_SENDV_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (nn = 0; nn < iovcnt; nn++) {
+        buffers[nn].buf = iov[nn].iov_base;
+        buffers[nn].len = iov[nn].iov_len;
+    }
+    QSOCKET_CALL(ret, WSASend(fd, buffers, iovcnt, &sent, 0, NULL, NULL));
+    if (ret < 0)
+        return fix_errno();
+
+    return (int)sent;
+#else
+    struct msghdr  msg;
+
+    if (iovcnt > SOCKET_SENDV_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = (struct iovec*)iov;
+    msg.msg_iovlen = iovcnt;
+
+    SOCKET_CALL(sendmsg(fd, &msg, 0))
+#endif
+}
+
 int
 socket_send_oob( int  fd, const void*  buf, int  buflen )
 {
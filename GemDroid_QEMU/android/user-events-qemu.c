@@ -11,6 +11,7 @@
 */
 #include "android/user-events.h"
 #include "android/utils/debug.h"
+#include "android/utils/system.h"
 #include "ui/console.h"
 #include <stdio.h>
 
@@ -50,15 +51,81 @@ user_event_mouse(int dx, int dy, int dz, unsigned buttons_state)
 static QEMUPutGenericEvent *generic_event_callback;
 static void*                generic_event_opaque;
 
+static QEMUPutGenericEventBatch *generic_batch_callback;
+static void*                     generic_batch_opaque;
+
+/* Events buffered by user_event_generic() inside a batch. The buffer
+ * grows as needed, so that a batch is always delivered in one piece: a
+ * multi-touch frame fits in the initial size, but 'event send' and replays
+ * can produce longer ones. */
+#define  MIN_BATCH_EVENTS  64
+
+static UserEvent*  batch_events;
+static int         batch_count;
+static int         batch_capacity;
+static int         batch_depth;
+
 void  user_event_register_generic(void* opaque, QEMUPutGenericEvent *callback)
 {
     generic_event_callback = callback;
     generic_event_opaque   = opaque;
 }
 
+void  user_event_register_generic_batch(void* opaque, QEMUPutGenericEventBatch *callback)
+{
+    generic_batch_callback = callback;
+    generic_batch_opaque   = opaque;
+}
+
+static void
+flush_batch(void)
+{
+    int nn;
+
+    if (batch_count == 0)
+        return;
+
+    if (generic_batch_callback) {
+        generic_batch_callback(generic_batch_opaque, batch_events, batch_count);
+    } else if (generic_event_callback) {
+        for (nn = 0; nn < batch_count; nn++)
+            generic_event_callback(generic_event_opaque,
+                                   batch_events[nn].type,
+                                   batch_events[nn].code,
+                                   batch_events[nn].value);
+    }
+    batch_count = 0;
+}
+
 void
 user_event_generic(int type, int code, int value)
 {
+    if (batch_depth > 0) {
+        UserEvent*  event;
+
+        if (batch_count == batch_capacity) {
+            batch_capacity = batch_capacity ? batch_capacity * 2 : MIN_BATCH_EVENTS;
+            AARRAY_RENEW(batch_events, batch_capacity);
+        }
+        event = &batch_events[batch_count++];
+        event->type  = type;
+        event->code  = code;
+        event->value = value;
+        return;
+    }
     if (generic_event_callback)
         generic_event_callback(generic_event_opaque, type, code, value);
 }
+
+void
+user_event_begin_batch(void)
+{
+    batch_depth++;
+}
+
+void
+user_event_end_batch(void)
+{
+    if (batch_depth > 0 && --batch_depth == 0)
+        flush_batch();
+}
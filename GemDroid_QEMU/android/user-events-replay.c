@@ -0,0 +1,210 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* Replay of input events recorded with 'getevent -t' in the guest.
+ *
+ * The file is read lazily, one event ahead, so that recordings of any
+ * length can be replayed. A single virtual clock timer is armed for the
+ * timestamp of the next event, relative to the start of the replay, and
+ * all events that are due when it fires are sent in batches ending at
+ * each EV_SYN/SYN_REPORT, so that each frame reaches the kernel at once.
+ */
+
+#include "android/user-events.h"
+#include "android/hw-events.h"
+#include "android/skin/linux_keycodes.h"
+#include "android/utils/debug.h"
+#include "android/utils/system.h"
+#include "qemu/timer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define  D(...)  VERBOSE_PRINT(keys,__VA_ARGS__)
+
+/* Maximum number of events sent per timer tick. Late events are sent on
+ * the next tick, which lets the guest drain its event queue in between.
+ */
+#define  MAX_EVENTS_PER_TICK  256
+
+typedef struct {
+    FILE*       file;
+    QEMUTimer*  timer;
+    /* Virtual clock time at the start of the replay, in ns. */
+    int64_t     start_ns;
+    /* Timestamp of the first event in the file, in us. */
+    int64_t     first_us;
+    /* Next event to send, and its timestamp in us. */
+    int         has_next;
+    int64_t     next_us;
+    UserEvent   next;
+    int         count;
+} EventReplay;
+
+static EventReplay*  _replay;
+
+/* Parse a 'getevent -t' line. Return 1 on success, 0 for lines that don't
+ * describe an event.
+ */
+static int
+_replay_parse_line( const char*  line, int64_t*  ptime_us, UserEvent*  event )
+{
+    const char*    p = line;
+    char*          end;
+    unsigned long  sec, usec;
+    unsigned long  fields[3];
+    int            nn;
+
+    p += strspn(p, " \t");
+    if (*p != '[')
+        return 0;
+    p++;
+
+    sec = strtoul(p, &end, 10);
+    if (end == p || *end != '.')
+        return 0;
+    p    = end + 1;
+    usec = strtoul(p, &end, 10);
+    if (end == p || *end != ']')
+        return 0;
+    p = end + 1;
+
+    /* Skip the optional device name. */
+    p += strspn(p, " \t");
+    if (*p == '/') {
+        p = strchr(p, ':');
+        if (p == NULL)
+            return 0;
+        p++;
+    }
+
+    for (nn = 0; nn < 3; nn++) {
+        p += strspn(p, " \t");
+        fields[nn] = strtoul(p, &end, 16);
+        if (end == p)
+            return 0;
+        p = end;
+    }
+
+    *ptime_us     = (int64_t)sec * 1000000 + usec;
+    event->type   = (int)fields[0];
+    event->code   = (int)fields[1];
+    event->value  = (int)(unsigned)fields[2];
+    return 1;
+}
+
+/* Read the next event from the file into r->next. */
+static void
+_replay_read_next( EventReplay*  r )
+{
+    char  line[256];
+
+    r->has_next = 0;
+    while (fgets(line, sizeof(line), r->file) != NULL) {
+        if (_replay_parse_line(line, &r->next_us, &r->next)) {
+            r->has_next = 1;
+            return;
+        }
+    }
+}
+
+static int64_t
+_replay_due_ns( EventReplay*  r )
+{
+    return r->start_ns + (r->next_us - r->first_us) * 1000;
+}
+
+static void
+_replay_tick( void*  opaque )
+{
+    EventReplay*  r     = opaque;
+    int64_t       now   = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int           count = 0;
+
+    user_event_begin_batch();
+    while (r->has_next && _replay_due_ns(r) <= now &&
+           count < MAX_EVENTS_PER_TICK) {
+        user_event_generic(r->next.type, r->next.code, r->next.value);
+        if (r->next.type == EV_SYN && r->next.code == SYN_REPORT) {
+            user_event_end_batch();
+            user_event_begin_batch();
+        }
+        count++;
+        _replay_read_next(r);
+    }
+    user_event_end_batch();
+    r->count += count;
+
+    if (!r->has_next) {
+        D("%s: replayed %d events", __FUNCTION__, r->count);
+        user_event_replay_stop();
+        return;
+    }
+
+    timer_mod(r->timer, count < MAX_EVENTS_PER_TICK ? _replay_due_ns(r) : now);
+}
+
+int
+user_event_replay_start( const char*  path )
+{
+    EventReplay*  r;
+    FILE*         file;
+
+    user_event_replay_stop();
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        int  err = errno;
+        D("%s: could not open '%s': %s", __FUNCTION__, path, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    ANEW0(r);
+    r->file  = file;
+    r->timer = timer_new(QEMU_CLOCK_VIRTUAL, SCALE_NS, _replay_tick, r);
+    _replay = r;
+
+    _replay_read_next(r);
+    if (!r->has_next) {
+        D("%s: no events in '%s'", __FUNCTION__, path);
+        user_event_replay_stop();
+        return 0;
+    }
+    r->first_us = r->next_us;
+    r->start_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    timer_mod(r->timer, r->start_ns);
+    return 0;
+}
+
+void
+user_event_replay_stop( void )
+{
+    EventReplay*  r = _replay;
+
+    if (r == NULL)
+        return;
+
+    _replay = NULL;
+    timer_del(r->timer);
+    timer_free(r->timer);
+    fclose(r->file);
+    AFREE(r);
+}
+
+int
+user_event_replay_active( void )
+{
+    return _replay != NULL;
+}
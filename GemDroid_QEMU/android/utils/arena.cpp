@@ -0,0 +1,90 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+#include "android/utils/arena.h"
+
+#include "android/base/containers/InternTable.h"
+#include "android/base/memory/Arena.h"
+#include "android/base/memory/LazyInstance.h"
+#include "android/base/synchronization/Lock.h"
+#include "android/base/StringView.h"
+
+using android::base::Arena;
+using android::base::AutoLock;
+using android::base::InternTable;
+using android::base::LazyInstance;
+using android::base::Lock;
+using android::base::StringView;
+
+/* Thin wrappers around android::base::Arena and InternTable. */
+
+struct AArena {
+    Arena  arena;
+};
+
+AArena*
+aarena_new(void)
+{
+    return new AArena();
+}
+
+void
+aarena_free( AArena*  arena )
+{
+    delete arena;
+}
+
+void*
+aarena_alloc( AArena*  arena, size_t  size )
+{
+    return arena->arena.alloc(size);
+}
+
+char*
+aarena_strdup( AArena*  arena, const char*  str )
+{
+    return arena->arena.strDup(str);
+}
+
+char*
+aarena_strndup( AArena*  arena, const char*  str, size_t  len )
+{
+    return arena->arena.strDup(str, len);
+}
+
+namespace {
+
+/* Configuration files can be parsed from several startup threads. */
+struct GlobalInternTable {
+    Lock         lock;
+    InternTable  table;
+};
+
+LazyInstance<GlobalInternTable> sInternTable = LAZY_INSTANCE_INIT;
+
+}  // namespace
+
+const char*
+aintern_string( const char*  str, size_t  len )
+{
+    GlobalInternTable*  global = sInternTable.ptr();
+    AutoLock  lock(global->lock);
+    return global->table.intern(StringView(str, len));
+}
+
+const char*
+aintern_find( const char*  str, size_t  len )
+{
+    GlobalInternTable*  global = sInternTable.ptr();
+    AutoLock  lock(global->lock);
+    return global->table.find(StringView(str, len));
+}
@@ -0,0 +1,57 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef _ANDROID_UTILS_ARENA_H
+#define _ANDROID_UTILS_ARENA_H
+
+#include "android/utils/compiler.h"
+
+#include <stddef.h>
+
+ANDROID_BEGIN_HEADER
+
+/* A bump-pointer allocator for transient data, e.g. the strings created
+ * while parsing a configuration file. Allocations are carved from large
+ * chunks and can't be freed individually: all of them are released at
+ * once by aarena_free().
+ */
+typedef struct AArena  AArena;
+
+/* Create a new empty arena */
+AArena*   aarena_new(void);
+
+/* Release an arena and all memory allocated from it */
+void      aarena_free( AArena*  arena );
+
+/* Allocate 'size' bytes, suitably aligned for any type. Never returns NULL */
+void*     aarena_alloc( AArena*  arena, size_t  size );
+
+/* Copy a zero-terminated string into the arena */
+char*     aarena_strdup( AArena*  arena, const char*  str );
+
+/* Copy 'len' bytes from 'str' into the arena, followed by a zero */
+char*     aarena_strndup( AArena*  arena, const char*  str, size_t  len );
+
+/* Return the interned copy of the 'len' bytes at 'str'. The process-wide
+ * intern table keeps a single zero-terminated copy of each distinct string
+ * until exit, so interned strings can be compared by address. Meant for
+ * strings that are repeated many times, like configuration keys.
+ */
+const char*  aintern_string( const char*  str, size_t  len );
+
+/* Return the interned copy of the 'len' bytes at 'str', or NULL if it has
+ * never been interned.
+ */
+const char*  aintern_find( const char*  str, size_t  len );
+
+ANDROID_END_HEADER
+
+#endif /* _ANDROID_UTILS_ARENA_H */
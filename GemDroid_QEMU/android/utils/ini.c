@@ -15,6 +15,7 @@
 #include <string.h>
 #include <limits.h>
 #include <errno.h>
+#include "android/utils/arena.h"
 #include "android/utils/debug.h"
 #include "android/utils/system.h" /* for ASTRDUP */
 #include "android/utils/bufprint.h"
@@ -27,27 +28,27 @@
 /* a simple .ini file parser and container for Android
  * no sections support. see android/utils/ini.h for
  * more details on the supported file format.
+ *
+ * keys are interned, since the same ones appear in many files, and
+ * can then be compared by address. values are allocated from an arena
+ * owned by the IniFile, and released all at once with it.
  */
 typedef struct {
-    char*  key;
-    char*  value;
+    const char*  key;
+    char*        value;
 } IniPair;
 
 struct IniFile {
     int       numPairs;
     int       maxPairs;
     IniPair*  pairs;
+    AArena*   arena;
 };
 
 void
 iniFile_free( IniFile*  i )
 {
-    int  nn;
-    for (nn = 0; nn < i->numPairs; nn++) {
-        AFREE(i->pairs[nn].key);
-        i->pairs[nn].key   = NULL;
-        i->pairs[nn].value = NULL;
-    }
+    aarena_free(i->arena);
     AFREE(i->pairs);
     AFREE(i);
 }
@@ -58,31 +59,29 @@ iniFile_alloc( void )
     IniFile*  i;
 
     ANEW0(i);
+    i->arena = aarena_new();
     return i;
 }
 
 static void
-iniPair_init( IniPair* pair, const char* key, int keyLen,
-                             const char* value, int valueLen )
+iniPair_init( IniFile* i, IniPair* pair, const char* key, int keyLen,
+                                         const char* value, int valueLen )
 {
-    AARRAY_NEW(pair->key, keyLen + valueLen + 2);
-    memcpy(pair->key, key, keyLen);
-    pair->key[keyLen] = 0;
-
-    pair->value = pair->key + keyLen + 1;
-    memcpy(pair->value, value, valueLen);
-    pair->value[valueLen] = 0;
+    pair->key   = aintern_string(key, keyLen);
+    pair->value = aarena_strndup(i->arena, value, valueLen);
 }
 
 static void
-iniPair_replaceValue( IniPair* pair, const char* value )
+iniPair_replaceValue( IniFile* i, IniPair* pair, const char* value )
 {
-    char* key      = pair->key;
-    int   keyLen   = strlen(key);
-    int   valueLen = strlen(value);
+    int  valueLen = strlen(value);
 
-    iniPair_init(pair, key, keyLen, value, valueLen);
-    AFREE(key);
+    /* reuse the current storage when possible */
+    if (valueLen <= (int)strlen(pair->value)) {
+        memmove(pair->value, value, valueLen + 1);
+        return;
+    }
+    pair->value = aarena_strndup(i->arena, value, valueLen);
 }
 
 static void
@@ -101,7 +100,7 @@ iniFile_addPair( IniFile*  i,
     }
 
     pair = i->pairs + i->numPairs;
-    iniPair_init(pair, key, keyLen, value, valueLen);
+    iniPair_init(i, pair, key, keyLen, value, valueLen);
 
     i->numPairs += 1;
 }
@@ -110,10 +109,15 @@ static IniPair*
 iniFile_getPair( IniFile* i, const char* key )
 {
     if (i && key) {
-        int  nn;
+        /* a key that was never interned can't be in any file */
+        const char*  ikey = aintern_find(key, strlen(key));
+        int          nn;
+
+        if (ikey == NULL)
+            return NULL;
 
         for (nn = 0; nn < i->numPairs; nn++) {
-            if (!strcmp(i->pairs[nn].key,key))
+            if (i->pairs[nn].key == ikey)
                 return &i->pairs[nn];
         }
     }
@@ -478,7 +482,7 @@ iniFile_setValue( IniFile* f, const char* key, const char* value )
 
     pair = iniFile_getPair(f, key);
     if (pair != NULL) {
-        iniPair_replaceValue(pair, value);
+        iniPair_replaceValue(f, pair, value);
     } else {
         iniFile_addPair(f, key, strlen(key), value, strlen(value));
     }
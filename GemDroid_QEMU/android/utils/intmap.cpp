@@ -0,0 +1,119 @@
+/* Copyright (C) 2011 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+#include "android/utils/intmap.h"
+
+#include "android/base/containers/IntMap.h"
+#include "android/utils/system.h"
+
+#include <stddef.h>
+
+/* The map is a thin wrapper around android::base::IntMap, an open
+ * addressing hash table, so lookups don't depend on the number of keys.
+ */
+
+typedef android::base::IntMap<void> IntMap;
+
+struct AIntMap {
+    IntMap  map;
+};
+
+AIntMap*
+aintMap_new(void)
+{
+    return new AIntMap();
+}
+
+void
+aintMap_free( AIntMap*  map )
+{
+    delete map;
+}
+
+int
+aintMap_getCount( AIntMap* map )
+{
+    return (int)map->map.size();
+}
+
+int
+aintMap_has( AIntMap*  map, int key )
+{
+    return map->map.contains(key);
+}
+
+void*
+aintMap_get( AIntMap*  map, int  key )
+{
+    return map->map.get(key);
+}
+
+void*
+aintMap_getWithDefault( AIntMap*  map, int key, void*  def )
+{
+    return map->map.get(key, def);
+}
+
+void*
+aintMap_set( AIntMap* map, int key, void* value )
+{
+    return map->map.set(key, value);
+}
+
+void*
+aintMap_del( AIntMap* map, int key )
+{
+    return map->map.remove(key);
+}
+
+
+#define ITER_MAGIC  ((void*)(ptrdiff_t)0x17e8af1c)
+
+/* magic[1] holds a heap-allocated IntMap::Iterator, released when the
+ * iteration ends or by aintMapIterator_done().
+ */
+
+void
+aintMapIterator_init( AIntMapIterator* iter, AIntMap* map )
+{
+    AZERO(iter);
+    iter->magic[0] = ITER_MAGIC;
+    iter->magic[1] = new IntMap::Iterator(&map->map);
+}
+
+int
+aintMapIterator_next( AIntMapIterator* iter )
+{
+    IntMap::Iterator*  it;
+
+    if (iter == NULL || iter->magic[0] != ITER_MAGIC)
+        return 0;
+
+    it = static_cast<IntMap::Iterator*>(iter->magic[1]);
+    if (!it->hasNext()) {
+        aintMapIterator_done(iter);
+        return 0;
+    }
+
+    it->next();
+    iter->key   = it->key();
+    iter->value = it->value();
+    return 1;
+}
+
+void
+aintMapIterator_done( AIntMapIterator* iter )
+{
+    if (iter->magic[0] == ITER_MAGIC)
+        delete static_cast<IntMap::Iterator*>(iter->magic[1]);
+    AZERO(iter);
+}
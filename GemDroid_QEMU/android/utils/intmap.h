@@ -19,6 +19,9 @@ ANDROID_BEGIN_HEADER
 /* A simple container that can hold a simple mapping from integers to
  * references. I.e. a dictionary where keys are integers, and values
  * are liberal pointer values (NULL is allowed).
+ *
+ * This is a hash table, so lookups, insertions and deletions take
+ * constant time on average, whatever the number of keys.
  */
 
 typedef struct AIntMap  AIntMap;
@@ -27,12 +30,12 @@ typedef struct AIntMap  AIntMap;
 AIntMap*  aintMap_new(void);
 
 /* Returns the number of keys stored in the map */
-int       aintmap_getCount( AIntMap* map );
+int       aintMap_getCount( AIntMap* map );
 
 /* Returns TRUE if the map has a value for the 'key'. Necessary because
  * NULL is a valid value for the map.
  */
-int       aintmap_has( AIntMap*  map, int key );
+int       aintMap_has( AIntMap*  map, int key );
 
 /* Get the value associated with a 'key', or NULL if not in map */
 void*     aintMap_get( AIntMap*  map, int  key );
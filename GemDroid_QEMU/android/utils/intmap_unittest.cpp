@@ -0,0 +1,73 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/intmap.h"
+
+#include <gtest/gtest.h>
+
+TEST(intmap, SetGetDel) {
+    AIntMap* map = aintMap_new();
+    int a, b;
+
+    EXPECT_EQ(0, aintMap_getCount(map));
+    EXPECT_FALSE(aintMap_set(map, 1, &a));
+    EXPECT_FALSE(aintMap_set(map, 2, NULL));
+    EXPECT_EQ(2, aintMap_getCount(map));
+
+    EXPECT_EQ(&a, aintMap_get(map, 1));
+    EXPECT_TRUE(aintMap_has(map, 2));
+    EXPECT_EQ(NULL, aintMap_getWithDefault(map, 2, &b));
+    EXPECT_EQ(&b, aintMap_getWithDefault(map, 3, &b));
+    EXPECT_FALSE(aintMap_has(map, 3));
+
+    EXPECT_EQ(&a, aintMap_set(map, 1, &b));
+    EXPECT_EQ(&b, aintMap_del(map, 1));
+    EXPECT_EQ(NULL, aintMap_del(map, 1));
+    EXPECT_EQ(1, aintMap_getCount(map));
+
+    aintMap_free(map);
+}
+
+TEST(intmap, Iterator) {
+    const int kCount = 1000;
+    AIntMap* map = aintMap_new();
+    static int values[kCount];
+    for (int n = 0; n < kCount; n++) {
+        aintMap_set(map, n * 7, &values[n]);
+    }
+
+    bool seen[kCount] = { false };
+    int count = 0;
+    AIntMapIterator iter[1];
+    aintMapIterator_init(iter, map);
+    while (aintMapIterator_next(iter)) {
+        int n = iter->key / 7;
+        ASSERT_EQ(n * 7, iter->key);
+        EXPECT_FALSE(seen[n]);
+        EXPECT_EQ(&values[n], iter->value);
+        seen[n] = true;
+        count++;
+    }
+    EXPECT_EQ(kCount, count);
+    // Calling it again after the end is harmless.
+    EXPECT_EQ(0, aintMapIterator_next(iter));
+
+    // Stopping early.
+    aintMapIterator_init(iter, map);
+    EXPECT_EQ(1, aintMapIterator_next(iter));
+    aintMapIterator_done(iter);
+
+    int sum = 0;
+    AINTMAP_FOREACH_KEY(map, key, sum += key);
+    EXPECT_EQ(7 * kCount * (kCount - 1) / 2, sum);
+
+    aintMap_free(map);
+}
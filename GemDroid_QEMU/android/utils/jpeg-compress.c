@@ -16,6 +16,22 @@
 #include "jpeg-compress.h"
 #include "panic.h"
 
+#ifndef _WIN32
+/* NOTE: Use pthreads directly, the emulator's threading headers pull in
+ * type definitions that conflict with jpeglib's on some hosts. */
+#include <pthread.h>
+#include <unistd.h>
+#define JPEG_HAVE_THREADS  1
+#endif
+
+/* Maximum number of strips (and threads) used to compress an image. */
+#define JPEG_MAX_STRIPS         16
+/* Minimum number of lines in a strip, so that the cost of the strip's own
+ * headers and thread hand-off stays negligible. */
+#define JPEG_MIN_STRIP_LINES    128
+/* Height of a MCU row. jpeg_set_defaults() uses 2x2 chroma subsampling. */
+#define JPEG_MCU_LINES          16
+
 /* Implements JPEG destination manager's init_destination routine. */
 static void _on_init_destination(j_compress_ptr cinfo);
 /* Implements JPEG destination manager's empty_output_buffer routine. */
@@ -23,6 +39,8 @@ static boolean _on_empty_output_buffer(j_compress_ptr cinfo);
 /* Implements JPEG destination manager's term_destination routine. */
 static void _on_term_destination(j_compress_ptr cinfo);
 
+typedef struct AJPEGPool AJPEGPool;
+
 /* JPEG compression descriptor. */
 struct AJPEGDesc {
     /* Common JPEG compression destination manager header. */
@@ -35,6 +53,10 @@ struct AJPEGDesc {
     int                             chunk_size;
     /* Size of the header to put in front of the compressed data. */
     int                             header_size;
+    /* Maximum number of threads to use, see jpeg_compressor_set_workers. */
+    int                             num_workers;
+    /* Strip compression state, created on first use. */
+    AJPEGPool*                      pool;
 };
 
 /********************************************************************************
@@ -70,8 +92,10 @@ static boolean
 _on_empty_output_buffer(j_compress_ptr cinfo)
 {
     AJPEGDesc* const dst = (AJPEGDesc*)cinfo->dest;
-    /* Save already compressed data size. */
-    const int accumulated = jpeg_compressor_get_jpeg_size(dst);
+    /* The entire buffer is full. NOTE: Don't use 'next_output_byte' here,
+     * the Huffman encoder works on a private copy of the buffer pointers
+     * and doesn't update them before calling this routine. */
+    const int accumulated = dst->size - dst->header_size;
 
     /* Reallocate output buffer. */
     dst->size += dst->chunk_size;
@@ -95,6 +119,371 @@ _on_term_destination(j_compress_ptr cinfo)
 {
 }
 
+/********************************************************************************
+ *                      Region compression.
+ *******************************************************************************/
+
+/* Describes a framebuffer region to compress. */
+typedef struct AJPEGRegion {
+    int             x, y, w, h;
+    int             num_lines;
+    int             bpp, bpl;
+    const uint8_t*  fb;
+    int             jpeg_quality;
+    int             ydir;
+} AJPEGRegion;
+
+/* Compresses 'lines' lines of a region, starting at its line 'first', into
+ * a standalone JPEG image using 'dsc' as the destination manager. Lines are
+ * read straight from the framebuffer, jpeglib converts them on the fly. */
+static void
+_compress_lines(AJPEGDesc* dsc, const AJPEGRegion* r, int first, int lines)
+{
+    struct jpeg_compress_struct cinfo = {0};
+    struct jpeg_error_mgr err_mgr;
+    const int x_shift = r->x * r->bpp;
+    const int y = r->y + first;
+
+    /*
+     * Initialize compressin information structure, and start compression
+     */
+
+    cinfo.err = jpeg_std_error(&err_mgr);
+    jpeg_create_compress(&cinfo);
+    cinfo.dest = &dsc->common;
+    cinfo.image_width = r->w;
+    cinfo.image_height = lines;
+
+    /* Decode framebuffer's pixel format. There can be only three:
+     * - RGB565,
+     * - RGBA8888,
+     * - RGBX8888 */
+    if (r->bpp == 2) {
+        /* This is RGB565 - most commonly used pixel format for framebuffer. */
+        cinfo.input_components = 2;
+        cinfo.in_color_space = JCS_RGB_565;
+    } else {
+        /* RGBA8888, or RGBX8888 - makes no difference here. */
+        cinfo.input_components = 4;
+        cinfo.in_color_space = JCS_RGBA_8888;
+    }
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, r->jpeg_quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    /* Line by line compress the region. */
+    if (r->ydir >= 0) {
+        while (cinfo.next_scanline < cinfo.image_height) {
+            JSAMPROW rgb = (JSAMPROW)(r->fb + (cinfo.next_scanline + y) * r->bpl + x_shift);
+            jpeg_write_scanlines(&cinfo, (JSAMPARRAY)&rgb, 1);
+        }
+    } else {
+        const int y_shift = r->num_lines - y - 1;
+        while (cinfo.next_scanline < cinfo.image_height) {
+            JSAMPROW rgb = (JSAMPROW)(r->fb + (y_shift - cinfo.next_scanline) * r->bpl + x_shift);
+            jpeg_write_scanlines(&cinfo, (JSAMPARRAY)&rgb, 1);
+        }
+    }
+
+    /* Complete the compression. */
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+}
+
+/* Makes sure that the descriptor's buffer can hold 'size' bytes of
+ * compressed data after its header. */
+static void
+_reserve_buffer(AJPEGDesc* dsc, int size)
+{
+    const int needed = dsc->header_size + size;
+    if (dsc->jpeg_buf == NULL || dsc->size < needed) {
+        dsc->size = ((needed + dsc->chunk_size - 1) / dsc->chunk_size) * dsc->chunk_size;
+        dsc->jpeg_buf = realloc(dsc->jpeg_buf, dsc->size);
+        if (dsc->jpeg_buf == NULL) {
+            APANIC("Unable to allocate %d bytes for JPEG compression", dsc->size);
+        }
+    }
+}
+
+/********************************************************************************
+ *                      Strip compression.
+ *
+ * Large regions are cut into horizontal strips whose height is a multiple
+ * of the MCU height, and each strip is compressed as a standalone image by
+ * a different thread. Since all strips use the same parameters, they share
+ * the same quantization and Huffman tables, and the entropy-coded data of
+ * each strip is exactly what a single compressor would have emitted for
+ * those lines after a restart marker. The final image is then made of the
+ * first strip's headers, a DRI marker making every strip a restart
+ * interval, and the strips' data separated by RSTn markers.
+ *******************************************************************************/
+
+#ifdef JPEG_HAVE_THREADS
+
+struct AJPEGPool {
+    pthread_mutex_t lock;
+    /* Signaled when strips are available to the worker threads. */
+    pthread_cond_t  work_cond;
+    /* Signaled when the last strip of an image is compressed. */
+    pthread_cond_t  done_cond;
+    pthread_t       threads[JPEG_MAX_STRIPS];
+    int             num_threads;
+    int             quit;
+    /* Region being compressed, and its partitioning. */
+    AJPEGRegion     region;
+    int             num_strips;
+    int             strip_lines;
+    int             next_strip;
+    int             done_strips;
+    /* Compressed strips. Their buffers are kept from an image to the next. */
+    AJPEGDesc*      strips[JPEG_MAX_STRIPS];
+};
+
+/* Compresses pending strips until there is none left.
+ * Called with the pool lock held, returns with it held. */
+static void
+_pool_run_strips_locked(AJPEGPool* pool)
+{
+    while (pool->next_strip < pool->num_strips) {
+        const int index = pool->next_strip++;
+        const int first = index * pool->strip_lines;
+        int lines = pool->region.h - first;
+        if (lines > pool->strip_lines) {
+            lines = pool->strip_lines;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+        _compress_lines(pool->strips[index], &pool->region, first, lines);
+        pthread_mutex_lock(&pool->lock);
+
+        if (++pool->done_strips == pool->num_strips) {
+            pthread_cond_signal(&pool->done_cond);
+        }
+    }
+}
+
+static void*
+_pool_thread(void* opaque)
+{
+    AJPEGPool* const pool = (AJPEGPool*)opaque;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->next_strip >= pool->num_strips) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (pool->quit) {
+            break;
+        }
+        _pool_run_strips_locked(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static AJPEGPool*
+_pool_new(AJPEGDesc* dsc, int num_threads)
+{
+    int n;
+    AJPEGPool* pool = (AJPEGPool*)calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        APANIC("Unable to allocate JPEG compression pool.");
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    for (n = 0; n < JPEG_MAX_STRIPS; n++) {
+        pool->strips[n] = jpeg_compressor_create(0, dsc->chunk_size);
+    }
+    for (n = 0; n < num_threads; n++) {
+        if (pthread_create(&pool->threads[n], NULL, _pool_thread, pool) != 0) {
+            break;
+        }
+    }
+    pool->num_threads = n;
+    return pool;
+}
+
+static void
+_pool_free(AJPEGPool* pool)
+{
+    int n;
+
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (n = 0; n < pool->num_threads; n++) {
+        pthread_join(pool->threads[n], NULL);
+    }
+    for (n = 0; n < JPEG_MAX_STRIPS; n++) {
+        jpeg_compressor_destroy(pool->strips[n]);
+    }
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+/* Locates the headers of a compressed strip.
+ * Return:
+ *  Offset of the entropy-coded data, with 'sof' and 'sos' set to the
+ *  offsets of the SOF0 and SOS markers, or -1 if the image can't be parsed.
+ */
+static int
+_find_scan_data(const uint8_t* buf, int size, int* sof, int* sos)
+{
+    int pos = 2;    /* Skip SOI */
+
+    *sof = -1;
+    while (pos + 4 <= size && buf[pos] == 0xFF) {
+        const int marker = buf[pos + 1];
+        const int len = (buf[pos + 2] << 8) | buf[pos + 3];
+        if (marker == 0xC0) {
+            *sof = pos;
+        } else if (marker == 0xDA) {
+            *sos = pos;
+            return (*sof >= 0) ? pos + 2 + len : -1;
+        }
+        pos += 2 + len;
+    }
+    return -1;
+}
+
+/* Assembles the compressed strips into the descriptor's buffer.
+ * Return:
+ *  0 on success, or -1 if strips couldn't be parsed.
+ */
+static int
+_stitch_strips(AJPEGDesc* dsc, AJPEGPool* pool, int restart_interval)
+{
+    const uint8_t* first = pool->strips[0]->jpeg_buf + pool->strips[0]->header_size;
+    int sof, sos, data, total, n;
+    uint8_t* out;
+
+    data = _find_scan_data(first, jpeg_compressor_get_jpeg_size(pool->strips[0]),
+                           &sof, &sos);
+    if (data < 0) {
+        return -1;
+    }
+
+    /* Headers + DRI + SOS + (RSTn + data) per strip + EOI */
+    total = sos + 6 + (data - sos) + 2;
+    for (n = 0; n < pool->num_strips; n++) {
+        total += jpeg_compressor_get_jpeg_size(pool->strips[n]) - data - 2;
+        if (n > 0) {
+            total += 2;
+        }
+    }
+    _reserve_buffer(dsc, total);
+
+    out = dsc->jpeg_buf + dsc->header_size;
+    memcpy(out, first, sos);
+    /* The first strip's SOF0 has the strip's height, patch it. */
+    out[sof + 5] = (uint8_t)(pool->region.h >> 8);
+    out[sof + 6] = (uint8_t)pool->region.h;
+    out += sos;
+
+    *out++ = 0xFF;
+    *out++ = 0xDD;
+    *out++ = 0;
+    *out++ = 4;
+    *out++ = (uint8_t)(restart_interval >> 8);
+    *out++ = (uint8_t)restart_interval;
+
+    memcpy(out, first + sos, data - sos);
+    out += data - sos;
+
+    for (n = 0; n < pool->num_strips; n++) {
+        const AJPEGDesc* strip = pool->strips[n];
+        const int len = jpeg_compressor_get_jpeg_size(strip) - data - 2;
+        if (n > 0) {
+            *out++ = 0xFF;
+            *out++ = 0xD0 + ((n - 1) & 7);
+        }
+        memcpy(out, strip->jpeg_buf + strip->header_size + data, len);
+        out += len;
+    }
+    *out++ = 0xFF;
+    *out++ = 0xD9;
+
+    dsc->common.next_output_byte = out;
+    dsc->common.free_in_buffer = dsc->jpeg_buf + dsc->size - out;
+    return 0;
+}
+
+/* Compresses a region as strips in parallel.
+ * Return:
+ *  0 on success, or -1 if the region should be compressed in one go.
+ */
+static int
+_compress_strips(AJPEGDesc* dsc, const AJPEGRegion* r)
+{
+    AJPEGPool* pool;
+    int num_strips, strip_lines, mcus_per_row, restart_interval;
+
+    num_strips = dsc->num_workers;
+    if (num_strips > r->h / JPEG_MIN_STRIP_LINES) {
+        num_strips = r->h / JPEG_MIN_STRIP_LINES;
+    }
+    if (num_strips < 2) {
+        return -1;
+    }
+    strip_lines = (r->h + num_strips - 1) / num_strips;
+    strip_lines = ((strip_lines + JPEG_MCU_LINES - 1) / JPEG_MCU_LINES) * JPEG_MCU_LINES;
+    num_strips = (r->h + strip_lines - 1) / strip_lines;
+
+    /* The restart interval is a 16-bit count of MCUs. */
+    mcus_per_row = (r->w + JPEG_MCU_LINES - 1) / JPEG_MCU_LINES;
+    restart_interval = mcus_per_row * (strip_lines / JPEG_MCU_LINES);
+    if (restart_interval > 65535) {
+        return -1;
+    }
+
+    if (dsc->pool == NULL) {
+        dsc->pool = _pool_new(dsc, dsc->num_workers - 1);
+    }
+    pool = dsc->pool;
+
+    /* The calling thread compresses strips too. */
+    pthread_mutex_lock(&pool->lock);
+    pool->region      = *r;
+    pool->num_strips  = num_strips;
+    pool->strip_lines = strip_lines;
+    pool->next_strip  = 0;
+    pool->done_strips = 0;
+    pthread_cond_broadcast(&pool->work_cond);
+    _pool_run_strips_locked(pool);
+    while (pool->done_strips < pool->num_strips) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return _stitch_strips(dsc, pool, restart_interval);
+}
+
+#else  /* !JPEG_HAVE_THREADS */
+
+struct AJPEGPool {
+    int unused;
+};
+
+static void
+_pool_free(AJPEGPool* pool)
+{
+}
+
+static int
+_compress_strips(AJPEGDesc* dsc, const AJPEGRegion* r)
+{
+    return -1;
+}
+
+#endif  /* !JPEG_HAVE_THREADS */
+
 /********************************************************************************
  *                      JPEG compressor API.
  *******************************************************************************/
@@ -116,6 +505,8 @@ jpeg_compressor_create(int header_size, int chunk_size)
     dsc->size                       = 0;
     dsc->chunk_size                 = chunk_size;
     dsc->header_size                = header_size;
+    dsc->num_workers                = 1;
+    dsc->pool                       = NULL;
     return dsc;
 }
 
@@ -123,6 +514,7 @@ void
 jpeg_compressor_destroy(AJPEGDesc* dsc)
 {
     if (dsc != NULL) {
+        _pool_free(dsc->pool);
         if (dsc->jpeg_buf != NULL) {
             free(dsc->jpeg_buf);
         }
@@ -149,6 +541,29 @@ jpeg_compressor_get_header_size(const AJPEGDesc* dsc)
      return dsc->header_size;
 }
 
+void
+jpeg_compressor_set_workers(AJPEGDesc* dsc, int num_workers)
+{
+#ifdef JPEG_HAVE_THREADS
+    if (num_workers <= 0) {
+        num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_workers > JPEG_MAX_STRIPS) {
+        num_workers = JPEG_MAX_STRIPS;
+    }
+#else
+    num_workers = 1;
+#endif
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+    if (num_workers != dsc->num_workers) {
+        _pool_free(dsc->pool);
+        dsc->pool = NULL;
+        dsc->num_workers = num_workers;
+    }
+}
+
 void
 jpeg_compressor_compress_fb(AJPEGDesc* dsc,
                             int x, int y, int w, int h, int num_lines,
@@ -156,52 +571,21 @@ jpeg_compressor_compress_fb(AJPEGDesc* dsc,
                             const uint8_t* fb,
                             int jpeg_quality,
                             int ydir){
-    struct jpeg_compress_struct cinfo = {0};
-    struct jpeg_error_mgr err_mgr;
-    const int x_shift = x * bpp;
+    AJPEGRegion r;
 
-    /*
-     * Initialize compressin information structure, and start compression
-     */
-
-    cinfo.err = jpeg_std_error(&err_mgr);
-    jpeg_create_compress(&cinfo);
-    cinfo.dest = &dsc->common;
-    cinfo.image_width = w;
-    cinfo.image_height = h;
-
-    /* Decode framebuffer's pixel format. There can be only three:
-     * - RGB565,
-     * - RGBA8888,
-     * - RGBX8888 */
-    if (bpp == 2) {
-        /* This is RGB565 - most commonly used pixel format for framebuffer. */
-        cinfo.input_components = 2;
-        cinfo.in_color_space = JCS_RGB_565;
-    } else {
-        /* RGBA8888, or RGBX8888 - makes no difference here. */
-        cinfo.input_components = 4;
-        cinfo.in_color_space = JCS_RGBA_8888;
-    }
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, jpeg_quality, TRUE);
-    jpeg_start_compress(&cinfo, TRUE);
+    r.x = x;
+    r.y = y;
+    r.w = w;
+    r.h = h;
+    r.num_lines = num_lines;
+    r.bpp = bpp;
+    r.bpl = bpl;
+    r.fb = fb;
+    r.jpeg_quality = jpeg_quality;
+    r.ydir = ydir;
 
-    /* Line by line compress the region. */
-    if (ydir >= 0) {
-        while (cinfo.next_scanline < cinfo.image_height) {
-            JSAMPROW rgb = (JSAMPROW)(fb + (cinfo.next_scanline + y) * bpl + x_shift);
-            jpeg_write_scanlines(&cinfo, (JSAMPARRAY)&rgb, 1);
-        }
-    } else {
-        const int y_shift = num_lines - y - 1;
-        while (cinfo.next_scanline < cinfo.image_height) {
-            JSAMPROW rgb = (JSAMPROW)(fb + (y_shift - cinfo.next_scanline) * bpl + x_shift);
-            jpeg_write_scanlines(&cinfo, (JSAMPARRAY)&rgb, 1);
-        }
+    if (dsc->num_workers > 1 && _compress_strips(dsc, &r) == 0) {
+        return;
     }
-
-    /* Complete the compression. */
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
+    _compress_lines(dsc, &r, 0, h);
 }
@@ -77,6 +77,20 @@ extern void* jpeg_compressor_get_buffer(const AJPEGDesc* dsc);
  */
 extern int jpeg_compressor_get_header_size(const AJPEGDesc* dsc);
 
+/* Sets the number of threads used to compress large regions.
+ * Regions taller than a few hundred lines are then cut into horizontal
+ * strips that are compressed in parallel, on worker threads owned by the
+ * descriptor and on the calling thread, and assembled into a single JPEG
+ * image with restart markers between strips. The output is a baseline JPEG
+ * that decodes to the same pixels as the one compressed in one go.
+ * Param:
+ *  dsc - Compression descriptor, obtained with jpeg_compressor_create.
+ *  num_workers - Number of threads to use, including the calling one, or 0
+ *      to use one per CPU. 1 (the default) disables parallel compression,
+ *      which is also the case on Windows.
+ */
+extern void jpeg_compressor_set_workers(AJPEGDesc* dsc, int num_workers);
+
 /* Compresses a framebuffer region into JPEG image.
  * Param:
  *  dsc - Compression descriptor, obtained with jpeg_compressor_create.
@@ -91,6 +105,9 @@ extern int jpeg_compressor_get_header_size(const AJPEGDesc* dsc);
  *  ydir - Indicates direction in which lines are arranged in the framebuffer. If
  *      this value is negative, lines are arranged in bottom-up format (i.e. the
  *      bottom line is at the beginning of the buffer).
+ * Lines are read straight from 'fb', without an intermediate RGB copy. The
+ * compressed image replaces the previous one in the descriptor's buffer,
+ * which is only reallocated when it has to grow.
  */
 extern void jpeg_compressor_compress_fb(AJPEGDesc* dsc,
                                         int x, int y, int w, int h,
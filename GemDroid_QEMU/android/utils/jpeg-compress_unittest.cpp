@@ -0,0 +1,212 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include <stdint.h>
+
+#include "android/utils/jpeg-compress.h"
+
+#include "android/base/system/System.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+extern "C" {
+#include "jpeglib.h"
+}
+
+using android::base::System;
+
+namespace {
+
+// Builds a framebuffer with enough detail to exercise the entropy coder.
+std::vector<uint8_t> makeFrame(int width, int height, int bpp) {
+    std::vector<uint8_t> fb(width * height * bpp);
+    uint32_t seed = 12345;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            seed = seed * 1103515245 + 12345;
+            uint8_t noise = (uint8_t)(seed >> 24) & 0x1f;
+            uint8_t r = (uint8_t)(x + noise);
+            uint8_t g = (uint8_t)(y + noise);
+            uint8_t b = (uint8_t)((x ^ y) + noise);
+            uint8_t* p = &fb[(y * width + x) * bpp];
+            if (bpp == 2) {
+                uint16_t pix = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+                memcpy(p, &pix, sizeof(pix));
+            } else {
+                p[0] = r;
+                p[1] = g;
+                p[2] = b;
+                p[3] = 0xff;
+            }
+        }
+    }
+    return fb;
+}
+
+void initSource(j_decompress_ptr) {}
+boolean fillInputBuffer(j_decompress_ptr) { return FALSE; }
+void termSource(j_decompress_ptr) {}
+
+void skipInputData(j_decompress_ptr cinfo, long count) {
+    cinfo->src->next_input_byte += count;
+    cinfo->src->bytes_in_buffer -= count;
+}
+
+// Decompresses the image held by |dsc| into RGB pixels.
+std::vector<uint8_t> decode(const AJPEGDesc* dsc, int* width, int* height) {
+    const uint8_t* data =
+            static_cast<const uint8_t*>(jpeg_compressor_get_buffer(dsc)) +
+            jpeg_compressor_get_header_size(dsc);
+
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr err;
+    jpeg_source_mgr src;
+
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_decompress(&cinfo);
+    src.next_input_byte = data;
+    src.bytes_in_buffer = jpeg_compressor_get_jpeg_size(dsc);
+    src.init_source = initSource;
+    src.fill_input_buffer = fillInputBuffer;
+    src.skip_input_data = skipInputData;
+    src.resync_to_restart = jpeg_resync_to_restart;
+    src.term_source = termSource;
+    cinfo.src = &src;
+
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+
+    std::vector<uint8_t> pixels(cinfo.output_width * cinfo.output_height * 3);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = &pixels[cinfo.output_scanline * cinfo.output_width * 3];
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return pixels;
+}
+
+bool hasRestartMarkers(const AJPEGDesc* dsc) {
+    const uint8_t* data =
+            static_cast<const uint8_t*>(jpeg_compressor_get_buffer(dsc)) +
+            jpeg_compressor_get_header_size(dsc);
+    int size = jpeg_compressor_get_jpeg_size(dsc);
+    for (int n = 0; n + 1 < size; n++) {
+        if (data[n] == 0xff && data[n + 1] == 0xdd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Compresses the same region with and without strips, and checks that
+// both images decode to the same pixels.
+void checkStrips(int width, int height, int bpp,
+                 int x, int y, int w, int h, int ydir) {
+    std::vector<uint8_t> fb = makeFrame(width, height, bpp);
+
+    AJPEGDesc* serial = jpeg_compressor_create(16, 4096);
+    AJPEGDesc* strips = jpeg_compressor_create(16, 4096);
+    jpeg_compressor_set_workers(strips, 4);
+
+    jpeg_compressor_compress_fb(serial, x, y, w, h, height, bpp,
+                                width * bpp, &fb[0], 50, ydir);
+    jpeg_compressor_compress_fb(strips, x, y, w, h, height, bpp,
+                                width * bpp, &fb[0], 50, ydir);
+
+    int serialW, serialH, stripsW, stripsH;
+    std::vector<uint8_t> expected = decode(serial, &serialW, &serialH);
+    std::vector<uint8_t> actual = decode(strips, &stripsW, &stripsH);
+    EXPECT_EQ(w, serialW);
+    EXPECT_EQ(h, serialH);
+    EXPECT_EQ(serialW, stripsW);
+    EXPECT_EQ(serialH, stripsH);
+    EXPECT_TRUE(expected == actual);
+    EXPECT_FALSE(hasRestartMarkers(serial));
+    EXPECT_TRUE(hasRestartMarkers(strips));
+
+    jpeg_compressor_destroy(serial);
+    jpeg_compressor_destroy(strips);
+}
+
+}  // namespace
+
+TEST(jpeg_compress, SmallRegionIsNotSplit) {
+    std::vector<uint8_t> fb = makeFrame(64, 64, 4);
+    AJPEGDesc* dsc = jpeg_compressor_create(0, 1024);
+    jpeg_compressor_set_workers(dsc, 4);
+    jpeg_compressor_compress_fb(dsc, 0, 0, 64, 64, 64, 4, 64 * 4,
+                                &fb[0], 50, 1);
+    EXPECT_FALSE(hasRestartMarkers(dsc));
+    jpeg_compressor_destroy(dsc);
+}
+
+TEST(jpeg_compress, StripsMatchSerialRGBX) {
+    checkStrips(480, 800, 4, 0, 0, 480, 800, 1);
+}
+
+TEST(jpeg_compress, StripsMatchSerialRGB565) {
+    checkStrips(480, 800, 2, 0, 0, 480, 800, 1);
+}
+
+TEST(jpeg_compress, StripsMatchSerialBottomUpSubRegion) {
+    // Odd sizes, so that the last strip is shorter than the others and
+    // the last MCU column is partial.
+    checkStrips(720, 1280, 4, 13, 7, 701, 1203, -1);
+}
+
+TEST(jpeg_compress, BufferIsReused) {
+    std::vector<uint8_t> fb = makeFrame(320, 640, 4);
+    AJPEGDesc* dsc = jpeg_compressor_create(8, 4096);
+    jpeg_compressor_set_workers(dsc, 4);
+
+    jpeg_compressor_compress_fb(dsc, 0, 0, 320, 640, 640, 4, 320 * 4,
+                                &fb[0], 50, 1);
+    void* buffer = jpeg_compressor_get_buffer(dsc);
+    int size = jpeg_compressor_get_jpeg_size(dsc);
+
+    for (int n = 0; n < 5; n++) {
+        jpeg_compressor_compress_fb(dsc, 0, 0, 320, 640, 640, 4, 320 * 4,
+                                    &fb[0], 50, 1);
+        EXPECT_EQ(buffer, jpeg_compressor_get_buffer(dsc));
+        EXPECT_EQ(size, jpeg_compressor_get_jpeg_size(dsc));
+    }
+    jpeg_compressor_destroy(dsc);
+}
+
+// Full-screen frames per second, with and without strips.
+TEST(jpeg_compress, DISABLED_FramesPerSecondBenchmark) {
+    const int kWidth = 1080, kHeight = 1920, kFrames = 50;
+    std::vector<uint8_t> fb = makeFrame(kWidth, kHeight, 4);
+
+    for (int workers = 1; workers <= 8; workers *= 2) {
+        AJPEGDesc* dsc = jpeg_compressor_create(0, 64 * 1024);
+        jpeg_compressor_set_workers(dsc, workers);
+        double start = System::getHighResTimeUs() / 1000.;
+        for (int n = 0; n < kFrames; n++) {
+            jpeg_compressor_compress_fb(dsc, 0, 0, kWidth, kHeight, kHeight,
+                                        4, kWidth * 4, &fb[0], 10, 1);
+        }
+        double elapsed = System::getHighResTimeUs() / 1000. - start;
+        printf("%d worker(s): %.2f ms/frame, %.1f frames/s, %d bytes\n",
+               workers, elapsed / kFrames, kFrames * 1e3 / elapsed,
+               jpeg_compressor_get_jpeg_size(dsc));
+        jpeg_compressor_destroy(dsc);
+    }
+}
@@ -0,0 +1,209 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/startup_cache.h"
+
+#include "android/base/String.h"
+#include "android/base/StringFormat.h"
+#include "android/utils/bufprint.h"
+#include "android/utils/debug.h"
+#include "android/utils/file_data.h"
+#include "android/utils/path.h"
+#include "android/utils/system.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define  D(...)  VERBOSE_PRINT(init,__VA_ARGS__)
+
+using android::base::String;
+using android::base::StringFormat;
+
+// Each entry is stored in a file named after a hash of its input path and
+// kind, which contains a text header followed by the value:
+//
+//     android-startup-cache 1
+//     <kind>
+//     <path>
+//     <file size> <file mtime> <file hash> <value size>
+//     <value bytes>
+//
+// A hash collision only results in a cache miss, since the header must
+// match the input file exactly for the value to be used.
+
+namespace {
+
+const char kMagic[] = "android-startup-cache 1\n";
+
+// Size of the regions at the start and end of a file covered by its hash.
+const size_t kHashedRegionSize = 64 * 1024;
+
+const uint64_t kFnvOffsetBasis = 14695981039346656037ULL;
+const uint64_t kFnvPrime = 1099511628211ULL;
+
+// Cache directory, or NULL if the cache is disabled.
+char* sCacheDir = NULL;
+
+uint64_t fnv1aHash(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t n = 0; n < size; ++n) {
+        hash ^= p[n];
+        hash *= kFnvPrime;
+    }
+    return hash;
+}
+
+// Return the header of the entry for |kind| derived from the current
+// content of |path|, without the value size. Return an empty string if
+// the file cannot be read.
+String entryHeader(const char* path, const char* kind) {
+    struct stat st;
+    if (::stat(path, &st) < 0) {
+        return String();
+    }
+    FILE* file = ::fopen(path, "rb");
+    if (!file) {
+        return String();
+    }
+
+    uint64_t fileSize = static_cast<uint64_t>(st.st_size);
+    uint64_t hash = kFnvOffsetBasis;
+    char* buffer = static_cast<char*>(::malloc(kHashedRegionSize));
+    size_t len = ::fread(buffer, 1, kHashedRegionSize, file);
+    hash = fnv1aHash(hash, buffer, len);
+    if (fileSize > 2 * kHashedRegionSize) {
+        ::fseek(file, -static_cast<long>(kHashedRegionSize), SEEK_END);
+    }
+    len = ::fread(buffer, 1, kHashedRegionSize, file);
+    hash = fnv1aHash(hash, buffer, len);
+    ::free(buffer);
+    ::fclose(file);
+
+    return StringFormat("%s%s\n%s\n%" PRIu64 " %" PRIu64 " %016" PRIx64 " ",
+                        kMagic, kind, path, fileSize,
+                        static_cast<uint64_t>(st.st_mtime), hash);
+}
+
+String entryPath(const char* path, const char* kind) {
+    uint64_t hash = fnv1aHash(kFnvOffsetBasis, path, ::strlen(path) + 1U);
+    hash = fnv1aHash(hash, kind, ::strlen(kind));
+    return StringFormat("%s%s%016" PRIx64, sCacheDir, PATH_SEP, hash);
+}
+
+}  // namespace
+
+void android_startupCache_init(void) {
+    if (::getenv("ANDROID_EMULATOR_NO_STARTUP_CACHE")) {
+        return;
+    }
+    char temp[PATH_MAX];
+    char* end = temp + sizeof(temp);
+    char* p = bufprint_config_file(temp, end, "startup-cache");
+    if (p >= end) {
+        return;
+    }
+    android_startupCache_setDirectory(temp);
+}
+
+void android_startupCache_setDirectory(const char* dir) {
+    AFREE(sCacheDir);
+    sCacheDir = NULL;
+    if (!dir) {
+        return;
+    }
+    if (path_mkdir_if_needed(dir, 0755) < 0) {
+        D("Could not create startup cache directory %s: %s",
+          dir, strerror(errno));
+        return;
+    }
+    sCacheDir = ASTRDUP(dir);
+}
+
+bool android_startupCache_get(const char* path,
+                              const char* kind,
+                              char** out,
+                              size_t* outSize) {
+    *out = NULL;
+    *outSize = 0;
+    if (!sCacheDir) {
+        return false;
+    }
+    String entry = entryPath(path, kind);
+    FileData data = FILE_DATA_INIT;
+    if (fileData_initFromFile(&data, entry.c_str()) < 0) {
+        return false;
+    }
+
+    bool result = false;
+    String header = entryHeader(path, kind);
+    const char* content = reinterpret_cast<const char*>(data.data);
+    if (!header.empty() && data.size > header.size() &&
+        !memcmp(content, header.c_str(), header.size())) {
+        // Parse the value size, which must match the rest of the entry.
+        const char* p = content + header.size();
+        const char* end = content + data.size;
+        size_t size = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            size = size * 10 + (*p++ - '0');
+        }
+        if (p < end && *p == '\n' && static_cast<size_t>(end - p - 1) == size) {
+            *out = static_cast<char*>(::malloc(size ? size : 1U));
+            ::memcpy(*out, p + 1, size);
+            *outSize = size;
+            result = true;
+        }
+    }
+    fileData_done(&data);
+
+    D("Startup cache %s for %s of %s", result ? "hit" : "miss", kind, path);
+    return result;
+}
+
+void android_startupCache_put(const char* path,
+                              const char* kind,
+                              const void* data,
+                              size_t size) {
+    if (!sCacheDir) {
+        return;
+    }
+    String header = entryHeader(path, kind);
+    if (header.empty()) {
+        return;
+    }
+    header += StringFormat("%" PRIu64 "\n", static_cast<uint64_t>(size));
+
+    // Write to a temporary file, then rename it, so that other instances
+    // never see partial entries.
+    String entry = entryPath(path, kind);
+    String temp = StringFormat("%s.%d.tmp", entry.c_str(), (int)getpid());
+    FILE* file = ::fopen(temp.c_str(), "wb");
+    if (!file) {
+        return;
+    }
+    bool ok = ::fwrite(header.c_str(), header.size(), 1, file) == 1 &&
+              (size == 0 || ::fwrite(data, size, 1, file) == 1);
+    ok = (::fclose(file) == 0) && ok;
+#ifdef _WIN32
+    // rename() doesn't replace existing files on Windows.
+    if (ok) {
+        path_delete_file(entry.c_str());
+    }
+#endif
+    if (!ok || ::rename(temp.c_str(), entry.c_str()) < 0) {
+        path_delete_file(temp.c_str());
+    }
+}
@@ -0,0 +1,66 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_STARTUP_CACHE_H
+#define ANDROID_UTILS_STARTUP_CACHE_H
+
+#include "android/utils/compiler.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+ANDROID_BEGIN_HEADER
+
+// A small persistent cache for values that are expensive to derive from
+// large, rarely-modified input files, e.g. the version string of a
+// compressed kernel image, or a file extracted from a ramdisk image.
+//
+// Each value is identified by a |kind| string and the path of its input
+// file, and is only returned while the file keeps the same size,
+// modification time and content hash. The hash only covers the start and
+// end of the file, so checking an entry stays cheap for large files.
+//
+// Entries are stored as one file each in the cache directory, and written
+// atomically, so concurrent emulator instances can share the cache.
+//
+// The cache is disabled until android_startupCache_init() or
+// android_startupCache_setDirectory() is called, so that unit tests and
+// other tools don't touch the user's configuration directory.
+
+// Enable the cache, using the 'startup-cache' sub-directory of the user's
+// configuration directory (e.g. ~/.android). Does nothing if the
+// ANDROID_EMULATOR_NO_STARTUP_CACHE environment variable is defined.
+void android_startupCache_init(void);
+
+// Enable the cache using directory |dir|, which is created if needed, or
+// disable it if |dir| is NULL. Mostly useful for unit-testing.
+void android_startupCache_setDirectory(const char* dir);
+
+// Look for the value of type |kind| derived from the file at |path|.
+// On success, return true and set |*out| to a heap-allocated copy of the
+// value, of |*outSize| bytes, which must be free()-ed by the caller.
+// Return false if the cache is disabled, or there is no valid entry.
+bool android_startupCache_get(const char* path,
+                              const char* kind,
+                              char** out,
+                              size_t* outSize);
+
+// Record |size| bytes at |data| as the value of type |kind| derived from
+// the current content of the file at |path|. Errors are ignored, since
+// the value can always be computed again.
+void android_startupCache_put(const char* path,
+                              const char* kind,
+                              const void* data,
+                              size_t size);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_STARTUP_CACHE_H
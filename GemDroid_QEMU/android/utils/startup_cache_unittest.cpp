@@ -0,0 +1,135 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/startup_cache.h"
+
+#include "android/base/String.h"
+#include "android/base/testing/TestTempDir.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using android::base::String;
+using android::base::TestTempDir;
+
+namespace {
+
+class StartupCacheTest : public ::testing::Test {
+public:
+    StartupCacheTest() : mTempDir("startupcache") {
+        mCacheDir = mTempDir.pathString();
+        mCacheDir += "/cache";
+        mInputPath = mTempDir.pathString();
+        mInputPath += "/input.img";
+    }
+
+    ~StartupCacheTest() {
+        android_startupCache_setDirectory(NULL);
+    }
+
+    void enable() {
+        android_startupCache_setDirectory(mCacheDir.c_str());
+    }
+
+    // Write |size| bytes of input file content, all set to |c| except
+    // for the byte at |offset|, set to |c + 1|.
+    bool writeInput(size_t size, char c, size_t offset) {
+        FILE* file = fopen(mInputPath.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        for (size_t n = 0; n < size; n++) {
+            fputc(n == offset ? c + 1 : c, file);
+        }
+        return fclose(file) == 0;
+    }
+
+    // Return true iff the cache has a value for the input file, and
+    // it is |expected|.
+    bool hasValue(const char* kind, const char* expected) {
+        char* out = NULL;
+        size_t outSize = 0;
+        if (!android_startupCache_get(input(), kind, &out, &outSize)) {
+            EXPECT_FALSE(out);
+            return false;
+        }
+        bool result = (outSize == strlen(expected) &&
+                       !memcmp(out, expected, outSize));
+        free(out);
+        return result;
+    }
+
+    const char* input() const { return mInputPath.c_str(); }
+
+private:
+    TestTempDir mTempDir;
+    String mCacheDir;
+    String mInputPath;
+};
+
+}  // namespace
+
+TEST_F(StartupCacheTest, DisabledByDefault) {
+    ASSERT_TRUE(writeInput(100, 'a', 0));
+    android_startupCache_put(input(), "kind", "value", 5);
+    EXPECT_FALSE(hasValue("kind", "value"));
+}
+
+TEST_F(StartupCacheTest, PutAndGet) {
+    enable();
+    ASSERT_TRUE(writeInput(100, 'a', 0));
+    EXPECT_FALSE(hasValue("kind", "value"));
+
+    android_startupCache_put(input(), "kind", "value", 5);
+    EXPECT_TRUE(hasValue("kind", "value"));
+    EXPECT_FALSE(hasValue("other-kind", "value"));
+
+    android_startupCache_put(input(), "other-kind", "", 0);
+    EXPECT_TRUE(hasValue("other-kind", ""));
+    EXPECT_TRUE(hasValue("kind", "value"));
+
+    // Replace an existing value.
+    android_startupCache_put(input(), "kind", "new value", 9);
+    EXPECT_TRUE(hasValue("kind", "new value"));
+}
+
+TEST_F(StartupCacheTest, MissingInput) {
+    enable();
+    android_startupCache_put(input(), "kind", "value", 5);
+    EXPECT_FALSE(hasValue("kind", "value"));
+}
+
+TEST_F(StartupCacheTest, ModifiedInputInvalidatesEntries) {
+    enable();
+    // Large enough for the content hash to only cover both ends.
+    const size_t kSize = 1024 * 1024;
+    ASSERT_TRUE(writeInput(kSize, 'a', 0));
+    android_startupCache_put(input(), "kind", "value", 5);
+    EXPECT_TRUE(hasValue("kind", "value"));
+
+    // Same size, but a different first byte.
+    ASSERT_TRUE(writeInput(kSize, 'a', 1));
+    EXPECT_FALSE(hasValue("kind", "value"));
+    android_startupCache_put(input(), "kind", "value", 5);
+    EXPECT_TRUE(hasValue("kind", "value"));
+
+    // Same size, but a different last byte.
+    ASSERT_TRUE(writeInput(kSize, 'a', kSize - 1));
+    EXPECT_FALSE(hasValue("kind", "value"));
+    android_startupCache_put(input(), "kind", "value", 5);
+
+    // Different size.
+    ASSERT_TRUE(writeInput(kSize + 1, 'a', kSize - 1));
+    EXPECT_FALSE(hasValue("kind", "value"));
+}
@@ -0,0 +1,180 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/startup_tasks.h"
+
+#include "android/base/containers/PodVector.h"
+#include "android/base/threads/TaskGraph.h"
+#include "android/utils/debug.h"
+#include "android/utils/system.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+using android::base::PodVector;
+using android::base::TaskGraph;
+
+namespace {
+
+// Startup only has a few independent steps, mostly I/O bound.
+const int kNumThreads = 2;
+
+struct Phase {
+    const char* name;
+    int64_t startUs;
+    int64_t endUs;
+};
+
+struct StartupState {
+    explicit StartupState(const char* tracePath_) :
+            graph(kNumThreads),
+            tracePath(tracePath_ ? ASTRDUP(tracePath_) : NULL),
+            phases() {}
+
+    ~StartupState() {
+        AFREE(tracePath);
+    }
+
+    TaskGraph graph;
+    char* tracePath;
+    PodVector<Phase> phases;
+};
+
+// Only accessed from the main thread.
+StartupState* sState = NULL;
+
+void endPhase() {
+    PodVector<Phase>& phases = sState->phases;
+    if (!phases.empty() && phases[phases.size() - 1].endUs < 0) {
+        phases[phases.size() - 1].endUs = sState->graph.elapsedUs();
+    }
+}
+
+// Write one Chrome trace 'complete' event. Main thread phases use thread
+// id 0, and tasks use their worker index + 1.
+void writeTraceEvent(FILE* file,
+                     bool first,
+                     const char* category,
+                     const char* name,
+                     int tid,
+                     int64_t startUs,
+                     int64_t endUs) {
+    fprintf(file,
+            "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+            "\"tid\":%d,\"ts\":%" PRId64 ",\"dur\":%" PRId64 "}",
+            first ? "" : ",", name, category, tid, startUs, endUs - startUs);
+}
+
+void writeTrace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        derror("Could not write startup trace to %s", path);
+        return;
+    }
+    fprintf(file, "{\"traceEvents\":[");
+    bool first = true;
+    for (size_t n = 0; n < sState->phases.size(); ++n) {
+        const Phase& phase = sState->phases[n];
+        writeTraceEvent(file, first, "phase", phase.name, 0,
+                        phase.startUs, phase.endUs);
+        first = false;
+    }
+    for (size_t n = 0; n < sState->graph.size(); ++n) {
+        TaskGraph::TaskInfo info;
+        if (sState->graph.getTaskInfo(static_cast<TaskGraph::TaskId>(n),
+                                      &info)) {
+            writeTraceEvent(file, first, "task", info.name, info.worker + 1,
+                            info.startUs, info.endUs);
+            first = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0) {
+        derror("Could not write startup trace to %s", path);
+    }
+}
+
+}  // namespace
+
+void android_startup_init(const char* tracePath) {
+    if (!sState) {
+        sState = new StartupState(tracePath);
+    }
+}
+
+void android_startup_phase(const char* name) {
+    if (!sState) {
+        return;
+    }
+    endPhase();
+    Phase phase = { name, sState->graph.elapsedUs(), -1 };
+    sState->phases.push_back(phase);
+}
+
+AndroidStartupTask android_startup_addTask(const char* name,
+                                           AndroidStartupTaskFunc func,
+                                           void* opaque,
+                                           const AndroidStartupTask* deps,
+                                           int numDeps) {
+    AndroidStartupTask task = -1;
+    if (sState) {
+        // Negative dependencies are tasks that already ran synchronously.
+        PodVector<TaskGraph::TaskId> validDeps;
+        for (int n = 0; n < numDeps; ++n) {
+            if (deps[n] >= 0) {
+                validDeps.push_back(deps[n]);
+            }
+        }
+        task = sState->graph.add(name, func, opaque, validDeps.begin(),
+                                 validDeps.size());
+    }
+    if (task < 0) {
+        func(opaque);
+    }
+    return task;
+}
+
+void android_startup_waitTask(AndroidStartupTask task) {
+    if (sState && task >= 0) {
+        sState->graph.wait(task);
+    }
+}
+
+void android_startup_finish(void) {
+    if (!sState) {
+        return;
+    }
+    endPhase();
+    sState->graph.waitAll();
+
+    if (VERBOSE_CHECK(init)) {
+        for (size_t n = 0; n < sState->phases.size(); ++n) {
+            const Phase& phase = sState->phases[n];
+            dprint("startup: phase %-20s %8.2f ms -> %8.2f ms", phase.name,
+                   phase.startUs / 1000., phase.endUs / 1000.);
+        }
+        for (size_t n = 0; n < sState->graph.size(); ++n) {
+            TaskGraph::TaskInfo info;
+            if (sState->graph.getTaskInfo(static_cast<TaskGraph::TaskId>(n),
+                                          &info)) {
+                dprint("startup: task  %-20s %8.2f ms -> %8.2f ms", info.name,
+                       info.startUs / 1000., info.endUs / 1000.);
+            }
+        }
+    }
+    if (sState->tracePath) {
+        writeTrace(sState->tracePath);
+    }
+
+    // This stops the worker threads.
+    delete sState;
+    sState = NULL;
+}
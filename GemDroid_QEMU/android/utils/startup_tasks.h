@@ -0,0 +1,67 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_STARTUP_TASKS_H
+#define ANDROID_UTILS_STARTUP_TASKS_H
+
+#include "android/utils/compiler.h"
+
+ANDROID_BEGIN_HEADER
+
+// Support for running independent emulator startup steps in parallel, and
+// for tracing how long each step takes.
+//
+// The main thread calls android_startup_phase() at the start of each of
+// its own sequential phases, and uses android_startup_addTask() to run
+// steps that don't depend on each other on a small pool of worker threads
+// (see android/base/threads/TaskGraph.h). Results of a task must only be
+// used after android_startup_waitTask() returned for it.
+//
+// android_startup_finish() waits for all tasks, prints the timings of all
+// phases and tasks with VERBOSE_init, and optionally writes them to a file
+// in the Chrome trace event format (see chrome://tracing).
+
+// Identifies a startup task. Negative values are invalid.
+typedef int AndroidStartupTask;
+
+// Type of a function run by a startup task.
+typedef void (*AndroidStartupTaskFunc)(void* opaque);
+
+// Start the worker threads. If |tracePath| is not NULL, the timings
+// will be written to this file by android_startup_finish().
+void android_startup_init(const char* tracePath);
+
+// End the current main thread phase, if any, and start a new one named
+// |name|, which must be a string literal.
+void android_startup_phase(const char* name);
+
+// Add a new task named |name| (a string literal) which calls
+// |func(opaque)| once all the |numDeps| tasks in |deps| have completed.
+// Return its identifier. If android_startup_init() was not called, or the
+// dependencies are invalid, |func| is called synchronously instead, and
+// the result is -1. Negative values in |deps| are ignored.
+AndroidStartupTask android_startup_addTask(const char* name,
+                                           AndroidStartupTaskFunc func,
+                                           void* opaque,
+                                           const AndroidStartupTask* deps,
+                                           int numDeps);
+
+// Wait for the completion of |task|. Does nothing if |task| is negative.
+void android_startup_waitTask(AndroidStartupTask task);
+
+// End the current phase, wait for all tasks and stop the worker threads,
+// then report the timings. Must be called before starting the emulation,
+// so that no worker thread is left running.
+void android_startup_finish(void);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_STARTUP_TASKS_H
@@ -0,0 +1,98 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/startup_tasks.h"
+
+#include "android/base/String.h"
+#include "android/base/testing/TestTempDir.h"
+#include "android/utils/file_data.h"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+using android::base::String;
+using android::base::TestTempDir;
+
+namespace {
+
+void increment(void* opaque) {
+    int* counter = static_cast<int*>(opaque);
+    (*counter)++;
+}
+
+// Sets |*value| to 1 + the value of |*input|.
+struct Step {
+    const int* input;
+    int value;
+};
+
+void runStep(void* opaque) {
+    Step* step = static_cast<Step*>(opaque);
+    step->value = *step->input + 1;
+}
+
+}  // namespace
+
+TEST(StartupTasks, WithoutInit) {
+    int counter = 0;
+    EXPECT_EQ(-1, android_startup_addTask("task", increment, &counter,
+                                          NULL, 0));
+    EXPECT_EQ(1, counter);
+    android_startup_waitTask(-1);
+    android_startup_phase("phase");
+    android_startup_finish();
+}
+
+TEST(StartupTasks, TasksAndTrace) {
+    TestTempDir tempDir("startuptasks");
+    String tracePath = tempDir.pathString();
+    tracePath += "/trace.json";
+
+    android_startup_init(tracePath.c_str());
+    android_startup_phase("first-phase");
+
+    const int zero = 0;
+    Step first = { &zero, 0 };
+    Step second = { &first.value, 0 };
+    AndroidStartupTask firstTask =
+            android_startup_addTask("first-task", runStep, &first, NULL, 0);
+    EXPECT_LE(0, firstTask);
+    // Negative dependencies are ignored.
+    AndroidStartupTask deps[2] = { -1, firstTask };
+    AndroidStartupTask secondTask =
+            android_startup_addTask("second-task", runStep, &second, deps, 2);
+    EXPECT_LT(firstTask, secondTask);
+
+    android_startup_phase("second-phase");
+    android_startup_waitTask(secondTask);
+    EXPECT_EQ(1, first.value);
+    EXPECT_EQ(2, second.value);
+    android_startup_finish();
+
+    FileData data = FILE_DATA_INIT;
+    ASSERT_EQ(0, fileData_initFromFile(&data, tracePath.c_str()));
+    String trace(reinterpret_cast<const char*>(data.data), data.size);
+    fileData_done(&data);
+
+    EXPECT_EQ(0, strncmp("{\"traceEvents\":[", trace.c_str(), 16));
+    EXPECT_TRUE(strstr(trace.c_str(), "\"name\":\"first-phase\""));
+    EXPECT_TRUE(strstr(trace.c_str(), "\"name\":\"second-phase\""));
+    EXPECT_TRUE(strstr(trace.c_str(), "\"name\":\"first-task\""));
+    EXPECT_TRUE(strstr(trace.c_str(), "\"name\":\"second-task\""));
+    EXPECT_TRUE(strstr(trace.c_str(), "]}\n"));
+
+    // Everything runs synchronously again after android_startup_finish().
+    int counter = 0;
+    EXPECT_EQ(-1, android_startup_addTask("task", increment, &counter,
+                                          NULL, 0));
+    EXPECT_EQ(1, counter);
+}
@@ -28,6 +28,7 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #endif
+#include <zlib.h>
 #include "config.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
@@ -37,11 +38,15 @@
 #include "hw/pci/pci.h"
 #include "hw/audiodev.h"
 #include "sysemu/kvm.h"
+#include "exec/hax.h"
 #include "migration/migration.h"
 #include "migration/qemu-file.h"
 #include "net/net.h"
 #include "exec/gdbstub.h"
 #include "exec/ram_addr.h"
+#include "qemu/host-utils.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
 #include "hw/i386/smbios.h"
 
 #ifdef TARGET_SPARC
@@ -94,15 +99,38 @@ const uint32_t arch_type = QEMU_ARCH;
 #define RAM_SAVE_FLAG_PAGE     0x08
 #define RAM_SAVE_FLAG_EOS      0x10
 #define RAM_SAVE_FLAG_CONTINUE 0x20
+/* Version 5 and later */
+#define RAM_SAVE_FLAG_COMPRESS_PAGE 0x100 /* zlib stream of contiguous pages */
+#define RAM_SAVE_FLAG_DEDUP         0x200 /* copy of an earlier page */
 
-static int is_dup_page(uint8_t *page, uint8_t ch)
+/* Current version of the "ram" section, see ram_load() for older ones */
+#define RAM_SAVE_VERSION 5
+
+/* Number of contiguous pages compressed as a single zlib stream */
+#define RAM_COMPRESS_RUN_PAGES   64
+#define RAM_COMPRESS_RUN_SIZE    (RAM_COMPRESS_RUN_PAGES * TARGET_PAGE_SIZE)
+#define RAM_COMPRESS_MAX_THREADS 8
+/* Compression jobs in flight per worker thread */
+#define RAM_COMPRESS_JOBS_PER_THREAD 2
+
+/* Size of the table used to find duplicate pages, in entries */
+#define RAM_DEDUP_TABLE_BITS 18
+#define RAM_DEDUP_TABLE_SIZE (1 << RAM_DEDUP_TABLE_BITS)
+
+static int is_dup_page(uint8_t *page)
 {
-    uint32_t val = ch << 24 | ch << 16 | ch << 8 | ch;
-    uint32_t *array = (uint32_t *)page;
+    VECTYPE *p = (VECTYPE *)page;
+    VECTYPE val = SPLAT(page);
+    const VECTYPE zero = (VECTYPE){0};
     int i;
 
-    for (i = 0; i < (TARGET_PAGE_SIZE / 4); i++) {
-        if (array[i] != val) {
+    /* OR together the differences of 4 vectors at a time so that the
+     * common case of a non-uniform page only takes one branch per 64 bytes
+     * on SSE2 hosts. */
+    for (i = 0; i < TARGET_PAGE_SIZE / sizeof(VECTYPE); i += 4) {
+        VECTYPE diff = (p[i] ^ val) | (p[i + 1] ^ val) |
+                       (p[i + 2] ^ val) | (p[i + 3] ^ val);
+        if (!ALL_EQ(diff, zero)) {
             return 0;
         }
     }
@@ -110,67 +138,968 @@ static int is_dup_page(uint8_t *page, uint8_t ch)
     return 1;
 }
 
+/*
+ * Parallel (de)compression of page runs.
+ *
+ * A batch of jobs is handed to a small pool of worker threads, and the
+ * calling thread takes part in the work too. ram_compress_run() returns
+ * once every job of the batch is done, so the stream itself is only ever
+ * touched from the migration thread.
+ */
+
+typedef struct RamCompressJob {
+    RAMBlock *block;
+    ram_addr_t offset;
+    int npages;
+    uint8_t *host;          /* guest pages */
+    const uint8_t *src;     /* save: pages to compress, host or a copy;
+                               load: compressed data */
+    uint8_t *in;            /* save: private copy of the pages;
+                               load: buffer for the compressed data */
+    unsigned long in_len;
+    uint8_t *out;           /* save: compressed data */
+    unsigned long out_len;
+    int decompress;
+    int ret;                /* zlib status */
+} RamCompressJob;
+
+static struct {
+    int nthreads;
+    int max_jobs;
+    QemuThread *threads;
+    QemuMutex lock;
+    QemuCond work_cond;
+    QemuCond done_cond;
+    RamCompressJob *jobs;
+    int njobs;
+    int next_job;
+    int pending;
+} ram_compress;
+
+static void ram_compress_do_job(RamCompressJob *job)
+{
+    if (job->decompress) {
+        uLongf len = job->npages * TARGET_PAGE_SIZE;
+
+        job->ret = uncompress(job->host, &len, job->src, job->in_len);
+        if (job->ret == Z_OK && len != job->npages * TARGET_PAGE_SIZE) {
+            job->ret = Z_DATA_ERROR;
+        }
+    } else {
+        uLongf len = compressBound(RAM_COMPRESS_RUN_SIZE);
+
+        job->ret = compress2(job->out, &len, job->src,
+                             job->npages * TARGET_PAGE_SIZE, Z_BEST_SPEED);
+        job->out_len = len;
+    }
+}
+
+/* Runs jobs from the current batch until there are none left to start.
+ * Called with ram_compress.lock held. */
+static void ram_compress_work(void)
+{
+    while (ram_compress.next_job < ram_compress.njobs) {
+        RamCompressJob *job = &ram_compress.jobs[ram_compress.next_job++];
+
+        qemu_mutex_unlock(&ram_compress.lock);
+        ram_compress_do_job(job);
+        qemu_mutex_lock(&ram_compress.lock);
+
+        if (--ram_compress.pending == 0) {
+            qemu_cond_signal(&ram_compress.done_cond);
+        }
+    }
+}
+
+static void *ram_compress_thread(void *opaque)
+{
+    qemu_mutex_lock(&ram_compress.lock);
+    for (;;) {
+        while (ram_compress.next_job >= ram_compress.njobs) {
+            qemu_cond_wait(&ram_compress.work_cond, &ram_compress.lock);
+        }
+        ram_compress_work();
+    }
+    return NULL;
+}
+
+static int ram_compress_host_cpus(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    return sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+static void ram_compress_init(void)
+{
+    int i;
+
+    if (ram_compress.jobs) {
+        return;
+    }
+
+    ram_compress.nthreads = ram_compress_host_cpus();
+    if (ram_compress.nthreads < 1) {
+        ram_compress.nthreads = 1;
+    } else if (ram_compress.nthreads > RAM_COMPRESS_MAX_THREADS) {
+        ram_compress.nthreads = RAM_COMPRESS_MAX_THREADS;
+    }
+    ram_compress.max_jobs = ram_compress.nthreads * RAM_COMPRESS_JOBS_PER_THREAD;
+
+    ram_compress.jobs = g_malloc0(ram_compress.max_jobs *
+                                  sizeof(ram_compress.jobs[0]));
+    for (i = 0; i < ram_compress.max_jobs; i++) {
+        ram_compress.jobs[i].in =
+            g_malloc(compressBound(RAM_COMPRESS_RUN_SIZE));
+        ram_compress.jobs[i].out =
+            g_malloc(compressBound(RAM_COMPRESS_RUN_SIZE));
+    }
+
+    qemu_mutex_init(&ram_compress.lock);
+    qemu_cond_init(&ram_compress.work_cond);
+    qemu_cond_init(&ram_compress.done_cond);
+
+    /* The migration thread is the last worker */
+    ram_compress.threads = g_malloc0((ram_compress.nthreads - 1) *
+                                     sizeof(QemuThread));
+    for (i = 0; i < ram_compress.nthreads - 1; i++) {
+        qemu_thread_create(&ram_compress.threads[i], ram_compress_thread,
+                           NULL, QEMU_THREAD_DETACHED);
+    }
+}
+
+/* Processes the first njobs entries of ram_compress.jobs in parallel */
+static void ram_compress_run(int njobs)
+{
+    if (njobs == 0) {
+        return;
+    }
+
+    qemu_mutex_lock(&ram_compress.lock);
+    ram_compress.njobs = njobs;
+    ram_compress.next_job = 0;
+    ram_compress.pending = njobs;
+    qemu_cond_broadcast(&ram_compress.work_cond);
+
+    ram_compress_work();
+    while (ram_compress.pending > 0) {
+        qemu_cond_wait(&ram_compress.done_cond, &ram_compress.lock);
+    }
+    ram_compress.njobs = 0;
+    ram_compress.next_job = 0;
+    qemu_mutex_unlock(&ram_compress.lock);
+}
+
+/*
+ * Lazy restore.
+ *
+ * When enabled, loading a snapshot only records where the page data of each
+ * RAM record lives (a private copy of the compressed run or raw page, or the
+ * fill byte of a uniform page) and revokes access to the target pages. The
+ * guest can resume right after the stream has been read; the first access
+ * to a page that is still missing faults, and the SIGSEGV handler fills the
+ * whole run containing that page before returning. Meanwhile, a timer on
+ * the main loop decompresses the remaining runs in batches on the
+ * compression pool, so that everything is resident shortly after resume.
+ *
+ * This relies on the guest RAM being accessed from the main thread only,
+ * which is the case with TCG. It is disabled with KVM or HAX (the
+ * hypervisor would see the protected pages), on Windows, and when the host
+ * page size differs from the target one. Code that passes guest memory to
+ * the kernel (e.g. to a socket) must call ram_lazy_touch() first since the
+ * kernel returns EFAULT instead of faulting.
+ */
+
+/* Delay between two prefetch batches, in ms */
+#define RAM_LAZY_PREFETCH_DELAY_MS 1
+/* Payload copies are allocated out of chunks of this size */
+#define RAM_LAZY_CHUNK_SIZE (4 * 1024 * 1024)
+
+int ram_lazy_pending;
+
+#ifndef _WIN32
+#include <signal.h>
+
+typedef struct RamLazyRun {
+    uint8_t *host;
+    const uint8_t *data;    /* zlib stream, or raw pages if len is 0 */
+    uint32_t len;
+    uint16_t npages;
+    uint8_t done;
+    uint8_t fill;           /* byte of a uniform page, if data is NULL */
+} RamLazyRun;
+
+typedef struct RamLazyBlock {
+    uint8_t *host;
+    ram_addr_t length;
+    uint32_t *page_run;     /* run index + 1 for each page, 0 if resident */
+} RamLazyBlock;
+
+static struct {
+    int enabled;
+    int installed;
+    RamLazyBlock *blocks;
+    int nblocks;
+    RamLazyRun *runs;
+    int nruns;
+    int runs_size;
+    int next_prefetch;
+    uint8_t **chunks;
+    int nchunks;
+    size_t chunk_used;
+    QEMUTimer *timer;
+    struct sigaction old_segv;
+#ifdef __APPLE__
+    struct sigaction old_bus;
+#endif
+} ram_lazy;
+
+/* inflate() may be called from the signal handler, so it must not touch
+ * the heap: its state and window come from this arena instead. */
+static uint8_t ram_lazy_zarena[64 * 1024] __attribute__((aligned(16)));
+static size_t ram_lazy_zarena_used;
+
+static voidpf ram_lazy_zalloc(voidpf opaque, uInt items, uInt size)
+{
+    size_t n = ((size_t)items * size + 15) & ~(size_t)15;
+
+    if (ram_lazy_zarena_used + n > sizeof(ram_lazy_zarena)) {
+        return Z_NULL;
+    }
+    ram_lazy_zarena_used += n;
+    return ram_lazy_zarena + ram_lazy_zarena_used - n;
+}
+
+static void ram_lazy_zfree(voidpf opaque, voidpf address)
+{
+}
+
+static int ram_lazy_inflate(uint8_t *dst, size_t dst_len,
+                            const uint8_t *src, size_t src_len)
+{
+    z_stream s;
+    int ret;
+
+    memset(&s, 0, sizeof(s));
+    s.zalloc = ram_lazy_zalloc;
+    s.zfree = ram_lazy_zfree;
+    ram_lazy_zarena_used = 0;
+    if (inflateInit(&s) != Z_OK) {
+        return -1;
+    }
+    s.next_in = (Bytef *)src;
+    s.avail_in = src_len;
+    s.next_out = dst;
+    s.avail_out = dst_len;
+    ret = inflate(&s, Z_FINISH);
+    inflateEnd(&s);
+    return (ret == Z_STREAM_END && s.total_out == dst_len) ? 0 : -1;
+}
+
+/* Reports a fatal error. Only uses async-signal-safe functions, since it
+ * can be called from the signal handler. */
+static void ram_lazy_fatal(const char *msg)
+{
+    ssize_t ret = write(STDERR_FILENO, msg, strlen(msg));
+
+    (void)ret;
+    abort();
+}
+
+static void ram_lazy_protect(uint8_t *host, int npages, int prot)
+{
+    if (mprotect(host, npages * TARGET_PAGE_SIZE, prot) < 0) {
+        ram_lazy_fatal("ram_lazy: mprotect failed\n");
+    }
+}
+
+static RamLazyBlock *ram_lazy_find_block(const uint8_t *host)
+{
+    int i;
+
+    for (i = 0; i < ram_lazy.nblocks; i++) {
+        RamLazyBlock *b = &ram_lazy.blocks[i];
+
+        if (host >= b->host && host < b->host + b->length) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+/* Marks a run resident, once its pages hold the right data */
+static void ram_lazy_run_done(RamLazyRun *run)
+{
+    RamLazyBlock *b = ram_lazy_find_block(run->host);
+    unsigned long page = (run->host - b->host) >> TARGET_PAGE_BITS;
+    int i;
+
+    for (i = 0; i < run->npages; i++) {
+        b->page_run[page + i] = 0;
+    }
+    run->done = 1;
+    ram_lazy_pending--;
+}
+
+/* Fills a run from its saved data. Safe to call from the signal handler. */
+static void ram_lazy_fill(RamLazyRun *run)
+{
+    size_t size = run->npages * TARGET_PAGE_SIZE;
+
+    ram_lazy_protect(run->host, run->npages, PROT_READ | PROT_WRITE);
+    if (!run->data) {
+        memset(run->host, run->fill, size);
+        if (run->fill == 0) {
+            qemu_madvise(run->host, size, QEMU_MADV_DONTNEED);
+        }
+    } else if (run->len == 0) {
+        memcpy(run->host, run->data, size);
+    } else if (ram_lazy_inflate(run->host, size, run->data, run->len) < 0) {
+        ram_lazy_fatal("ram_lazy: corrupted compressed page run\n");
+    }
+    ram_lazy_run_done(run);
+}
+
+/* Returns the pending run holding the page at host, or NULL */
+static RamLazyRun *ram_lazy_find_run(const uint8_t *host)
+{
+    RamLazyBlock *b = ram_lazy_find_block(host);
+    uint32_t run;
+
+    if (!b || !b->page_run) {
+        return NULL;
+    }
+    run = b->page_run[(host - b->host) >> TARGET_PAGE_BITS];
+    return run ? &ram_lazy.runs[run - 1] : NULL;
+}
+
+static void ram_lazy_sigsegv(int sig, siginfo_t *info, void *ctx)
+{
+    struct sigaction *old = &ram_lazy.old_segv;
+    RamLazyRun *run;
+
+    if (ram_lazy_pending &&
+        (run = ram_lazy_find_run(info->si_addr)) != NULL) {
+        ram_lazy_fill(run);
+        return;
+    }
+
+#ifdef __APPLE__
+    if (sig == SIGBUS) {
+        old = &ram_lazy.old_bus;
+    }
+#endif
+    /* Not ours: hand the fault over to whoever was there before */
+    if (old->sa_flags & SA_SIGINFO) {
+        old->sa_sigaction(sig, info, ctx);
+    } else if (old->sa_handler == SIG_DFL || old->sa_handler == SIG_IGN) {
+        /* The access is restarted and faults again with the old action */
+        sigaction(sig, old, NULL);
+    } else {
+        old->sa_handler(sig);
+    }
+}
+
+static void ram_lazy_install(void)
+{
+    struct sigaction act;
+
+    if (ram_lazy.installed) {
+        return;
+    }
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = ram_lazy_sigsegv;
+    act.sa_flags = SA_SIGINFO;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGSEGV, &act, &ram_lazy.old_segv);
+#ifdef __APPLE__
+    /* Darwin reports accesses to PROT_NONE pages as SIGBUS */
+    sigaction(SIGBUS, &act, &ram_lazy.old_bus);
+#endif
+    ram_lazy.installed = 1;
+}
+
+/* Drops all bookkeeping. Every run must be resident or unprotected. */
+static void ram_lazy_release(void)
+{
+    int i;
+
+    if (ram_lazy.installed) {
+        sigaction(SIGSEGV, &ram_lazy.old_segv, NULL);
+#ifdef __APPLE__
+        sigaction(SIGBUS, &ram_lazy.old_bus, NULL);
+#endif
+        ram_lazy.installed = 0;
+    }
+    if (ram_lazy.timer) {
+        timer_del(ram_lazy.timer);
+    }
+    for (i = 0; i < ram_lazy.nblocks; i++) {
+        g_free(ram_lazy.blocks[i].page_run);
+    }
+    g_free(ram_lazy.blocks);
+    ram_lazy.blocks = NULL;
+    ram_lazy.nblocks = 0;
+    for (i = 0; i < ram_lazy.nchunks; i++) {
+        g_free(ram_lazy.chunks[i]);
+    }
+    g_free(ram_lazy.chunks);
+    ram_lazy.chunks = NULL;
+    ram_lazy.nchunks = 0;
+    ram_lazy.chunk_used = 0;
+    g_free(ram_lazy.runs);
+    ram_lazy.runs = NULL;
+    ram_lazy.nruns = ram_lazy.runs_size = 0;
+    ram_lazy.next_prefetch = 0;
+    ram_lazy_pending = 0;
+}
+
+/* Fills the next batch of pending runs. Returns 1 when none are left. */
+static int ram_lazy_prefetch_batch(void)
+{
+    int ids[ram_compress.max_jobs];
+    int njobs = 0, i;
+
+    while (ram_lazy.next_prefetch < ram_lazy.nruns &&
+           njobs < ram_compress.max_jobs) {
+        int id = ram_lazy.next_prefetch++;
+        RamLazyRun *run = &ram_lazy.runs[id];
+        RamCompressJob *job;
+
+        if (run->done) {
+            continue;
+        }
+        if (run->len == 0) {
+            ram_lazy_fill(run);
+            continue;
+        }
+        /* Decompress off to the side: the pages stay protected until the
+         * data is complete. */
+        job = &ram_compress.jobs[njobs];
+        job->host = job->out;
+        job->src = run->data;
+        job->in_len = run->len;
+        job->npages = run->npages;
+        job->decompress = 1;
+        ids[njobs++] = id;
+    }
+
+    ram_compress_run(njobs);
+    for (i = 0; i < njobs; i++) {
+        RamLazyRun *run = &ram_lazy.runs[ids[i]];
+
+        if (ram_compress.jobs[i].ret != Z_OK) {
+            ram_lazy_fatal("ram_lazy: corrupted compressed page run\n");
+        }
+        ram_lazy_protect(run->host, run->npages, PROT_READ | PROT_WRITE);
+        memcpy(run->host, ram_compress.jobs[i].out,
+               run->npages * TARGET_PAGE_SIZE);
+        ram_lazy_run_done(run);
+    }
+    return ram_lazy.next_prefetch >= ram_lazy.nruns;
+}
+
+static void ram_lazy_prefetch(void *opaque)
+{
+    if (ram_lazy_prefetch_batch()) {
+        ram_lazy_release();
+        return;
+    }
+    timer_mod(ram_lazy.timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+              RAM_LAZY_PREFETCH_DELAY_MS);
+}
+
+void ram_set_lazy_load(int enable)
+{
+    ram_lazy.enabled = enable;
+}
+
+/* Called for the block list of a new stream. Returns 1 if its pages can be
+ * loaded lazily. */
+static int ram_lazy_start(void)
+{
+    RAMBlock *block;
+    int i = 0;
+
+    /* Anything left from an earlier load is about to be overwritten */
+    for (i = 0; i < ram_lazy.nruns; i++) {
+        if (!ram_lazy.runs[i].done) {
+            ram_lazy_protect(ram_lazy.runs[i].host, ram_lazy.runs[i].npages,
+                             PROT_READ | PROT_WRITE);
+        }
+    }
+    ram_lazy_release();
+
+    if (!ram_lazy.enabled || kvm_enabled() || hax_enabled() ||
+        getpagesize() != TARGET_PAGE_SIZE) {
+        return 0;
+    }
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        ram_lazy.nblocks++;
+    }
+    ram_lazy.blocks = g_malloc0(ram_lazy.nblocks * sizeof(ram_lazy.blocks[0]));
+    i = 0;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        ram_lazy.blocks[i].host = block->host;
+        ram_lazy.blocks[i].length = block->length;
+        i++;
+    }
+    if (!ram_lazy.timer) {
+        ram_lazy.timer = timer_new_ms(QEMU_CLOCK_REALTIME, ram_lazy_prefetch,
+                                      NULL);
+    }
+    ram_lazy_install();
+    return 1;
+}
+
+/*
+ * Registers a run of npages pages at host, with no data yet, and revokes
+ * access to them. Returns NULL if host is not guest RAM.
+ */
+static RamLazyRun *ram_lazy_new_run(uint8_t *host, int npages)
+{
+    RamLazyBlock *b = ram_lazy_find_block(host);
+    unsigned long page;
+    RamLazyRun *run;
+    int i;
+
+    if (!b || host + npages * TARGET_PAGE_SIZE > b->host + b->length) {
+        return NULL;
+    }
+    /* A later record always wins over an earlier one */
+    ram_lazy_populate(host, npages * TARGET_PAGE_SIZE);
+
+    if (ram_lazy.nruns == ram_lazy.runs_size) {
+        ram_lazy.runs_size = ram_lazy.runs_size ? ram_lazy.runs_size * 2 : 1024;
+        ram_lazy.runs = g_realloc(ram_lazy.runs, ram_lazy.runs_size *
+                                  sizeof(ram_lazy.runs[0]));
+    }
+    run = &ram_lazy.runs[ram_lazy.nruns++];
+    run->host = host;
+    run->data = NULL;
+    run->len = 0;
+    run->npages = npages;
+    run->done = 0;
+    run->fill = 0;
+
+    if (!b->page_run) {
+        b->page_run = g_malloc0((b->length >> TARGET_PAGE_BITS) *
+                                sizeof(b->page_run[0]));
+    }
+    page = (host - b->host) >> TARGET_PAGE_BITS;
+    for (i = 0; i < npages; i++) {
+        b->page_run[page + i] = ram_lazy.nruns;
+    }
+    if (ram_lazy_pending++ == 0) {
+        timer_mod(ram_lazy.timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+    }
+    ram_lazy_protect(host, npages, PROT_NONE);
+    return run;
+}
+
+/*
+ * Registers npages pages at host to be filled later from len bytes of data
+ * (a zlib stream, or raw pages if len is 0). Returns the buffer where the
+ * caller must store the data, or NULL if host is not guest RAM.
+ */
+static uint8_t *ram_lazy_add_run(uint8_t *host, int npages, uint32_t len)
+{
+    size_t size = len ? len : npages * TARGET_PAGE_SIZE;
+    RamLazyRun *run = ram_lazy_new_run(host, npages);
+    uint8_t *data;
+
+    if (!run) {
+        return NULL;
+    }
+    if (ram_lazy.nchunks == 0 ||
+        ram_lazy.chunk_used + size > RAM_LAZY_CHUNK_SIZE) {
+        ram_lazy.chunks = g_realloc(ram_lazy.chunks, (ram_lazy.nchunks + 1) *
+                                    sizeof(ram_lazy.chunks[0]));
+        ram_lazy.chunks[ram_lazy.nchunks++] = g_malloc(RAM_LAZY_CHUNK_SIZE);
+        ram_lazy.chunk_used = 0;
+    }
+    data = ram_lazy.chunks[ram_lazy.nchunks - 1] + ram_lazy.chunk_used;
+    ram_lazy.chunk_used += size;
+
+    run->data = data;
+    run->len = len;
+    return data;
+}
+
+/* Registers the page at host to be filled later with ch. Returns -1 if host
+ * is not guest RAM. */
+static int ram_lazy_add_fill(uint8_t *host, uint8_t ch)
+{
+    RamLazyRun *run = ram_lazy_new_run(host, 1);
+
+    if (!run) {
+        return -1;
+    }
+    run->fill = ch;
+    return 0;
+}
+
+/* Makes the guest memory in [host, host + size) resident, if it is still
+ * waiting to be restored. */
+void ram_lazy_populate(void *host, size_t size)
+{
+    uint8_t *p = (uint8_t *)((uintptr_t)host & TARGET_PAGE_MASK);
+    uint8_t *end = (uint8_t *)host + size;
+
+    for (; p < end && ram_lazy_pending; p += TARGET_PAGE_SIZE) {
+        RamLazyRun *run = ram_lazy_find_run(p);
+
+        if (run) {
+            ram_lazy_fill(run);
+        }
+    }
+}
+
+/* Makes all guest memory resident, e.g. before saving it */
+static void ram_lazy_populate_all(void)
+{
+    if (!ram_lazy_pending) {
+        return;
+    }
+    while (!ram_lazy_prefetch_batch()) {
+    }
+    ram_lazy_release();
+}
+
+#else  /* _WIN32 */
+
+void ram_set_lazy_load(int enable)
+{
+}
+
+void ram_lazy_populate(void *host, size_t size)
+{
+}
+
+static int ram_lazy_start(void)
+{
+    return 0;
+}
+
+static uint8_t *ram_lazy_add_run(uint8_t *host, int npages, uint32_t len)
+{
+    return NULL;
+}
+
+static int ram_lazy_add_fill(uint8_t *host, uint8_t ch)
+{
+    return -1;
+}
+
+static void ram_lazy_populate_all(void)
+{
+}
+
+#endif  /* _WIN32 */
+
+/*
+ * Duplicate page detection.
+ *
+ * While the VM is stopped (i.e. when taking a snapshot), every page that is
+ * sent is hashed and remembered, so that later identical pages of the same
+ * RAM block can be sent as a reference to the first copy. This is only
+ * valid if the source page cannot change after it was sent, hence the
+ * restriction to stopped VMs.
+ */
+
+typedef struct RamDedupEntry {
+    uint64_t hash;
+    ram_addr_t addr;        /* RAM address of the first copy, 0 if unused */
+} RamDedupEntry;
+
+typedef struct RamDedupRef {
+    RAMBlock *block;
+    ram_addr_t offset;
+    ram_addr_t src_offset;
+} RamDedupRef;
+
+static RamDedupEntry *ram_dedup_table;
+static int ram_dedup_count;
+
+/* References whose source page is still part of the current batch */
+static RamDedupRef *ram_dedup_refs;
+static int ram_dedup_nrefs;
+
+static uint64_t ram_page_hash(const uint8_t *page)
+{
+    const uint64_t *p = (const uint64_t *)page;
+    uint64_t h0 = 0, h1 = 0, h2 = 0, h3 = 0;
+    int i;
+
+    /* 4 independent multiply chains keep the hash off the critical path */
+    for (i = 0; i < TARGET_PAGE_SIZE / 8; i += 4) {
+        h0 = (h0 ^ p[i + 0]) * 0x9e3779b97f4a7c15ULL;
+        h1 = (h1 ^ p[i + 1]) * 0xc2b2ae3d27d4eb4fULL;
+        h2 = (h2 ^ p[i + 2]) * 0x165667b19e3779f9ULL;
+        h3 = (h3 ^ p[i + 3]) * 0x27d4eb2f165667c5ULL;
+    }
+    h0 ^= (h1 >> 17) ^ (h1 << 47);
+    h2 ^= (h3 >> 29) ^ (h3 << 35);
+    return (h0 ^ (h2 >> 31)) * 0x9e3779b97f4a7c15ULL;
+}
+
+static void ram_dedup_start(void)
+{
+    if (!ram_dedup_table) {
+        ram_dedup_table = g_malloc(RAM_DEDUP_TABLE_SIZE *
+                                   sizeof(ram_dedup_table[0]));
+        ram_dedup_refs = g_malloc(ram_compress.max_jobs *
+                                  RAM_COMPRESS_RUN_PAGES *
+                                  sizeof(ram_dedup_refs[0]));
+    }
+    memset(ram_dedup_table, 0,
+           RAM_DEDUP_TABLE_SIZE * sizeof(ram_dedup_table[0]));
+    ram_dedup_count = 0;
+    ram_dedup_nrefs = 0;
+}
+
+static void ram_dedup_stop(void)
+{
+    g_free(ram_dedup_table);
+    g_free(ram_dedup_refs);
+    ram_dedup_table = NULL;
+    ram_dedup_refs = NULL;
+}
+
+/*
+ * Looks the page at offset in block up. Returns 1 and sets *src_offset if
+ * an identical page of the same block was sent before; otherwise records
+ * the page (while there is room) and returns 0.
+ */
+static int ram_dedup_find(RAMBlock *block, ram_addr_t offset,
+                          ram_addr_t *src_offset)
+{
+    uint8_t *p = block->host + offset;
+    uint64_t hash = ram_page_hash(p);
+    unsigned i = hash >> (64 - RAM_DEDUP_TABLE_BITS);
+
+    for (;; i = (i + 1) & (RAM_DEDUP_TABLE_SIZE - 1)) {
+        RamDedupEntry *e = &ram_dedup_table[i];
+
+        if (e->addr == 0) {
+            /* Keep the load factor at 3/4 at most; past that, just stop
+             * recording new pages. */
+            if (ram_dedup_count < RAM_DEDUP_TABLE_SIZE / 4 * 3) {
+                e->hash = hash;
+                /* Never 0: RAM addresses are stored off by one page */
+                e->addr = block->offset + offset + TARGET_PAGE_SIZE;
+                ram_dedup_count++;
+            }
+            return 0;
+        }
+        if (e->hash == hash) {
+            ram_addr_t addr = e->addr - TARGET_PAGE_SIZE;
+
+            if (addr >= block->offset && addr < block->offset + block->length &&
+                memcmp(block->host + (addr - block->offset), p,
+                       TARGET_PAGE_SIZE) == 0) {
+                *src_offset = addr - block->offset;
+                return 1;
+            }
+        }
+    }
+}
+
 static RAMBlock *last_block;
 static ram_addr_t last_offset;
+static RAMBlock *last_sent_block;
+
+static void ram_put_header(QEMUFile *f, RAMBlock *block, ram_addr_t offset,
+                           int flags)
+{
+    int cont = (block == last_sent_block) ? RAM_SAVE_FLAG_CONTINUE : 0;
+
+    qemu_put_be64(f, offset | cont | flags);
+    if (!cont) {
+        qemu_put_byte(f, strlen(block->idstr));
+        qemu_put_buffer(f, (uint8_t *)block->idstr, strlen(block->idstr));
+        last_sent_block = block;
+    }
+}
+
+/* Compresses the pending runs, then writes them and the page references
+ * that depend on them to the stream. Returns the number of bytes sent. */
+static int ram_save_flush(QEMUFile *f, int njobs)
+{
+    int bytes_sent = 0;
+    int i, j;
+
+    /* A running guest may modify the pages while they are compressed,
+     * which zlib does not cope with; work on a private copy then. Changed
+     * pages are dirty again and will be sent once more anyway. */
+    for (i = 0; i < njobs; i++) {
+        RamCompressJob *job = &ram_compress.jobs[i];
+
+        if (vm_running) {
+            memcpy(job->in, job->host, job->npages * TARGET_PAGE_SIZE);
+            job->src = job->in;
+        } else {
+            job->src = job->host;
+        }
+    }
+
+    ram_compress_run(njobs);
+
+    for (i = 0; i < njobs; i++) {
+        RamCompressJob *job = &ram_compress.jobs[i];
+        int len = job->npages * TARGET_PAGE_SIZE;
+
+        if (job->ret == Z_OK && job->out_len < len) {
+            ram_put_header(f, job->block, job->offset,
+                           RAM_SAVE_FLAG_COMPRESS_PAGE);
+            qemu_put_byte(f, job->npages);
+            qemu_put_be32(f, job->out_len);
+            qemu_put_buffer(f, job->out, job->out_len);
+            bytes_sent += job->out_len;
+        } else {
+            /* Incompressible, send as is */
+            for (j = 0; j < job->npages; j++) {
+                ram_put_header(f, job->block,
+                               job->offset + j * TARGET_PAGE_SIZE,
+                               RAM_SAVE_FLAG_PAGE);
+                qemu_put_buffer(f, (uint8_t *)job->src + j * TARGET_PAGE_SIZE,
+                                TARGET_PAGE_SIZE);
+            }
+            bytes_sent += len;
+        }
+    }
+
+    for (i = 0; i < ram_dedup_nrefs; i++) {
+        RamDedupRef *ref = &ram_dedup_refs[i];
+
+        ram_put_header(f, ref->block, ref->offset, RAM_SAVE_FLAG_DEDUP);
+        qemu_put_be64(f, ref->src_offset);
+        bytes_sent += 8;
+    }
+    ram_dedup_nrefs = 0;
+
+    return bytes_sent;
+}
+
+/*
+ * Sends npages dirty pages starting at offset in block. Uniform pages and
+ * duplicates are sent right away or queued as references, the others are
+ * grouped into runs of contiguous pages for compression. *njobs is the
+ * number of runs queued so far in ram_compress.jobs.
+ */
+static int ram_save_pages(QEMUFile *f, RAMBlock *block, ram_addr_t offset,
+                          int npages, int *njobs)
+{
+    RamCompressJob *job = NULL;
+    int dedup = ram_dedup_table != NULL && !vm_running;
+    int bytes_sent = 0;
+    int i;
+
+    for (i = 0; i < npages; i++, offset += TARGET_PAGE_SIZE) {
+        uint8_t *p = block->host + offset;
+        ram_addr_t src_offset;
+
+        if (is_dup_page(p)) {
+            ram_put_header(f, block, offset, RAM_SAVE_FLAG_COMPRESS);
+            qemu_put_byte(f, *p);
+            bytes_sent += 1;
+            job = NULL;
+            continue;
+        }
+
+        if (dedup && ram_dedup_find(block, offset, &src_offset)) {
+            RamDedupRef *ref = &ram_dedup_refs[ram_dedup_nrefs++];
+
+            ref->block = block;
+            ref->offset = offset;
+            ref->src_offset = src_offset;
+            job = NULL;
+            continue;
+        }
+
+        if (job == NULL || job->npages == RAM_COMPRESS_RUN_PAGES) {
+            if (*njobs == ram_compress.max_jobs) {
+                bytes_sent += ram_save_flush(f, *njobs);
+                *njobs = 0;
+            }
+            job = &ram_compress.jobs[(*njobs)++];
+            job->block = block;
+            job->offset = offset;
+            job->host = p;
+            job->npages = 0;
+            job->decompress = 0;
+        }
+        job->npages++;
+    }
+
+    return bytes_sent;
+}
 
 static int ram_save_block(QEMUFile *f)
 {
+    unsigned long *bitmap = ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION];
     RAMBlock *block = last_block;
     ram_addr_t offset = last_offset;
-    ram_addr_t current_addr;
+    int budget = ram_compress.max_jobs * RAM_COMPRESS_RUN_PAGES;
     int bytes_sent = 0;
+    int njobs = 0;
+    int nb_blocks = 0;
+    int segment;
+    RAMBlock *b;
 
     if (!block)
         block = QTAILQ_FIRST(&ram_list.blocks);
 
-    current_addr = block->offset + offset;
+    QTAILQ_FOREACH(b, &ram_list.blocks, next) {
+        nb_blocks++;
+    }
 
-    do {
-        if (cpu_physical_memory_get_dirty(current_addr, TARGET_PAGE_SIZE,
-                                          DIRTY_MEMORY_MIGRATION)) {
-            uint8_t *p;
-            int cont = (block == last_block) ? RAM_SAVE_FLAG_CONTINUE : 0;
+    /* Walk from the cursor to the end of its block, through all the other
+     * blocks, and back to the cursor, one dirty bitmap word at a time. */
+    for (segment = 0; segment <= nb_blocks && budget > 0; segment++) {
+        unsigned long base = block->offset >> TARGET_PAGE_BITS;
+        unsigned long end = (segment == nb_blocks) ? last_offset : block->length;
 
-            cpu_physical_memory_reset_dirty(current_addr,
-                                            TARGET_PAGE_SIZE,
-                                            DIRTY_MEMORY_MIGRATION);
+        end = base + (end >> TARGET_PAGE_BITS);
 
-            p = block->host + offset;
+        while (budget > 0) {
+            unsigned long page, run_end;
+            int npages;
 
-            if (is_dup_page(p, *p)) {
-                qemu_put_be64(f, offset | cont | RAM_SAVE_FLAG_COMPRESS);
-                if (!cont) {
-                    qemu_put_byte(f, strlen(block->idstr));
-                    qemu_put_buffer(f, (uint8_t *)block->idstr,
-                                    strlen(block->idstr));
-                }
-                qemu_put_byte(f, *p);
-                bytes_sent = 1;
-            } else {
-                qemu_put_be64(f, offset | cont | RAM_SAVE_FLAG_PAGE);
-                if (!cont) {
-                    qemu_put_byte(f, strlen(block->idstr));
-                    qemu_put_buffer(f, (uint8_t *)block->idstr,
-                                    strlen(block->idstr));
-                }
-                qemu_put_buffer(f, p, TARGET_PAGE_SIZE);
-                bytes_sent = TARGET_PAGE_SIZE;
+            page = find_next_bit(bitmap, end, base + (offset >> TARGET_PAGE_BITS));
+            if (page >= end) {
+                offset = (end - base) << TARGET_PAGE_BITS;
+                break;
             }
+            run_end = find_next_zero_bit(bitmap, MIN(end, page + budget), page);
+            npages = run_end - page;
+            offset = (page - base) << TARGET_PAGE_BITS;
 
-            break;
+            cpu_physical_memory_reset_dirty(block->offset + offset,
+                                            (ram_addr_t)npages << TARGET_PAGE_BITS,
+                                            DIRTY_MEMORY_MIGRATION);
+            bytes_sent += ram_save_pages(f, block, offset, npages, &njobs);
+            budget -= npages;
+            offset += (ram_addr_t)npages << TARGET_PAGE_BITS;
         }
 
-        offset += TARGET_PAGE_SIZE;
-        if (offset >= block->length) {
+        if (budget > 0 || offset >= block->length) {
+            if (segment == nb_blocks) {
+                break;
+            }
             offset = 0;
             block = QTAILQ_NEXT(block, next);
             if (!block)
                 block = QTAILQ_FIRST(&ram_list.blocks);
         }
+    }
 
-        current_addr = block->offset + offset;
-
-    } while (current_addr != last_block->offset + last_offset);
+    bytes_sent += ram_save_flush(f, njobs);
 
     last_block = block;
     last_offset = offset;
@@ -180,20 +1109,34 @@ static int ram_save_block(QEMUFile *f)
 
 static uint64_t bytes_transferred;
 
+/* Counts the pages with their migration dirty bit set in [page, end) */
+static ram_addr_t ram_count_dirty_pages(unsigned long page, unsigned long end)
+{
+    unsigned long *bitmap = ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION];
+    ram_addr_t count = 0;
+
+    for (; page < end && (page % BITS_PER_LONG) != 0; page++) {
+        count += test_bit(page, bitmap);
+    }
+    for (; page + BITS_PER_LONG <= end; page += BITS_PER_LONG) {
+        count += ctpopl(bitmap[BIT_WORD(page)]);
+    }
+    for (; page < end; page++) {
+        count += test_bit(page, bitmap);
+    }
+    return count;
+}
+
 static ram_addr_t ram_save_remaining(void)
 {
     RAMBlock *block;
     ram_addr_t count = 0;
 
     QTAILQ_FOREACH(block, &ram_list.blocks, next) {
-        ram_addr_t addr;
-        for (addr = block->offset; addr < block->offset + block->length;
-             addr += TARGET_PAGE_SIZE) {
-            if (cpu_physical_memory_get_dirty(addr, TARGET_PAGE_SIZE,
-                                              DIRTY_MEMORY_MIGRATION)) {
-                count++;
-            }
-        }
+        unsigned long page = block->offset >> TARGET_PAGE_BITS;
+
+        count += ram_count_dirty_pages(page,
+                                       page + (block->length >> TARGET_PAGE_BITS));
     }
 
     return count;
@@ -255,13 +1198,13 @@ static void sort_ram_list(void)
 
 int ram_save_live(QEMUFile *f, int stage, void *opaque)
 {
-    ram_addr_t addr;
     uint64_t bytes_transferred_last;
     double bwidth = 0;
     uint64_t expected_time = 0;
 
     if (stage < 0) {
         cpu_physical_memory_set_dirty_tracking(0);
+        ram_dedup_stop();
         return 0;
     }
 
@@ -272,21 +1215,27 @@ int ram_save_live(QEMUFile *f, int stage, void *opaque)
 
     if (stage == 1) {
         RAMBlock *block;
+
+        /* The compression threads read guest memory directly */
+        ram_lazy_populate_all();
+
         bytes_transferred = 0;
         last_block = NULL;
         last_offset = 0;
+        last_sent_block = NULL;
         sort_ram_list();
+        ram_compress_init();
+
+        /* Page references are only safe if nothing changes behind our back */
+        if (!vm_running) {
+            ram_dedup_start();
+        }
 
         /* Make sure all dirty bits are set */
         QTAILQ_FOREACH(block, &ram_list.blocks, next) {
-            for (addr = block->offset; addr < block->offset + block->length;
-                 addr += TARGET_PAGE_SIZE) {
-                if (!cpu_physical_memory_get_dirty(addr, TARGET_PAGE_SIZE,
-                                                   DIRTY_MEMORY_MIGRATION)) {
-                    cpu_physical_memory_set_dirty_flag(
-                            addr, DIRTY_MEMORY_MIGRATION);
-                }
-            }
+            bitmap_set(ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION],
+                       block->offset >> TARGET_PAGE_BITS,
+                       block->length >> TARGET_PAGE_BITS);
         }
 
         /* Enable dirty memory tracking */
@@ -332,6 +1281,7 @@ int ram_save_live(QEMUFile *f, int stage, void *opaque)
             bytes_transferred += bytes_sent;
         }
         cpu_physical_memory_set_dirty_tracking(0);
+        ram_dedup_stop();
     }
 
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
@@ -341,9 +1291,14 @@ int ram_save_live(QEMUFile *f, int stage, void *opaque)
     return (stage == 2) && (expected_time <= migrate_max_downtime());
 }
 
+/*
+ * Returns the host address of the page at offset in the block named by the
+ * record, or NULL if there is no such page. The block is stored in *pblock.
+ */
 static inline void *host_from_stream_offset(QEMUFile *f,
                                             ram_addr_t offset,
-                                            int flags)
+                                            int flags,
+                                            RAMBlock **pblock)
 {
     static RAMBlock *block = NULL;
     char id[256];
@@ -354,32 +1309,127 @@ static inline void *host_from_stream_offset(QEMUFile *f,
             fprintf(stderr, "Ack, bad migration stream!\n");
             return NULL;
         }
+    } else {
+        len = qemu_get_byte(f);
+        qemu_get_buffer(f, (uint8_t *)id, len);
+        id[len] = 0;
 
-        return block->host + offset;
+        QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+            if (!strncmp(id, block->idstr, sizeof(id)))
+                break;
+        }
+        if (!block) {
+            fprintf(stderr, "Can't find block %s!\n", id);
+            return NULL;
+        }
     }
 
-    len = qemu_get_byte(f);
-    qemu_get_buffer(f, (uint8_t *)id, len);
-    id[len] = 0;
+    if (offset + TARGET_PAGE_SIZE > block->length) {
+        fprintf(stderr, "Bad offset 0x" RAM_ADDR_FMT " in block %s!\n",
+                offset, block->idstr);
+        return NULL;
+    }
+    if (pblock) {
+        *pblock = block;
+    }
+    return block->host + offset;
+}
 
-    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
-        if (!strncmp(id, block->idstr, sizeof(id)))
-            return block->host + offset;
+/*
+ * Compressed runs are decompressed in batches on the worker threads. A
+ * record that touches a page of a run still in the batch has to wait until
+ * the batch is done, since the later record must win.
+ */
+static int ram_load_pending_overlaps(int njobs, uint8_t *host, int npages)
+{
+    int i;
+
+    for (i = 0; i < njobs; i++) {
+        RamCompressJob *job = &ram_compress.jobs[i];
+
+        if (host < job->host + job->npages * TARGET_PAGE_SIZE &&
+            job->host < host + npages * TARGET_PAGE_SIZE) {
+            return 1;
+        }
     }
+    return 0;
+}
 
-    fprintf(stderr, "Can't find block %s!\n", id);
-    return NULL;
+static int ram_load_flush(int *njobs)
+{
+    int i, ret = 0;
+
+    ram_compress_run(*njobs);
+    for (i = 0; i < *njobs; i++) {
+        if (ram_compress.jobs[i].ret != Z_OK) {
+            fprintf(stderr, "ram_load: corrupted compressed page run\n");
+            ret = -EINVAL;
+        }
+    }
+    *njobs = 0;
+    return ret;
+}
+
+/* Whether the records of the stream being loaded are restored lazily */
+static int ram_load_lazy;
+
+static int ram_load_compressed(QEMUFile *f, RAMBlock *block, uint8_t *host,
+                               int *njobs)
+{
+    RamCompressJob *job;
+    int npages, len;
+
+    npages = qemu_get_byte(f);
+    len = qemu_get_be32(f);
+    if (npages < 1 || npages > RAM_COMPRESS_RUN_PAGES ||
+        len <= 0 || len > compressBound(RAM_COMPRESS_RUN_SIZE)) {
+        return -EINVAL;
+    }
+    if (host + npages * TARGET_PAGE_SIZE > block->host + block->length) {
+        return -EINVAL;
+    }
+
+    if (ram_load_lazy) {
+        uint8_t *data = ram_lazy_add_run(host, npages, len);
+
+        if (!data) {
+            return -EINVAL;
+        }
+        qemu_get_buffer(f, data, len);
+        return 0;
+    }
+
+    if (*njobs == ram_compress.max_jobs ||
+        ram_load_pending_overlaps(*njobs, host, npages)) {
+        int ret = ram_load_flush(njobs);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    job = &ram_compress.jobs[(*njobs)++];
+    job->host = host;
+    job->npages = npages;
+    job->in_len = len;
+    job->decompress = 1;
+    job->src = job->in;
+    qemu_get_buffer(f, job->in, len);
+    return 0;
 }
 
 int ram_load(QEMUFile *f, void *opaque, int version_id)
 {
     ram_addr_t addr;
     int flags;
+    int njobs = 0;
+    int ret;
 
-    if (version_id < 3 || version_id > 4) {
+    if (version_id < 3 || version_id > RAM_SAVE_VERSION) {
         return -EINVAL;
     }
 
+    ram_compress_init();
+
     do {
         addr = qemu_get_be64(f);
 
@@ -387,7 +1437,9 @@ int ram_load(QEMUFile *f, void *opaque, int version_id)
         addr &= TARGET_PAGE_MASK;
 
         if (flags & RAM_SAVE_FLAG_MEM_SIZE) {
-            if (version_id != 3) {
+            ram_load_lazy = ram_lazy_start();
+
+            if (version_id == 4) {
                 if (addr != ram_bytes_total()) {
                     return -EINVAL;
                 }
@@ -427,38 +1479,102 @@ int ram_load(QEMUFile *f, void *opaque, int version_id)
             void *host;
             uint8_t ch;
 
-            if (version_id != 3)
+            if (version_id == 4)
                 host = qemu_get_ram_ptr(addr);
             else
-                host = host_from_stream_offset(f, addr, flags);
+                host = host_from_stream_offset(f, addr, flags, NULL);
             if (!host) {
                 return -EINVAL;
             }
+            if (ram_load_pending_overlaps(njobs, host, 1) &&
+                (ret = ram_load_flush(&njobs)) < 0) {
+                return ret;
+            }
 
             ch = qemu_get_byte(f);
-            memset(host, ch, TARGET_PAGE_SIZE);
+            if (ram_load_lazy) {
+                if (ram_lazy_add_fill(host, ch) < 0) {
+                    return -EINVAL;
+                }
+            } else {
+                ram_lazy_touch(host, TARGET_PAGE_SIZE);
+                memset(host, ch, TARGET_PAGE_SIZE);
 #ifndef _WIN32
-            if (ch == 0 &&
-                (!kvm_enabled() || kvm_has_sync_mmu())) {
-                qemu_madvise(host, TARGET_PAGE_SIZE, QEMU_MADV_DONTNEED);
-            }
+                if (ch == 0 &&
+                    (!kvm_enabled() || kvm_has_sync_mmu())) {
+                    qemu_madvise(host, TARGET_PAGE_SIZE, QEMU_MADV_DONTNEED);
+                }
 #endif
+            }
         } else if (flags & RAM_SAVE_FLAG_PAGE) {
             void *host;
 
-            if (version_id != 3)
+            if (version_id == 4)
                 host = qemu_get_ram_ptr(addr);
             else
-                host = host_from_stream_offset(f, addr, flags);
+                host = host_from_stream_offset(f, addr, flags, NULL);
+            if (!host) {
+                return -EINVAL;
+            }
+            if (ram_load_pending_overlaps(njobs, host, 1) &&
+                (ret = ram_load_flush(&njobs)) < 0) {
+                return ret;
+            }
+
+            if (ram_load_lazy) {
+                uint8_t *data = ram_lazy_add_run(host, 1, 0);
+
+                if (!data) {
+                    return -EINVAL;
+                }
+                qemu_get_buffer(f, data, TARGET_PAGE_SIZE);
+            } else {
+                qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+            }
+        } else if (flags & RAM_SAVE_FLAG_COMPRESS_PAGE) {
+            RAMBlock *block;
+            void *host = host_from_stream_offset(f, addr, flags, &block);
 
-            qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+            if (!host) {
+                return -EINVAL;
+            }
+            ret = ram_load_compressed(f, block, host, &njobs);
+            if (ret < 0) {
+                return ret;
+            }
+        } else if (flags & RAM_SAVE_FLAG_DEDUP) {
+            RAMBlock *block;
+            uint8_t *host = host_from_stream_offset(f, addr, flags, &block);
+            uint8_t *src;
+            ram_addr_t src_offset;
+
+            if (!host) {
+                return -EINVAL;
+            }
+            /* The source page belongs to the same block */
+            src_offset = qemu_get_be64(f);
+            if ((src_offset & ~TARGET_PAGE_MASK) ||
+                src_offset + TARGET_PAGE_SIZE > block->length) {
+                return -EINVAL;
+            }
+            src = block->host + src_offset;
+            if ((ram_load_pending_overlaps(njobs, host, 1) ||
+                 ram_load_pending_overlaps(njobs, src, 1)) &&
+                (ret = ram_load_flush(&njobs)) < 0) {
+                return ret;
+            }
+
+            ram_lazy_touch(host, TARGET_PAGE_SIZE);
+            ram_lazy_touch(src, TARGET_PAGE_SIZE);
+            memcpy(host, src, TARGET_PAGE_SIZE);
         }
         if (qemu_file_get_error(f)) {
+            ram_load_flush(&njobs);
             return -EIO;
         }
     } while (!(flags & RAM_SAVE_FLAG_EOS));
 
-    return 0;
+    return ram_load_flush(&njobs);
 }
 #endif
 
@@ -71,6 +71,10 @@ static BlockDriverState *bs_snapshots;
 /* If non-zero, use only whitelisted block drivers */
 static int use_bdrv_whitelist;
 
+/* Metadata cache budgets, 0 for the driver defaults */
+static int64_t bdrv_map_cache_size;
+static int64_t bdrv_alloc_cache_size;
+
 int _path_is_absolute(const char *path)
 {
     const char *p;
@@ -2480,6 +2484,27 @@ void bdrv_init_with_whitelist(void)
     bdrv_init();
 }
 
+void bdrv_set_metadata_cache_sizes(int64_t map_cache_size,
+                                   int64_t alloc_cache_size)
+{
+    if (map_cache_size > 0) {
+        bdrv_map_cache_size = map_cache_size;
+    }
+    if (alloc_cache_size > 0) {
+        bdrv_alloc_cache_size = alloc_cache_size;
+    }
+}
+
+int64_t bdrv_get_map_cache_size(void)
+{
+    return bdrv_map_cache_size;
+}
+
+int64_t bdrv_get_alloc_cache_size(void)
+{
+    return bdrv_alloc_cache_size;
+}
+
 void *qemu_aio_get(AIOPool *pool, BlockDriverState *bs,
                    BlockDriverCompletionFunc *cb, void *opaque)
 {
@@ -0,0 +1,303 @@
+/*
+ * Metadata table cache for the QCOW version 2 format
+ *
+ * Copyright (c) 2004-2006 Fabrice Bellard
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu-common.h"
+#include "block/block_int.h"
+#include "block/qcow2.h"
+
+/*
+ * A Qcow2Cache holds a fixed number of cluster-sized metadata tables
+ * (L2 tables or refcount blocks), indexed by their offset in the image
+ * file through a small chained hash table. Replacement is strict LRU:
+ * every successful lookup moves the entry to the head of a doubly-linked
+ * list, and new tables always recycle the tail entry.
+ *
+ * Entries are referred to by index so that the bookkeeping arrays can be
+ * allocated in one go and never move.
+ */
+
+#define CACHE_NIL  (-1)
+
+typedef struct Qcow2CachedTable {
+    uint64_t offset;    /* offset of the table in the image, 0 if unused */
+    int hash_next;      /* next entry in the same hash bucket */
+    int lru_prev;       /* towards the most recently used entry */
+    int lru_next;       /* towards the least recently used entry */
+} Qcow2CachedTable;
+
+struct Qcow2Cache {
+    Qcow2CachedTable *entries;
+    int *buckets;
+    uint8_t *tables;
+    int size;
+    int bucket_mask;
+    int table_bits;
+    int lru_head;
+    int lru_tail;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+static inline int cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    /* Tables are cluster-aligned, so drop the in-cluster bits first */
+    uint64_t key = (offset >> c->table_bits) * 0x9e3779b97f4a7c15ULL;
+    return (int)(key >> 32) & c->bucket_mask;
+}
+
+static inline void *cache_table(Qcow2Cache *c, int i)
+{
+    return c->tables + ((size_t)i << c->table_bits);
+}
+
+static void cache_lru_unlink(Qcow2Cache *c, int i)
+{
+    Qcow2CachedTable *e = &c->entries[i];
+
+    if (e->lru_prev != CACHE_NIL) {
+        c->entries[e->lru_prev].lru_next = e->lru_next;
+    } else {
+        c->lru_head = e->lru_next;
+    }
+    if (e->lru_next != CACHE_NIL) {
+        c->entries[e->lru_next].lru_prev = e->lru_prev;
+    } else {
+        c->lru_tail = e->lru_prev;
+    }
+    e->lru_prev = e->lru_next = CACHE_NIL;
+}
+
+static void cache_lru_push_head(Qcow2Cache *c, int i)
+{
+    Qcow2CachedTable *e = &c->entries[i];
+
+    e->lru_prev = CACHE_NIL;
+    e->lru_next = c->lru_head;
+    if (c->lru_head != CACHE_NIL) {
+        c->entries[c->lru_head].lru_prev = i;
+    } else {
+        c->lru_tail = i;
+    }
+    c->lru_head = i;
+}
+
+static void cache_lru_push_tail(Qcow2Cache *c, int i)
+{
+    Qcow2CachedTable *e = &c->entries[i];
+
+    e->lru_next = CACHE_NIL;
+    e->lru_prev = c->lru_tail;
+    if (c->lru_tail != CACHE_NIL) {
+        c->entries[c->lru_tail].lru_next = i;
+    } else {
+        c->lru_head = i;
+    }
+    c->lru_tail = i;
+}
+
+static int cache_hash_find(Qcow2Cache *c, uint64_t offset)
+{
+    int i = c->buckets[cache_hash(c, offset)];
+
+    while (i != CACHE_NIL && c->entries[i].offset != offset) {
+        i = c->entries[i].hash_next;
+    }
+    return i;
+}
+
+static void cache_hash_remove(Qcow2Cache *c, int i)
+{
+    int *link = &c->buckets[cache_hash(c, c->entries[i].offset)];
+
+    while (*link != i) {
+        link = &c->entries[*link].hash_next;
+    }
+    *link = c->entries[i].hash_next;
+    c->entries[i].hash_next = CACHE_NIL;
+    c->entries[i].offset = 0;
+}
+
+Qcow2Cache *qcow2_cache_create(int num_tables, int table_bits)
+{
+    Qcow2Cache *c;
+    int nb_buckets, i;
+
+    /* Keep the load factor of the hash table at or below 0.5 */
+    nb_buckets = 1;
+    while (nb_buckets < 2 * num_tables) {
+        nb_buckets <<= 1;
+    }
+
+    c = g_malloc0(sizeof(*c));
+    c->size = num_tables;
+    c->table_bits = table_bits;
+    c->bucket_mask = nb_buckets - 1;
+    c->entries = g_malloc(num_tables * sizeof(c->entries[0]));
+    c->buckets = g_malloc(nb_buckets * sizeof(c->buckets[0]));
+    c->tables = qemu_blockalign(NULL, (size_t)num_tables << table_bits);
+
+    for (i = 0; i < nb_buckets; i++) {
+        c->buckets[i] = CACHE_NIL;
+    }
+    c->lru_head = c->lru_tail = CACHE_NIL;
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].offset = 0;
+        c->entries[i].hash_next = CACHE_NIL;
+        cache_lru_push_tail(c, i);
+    }
+    return c;
+}
+
+void qcow2_cache_destroy(Qcow2Cache *c)
+{
+    if (!c) {
+        return;
+    }
+    qemu_vfree(c->tables);
+    g_free(c->buckets);
+    g_free(c->entries);
+    g_free(c);
+}
+
+/*
+ * qcow2_cache_find
+ *
+ * Returns the cached copy of the table at the given offset and marks it as
+ * the most recently used entry, or NULL if the table is not in the cache.
+ */
+void *qcow2_cache_find(Qcow2Cache *c, uint64_t offset)
+{
+    int i = cache_hash_find(c, offset);
+
+    if (i == CACHE_NIL) {
+        c->misses++;
+        return NULL;
+    }
+    c->hits++;
+    if (c->lru_head != i) {
+        cache_lru_unlink(c, i);
+        cache_lru_push_head(c, i);
+    }
+    return cache_table(c, i);
+}
+
+/*
+ * qcow2_cache_get_empty
+ *
+ * Binds a cache entry to the given offset and returns its buffer, which the
+ * caller must fill (from disk or from scratch) before anybody else looks the
+ * offset up. The least recently used entry is recycled; a stale entry for the
+ * same offset is reused instead so that an offset is never cached twice.
+ */
+void *qcow2_cache_get_empty(Qcow2Cache *c, uint64_t offset)
+{
+    int i = cache_hash_find(c, offset);
+
+    if (i == CACHE_NIL) {
+        i = c->lru_tail;
+        if (c->entries[i].offset != 0) {
+            cache_hash_remove(c, i);
+        }
+        c->entries[i].offset = offset;
+        c->entries[i].hash_next = c->buckets[cache_hash(c, offset)];
+        c->buckets[cache_hash(c, offset)] = i;
+    }
+    if (c->lru_head != i) {
+        cache_lru_unlink(c, i);
+        cache_lru_push_head(c, i);
+    }
+    return cache_table(c, i);
+}
+
+/*
+ * qcow2_cache_discard
+ *
+ * Drops the table at the given offset from the cache, if present. Used when
+ * filling an entry failed or the cached copy no longer matches the image.
+ */
+void qcow2_cache_discard(Qcow2Cache *c, uint64_t offset)
+{
+    int i = cache_hash_find(c, offset);
+
+    if (i == CACHE_NIL) {
+        return;
+    }
+    cache_hash_remove(c, i);
+    cache_lru_unlink(c, i);
+    cache_lru_push_tail(c, i);
+}
+
+void qcow2_cache_reset(Qcow2Cache *c)
+{
+    int i;
+
+    for (i = 0; i <= c->bucket_mask; i++) {
+        c->buckets[i] = CACHE_NIL;
+    }
+    for (i = 0; i < c->size; i++) {
+        c->entries[i].offset = 0;
+        c->entries[i].hash_next = CACHE_NIL;
+    }
+}
+
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats)
+{
+    stats->size = (int64_t)c->size << c->table_bits;
+    stats->hits = c->hits;
+    stats->misses = c->misses;
+}
+
+/*********************************************************/
+/* cache sizing */
+
+/* Number of tables of 1 << table_bits bytes that fit in the configured
+ * budget (or the default one if none was set), clamped to
+ * [min_tables, QCOW2_MAX_CACHE_TABLES]. */
+static int cache_tables_for(int64_t bytes, int64_t default_bytes,
+                            int table_bits, int min_tables)
+{
+    int64_t n = (bytes > 0 ? bytes : default_bytes) >> table_bits;
+
+    if (n < min_tables) {
+        n = min_tables;
+    }
+    if (n > QCOW2_MAX_CACHE_TABLES) {
+        n = QCOW2_MAX_CACHE_TABLES;
+    }
+    return (int)n;
+}
+
+int qcow2_l2_cache_tables(int cluster_bits)
+{
+    return cache_tables_for(bdrv_get_map_cache_size(),
+                            QCOW2_DEFAULT_L2_CACHE_SIZE, cluster_bits,
+                            QCOW2_MIN_L2_CACHE_TABLES);
+}
+
+int qcow2_refcount_cache_tables(int cluster_bits)
+{
+    return cache_tables_for(bdrv_get_alloc_cache_size(),
+                            QCOW2_DEFAULT_REFCOUNT_CACHE_SIZE, cluster_bits,
+                            QCOW2_MIN_REFCOUNT_CACHE_TABLES);
+}
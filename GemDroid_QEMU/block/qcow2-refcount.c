@@ -61,7 +61,11 @@ int qcow2_refcount_init(BlockDriverState *bs)
     BDRVQcowState *s = bs->opaque;
     int ret, refcount_table_size2, i;
 
-    s->refcount_block_cache = g_malloc(s->cluster_size);
+    s->refcount_block_tables =
+        qcow2_cache_create(qcow2_refcount_cache_tables(s->cluster_bits),
+                           s->cluster_bits);
+    s->refcount_block_cache = NULL;
+    s->refcount_block_cache_offset = 0;
     refcount_table_size2 = s->refcount_table_size * sizeof(uint64_t);
     s->refcount_table = g_malloc(refcount_table_size2);
     if (s->refcount_table_size > 0) {
@@ -81,7 +85,9 @@ int qcow2_refcount_init(BlockDriverState *bs)
 void qcow2_refcount_close(BlockDriverState *bs)
 {
     BDRVQcowState *s = bs->opaque;
-    g_free(s->refcount_block_cache);
+    qcow2_cache_destroy(s->refcount_block_tables);
+    s->refcount_block_tables = NULL;
+    s->refcount_block_cache = NULL;
     g_free(s->refcount_table);
 }
 
@@ -99,10 +105,22 @@ static int load_refcount_block(BlockDriverState *bs,
         }
     }
 
+    s->refcount_block_cache = qcow2_cache_find(s->refcount_block_tables,
+                                               refcount_block_offset);
+    if (s->refcount_block_cache != NULL) {
+        s->refcount_block_cache_offset = refcount_block_offset;
+        return 0;
+    }
+
+    s->refcount_block_cache = qcow2_cache_get_empty(s->refcount_block_tables,
+                                                    refcount_block_offset);
+
     BLKDBG_EVENT(bs->file, BLKDBG_REFBLOCK_LOAD);
     ret = bdrv_pread(bs->file, refcount_block_offset, s->refcount_block_cache,
                      s->cluster_size);
     if (ret < 0) {
+        qcow2_cache_discard(s->refcount_block_tables, refcount_block_offset);
+        s->refcount_block_cache_offset = 0;
         return ret;
     }
 
@@ -110,6 +128,20 @@ static int load_refcount_block(BlockDriverState *bs,
     return 0;
 }
 
+/*
+ * Makes a freshly allocated refcount block at the given offset the current
+ * one. Its contents are zeroed; the caller is responsible for writing it out.
+ */
+static void new_refcount_block(BlockDriverState *bs, int64_t offset)
+{
+    BDRVQcowState *s = bs->opaque;
+
+    s->refcount_block_cache = qcow2_cache_get_empty(s->refcount_block_tables,
+                                                    offset);
+    memset(s->refcount_block_cache, 0, s->cluster_size);
+    s->refcount_block_cache_offset = offset;
+}
+
 /*
  * Returns the refcount of the cluster given by its index. Any non-negative
  * return value is the refcount of the cluster, negative values are -errno
@@ -246,8 +278,7 @@ static int64_t alloc_refcount_block(BlockDriverState *bs, int64_t cluster_index)
 
     if (in_same_refcount_block(s, new_block, cluster_index << s->cluster_bits)) {
         /* Zero the new refcount block before updating it */
-        memset(s->refcount_block_cache, 0, s->cluster_size);
-        s->refcount_block_cache_offset = new_block;
+        new_refcount_block(bs, new_block);
 
         /* The block describes itself, need to update the cache */
         int block_index = (new_block >> s->cluster_bits) &
@@ -263,8 +294,7 @@ static int64_t alloc_refcount_block(BlockDriverState *bs, int64_t cluster_index)
 
         /* Initialize the new refcount block only after updating its refcount,
          * update_refcount uses the refcount cache itself */
-        memset(s->refcount_block_cache, 0, s->cluster_size);
-        s->refcount_block_cache_offset = new_block;
+        new_refcount_block(bs, new_block);
     }
 
     /* Now the new refcount block needs to be written to disk */
@@ -365,6 +395,10 @@ static int64_t alloc_refcount_block(BlockDriverState *bs, int64_t cluster_index)
     if (ret < 0) {
         goto fail_table;
     }
+    for (i = 0; i < blocks_clusters; i++) {
+        qcow2_cache_discard(s->refcount_block_tables,
+                            meta_offset + (i * s->cluster_size));
+    }
 
     /* Write refcount table to disk */
     for(i = 0; i < table_size; i++) {
@@ -417,6 +451,8 @@ static int64_t alloc_refcount_block(BlockDriverState *bs, int64_t cluster_index)
 fail_table:
     g_free(new_table);
 fail_block:
+    /* The cached copy of new_block may not match what is on disk */
+    qcow2_cache_discard(s->refcount_block_tables, new_block);
     s->refcount_block_cache_offset = 0;
     return ret;
 }
@@ -448,13 +484,15 @@ static int write_refcount_block_entries(BlockDriverState *bs,
         refcount_block_offset + (first_index << REFCOUNT_SHIFT),
         &s->refcount_block_cache[first_index], size);
     if (ret < 0) {
+        /* Don't let later lookups trust the updates that failed to land */
+        qcow2_cache_discard(s->refcount_block_tables, refcount_block_offset);
+        s->refcount_block_cache_offset = 0;
         return ret;
     }
 
     return 0;
 }
 
-/* XXX: cache several refcount block clusters ? */
 static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
     int64_t offset, int64_t length, int addend)
 {
@@ -203,8 +203,9 @@ static int qcow_open(BlockDriverState *bs, int flags)
             be64_to_cpus(&s->l1_table[i]);
         }
     }
-    /* alloc L2 cache */
-    s->l2_cache = g_malloc(s->l2_size * L2_CACHE_SIZE * sizeof(uint64_t));
+    /* alloc L2 cache, each entry holds one cluster-sized L2 table */
+    s->l2_table_cache = qcow2_cache_create(qcow2_l2_cache_tables(s->cluster_bits),
+                                           s->cluster_bits);
     s->cluster_cache = g_malloc(s->cluster_size);
     /* one more sector for decompressed data alignment */
     s->cluster_data = g_malloc(QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size
@@ -245,7 +246,7 @@ static int qcow_open(BlockDriverState *bs, int flags)
     qcow2_free_snapshots(bs);
     qcow2_refcount_close(bs);
     g_free(s->l1_table);
-    g_free(s->l2_cache);
+    qcow2_cache_destroy(s->l2_table_cache);
     g_free(s->cluster_cache);
     g_free(s->cluster_data);
     return -1;
@@ -662,7 +663,7 @@ static void qcow_close(BlockDriverState *bs)
 {
     BDRVQcowState *s = bs->opaque;
     g_free(s->l1_table);
-    g_free(s->l2_cache);
+    qcow2_cache_destroy(s->l2_table_cache);
     g_free(s->cluster_cache);
     g_free(s->cluster_data);
     qcow2_refcount_close(bs);
@@ -1233,8 +1234,19 @@ static int64_t qcow_vm_state_offset(BDRVQcowState *s)
 static int qcow_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
 {
     BDRVQcowState *s = bs->opaque;
+    Qcow2CacheStats stats;
+
     bdi->cluster_size = s->cluster_size;
     bdi->vm_state_offset = qcow_vm_state_offset(s);
+
+    qcow2_cache_get_stats(s->l2_table_cache, &stats);
+    bdi->l2_cache_size = stats.size;
+    bdi->l2_cache_hits = stats.hits;
+    bdi->l2_cache_misses = stats.misses;
+    qcow2_cache_get_stats(s->refcount_block_tables, &stats);
+    bdi->refcount_cache_size = stats.size;
+    bdi->refcount_cache_hits = stats.hits;
+    bdi->refcount_cache_misses = stats.misses;
     return 0;
 }
 
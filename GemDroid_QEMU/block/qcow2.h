@@ -49,7 +49,28 @@
 #define MIN_CLUSTER_BITS 9
 #define MAX_CLUSTER_BITS 21
 
-#define L2_CACHE_SIZE 16
+/*
+ * Default and limits for the metadata caches, see qcow2-cache.c. The
+ * budgets are in bytes rather than tables, so that the mapped range does
+ * not shrink with the cluster size: with the default 64 KiB clusters, 1 MiB
+ * of L2 tables (16 tables, as before) maps 8 GiB, which covers the default
+ * system and data images, while 4 KiB clusters now get 256 tables
+ * (512 MiB) instead of 16 (32 MiB). Use bdrv_set_metadata_cache_sizes()
+ * for larger images.
+ */
+#define QCOW2_DEFAULT_L2_CACHE_SIZE       (1024 * 1024)
+#define QCOW2_DEFAULT_REFCOUNT_CACHE_SIZE (256 * 1024)
+#define QCOW2_MIN_L2_CACHE_TABLES         16
+#define QCOW2_MIN_REFCOUNT_CACHE_TABLES   4
+#define QCOW2_MAX_CACHE_TABLES            65536
+
+typedef struct Qcow2Cache Qcow2Cache;
+
+typedef struct Qcow2CacheStats {
+    int64_t size; /* in bytes */
+    uint64_t hits;
+    uint64_t misses;
+} Qcow2CacheStats;
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -92,9 +113,7 @@ typedef struct BDRVQcowState {
     uint64_t cluster_offset_mask;
     uint64_t l1_table_offset;
     uint64_t *l1_table;
-    uint64_t *l2_cache;
-    uint64_t l2_cache_offsets[L2_CACHE_SIZE];
-    uint32_t l2_cache_counts[L2_CACHE_SIZE];
+    Qcow2Cache *l2_table_cache;
     uint8_t *cluster_cache;
     uint8_t *cluster_data;
     uint64_t cluster_cache_offset;
@@ -103,6 +122,8 @@ typedef struct BDRVQcowState {
     uint64_t *refcount_table;
     uint64_t refcount_table_offset;
     uint32_t refcount_table_size;
+    Qcow2Cache *refcount_block_tables;
+    /* the refcount block currently being worked on, an entry of the above */
     uint64_t refcount_block_cache_offset;
     uint16_t *refcount_block_cache;
     int64_t free_cluster_index;
@@ -206,6 +227,18 @@ uint64_t qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
 
 int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m);
 
+/* qcow2-cache.c functions */
+Qcow2Cache *qcow2_cache_create(int num_tables, int table_bits);
+void qcow2_cache_destroy(Qcow2Cache *c);
+void *qcow2_cache_find(Qcow2Cache *c, uint64_t offset);
+void *qcow2_cache_get_empty(Qcow2Cache *c, uint64_t offset);
+void qcow2_cache_discard(Qcow2Cache *c, uint64_t offset);
+void qcow2_cache_reset(Qcow2Cache *c);
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats);
+
+int qcow2_l2_cache_tables(int cluster_bits);
+int qcow2_refcount_cache_tables(int cluster_bits);
+
 /* qcow2-snapshot.c functions */
 int qcow2_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info);
 int qcow2_snapshot_goto(BlockDriverState *bs, const char *snapshot_id);
@@ -0,0 +1,286 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "RenderChannel.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// Ring sizes, allocated for each GLES pipe. Larger transfers, like texture
+// uploads or glReadPixels() results, simply stream through the ring in
+// several pieces, at the cost of one wakeup per ring-full. The command ring
+// holds about 4000 typical 64-byte commands, which keeps both sides busy
+// without waiting, and replies are mostly a few bytes each.
+#define TO_RENDERER_RING_SIZE  (256 * 1024)
+#define TO_GUEST_RING_SIZE     (64 * 1024)
+
+// The IOStream used by the RenderThread serving a channel.
+class RenderChannel::Stream : public IOStream {
+public:
+    explicit Stream(RenderChannel* channel) :
+            IOStream(10000),
+            m_channel(channel),
+            m_buf(NULL),
+            m_bufsize(0),
+            m_gotClientFlags(false) {}
+
+    virtual ~Stream() {
+        forceStop();
+        m_channel->unref();
+        free(m_buf);
+    }
+
+    virtual void* allocBuffer(size_t minSize) {
+        if (!m_buf || m_bufsize < minSize) {
+            size_t allocSize = minSize < 10000 ? 10000 : minSize;
+            unsigned char* p = (unsigned char*)realloc(m_buf, allocSize);
+            if (!p) {
+                ERR("%s: realloc (%zu) failed\n", __FUNCTION__, allocSize);
+                return NULL;
+            }
+            m_buf = p;
+            m_bufsize = allocSize;
+        }
+        return m_buf;
+    }
+
+    virtual int commitBuffer(size_t size) {
+        return writeFully(m_buf, size);
+    }
+
+    virtual int writeFully(const void* buf, size_t len) {
+        const unsigned char* p = (const unsigned char*)buf;
+        emugl::RingBuffer* ring = &m_channel->mToGuest;
+        while (len > 0) {
+            if (!ring->waitForWrite()) {
+                return -1;
+            }
+            size_t n = ring->write(p, len);
+            m_channel->notifyGuest(RENDER_CHANNEL_CAN_READ);
+            p += n;
+            len -= n;
+        }
+        return 0;
+    }
+
+    virtual const unsigned char* readFully(void* buf, size_t len) {
+        if (!buf || !skipClientFlags()) {
+            return NULL;
+        }
+        return readRaw(buf, len) ? (const unsigned char*)buf : NULL;
+    }
+
+    virtual const unsigned char* read(void* buf, size_t* inout_len) {
+        if (!buf || !skipClientFlags()) {
+            return NULL;
+        }
+        // Return everything that is available, i.e. all the guest buffers
+        // sent since the last wakeup, in a single call.
+        emugl::RingBuffer* ring = &m_channel->mToRenderer;
+        if (!ring->waitForRead()) {
+            return NULL;
+        }
+        *inout_len = ring->read(buf, *inout_len);
+        m_channel->notifyGuest(RENDER_CHANNEL_CAN_WRITE);
+        return (const unsigned char*)buf;
+    }
+
+    virtual void forceStop() {
+        m_channel->mToRenderer.close();
+        m_channel->mToGuest.close();
+        m_channel->notifyGuest(RENDER_CHANNEL_STOPPED);
+    }
+
+private:
+    bool readRaw(void* buf, size_t len) {
+        unsigned char* p = (unsigned char*)buf;
+        emugl::RingBuffer* ring = &m_channel->mToRenderer;
+        while (len > 0) {
+            if (!ring->waitForRead()) {
+                return false;
+            }
+            size_t n = ring->read(p, len);
+            m_channel->notifyGuest(RENDER_CHANNEL_CAN_WRITE);
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    // Guest clients start each connection with their clientFlags, which
+    // the RenderServer consumes itself for socket connections.
+    bool skipClientFlags() {
+        if (!m_gotClientFlags) {
+            unsigned int clientFlags;
+            if (!readRaw(&clientFlags, sizeof(clientFlags))) {
+                return false;
+            }
+            m_gotClientFlags = true;
+        }
+        return true;
+    }
+
+    RenderChannel* m_channel;
+    unsigned char* m_buf;
+    size_t m_bufsize;
+    bool m_gotClientFlags;
+};
+
+// static
+RenderChannel* RenderChannel::create() {
+#if defined(__linux__)
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        ERR("%s: eventfd() failed: %s\n", __FUNCTION__, strerror(errno));
+        return NULL;
+    }
+    return new RenderChannel(fd, fd);
+#elif !defined(_WIN32)
+    int fds[2];
+    if (pipe(fds) < 0) {
+        ERR("%s: pipe() failed: %s\n", __FUNCTION__, strerror(errno));
+        return NULL;
+    }
+    for (int n = 0; n < 2; n++) {
+        fcntl(fds[n], F_SETFL, fcntl(fds[n], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[n], F_SETFD, FD_CLOEXEC);
+    }
+    return new RenderChannel(fds[0], fds[1]);
+#else
+    // Channels are not supported on Windows, where the emulator's main loop
+    // can only watch sockets. The caller falls back to a TCP connection to
+    // the RenderServer.
+    return NULL;
+#endif
+}
+
+RenderChannel::RenderChannel(int readFd, int writeFd) :
+        mToRenderer(TO_RENDERER_RING_SIZE),
+        mToGuest(TO_GUEST_RING_SIZE),
+        mRefCount(1U),
+        mWakeOn(0U) {
+    mWakeFds[0] = readFd;
+    mWakeFds[1] = writeFd;
+}
+
+RenderChannel::~RenderChannel() {
+#ifndef _WIN32
+    ::close(mWakeFds[0]);
+    if (mWakeFds[1] != mWakeFds[0]) {
+        ::close(mWakeFds[1]);
+    }
+#endif
+}
+
+IOStream* RenderChannel::createStream() {
+    __atomic_add_fetch(&mRefCount, 1U, __ATOMIC_SEQ_CST);
+    return new Stream(this);
+}
+
+int RenderChannel::send(const RenderChannelBuffer* buffers, int numBuffers) {
+    if (mToRenderer.isClosed()) {
+        return -1;
+    }
+    int ret = 0;
+    for (int n = 0; n < numBuffers; n++) {
+        size_t len = mToRenderer.write(buffers[n].data, buffers[n].size);
+        ret += len;
+        if (len < buffers[n].size) {
+            break;
+        }
+    }
+    return ret;
+}
+
+int RenderChannel::recv(RenderChannelBuffer* buffers, int numBuffers) {
+    int ret = 0;
+    for (int n = 0; n < numBuffers; n++) {
+        size_t len = mToGuest.read(buffers[n].data, buffers[n].size);
+        ret += len;
+        if (len < buffers[n].size) {
+            break;
+        }
+    }
+    if (ret == 0 && mToGuest.isClosed()) {
+        return -1;
+    }
+    return ret;
+}
+
+unsigned RenderChannel::poll() const {
+    unsigned events = 0;
+    if (mToGuest.readAvailable() > 0) {
+        events |= RENDER_CHANNEL_CAN_READ;
+    }
+    if (mToRenderer.isClosed()) {
+        events |= RENDER_CHANNEL_STOPPED;
+    } else if (mToRenderer.writeAvailable() > 0) {
+        events |= RENDER_CHANNEL_CAN_WRITE;
+    }
+    return events;
+}
+
+void RenderChannel::wakeOn(unsigned events) {
+    __atomic_or_fetch(&mWakeOn, events, __ATOMIC_SEQ_CST);
+    // The RenderThread may have made progress before seeing the new
+    // flags, check again.
+    if (poll() & (events | RENDER_CHANNEL_STOPPED)) {
+        __atomic_and_fetch(&mWakeOn, ~events, __ATOMIC_SEQ_CST);
+        signalWakeFd();
+    }
+}
+
+void RenderChannel::close() {
+    mToRenderer.close();
+    mToGuest.close();
+    unref();
+}
+
+void RenderChannel::notifyGuest(unsigned events) {
+    if (events & RENDER_CHANNEL_STOPPED) {
+        signalWakeFd();
+        return;
+    }
+    if (__atomic_load_n(&mWakeOn, __ATOMIC_SEQ_CST) & events) {
+        __atomic_and_fetch(&mWakeOn, ~events, __ATOMIC_SEQ_CST);
+        signalWakeFd();
+    }
+}
+
+void RenderChannel::signalWakeFd() {
+#ifndef _WIN32
+    // The value doesn't matter, only the readability of the descriptor.
+    uint64_t value = 1;
+    ssize_t ret;
+    do {
+        ret = ::write(mWakeFds[1], &value, sizeof(value));
+    } while (ret < 0 && errno == EINTR);
+#endif
+}
+
+void RenderChannel::unref() {
+    if (__atomic_sub_fetch(&mRefCount, 1U, __ATOMIC_SEQ_CST) == 0) {
+        delete this;
+    }
+}
@@ -0,0 +1,99 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef _LIB_OPENGL_RENDER_RENDER_CHANNEL_H
+#define _LIB_OPENGL_RENDER_RENDER_CHANNEL_H
+
+#include "IOStream.h"
+#include "render_api.h"
+
+#include "emugl/common/ring_buffer.h"
+
+#include <stdint.h>
+
+// A RenderChannel connects one guest GLES pipe to a RenderThread of the
+// same process through a pair of shared memory ring buffers, instead of a
+// socket connection to the RenderServer. Commands and replies are copied
+// once into the rings, and no system call is made as long as both sides
+// are busy:
+//
+//   - The RenderThread sleeps on a futex when it runs out of commands,
+//     and is only woken up by the guest side when it actually sleeps.
+//
+//   - The guest side never blocks. When the guest waits for a reply or
+//     for room in the command ring, wakeOn() arms a doorbell, and the
+//     RenderThread writes to wakeFd() once the condition is met, which
+//     the emulator's main loop watches.
+//
+// A channel is reference-counted: the guest side owns one reference,
+// released by close(), and the stream returned by createStream() owns
+// the other one.
+class RenderChannel {
+public:
+    // Create a new channel, or return NULL on failure, or on Windows where
+    // channels are not supported: callers must then connect to the
+    // RenderServer through a socket instead.
+    static RenderChannel* create();
+
+    // Create the IOStream that the RenderThread serving this channel
+    // must use. Can only be called once.
+    IOStream* createStream();
+
+    // Guest side: file descriptor that becomes readable after wakeOn()
+    // conditions are met, or when the RenderThread stops. The caller must
+    // drain it with read() and then call poll().
+    int wakeFd() const { return mWakeFds[0]; }
+
+    // Guest side: send commands to the RenderThread. Return the number of
+    // bytes copied, which can be less than the buffers' total size, 0 if
+    // the command ring is full, or -1 if the RenderThread stopped.
+    int send(const RenderChannelBuffer* buffers, int numBuffers);
+
+    // Guest side: receive replies from the RenderThread. Return the number
+    // of bytes copied, 0 if there is nothing to read, or -1 if the
+    // RenderThread stopped.
+    int recv(RenderChannelBuffer* buffers, int numBuffers);
+
+    // Guest side: return a combination of RENDER_CHANNEL_XXX flags.
+    unsigned poll() const;
+
+    // Guest side: ask for wakeFd() to be signaled as soon as one of the
+    // RENDER_CHANNEL_CAN_READ / RENDER_CHANNEL_CAN_WRITE |events| occurs.
+    void wakeOn(unsigned events);
+
+    // Guest side: close the channel and release the guest's reference.
+    // Commands sent so far are still processed by the RenderThread.
+    void close();
+
+private:
+    class Stream;
+    friend class Stream;
+
+    RenderChannel(int readFd, int writeFd);
+    ~RenderChannel();
+
+    // Called from the RenderThread after it made progress.
+    void notifyGuest(unsigned events);
+    void signalWakeFd();
+    void unref();
+
+    emugl::RingBuffer mToRenderer;
+    emugl::RingBuffer mToGuest;
+    uint32_t mRefCount;
+    uint32_t mWakeOn;
+    int mWakeFds[2];
+};
+
+#endif  // _LIB_OPENGL_RENDER_RENDER_CHANNEL_H
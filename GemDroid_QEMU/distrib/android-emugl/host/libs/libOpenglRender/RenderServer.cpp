@@ -27,16 +27,14 @@
 #include "Win32PipeStream.h"
 #endif
 
-#include <set>
-
 #include <string.h>
 
-typedef std::set<RenderThread *> RenderThreadsSet;
-
 RenderServer::RenderServer() :
     m_lock(),
     m_listenSock(NULL),
-    m_exiting(false)
+    m_exiting(false),
+    m_threadsLock(),
+    m_threads()
 {
 }
 
@@ -84,10 +82,58 @@ RenderServer *RenderServer::create(char* addr, size_t addrLen)
     return server;
 }
 
-intptr_t RenderServer::main()
+bool RenderServer::startThread(IOStream *stream)
+{
+    emugl::Mutex::AutoLock lock(m_threadsLock);
+
+    if (m_exiting) {
+        delete stream;
+        return false;
+    }
+
+    RenderThread *rt = RenderThread::create(stream, &m_lock);
+    if (!rt) {
+        fprintf(stderr,"Failed to create RenderThread\n");
+        delete stream;
+        return false;
+    }
+    if (!rt->start()) {
+        fprintf(stderr,"Failed to start RenderThread\n");
+        delete rt;
+        return false;
+    }
+
+    //
+    // remove from the threads list threads which are
+    // no longer running
+    //
+    reapFinishedThreads();
+
+    m_threads.insert(rt);
+    DBG("Started new RenderThread\n");
+    return true;
+}
+
+void RenderServer::reapFinishedThreads()
 {
-    RenderThreadsSet threads;
+    for (RenderThreadsSet::iterator n,t = m_threads.begin();
+         t != m_threads.end();
+         t = n) {
+        // first find next iterator
+        n = t;
+        n++;
+
+        // delete and erase the current iterator
+        // if thread is no longer running
+        if ((*t)->isFinished()) {
+            delete (*t);
+            m_threads.erase(t);
+        }
+    }
+}
 
+intptr_t RenderServer::main()
+{
 #ifndef _WIN32
     sigset_t set;
     sigfillset(&set);
@@ -112,52 +158,23 @@ intptr_t RenderServer::main()
 
         // check if we have been requested to exit while waiting on accept
         if ((clientFlags & IOSTREAM_CLIENT_EXIT_SERVER) != 0) {
-            m_exiting = true;
             delete stream;
             break;
         }
 
-        RenderThread *rt = RenderThread::create(stream, &m_lock);
-        if (!rt) {
-            fprintf(stderr,"Failed to create RenderThread\n");
-            delete stream;
-        } else if (!rt->start()) {
-            fprintf(stderr,"Failed to start RenderThread\n");
-            delete rt;
-            delete stream;
-        }
-
-        //
-        // remove from the threads list threads which are
-        // no longer running
-        //
-        for (RenderThreadsSet::iterator n,t = threads.begin();
-             t != threads.end();
-             t = n) {
-            // first find next iterator
-            n = t;
-            n++;
-
-            // delete and erase the current iterator
-            // if thread is no longer running
-            if ((*t)->isFinished()) {
-                delete (*t);
-                threads.erase(t);
-            }
-        }
-
-        // if the thread has been created and started, insert it to the list
-        if (rt) {
-            threads.insert(rt);
-            DBG("Started new RenderThread\n");
-        }
+        startThread(stream);
     }
 
+    // Refuse new channel connections from now on.
+    m_threadsLock.lock();
+    m_exiting = true;
+    m_threadsLock.unlock();
+
     //
     // Wait for all threads to finish
     //
-    for (RenderThreadsSet::iterator t = threads.begin();
-         t != threads.end();
+    for (RenderThreadsSet::iterator t = m_threads.begin();
+         t != m_threads.end();
          t++) {
 #ifndef _WIN32
         // Note: temporarily disable following steps so emulator does not
@@ -167,7 +184,7 @@ intptr_t RenderServer::main()
 #endif
         delete (*t);
     }
-    threads.clear();
+    m_threads.clear();
 
     return 0;
 }
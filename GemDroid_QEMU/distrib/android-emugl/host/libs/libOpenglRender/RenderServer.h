@@ -20,6 +20,10 @@
 #include "emugl/common/mutex.h"
 #include "emugl/common/thread.h"
 
+#include <set>
+
+class RenderThread;
+
 class RenderServer : public emugl::Thread
 {
 public:
@@ -30,13 +34,27 @@ public:
 
     bool isExiting() const { return m_exiting; }
 
+    // Start a new RenderThread serving |stream|, for connections that
+    // don't go through the listening socket; such streams must consume
+    // the guest's clientFlags themselves. Takes ownership of |stream|,
+    // and returns false on failure, or if the server is exiting.
+    bool startThread(IOStream *stream);
+
 private:
     RenderServer();
 
+    // Delete the threads that are no longer running. Must be called
+    // with m_threadsLock held.
+    void reapFinishedThreads();
+
 private:
+    typedef std::set<RenderThread *> RenderThreadsSet;
+
     emugl::Mutex m_lock;
     SocketStream *m_listenSock;
     bool m_exiting;
+    emugl::Mutex m_threadsLock;
+    RenderThreadsSet m_threads;
 };
 
 #endif
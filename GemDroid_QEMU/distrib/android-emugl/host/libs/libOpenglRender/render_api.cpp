@@ -16,6 +16,7 @@
 #include "render_api.h"
 
 #include "IOStream.h"
+#include "RenderChannel.h"
 #include "RenderServer.h"
 #include "RenderWindow.h"
 #include "TimeUtils.h"
@@ -248,6 +249,51 @@ RENDER_APICALL void RENDER_APIENTRY repaintOpenGLDisplay(void)
             __FUNCTION__);
 }
 
+RENDER_APICALL void* RENDER_APIENTRY openRenderChannel(int* wakeFd)
+{
+    if (!s_renderThread) {
+        return NULL;
+    }
+    RenderChannel* channel = RenderChannel::create();
+    if (!channel) {
+        return NULL;
+    }
+    if (!s_renderThread->startThread(channel->createStream())) {
+        channel->close();
+        return NULL;
+    }
+    *wakeFd = channel->wakeFd();
+    return channel;
+}
+
+RENDER_APICALL int RENDER_APIENTRY renderChannelSend(
+        void* channel, const RenderChannelBuffer* buffers, int numBuffers)
+{
+    return static_cast<RenderChannel*>(channel)->send(buffers, numBuffers);
+}
+
+RENDER_APICALL int RENDER_APIENTRY renderChannelRecv(
+        void* channel, RenderChannelBuffer* buffers, int numBuffers)
+{
+    return static_cast<RenderChannel*>(channel)->recv(buffers, numBuffers);
+}
+
+RENDER_APICALL unsigned RENDER_APIENTRY renderChannelPoll(void* channel)
+{
+    return static_cast<RenderChannel*>(channel)->poll();
+}
+
+RENDER_APICALL void RENDER_APIENTRY renderChannelWakeOn(
+        void* channel, unsigned events)
+{
+    static_cast<RenderChannel*>(channel)->wakeOn(events);
+}
+
+RENDER_APICALL void RENDER_APIENTRY closeRenderChannel(void* channel)
+{
+    static_cast<RenderChannel*>(channel)->close();
+}
+
 
 /* NOTE: For now, always use TCP mode by default, until the emulator
  *        has been updated to support Unix and Win32 pipes
@@ -10,6 +10,10 @@
 #include <stdint.h>
 typedef void (*OnPostFn)(void* context, int width, int height, int ydir,
                          int format, int type, unsigned char* pixels);
+typedef struct {
+    void* data;
+    size_t size;
+} RenderChannelBuffer;
 #define LIST_RENDER_API_FUNCTIONS(X) \
   X(int, initLibrary, ()) \
   X(int, setStreamMode, (int mode)) \
@@ -21,6 +25,12 @@ typedef void (*OnPostFn)(void* context, int width, int height, int ydir,
   X(void, setOpenGLDisplayRotation, (float zRot)) \
   X(void, repaintOpenGLDisplay, ()) \
   X(int, stopOpenGLRenderer, ()) \
+  X(void*, openRenderChannel, (int* wakeFd)) \
+  X(int, renderChannelSend, (void* channel, const RenderChannelBuffer* buffers, int numBuffers)) \
+  X(int, renderChannelRecv, (void* channel, RenderChannelBuffer* buffers, int numBuffers)) \
+  X(unsigned, renderChannelPoll, (void* channel)) \
+  X(void, renderChannelWakeOn, (void* channel, unsigned events)) \
+  X(void, closeRenderChannel, (void* channel)) \
 
 
 #endif  // RENDER_API_FUNCTIONS_H
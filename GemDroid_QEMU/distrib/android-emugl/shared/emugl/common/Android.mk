@@ -10,6 +10,7 @@ commonSources := \
         lazy_instance.cpp \
         message_channel.cpp \
         pod_vector.cpp \
+        ring_buffer.cpp \
         shared_library.cpp \
         smart_ptr.cpp \
         sockets.cpp \
@@ -51,6 +52,7 @@ host_commonSources := \
     id_to_object_map_unittest.cpp \
     lazy_instance_unittest.cpp \
     pod_vector_unittest.cpp \
+    ring_buffer_unittest.cpp \
     message_channel_unittest.cpp \
     mutex_unittest.cpp \
     shared_library_unittest.cpp \
@@ -0,0 +1,206 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "emugl/common/ring_buffer.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace emugl {
+
+namespace {
+
+// All accesses to shared positions and flags are sequentially consistent:
+// a side that goes to sleep publishes its 'waiting' flag then re-checks
+// the other side's position, while the other side publishes its position
+// then checks the flag. With weaker orderings both could miss each other.
+inline uint32_t atomicLoad(const uint32_t* p) {
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+inline void atomicStore(uint32_t* p, uint32_t value) {
+    __atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+}  // namespace
+
+RingBuffer::RingBuffer(size_t capacity) :
+        mData(NULL),
+        mMask(0U),
+        mClosed(0U),
+        mHead(0U),
+        mCanRead(),
+        mTail(0U),
+        mCanWrite() {
+    uint32_t size = 1U;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    mData = static_cast<uint8_t*>(::malloc(size));
+    mMask = size - 1U;
+}
+
+RingBuffer::~RingBuffer() {
+    ::free(mData);
+}
+
+size_t RingBuffer::write(const void* data, size_t size) {
+    if (atomicLoad(&mClosed)) {
+        return 0U;
+    }
+    uint32_t head = mHead;
+    size_t avail = capacity() - (head - atomicLoad(&mTail));
+    if (size > avail) {
+        size = avail;
+    }
+    if (size == 0) {
+        return 0U;
+    }
+    size_t pos = head & mMask;
+    size_t first = capacity() - pos;
+    if (first > size) {
+        first = size;
+    }
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    ::memcpy(mData + pos, src, first);
+    ::memcpy(mData, src + first, size - first);
+
+    atomicStore(&mHead, head + size);
+    signal(&mCanRead);
+    return size;
+}
+
+size_t RingBuffer::read(void* data, size_t size) {
+    uint32_t tail = mTail;
+    size_t avail = atomicLoad(&mHead) - tail;
+    if (size > avail) {
+        size = avail;
+    }
+    if (size == 0) {
+        return 0U;
+    }
+    size_t pos = tail & mMask;
+    size_t first = capacity() - pos;
+    if (first > size) {
+        first = size;
+    }
+    uint8_t* dst = static_cast<uint8_t*>(data);
+    ::memcpy(dst, mData + pos, first);
+    ::memcpy(dst + first, mData, size - first);
+
+    atomicStore(&mTail, tail + size);
+    signal(&mCanWrite);
+    return size;
+}
+
+size_t RingBuffer::readAvailable() const {
+    return atomicLoad(&mHead) - atomicLoad(&mTail);
+}
+
+size_t RingBuffer::writeAvailable() const {
+    return capacity() - (atomicLoad(&mHead) - atomicLoad(&mTail));
+}
+
+size_t RingBuffer::waitForRead() {
+    for (;;) {
+        size_t avail = readAvailable();
+        if (avail > 0 || isClosed()) {
+            return avail;
+        }
+        uint32_t event = atomicLoad(&mCanRead.event);
+        atomicStore(&mCanRead.waiting, 1U);
+        if (readAvailable() == 0 && !isClosed()) {
+            wait(&mCanRead, event);
+        }
+        atomicStore(&mCanRead.waiting, 0U);
+    }
+}
+
+size_t RingBuffer::waitForWrite() {
+    for (;;) {
+        if (isClosed()) {
+            return 0U;
+        }
+        size_t avail = writeAvailable();
+        if (avail > 0) {
+            return avail;
+        }
+        uint32_t event = atomicLoad(&mCanWrite.event);
+        atomicStore(&mCanWrite.waiting, 1U);
+        if (writeAvailable() == 0 && !isClosed()) {
+            wait(&mCanWrite, event);
+        }
+        atomicStore(&mCanWrite.waiting, 0U);
+    }
+}
+
+void RingBuffer::close() {
+    atomicStore(&mClosed, 1U);
+    atomicStore(&mCanRead.waiting, 1U);
+    atomicStore(&mCanWrite.waiting, 1U);
+    signal(&mCanRead);
+    signal(&mCanWrite);
+}
+
+bool RingBuffer::isClosed() const {
+    return atomicLoad(&mClosed) != 0;
+}
+
+#ifdef __linux__
+
+// static
+void RingBuffer::wait(Waiter* w, uint32_t event) {
+    // Returns immediately if |w->event| was already changed by signal().
+    syscall(SYS_futex, &w->event, FUTEX_WAIT_PRIVATE, event, NULL, NULL, 0);
+}
+
+// static
+void RingBuffer::signal(Waiter* w) {
+    if (atomicLoad(&w->waiting)) {
+        __atomic_add_fetch(&w->event, 1U, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &w->event, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+#else  // !__linux__
+
+// static
+void RingBuffer::wait(Waiter* w, uint32_t event) {
+    w->lock.lock();
+    while (atomicLoad(&w->event) == event) {
+        w->cond.wait(&w->lock);
+    }
+    w->lock.unlock();
+}
+
+// static
+void RingBuffer::signal(Waiter* w) {
+    if (atomicLoad(&w->waiting)) {
+        w->lock.lock();
+        __atomic_add_fetch(&w->event, 1U, __ATOMIC_SEQ_CST);
+        w->cond.signal();
+        w->lock.unlock();
+    }
+}
+
+#endif  // !__linux__
+
+}  // namespace emugl
@@ -0,0 +1,115 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EMUGL_COMMON_RING_BUFFER_H
+#define EMUGL_COMMON_RING_BUFFER_H
+
+#include "emugl/common/condition_variable.h"
+#include "emugl/common/mutex.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace emugl {
+
+// A byte stream between exactly one producer thread and one consumer
+// thread, backed by a fixed-size circular buffer in memory.
+//
+// Each side only ever modifies its own position, so read() and write()
+// never take a lock nor enter the kernel. A side that has nothing to do
+// (consumer on an empty buffer, producer on a full one) can sleep with
+// waitForRead() / waitForWrite(); it is woken by the other side only when
+// it actually sleeps, so a busy stream costs no system call at all. On
+// Linux, sleeping uses a futex, elsewhere a condition variable.
+//
+// Usage is:
+//   - In the producer thread, call write() and waitForWrite().
+//   - In the consumer thread, call read() and waitForRead().
+//   - From any thread, call close() to make all waits return.
+class RingBuffer {
+public:
+    // Constructor. |capacity| is rounded up to the next power of 2.
+    explicit RingBuffer(size_t capacity);
+
+    // Destructor.
+    ~RingBuffer();
+
+    // Return the buffer's capacity in bytes.
+    size_t capacity() const { return mMask + 1U; }
+
+    // Copy up to |size| bytes into the buffer, without blocking. Return
+    // the number of bytes copied, which is 0 if the buffer is full or
+    // closed.
+    size_t write(const void* data, size_t size);
+
+    // Copy up to |size| bytes from the buffer, without blocking. Return
+    // the number of bytes copied, which is 0 if the buffer is empty. Data
+    // that was written before close() can still be read.
+    size_t read(void* data, size_t size);
+
+    // Return the number of bytes that can be read right now.
+    size_t readAvailable() const;
+
+    // Return the number of bytes that can be written right now.
+    size_t writeAvailable() const;
+
+    // Block until there is data to read, or the buffer is closed.
+    // Return the number of readable bytes, or 0 if the buffer was closed
+    // and is empty.
+    size_t waitForRead();
+
+    // Block until there is room to write, or the buffer is closed.
+    // Return the number of writable bytes, or 0 if the buffer was closed.
+    size_t waitForWrite();
+
+    // Close the buffer, wake up all waiters.
+    void close();
+
+    // Return true iff close() was called.
+    bool isClosed() const;
+
+private:
+    // A place where one side can sleep until the other one signals it.
+    struct Waiter {
+        Waiter() : waiting(0U), event(0U) {}
+
+        uint32_t waiting;
+        uint32_t event;
+#ifndef __linux__
+        Mutex lock;
+        ConditionVariable cond;
+#endif
+    };
+
+    static void wait(Waiter* w, uint32_t event);
+    static void signal(Waiter* w);
+
+    uint8_t* mData;
+    uint32_t mMask;
+    uint32_t mClosed;
+
+    // Free-running positions, in bytes. mHead is only modified by the
+    // producer and mTail by the consumer; keep them on separate cache
+    // lines to avoid false sharing.
+    uint8_t mPad0[64];
+    uint32_t mHead;
+    Waiter mCanRead;
+    uint8_t mPad1[64];
+    uint32_t mTail;
+    Waiter mCanWrite;
+};
+
+}  // namespace emugl
+
+#endif  // EMUGL_COMMON_RING_BUFFER_H
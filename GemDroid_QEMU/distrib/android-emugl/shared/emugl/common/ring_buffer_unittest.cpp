@@ -0,0 +1,345 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "emugl/common/ring_buffer.h"
+
+#include "emugl/common/testing/test_thread.h"
+#include "emugl/common/testing/test_time.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace emugl {
+
+namespace {
+
+// Write |size| bytes of a known pattern, blocking when the buffer is full.
+void writeAll(RingBuffer* ring, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        if (!ring->waitForWrite()) {
+            return;
+        }
+        size_t n = ring->write(data, size);
+        data += n;
+        size -= n;
+    }
+}
+
+// Read exactly |size| bytes, blocking when the buffer is empty. Return
+// false if the buffer was closed before that.
+bool readAll(RingBuffer* ring, uint8_t* data, size_t size) {
+    while (size > 0) {
+        if (!ring->waitForRead()) {
+            return false;
+        }
+        size_t n = ring->read(data, size);
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+uint8_t patternByte(size_t pos) {
+    return static_cast<uint8_t>(pos * 7 + (pos >> 8));
+}
+
+struct StreamState {
+    RingBuffer ring;
+    size_t total;
+    bool ok;
+
+    StreamState(size_t capacity, size_t total_) :
+            ring(capacity), total(total_), ok(true) {}
+};
+
+// Consumer thread that checks that it receives the expected pattern.
+void* checkPatternFunction(void* param) {
+    StreamState* s = static_cast<StreamState*>(param);
+    uint8_t* buf = new uint8_t[1000];
+    size_t pos = 0;
+    while (pos < s->total) {
+        if (!s->ring.waitForRead()) {
+            s->ok = false;
+            break;
+        }
+        size_t n = s->ring.read(buf, 1000);
+        for (size_t i = 0; i < n; i++) {
+            if (buf[i] != patternByte(pos + i)) {
+                s->ok = false;
+            }
+        }
+        pos += n;
+    }
+    delete [] buf;
+    return NULL;
+}
+
+void* closeFunction(void* param) {
+    static_cast<RingBuffer*>(param)->close();
+    return NULL;
+}
+
+}  // namespace
+
+TEST(RingBuffer, CapacityIsPowerOfTwo) {
+    EXPECT_EQ(1U, RingBuffer(1).capacity());
+    EXPECT_EQ(64U, RingBuffer(64).capacity());
+    EXPECT_EQ(128U, RingBuffer(65).capacity());
+}
+
+TEST(RingBuffer, SingleThreadWrapAround) {
+    RingBuffer ring(16);
+    uint8_t out[16];
+    size_t pos = 0;
+
+    // Odd-sized writes and reads, so that copies wrap around the end.
+    for (int n = 0; n < 100; n++) {
+        uint8_t in[11];
+        for (size_t i = 0; i < sizeof(in); i++) {
+            in[i] = patternByte(pos + i);
+        }
+        EXPECT_EQ(sizeof(in), ring.write(in, sizeof(in)));
+        EXPECT_EQ(sizeof(in), ring.readAvailable());
+        EXPECT_EQ(16U - sizeof(in), ring.writeAvailable());
+        EXPECT_EQ(sizeof(in), ring.read(out, sizeof(out)));
+        EXPECT_EQ(0, memcmp(in, out, sizeof(in)));
+        pos += sizeof(in);
+    }
+}
+
+TEST(RingBuffer, PartialWriteWhenFull) {
+    RingBuffer ring(8);
+    uint8_t data[12] = { 0 };
+    EXPECT_EQ(8U, ring.write(data, sizeof(data)));
+    EXPECT_EQ(0U, ring.write(data, sizeof(data)));
+    EXPECT_EQ(0U, ring.writeAvailable());
+
+    uint8_t out[3];
+    EXPECT_EQ(3U, ring.read(out, sizeof(out)));
+    EXPECT_EQ(3U, ring.write(data, sizeof(data)));
+}
+
+TEST(RingBuffer, CloseKeepsPendingData) {
+    RingBuffer ring(8);
+    uint8_t data[4] = { 1, 2, 3, 4 };
+    EXPECT_EQ(4U, ring.write(data, sizeof(data)));
+    ring.close();
+
+    EXPECT_TRUE(ring.isClosed());
+    EXPECT_EQ(0U, ring.write(data, sizeof(data)));
+    EXPECT_EQ(0U, ring.waitForWrite());
+    EXPECT_EQ(4U, ring.waitForRead());
+
+    uint8_t out[4];
+    EXPECT_EQ(4U, ring.read(out, sizeof(out)));
+    EXPECT_EQ(0, memcmp(data, out, sizeof(data)));
+    EXPECT_EQ(0U, ring.waitForRead());
+}
+
+TEST(RingBuffer, CloseWakesReader) {
+    RingBuffer ring(8);
+    TestThread* thread = new TestThread(closeFunction, &ring);
+    EXPECT_EQ(0U, ring.waitForRead());
+    thread->join();
+    delete thread;
+}
+
+TEST(RingBuffer, TwoThreadsStream) {
+    // Use a small buffer so that both sides block many times.
+    const size_t kTotal = 1 << 20;
+    StreamState state(256, kTotal);
+    TestThread* thread = new TestThread(checkPatternFunction, &state);
+
+    uint8_t* data = new uint8_t[kTotal];
+    for (size_t i = 0; i < kTotal; i++) {
+        data[i] = patternByte(i);
+    }
+    // Vary the write size to exercise partial writes.
+    size_t pos = 0;
+    for (size_t n = 1; pos < kTotal; n = n % 700 + 1) {
+        size_t size = (kTotal - pos < n) ? kTotal - pos : n;
+        writeAll(&state.ring, data + pos, size);
+        pos += size;
+    }
+    thread->join();
+    delete thread;
+    delete [] data;
+
+    EXPECT_TRUE(state.ok);
+}
+
+#ifndef _WIN32
+
+namespace {
+
+const size_t kCommandSize = 64;
+const size_t kReplySize = 4;
+
+// A stub renderer: decodes nothing, but consumes a stream of fixed-size
+// commands and answers each command whose first byte is non-zero with a
+// small reply, like glGetError() or glFinish() would. A command with a
+// first byte of 2 terminates the stream.
+struct StubRenderer {
+    RingBuffer commands;
+    RingBuffer replies;
+    int fds[2];  // For the socket version.
+
+    StubRenderer() : commands(1 << 20), replies(1 << 12) {
+        fds[0] = fds[1] = -1;
+    }
+};
+
+void* ringRendererFunction(void* param) {
+    StubRenderer* r = static_cast<StubRenderer*>(param);
+    uint8_t* cmd = new uint8_t[kCommandSize];
+    uint8_t reply[kReplySize] = { 0 };
+    while (readAll(&r->commands, cmd, kCommandSize)) {
+        if (cmd[0] != 0) {
+            writeAll(&r->replies, reply, sizeof(reply));
+        }
+        if (cmd[0] == 2) {
+            break;
+        }
+    }
+    delete [] cmd;
+    return NULL;
+}
+
+void* socketRendererFunction(void* param) {
+    StubRenderer* r = static_cast<StubRenderer*>(param);
+    uint8_t* cmd = new uint8_t[kCommandSize];
+    uint8_t reply[kReplySize] = { 0 };
+    for (;;) {
+        size_t got = 0;
+        while (got < kCommandSize) {
+            ssize_t n = ::recv(r->fds[1], cmd + got, kCommandSize - got, 0);
+            if (n <= 0) {
+                delete [] cmd;
+                return NULL;
+            }
+            got += n;
+        }
+        if (cmd[0] != 0) {
+            ::send(r->fds[1], reply, sizeof(reply), 0);
+        }
+        if (cmd[0] == 2) {
+            break;
+        }
+    }
+    delete [] cmd;
+    return NULL;
+}
+
+// Send |count| commands in batches of |batch| (one write each, as the
+// guest pipe driver does with its buffers), wait for a reply after each
+// batch. Return the elapsed time in microseconds.
+double runRing(StubRenderer* r, int count, int batch) {
+    uint8_t* cmds = new uint8_t[kCommandSize * batch];
+    uint8_t reply[kReplySize];
+    memset(cmds, 0, kCommandSize * batch);
+    double start = testGetHighResTimeUs();
+    for (int n = 0; n < count; n += batch) {
+        bool last = (n + batch >= count);
+        cmds[kCommandSize * (batch - 1)] = last ? 2 : 1;
+        writeAll(&r->commands, cmds, kCommandSize * batch);
+        readAll(&r->replies, reply, sizeof(reply));
+    }
+    double elapsed = testGetHighResTimeUs() - start;
+    delete [] cmds;
+    return elapsed;
+}
+
+double runSocket(StubRenderer* r, int count, int batch) {
+    uint8_t* cmds = new uint8_t[kCommandSize * batch];
+    uint8_t reply[kReplySize];
+    memset(cmds, 0, kCommandSize * batch);
+    double start = testGetHighResTimeUs();
+    for (int n = 0; n < count; n += batch) {
+        bool last = (n + batch >= count);
+        cmds[kCommandSize * (batch - 1)] = last ? 2 : 1;
+        size_t sent = 0, size = kCommandSize * batch;
+        while (sent < size) {
+            ssize_t ret = ::send(r->fds[0], cmds + sent, size - sent, 0);
+            if (ret <= 0) {
+                break;
+            }
+            sent += ret;
+        }
+        ::recv(r->fds[0], reply, sizeof(reply), MSG_WAITALL);
+    }
+    double elapsed = testGetHighResTimeUs() - start;
+    delete [] cmds;
+    return elapsed;
+}
+
+}  // namespace
+
+TEST(RingBuffer, StubRendererRoundTrip) {
+    StubRenderer renderer;
+    TestThread* thread = new TestThread(ringRendererFunction, &renderer);
+    runRing(&renderer, 1000, 10);
+    thread->join();
+    delete thread;
+    EXPECT_EQ(0U, renderer.commands.readAvailable());
+    EXPECT_EQ(0U, renderer.replies.readAvailable());
+}
+
+// Compare the ring buffer with a local socket pair, the transport used by
+// the renderer's Unix socket mode. Batches of 1 measure round-trip
+// latency, large batches measure throughput.
+TEST(RingBuffer, DISABLED_StubRendererBenchmark) {
+    static const int kBatches[] = { 1, 16, 1024 };
+    const int kCommands = 1 << 20;
+
+    for (size_t b = 0; b < sizeof(kBatches) / sizeof(kBatches[0]); b++) {
+        int batch = kBatches[b];
+        int count = (batch == 1) ? kCommands / 16 : kCommands;
+        double bytes = (double)count * kCommandSize;
+
+        StubRenderer ringRenderer;
+        TestThread* thread =
+                new TestThread(ringRendererFunction, &ringRenderer);
+        double ringUs = runRing(&ringRenderer, count, batch);
+        thread->join();
+        delete thread;
+
+        StubRenderer socketRenderer;
+        ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0,
+                                  socketRenderer.fds));
+        thread = new TestThread(socketRendererFunction, &socketRenderer);
+        double socketUs = runSocket(&socketRenderer, count, batch);
+        thread->join();
+        delete thread;
+        ::close(socketRenderer.fds[0]);
+        ::close(socketRenderer.fds[1]);
+
+        double rounds = (double)count / batch;
+        printf("batch %4d: ring %7.1f MB/s %6.2f us/round-trip   "
+               "socket %7.1f MB/s %6.2f us/round-trip\n",
+               batch,
+               bytes / ringUs, ringUs / rounds,
+               bytes / socketUs, socketUs / rounds);
+    }
+}
+
+#endif  // !_WIN32
+
+}  // namespace emugl
@@ -0,0 +1,47 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EMUGL_COMMON_TESTING_TEST_TIME_H
+#define EMUGL_COMMON_TESTING_TEST_TIME_H
+
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN 1
+#  include <windows.h>
+#else
+#  include <time.h>
+#endif
+
+#include <stdint.h>
+
+namespace emugl {
+
+// Return a monotonic timestamp in microseconds, to time benchmarks. This
+// mirrors android::base::System::getHighResTimeUs(), which emugl code
+// can't depend on.
+inline int64_t testGetHighResTimeUs() {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return static_cast<int64_t>(now.QuadPart * 1000000.0 / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000LL + ts.tv_nsec / 1000;
+#endif
+}
+
+}  // namespace emugl
+
+#endif  // EMUGL_COMMON_TESTING_TEST_TIME_H
@@ -229,19 +229,21 @@ rgba8888_ycc_convert (j_compress_ptr cinfo,
   my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
   register int r, g, b;
   register INT32 * ctab = cconvert->rgb_ycc_tab;
-  register INT32* inptr;
+  register const unsigned char* inptr;
   register JSAMPROW outptr0, outptr1, outptr2;
   register JDIMENSION col;
   JDIMENSION num_cols = cinfo->image_width;
 
   while (--num_rows >= 0) {
-    inptr = (INT32*)(*input_buf++);
+    /* NOTE: INT32 is a long, i.e. 8 bytes on 64-bit hosts, so don't use it
+     * to step over 4-byte pixels. */
+    inptr = (const unsigned char*)(*input_buf++);
     outptr0 = output_buf[0][output_row];
     outptr1 = output_buf[1][output_row];
     outptr2 = output_buf[2][output_row];
     output_row++;
     for (col = 0; col < num_cols; col++) {
-      register const unsigned char* color = (unsigned char*)(inptr + col);
+      register const unsigned char* color = inptr + col * 4;
       r = (*color) & 0xff; color++;
       g = (*color) & 0xff; color++;
       b = (*color) & 0xff; color++;
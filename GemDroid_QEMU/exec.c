@@ -49,6 +49,7 @@
 #include "exec/cputlb.h"
 #include "exec/hax.h"
 #include "exec/ram_addr.h"
+#include "migration/migration.h"
 #include "qemu/timer.h"
 #if defined(CONFIG_USER_ONLY)
 #include <qemu.h>
@@ -2137,6 +2138,9 @@ void *cpu_physical_memory_map(hwaddr addr,
         addr += l;
         done += l;
     }
+    if (ret && ret != bounce.buffer) {
+        ram_lazy_touch(ret, done);
+    }
     *plen = done;
     return ret;
 }
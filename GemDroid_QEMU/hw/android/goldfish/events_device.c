@@ -23,7 +23,20 @@
 #include "migration/qemu-file.h"
 #include "ui/console.h"
 
-#define MAX_EVENTS 256*4
+/* Size of the event queue, in 32-bit words. Each event takes three words
+ * (type, code and value), which the kernel driver reads one at a time.
+ */
+#define MAX_EVENTS 4096
+
+/* Size of the event queue in version 2 snapshots */
+#define MAX_EVENTS_V2 1024
+
+/* Once the queue is filled past this point, a new batch that only repeats
+ * the last queued one with updated axis values is folded into it instead
+ * of being queued, so that a guest that fell behind catches up with the
+ * latest positions instead of replaying stale ones.
+ */
+#define EVENTS_COALESCE_THRESHOLD  (MAX_EVENTS * 3 / 4)
 
 enum {
     REG_READ        = 0x00,
@@ -63,6 +76,11 @@ typedef struct
     unsigned last;
     unsigned state;
 
+    /* Position and size in words of the last queued batch, or 0 if a
+     * single event was queued after it. Not saved. */
+    unsigned batch_start;
+    unsigned batch_len;
+
     const char *name;
 
     struct {
@@ -89,7 +107,7 @@ typedef struct ABSEntry {
 /* modify this each time you change the events_device structure. you
  * will also need to upadte events_state_load and events_state_save
  */
-#define  EVENTS_STATE_SAVE_VERSION  2
+#define  EVENTS_STATE_SAVE_VERSION  3
 
 #undef  QFIELD_STRUCT
 #define QFIELD_STRUCT  events_state
@@ -110,44 +128,165 @@ static void  events_state_save(QEMUFile*  f, void*  opaque)
     qemu_put_struct(f, events_state_fields, s);
 }
 
+/* Version 2 had the same fields, with a smaller queue. The queued words
+ * are moved to the start of the current one. */
+static int  events_state_load_v2(QEMUFile*  f, events_state*  s)
+{
+    unsigned  events[MAX_EVENTS_V2];
+    unsigned  first, last, count, n;
+
+    s->pending = qemu_get_be32(f);
+    s->page    = qemu_get_be32(f);
+    if (qemu_get_buffer(f, (uint8_t*)events, sizeof(events)) != sizeof(events))
+        return -1;
+    first    = qemu_get_be32(f);
+    last     = qemu_get_be32(f);
+    s->state = qemu_get_be32(f);
+
+    count = (last - first) & (MAX_EVENTS_V2 - 1);
+    for (n = 0; n < count; n++)
+        s->events[n] = events[(first + n) & (MAX_EVENTS_V2 - 1)];
+    s->first = 0;
+    s->last  = count;
+    return 0;
+}
+
 static int  events_state_load(QEMUFile*  f, void* opaque, int  version_id)
 {
     events_state*  s = opaque;
 
+    s->batch_len = 0;
+    if (version_id == 2)
+        return events_state_load_v2(f, s);
     if (version_id != EVENTS_STATE_SAVE_VERSION)
         return -1;
 
     return qemu_get_struct(f, events_state_fields, s);
 }
 
-static void enqueue_event(events_state *s, unsigned int type, unsigned int code, int value)
+/* Number of words in the queue */
+static unsigned queued_words(events_state *s)
+{
+    return (s->last - s->first) & (MAX_EVENTS - 1);
+}
+
+/* Return 1 if 'events' can be folded into the last queued batch, i.e. if
+ * that batch hasn't been read at all by the driver yet, and both only
+ * differ by their EV_ABS and EV_REL values. Slot selections, tracking ids
+ * and key states must match, since they aren't positions.
+ */
+static int can_coalesce_batch(events_state *s, const UserEvent* events, int count)
+{
+    unsigned pos = s->batch_start;
+    int      n;
+
+    if (s->batch_len == 0 || s->batch_len != (unsigned)count * 3 ||
+        queued_words(s) < s->batch_len)
+        return 0;
+
+    for (n = 0; n < count; n++) {
+        unsigned type  = s->events[pos];
+        unsigned code  = s->events[(pos + 1) & (MAX_EVENTS - 1)];
+        int      value = s->events[(pos + 2) & (MAX_EVENTS - 1)];
+
+        if (type != (unsigned)events[n].type || code != (unsigned)events[n].code)
+            return 0;
+
+        switch (type) {
+        case EV_SYN:
+            if (code != SYN_REPORT)
+                return 0;
+            break;
+        case EV_REL:
+            break;
+        case EV_ABS:
+            if ((code == ABS_MT_SLOT || code == ABS_MT_TRACKING_ID) &&
+                value != events[n].value)
+                return 0;
+            break;
+        case EV_KEY:
+            if (value != events[n].value)
+                return 0;
+            break;
+        default:
+            return 0;
+        }
+        pos = (pos + 3) & (MAX_EVENTS - 1);
+    }
+    return 1;
+}
+
+static void coalesce_batch(events_state *s, const UserEvent* events, int count)
 {
-    int  enqueued = s->last - s->first;
+    unsigned pos = s->batch_start;
+    int      n;
+
+    for (n = 0; n < count; n++) {
+        unsigned* value = &s->events[(pos + 2) & (MAX_EVENTS - 1)];
 
-    if (enqueued < 0)
-        enqueued += MAX_EVENTS;
+        if (events[n].type == EV_ABS)
+            *value = events[n].value;
+        else if (events[n].type == EV_REL)
+            *value += events[n].value;
+        pos = (pos + 3) & (MAX_EVENTS - 1);
+    }
+}
+
+/* Queue a batch of events as a whole, or drop it as a whole if the queue is
+ * full, so that the kernel never sees a partial frame. The IRQ is raised at
+ * most once per batch.
+ */
+static void enqueue_batch(events_state *s, const UserEvent* events, int count)
+{
+    unsigned  enqueued = queued_words(s);
+    unsigned  words    = count * 3;
+    int       n;
 
-    if (enqueued + 3 > MAX_EVENTS) {
-        fprintf(stderr, "##KBD: Full queue, lose event\n");
+    if (count <= 0)
+        return;
+
+    if (enqueued + words > EVENTS_COALESCE_THRESHOLD &&
+        can_coalesce_batch(s, events, count)) {
+        coalesce_batch(s, events, count);
         return;
     }
 
-    if(s->first == s->last) {
+    /* Keep one free word, a full queue would look empty. */
+    if (enqueued + words >= MAX_EVENTS) {
+        fprintf(stderr, "##KBD: Full queue, lose %d event(s)\n", count);
+        return;
+    }
+
+    s->batch_start = s->last;
+    s->batch_len   = words;
+
+    for (n = 0; n < count; n++) {
+        s->events[s->last] = events[n].type;
+        s->last = (s->last + 1) & (MAX_EVENTS-1);
+        s->events[s->last] = events[n].code;
+        s->last = (s->last + 1) & (MAX_EVENTS-1);
+        s->events[s->last] = events[n].value;
+        s->last = (s->last + 1) & (MAX_EVENTS-1);
+    }
+
+    if (enqueued == 0) {
 	if (s->state == STATE_LIVE)
 	  qemu_irq_raise(s->irq);
 	else {
 	  s->state = STATE_BUFFERED;
 	}
     }
+}
+
+static void enqueue_event(events_state *s, unsigned int type, unsigned int code, int value)
+{
+    UserEvent  event = { type, code, value };
 
     //fprintf(stderr, "##KBD: type=%d code=%d value=%d\n", type, code, value);
 
-    s->events[s->last] = type;
-    s->last = (s->last + 1) & (MAX_EVENTS-1);
-    s->events[s->last] = code;
-    s->last = (s->last + 1) & (MAX_EVENTS-1);
-    s->events[s->last] = value;
-    s->last = (s->last + 1) & (MAX_EVENTS-1);
+    enqueue_batch(s, &event, 1);
+    /* Single events may be part of a larger frame, never coalesce them. */
+    s->batch_len = 0;
 }
 
 static unsigned dequeue_event(events_state *s)
@@ -281,16 +420,22 @@ static void events_put_mouse(void *opaque, int dx, int dy, int dz, int buttons_s
             multitouch_update_pointer(MTES_MOUSE, 0, dx, dy,
                                       (buttons_state & 1) ? 0x81 : 0);
         } else if (androidHwConfig_isScreenTouch(android_hw)) {
-            enqueue_event(s, EV_ABS, ABS_X, dx);
-            enqueue_event(s, EV_ABS, ABS_Y, dy);
-            enqueue_event(s, EV_ABS, ABS_Z, dz);
-            enqueue_event(s, EV_KEY, BTN_TOUCH, buttons_state&1);
-            enqueue_event(s, EV_SYN, 0, 0);
+            UserEvent  events[] = {
+                { EV_ABS, ABS_X, dx },
+                { EV_ABS, ABS_Y, dy },
+                { EV_ABS, ABS_Z, dz },
+                { EV_KEY, BTN_TOUCH, buttons_state&1 },
+                { EV_SYN, 0, 0 },
+            };
+            enqueue_batch(s, events, ARRAY_SIZE(events));
         }
     } else {
-        enqueue_event(s, EV_REL, REL_X, dx);
-        enqueue_event(s, EV_REL, REL_Y, dy);
-        enqueue_event(s, EV_SYN, 0, 0);
+        UserEvent  events[] = {
+            { EV_REL, REL_X, dx },
+            { EV_REL, REL_Y, dy },
+            { EV_SYN, 0, 0 },
+        };
+        enqueue_batch(s, events, ARRAY_SIZE(events));
     }
 }
 
@@ -301,6 +446,13 @@ static void  events_put_generic(void*  opaque, int  type, int  code, int  value)
     enqueue_event(s, type, code, value);
 }
 
+static void  events_put_generic_batch(void*  opaque, const UserEvent*  events, int  count)
+{
+    events_state *s = (events_state *) opaque;
+
+    enqueue_batch(s, events, count);
+}
+
 /* set bits [bitl..bith] in the ev_bits[type] array
  */
 static void
@@ -537,6 +689,7 @@ void events_dev_init(uint32_t base, qemu_irq irq)
      * ensure that it is called after initialization is complete
      */
     user_event_register_generic(s, events_put_generic);
+    user_event_register_generic_batch(s, events_put_generic_batch);
 
     register_savevm(NULL,
                     "events_state",
@@ -17,8 +17,13 @@
 #include "exec/ram_addr.h"
 #include "hw/android/goldfish/device.h"
 #include "hw/hw.h"
+#include "qemu/host-utils.h"
 #include "ui/console.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* These values *must* match the platform definitions found under
  * hardware/libhardware/include/hardware/hardware.h
  */
@@ -63,6 +68,8 @@ struct goldfish_fb_state {
     uint32_t int_enable;
     int      rotation;   /* 0, 1, 2 or 3 */
     int      dpi;
+    unsigned long* dirty_pages;  /* see compute_fb_update_rect_linear */
+    long     dirty_pages_size;
 };
 
 #define  GOLDFISH_FB_SAVE_VERSION  2
@@ -247,6 +254,8 @@ typedef struct {
     int            src_pitch;
     uint8_t*       dst_pixels;
     int            dst_pitch;
+    unsigned long* dirty_pages;  /* scratch, one bit per framebuffer page */
+    int            streaming;    /* use non-temporal stores for the copy */
 } FbUpdateState;
 
 /* This structure is used to hold the outputs for
@@ -258,184 +267,384 @@ typedef struct {
     int xmin, ymin, xmax, ymax;
 } FbUpdateRect;
 
-/* Determine the smallest bounding rectangle of pixels which changed
- * between the source (framebuffer) and destination (surface) pixel
- * buffers.
- *
- * Return 0 if there was no change, otherwise, populate '*rect'
- * and return 1.
- *
- * If 'dirty_base' is not 0, it is a physical address that will be
- * used to speed-up the check using the VGA dirty bits. In practice
- * this is only used if your kernel driver does not implement.
+/* Frames that touch at least this many bytes are copied with non-temporal
+ * stores, since they would only evict the rest of the cache anyway. Below
+ * that, the surface is better left in the cache for the display code that
+ * reads it right after.
+ */
+#define  FB_STREAMING_THRESHOLD  (16*1024*1024)
+
+#if defined(HOST_WORDS_BIGENDIAN) == defined(TARGET_WORDS_BIGENDIAN)
+
+#ifdef __SSE2__
+/* Return a 16-bit mask of the bytes that differ between two 16-byte blocks */
+static inline int
+fb_diff_mask(const uint8_t* a, const uint8_t* b)
+{
+    __m128i  va = _mm_loadu_si128((const __m128i*)a);
+    __m128i  vb = _mm_loadu_si128((const __m128i*)b);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xffff;
+}
+
+/* Return non-zero if two 64-byte blocks differ */
+static inline int
+fb_diff64(const uint8_t* a, const uint8_t* b)
+{
+    __m128i  eq;
+    eq = _mm_and_si128(
+            _mm_and_si128(
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a)),
+                               _mm_loadu_si128((const __m128i*)(b))),
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + 16)),
+                               _mm_loadu_si128((const __m128i*)(b + 16)))),
+            _mm_and_si128(
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + 32)),
+                               _mm_loadu_si128((const __m128i*)(b + 32))),
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + 48)),
+                               _mm_loadu_si128((const __m128i*)(b + 48)))));
+    return _mm_movemask_epi8(eq) != 0xffff;
+}
+#endif
+
+/* Return the offset of the first byte that differs between 'a' and 'b',
+ * or 'len' if they are identical.
+ */
+static int
+fb_first_diff(const uint8_t* a, const uint8_t* b, int len)
+{
+    int  i = 0;
+#ifdef __SSE2__
+    while (i + 64 <= len && !fb_diff64(a + i, b + i))
+        i += 64;
+    for ( ; i + 16 <= len; i += 16) {
+        int  mask = fb_diff_mask(a + i, b + i);
+        if (mask)
+            return i + ctz32(mask);
+    }
+#else
+    for ( ; i + 8 <= len; i += 8) {
+        uint64_t  wa, wb;
+        memcpy(&wa, a + i, 8);
+        memcpy(&wb, b + i, 8);
+        if (wa != wb)
+            break;
+    }
+#endif
+    for ( ; i < len; i++) {
+        if (a[i] != b[i])
+            break;
+    }
+    return i;
+}
+
+/* Return the offset of the last byte that differs between 'a' and 'b'
+ * in [start..len), or 'start-1' if there is none.
+ */
+static int
+fb_last_diff(const uint8_t* a, const uint8_t* b, int start, int len)
+{
+    int  i = len;
+#ifdef __SSE2__
+    while (i - 64 >= start && !fb_diff64(a + i - 64, b + i - 64))
+        i -= 64;
+    for ( ; i - 16 >= start; i -= 16) {
+        int  mask = fb_diff_mask(a + i - 16, b + i - 16);
+        if (mask)
+            return i - 16 + 31 - clz32(mask);
+    }
+#else
+    for ( ; i - 8 >= start; i -= 8) {
+        uint64_t  wa, wb;
+        memcpy(&wa, a + i - 8, 8);
+        memcpy(&wb, b + i - 8, 8);
+        if (wa != wb)
+            break;
+    }
+#endif
+    while (--i >= start) {
+        if (a[i] != b[i])
+            break;
+    }
+    return i;
+}
+
+/* Copy 'len' bytes, bypassing the cache if 'streaming' is set. The caller
+ * must issue a store fence once it is done with streaming copies.
+ */
+static void
+fb_copy_span(uint8_t* dst, const uint8_t* src, int len, int streaming)
+{
+#ifdef __SSE2__
+    if (streaming && len >= 64) {
+        int  head = (-(uintptr_t)dst) & 15;
+
+        memcpy(dst, src, head);
+        dst += head;
+        src += head;
+        len -= head;
+        for ( ; len >= 16; len -= 16, dst += 16, src += 16) {
+            _mm_stream_si128((__m128i*)dst,
+                             _mm_loadu_si128((const __m128i*)src));
+        }
+    }
+#endif
+    memcpy(dst, src, len);
+}
+
+#endif /* HOST_WORDS_BIGENDIAN == TARGET_WORDS_BIGENDIAN */
+
+/* Compare line 'yy' of the framebuffer with the surface, copy the changed
+ * pixels and return the bounds of the change in '*pxx1' and '*pxx2', with
+ * '*pxx1' set to the width if nothing changed.
  *
- * This function assumes that the framebuffers are in linear memory.
- * This may change later when we want to support larger framebuffers
- * that exceed the max DMA aperture size though.
+ * Return 0 if the pixel depth is not supported, 1 otherwise.
  */
 static int
-compute_fb_update_rect_linear(FbUpdateState*  fbs,
-                              uint32_t        dirty_base,
-                              FbUpdateRect*   rect)
+fb_update_line(FbUpdateState*  fbs, int  yy, int*  pxx1, int*  pxx2)
 {
-    int  yy;
     int  width = fbs->width;
-    const uint8_t* src_line = fbs->src_pixels;
-    uint8_t*       dst_line = fbs->dst_pixels;
-    uint32_t       dirty_addr = dirty_base;
-    rect->xmin = rect->ymin = INT_MAX;
-    rect->xmax = rect->ymax = INT_MIN;
-    for (yy = 0; yy < fbs->height; yy++) {
-        int xx1, xx2;
-        /* If dirty_addr is != 0, then use it as a physical address to
-         * use the VGA dirty bits table to speed up the detection of
-         * changed pixels.
-         */
-        if (dirty_addr != 0) {
-            int  dirty = cpu_physical_memory_get_dirty(dirty_addr,
-                                                       fbs->src_pitch,
-                                                       DIRTY_MEMORY_VGA);
-            if (!dirty) { /* this line was not modified, skip to next one */
-                goto NEXT_LINE;
-            }
-        }
+    const uint8_t* src_line = fbs->src_pixels + yy * fbs->src_pitch;
+    uint8_t*       dst_line = fbs->dst_pixels + yy * fbs->dst_pitch;
+    int  xx1, xx2;
 
-        /* Then compute actual bounds of the changed pixels, while
-         * copying them from 'src' to 'dst'. This depends on the pixel depth.
-         */
-        switch (fbs->bytes_per_pixel) {
-        case 2:
-        {
-            const uint16_t* src = (const uint16_t*) src_line;
-            uint16_t*       dst = (uint16_t*) dst_line;
-
-            xx1 = 0;
-            DUFF4(width, {
-                uint16_t spix = src[xx1];
-#if defined(HOST_WORDS_BIGENDIAN) != defined(TARGET_WORDS_BIGENDIAN)
-                spix = (uint16_t)((spix << 8) | (spix >> 8));
-#endif
-                if (spix != dst[xx1])
-                    break;
-                xx1++;
-            });
-            if (xx1 == width) {
-                break;
-            }
-            xx2 = width-1;
-            DUFF4(xx2-xx1, {
-                if (src[xx2] != dst[xx2])
-                    break;
-                xx2--;
-            });
-#if defined(HOST_WORDS_BIGENDIAN) != defined(TARGET_WORDS_BIGENDIAN)
-            /* Convert the guest pixels into host ones */
-            int xx = xx1;
-            DUFF4(xx2-xx1+1,{
-                unsigned   spix = src[xx];
-                dst[xx] = (uint16_t)((spix << 8) | (spix >> 8));
-                xx++;
-            });
+#if defined(HOST_WORDS_BIGENDIAN) == defined(TARGET_WORDS_BIGENDIAN)
+    /* Pixels only need to be copied, so a byte-wise comparison finds the
+     * same bounds as a pixel-wise one.
+     */
+    int  bpp = fbs->bytes_per_pixel;
+    int  len = width * bpp;
+    int  first, last;
+
+    if (bpp < 2 || bpp > 4)
+        return 0;
+
+    xx1 = xx2 = width;
+    first = fb_first_diff(src_line, dst_line, len);
+    if (first < len) {
+        last = fb_last_diff(src_line, dst_line, first, len);
+        xx1  = first / bpp;
+        xx2  = last / bpp;
+        fb_copy_span(dst_line + xx1*bpp, src_line + xx1*bpp,
+                     (xx2-xx1+1)*bpp, fbs->streaming);
+    }
 #else
-            memcpy( dst+xx1, src+xx1, (xx2-xx1+1)*2 );
-#endif
+    switch (fbs->bytes_per_pixel) {
+    case 2:
+    {
+        const uint16_t* src = (const uint16_t*) src_line;
+        uint16_t*       dst = (uint16_t*) dst_line;
+
+        xx1 = 0;
+        DUFF4(width, {
+            uint16_t spix = src[xx1];
+            spix = (uint16_t)((spix << 8) | (spix >> 8));
+            if (spix != dst[xx1])
+                break;
+            xx1++;
+        });
+        if (xx1 == width) {
             break;
         }
+        xx2 = width-1;
+        DUFF4(xx2-xx1, {
+            if (src[xx2] != dst[xx2])
+                break;
+            xx2--;
+        });
+        /* Convert the guest pixels into host ones */
+        int xx = xx1;
+        DUFF4(xx2-xx1+1,{
+            unsigned   spix = src[xx];
+            dst[xx] = (uint16_t)((spix << 8) | (spix >> 8));
+            xx++;
+        });
+        break;
+    }
 
-        case 3:
-        {
-            xx1 = 0;
-            DUFF4(width, {
-                int xx = xx1*3;
-                if (src_line[xx+0] != dst_line[xx+0] ||
-                    src_line[xx+1] != dst_line[xx+1] ||
-                    src_line[xx+2] != dst_line[xx+2]) {
-                    break;
-                }
-                xx1 ++;
-            });
-            if (xx1 == width) {
+    case 3:
+    {
+        xx1 = 0;
+        DUFF4(width, {
+            int xx = xx1*3;
+            if (src_line[xx+0] != dst_line[xx+0] ||
+                src_line[xx+1] != dst_line[xx+1] ||
+                src_line[xx+2] != dst_line[xx+2]) {
                 break;
             }
-            xx2 = width-1;
-            DUFF4(xx2-xx1,{
-                int xx = xx2*3;
-                if (src_line[xx+0] != dst_line[xx+0] ||
-                    src_line[xx+1] != dst_line[xx+1] ||
-                    src_line[xx+2] != dst_line[xx+2]) {
-                    break;
-                }
-                xx2--;
-            });
-            memcpy( dst_line+xx1*3, src_line+xx1*3, (xx2-xx1+1)*3 );
+            xx1 ++;
+        });
+        if (xx1 == width) {
             break;
         }
+        xx2 = width-1;
+        DUFF4(xx2-xx1,{
+            int xx = xx2*3;
+            if (src_line[xx+0] != dst_line[xx+0] ||
+                src_line[xx+1] != dst_line[xx+1] ||
+                src_line[xx+2] != dst_line[xx+2]) {
+                break;
+            }
+            xx2--;
+        });
+        memcpy( dst_line+xx1*3, src_line+xx1*3, (xx2-xx1+1)*3 );
+        break;
+    }
 
-        case 4:
-        {
-            const uint32_t* src = (const uint32_t*) src_line;
-            uint32_t*       dst = (uint32_t*) dst_line;
-
-            xx1 = 0;
-            DUFF4(width, {
-                uint32_t spix = src[xx1];
-#if defined(HOST_WORDS_BIGENDIAN) != defined(TARGET_WORDS_BIGENDIAN)
-                spix = (spix << 16) | (spix >> 16);
-                spix = ((spix << 8) & 0xff00ff00) | ((spix >> 8) & 0x00ff00ff);
-#endif
-                if (spix != dst[xx1]) {
-                    break;
-                }
-                xx1++;
-            });
-            if (xx1 == width) {
+    case 4:
+    {
+        const uint32_t* src = (const uint32_t*) src_line;
+        uint32_t*       dst = (uint32_t*) dst_line;
+
+        xx1 = 0;
+        DUFF4(width, {
+            uint32_t spix = src[xx1];
+            spix = (spix << 16) | (spix >> 16);
+            spix = ((spix << 8) & 0xff00ff00) | ((spix >> 8) & 0x00ff00ff);
+            if (spix != dst[xx1]) {
                 break;
             }
-            xx2 = width-1;
-            DUFF4(xx2-xx1,{
-                if (src[xx2] != dst[xx2]) {
-                    break;
-                }
-                xx2--;
-            });
-#if defined(HOST_WORDS_BIGENDIAN) != defined(TARGET_WORDS_BIGENDIAN)
-            /* Convert the guest pixels into host ones */
-            int xx = xx1;
-            DUFF4(xx2-xx1+1,{
-                uint32_t   spix = src[xx];
-                spix = (spix << 16) | (spix >> 16);
-                spix = ((spix << 8) & 0xff00ff00) | ((spix >> 8) & 0x00ff00ff);
-                dst[xx] = spix;
-                xx++;
-            })
-#else
-            memcpy( dst+xx1, src+xx1, (xx2-xx1+1)*4 );
-#endif
+            xx1++;
+        });
+        if (xx1 == width) {
             break;
         }
-        default:
+        xx2 = width-1;
+        DUFF4(xx2-xx1,{
+            if (src[xx2] != dst[xx2]) {
+                break;
+            }
+            xx2--;
+        });
+        /* Convert the guest pixels into host ones */
+        int xx = xx1;
+        DUFF4(xx2-xx1+1,{
+            uint32_t   spix = src[xx];
+            spix = (spix << 16) | (spix >> 16);
+            spix = ((spix << 8) & 0xff00ff00) | ((spix >> 8) & 0x00ff00ff);
+            dst[xx] = spix;
+            xx++;
+        })
+        break;
+    }
+    default:
+        return 0;
+    }
+#endif
+    *pxx1 = xx1;
+    *pxx2 = xx2;
+    return 1;
+}
+
+/* Update 'rect' with the changes found in lines [y1..y2) */
+static int
+fb_update_lines(FbUpdateState*  fbs, int  y1, int  y2, FbUpdateRect*  rect)
+{
+    int  yy;
+
+    for (yy = y1; yy < y2; yy++) {
+        int  xx1, xx2;
+
+        if (!fb_update_line(fbs, yy, &xx1, &xx2))
             return 0;
-        }
+
         /* Update bounds if pixels on this line were modified */
-        if (xx1 < width) {
+        if (xx1 < fbs->width) {
             if (xx1 < rect->xmin) rect->xmin = xx1;
             if (xx2 > rect->xmax) rect->xmax = xx2;
             if (yy < rect->ymin) rect->ymin = yy;
             if (yy > rect->ymax) rect->ymax = yy;
         }
-    NEXT_LINE:
-        src_line += fbs->src_pitch;
-        dst_line += fbs->dst_pitch;
     }
+    return 1;
+}
 
-    if (rect->ymin > rect->ymax) { /* nothing changed */
-        return 0;
+/* Determine the smallest bounding rectangle of pixels which changed
+ * between the source (framebuffer) and destination (surface) pixel
+ * buffers.
+ *
+ * Return 0 if there was no change, otherwise, populate '*rect'
+ * and return 1.
+ *
+ * If 'dirty_base' is not 0, it is the physical address of the framebuffer,
+ * and only the lines that overlap pages marked in the VGA dirty bitmap are
+ * compared. The bitmap is scanned once per frame, and the dirty bits of the
+ * framebuffer are reset before any pixel is read, so that guest writes
+ * racing with the copy are picked up by the next frame.
+ *
+ * This function assumes that the framebuffers are in linear memory.
+ * This may change later when we want to support larger framebuffers
+ * that exceed the max DMA aperture size though.
+ */
+static int
+compute_fb_update_rect_linear(FbUpdateState*  fbs,
+                              uint32_t        dirty_base,
+                              FbUpdateRect*   rect)
+{
+    ram_addr_t  fb_size = (ram_addr_t)fbs->height * fbs->src_pitch;
+    int         ok = 1;
+
+    rect->xmin = rect->ymin = INT_MAX;
+    rect->xmax = rect->ymax = INT_MIN;
+
+    if (dirty_base == 0) {
+        fbs->streaming = (fb_size >= FB_STREAMING_THRESHOLD);
+        ok = fb_update_lines(fbs, 0, fbs->height, rect);
+    } else {
+        unsigned long*  dirty = ram_list.dirty_memory[DIRTY_MEMORY_VGA];
+        unsigned long   first = dirty_base >> TARGET_PAGE_BITS;
+        unsigned long   end   = TARGET_PAGE_ALIGN(dirty_base + fb_size) >> TARGET_PAGE_BITS;
+        unsigned long   npages = end - first;
+        unsigned long   page, next, ndirty = 0;
+        int             next_y = 0;
+
+        /* Take a snapshot of the dirty pages, then reset them */
+        bitmap_zero(fbs->dirty_pages, npages);
+        for (page = find_next_bit(dirty, end, first); page < end;
+             page = find_next_bit(dirty, end, next)) {
+            next = find_next_zero_bit(dirty, end, page);
+            bitmap_set(fbs->dirty_pages, page - first, next - page);
+            ndirty += next - page;
+        }
+        if (ndirty == 0)
+            return 0;
+        cpu_physical_memory_reset_dirty(dirty_base, fb_size, DIRTY_MEMORY_VGA);
+
+        fbs->streaming = (ndirty << TARGET_PAGE_BITS >= FB_STREAMING_THRESHOLD);
+
+        /* Compare the lines overlapping each run of dirty pages */
+        for (page = find_next_bit(fbs->dirty_pages, npages, 0); page < npages;
+             page = find_next_bit(fbs->dirty_pages, npages, next)) {
+            ram_addr_t  start, stop;
+            int         y1, y2;
+
+            next  = find_next_zero_bit(fbs->dirty_pages, npages, page);
+            start = ((first + page) << TARGET_PAGE_BITS) - dirty_base;
+            stop  = ((first + next) << TARGET_PAGE_BITS) - dirty_base;
+            if ((first + page) << TARGET_PAGE_BITS < dirty_base)
+                start = 0;
+            if (stop > fb_size)
+                stop = fb_size;
+
+            y1 = start / fbs->src_pitch;
+            y2 = (stop + fbs->src_pitch - 1) / fbs->src_pitch;
+            if (y1 < next_y)
+                y1 = next_y;
+            if (y1 < y2)
+                ok = fb_update_lines(fbs, y1, y2, rect);
+            if (!ok)
+                break;
+            next_y = y2;
+        }
     }
 
-    /* Always clear the dirty VGA bits */
-    cpu_physical_memory_reset_dirty(dirty_base + rect->ymin * fbs->src_pitch,
-                                    (rect->ymax - rect->ymin + 1) * fbs->src_pitch,
-                                    DIRTY_MEMORY_VGA);
+#ifdef __SSE2__
+    if (fbs->streaming)
+        _mm_sfence();
+#endif
+
+    if (!ok || rect->ymin > rect->ymax) { /* nothing changed */
+        return 0;
+    }
     return 1;
 }
 
@@ -488,6 +697,15 @@ static void goldfish_fb_update_display(void *opaque)
     fbs.src_pixels = src_line;
     fbs.src_pitch  = width*s->ds->surface->pf.bytes_per_pixel;
 
+    /* One bit per page the framebuffer may overlap */
+    long  npages = ((long)height*fbs.src_pitch >> TARGET_PAGE_BITS) + 2;
+    if (npages > s->dirty_pages_size) {
+        g_free(s->dirty_pages);
+        s->dirty_pages      = bitmap_new(npages);
+        s->dirty_pages_size = npages;
+    }
+    fbs.dirty_pages = s->dirty_pages;
+
 
 #if STATS
     if (full_update)
@@ -516,6 +734,8 @@ static void goldfish_fb_update_display(void *opaque)
     else
     {
         if (full_update) { /* don't use dirty-bits optimization */
+            cpu_physical_memory_reset_dirty(base, height*fbs.src_pitch,
+                                            DIRTY_MEMORY_VGA);
             base = 0;
         }
         if (compute_fb_update_rect_linear(&fbs, base, &rect) == 0) {
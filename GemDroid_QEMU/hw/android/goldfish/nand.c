@@ -15,6 +15,7 @@
 #include "hw/android/goldfish/nand.h"
 #include "hw/android/goldfish/vmem.h"
 #include "hw/hw.h"
+#include "android/filesystems/image_copy.h"
 #include "android/utils/path.h"
 #include "android/utils/tempfile.h"
 #include "android/qemu-debug.h"
@@ -730,7 +731,11 @@ void nand_add_dev(const char *arg)
     int rwfd = -1;
     int read_only = 0;
     int pad;
-    ssize_t read_size;
+    int copy_ret;
+    AndroidImageCopyMethod copy_method;
+    static const char* const copy_method_names[] = {
+        "reflink", "kernel copy", "sparse copy", "sparse image expanded",
+    };
     uint32_t page_size = 2048;
     uint32_t extra_size = 64;
     uint32_t erase_pages = 64;
@@ -871,9 +876,20 @@ void nand_add_dev(const char *arg)
             XLOG("could not open file %s, %s\n", initfilename, strerror(errno));
             exit(1);
         }
+        /* Reflink or copy the image, skipping holes, and expanding it if
+         * it is an Android sparse one. */
+        copy_ret = android_copyImageFd(rwfd, initfd, &copy_method);
+        if (copy_ret < 0) {
+            XLOG("could not copy file %s to %s, %s\n",
+                 initfilename, rwfilename, strerror(-copy_ret));
+            exit(1);
+        }
+        VERBOSE_PRINT(init, "%s: copied %s to %s (%s)", __FUNCTION__,
+                      initfilename, rwfilename,
+                      copy_method_names[copy_method]);
+        close(initfd);
         if(dev_size == 0) {
-            dev_size = do_lseek(initfd, 0, SEEK_END);
-            do_lseek(initfd, 0, SEEK_SET);
+            dev_size = do_lseek(rwfd, 0, SEEK_END);
         }
     }
 
@@ -902,20 +918,6 @@ void nand_add_dev(const char *arg)
     dev->flags |= NAND_DEV_FLAG_BATCH_CAP;
 #endif
 
-    if (initfd >= 0) {
-        do {
-            read_size = do_read(initfd, dev->data, dev->erase_size);
-            if(read_size < 0) {
-                XLOG("could not read file %s, %s\n", initfilename, strerror(errno));
-                exit(1);
-            }
-            if(do_write(rwfd, dev->data, read_size) != read_size) {
-                XLOG("could not write file %s, %s\n", rwfilename, strerror(errno));
-                exit(1);
-            }
-        } while(read_size == dev->erase_size);
-        close(initfd);
-    }
     dev->fd = rwfd;
 
     nand_dev_count++;
@@ -15,6 +15,7 @@
 #include "hw/android/goldfish/device.h"
 #include "hw/android/goldfish/vmem.h"
 #include "exec/ram_addr.h"
+#include "migration/migration.h"
 #include "qemu/timer.h"
 
 #define  DEBUG 0
@@ -54,7 +55,10 @@
 /* Maximum length of pipe service name, in characters (excluding final 0) */
 #define MAX_PIPE_SERVICE_NAME_SIZE  255
 
-#define GOLDFISH_PIPE_SAVE_VERSION  3
+#define GOLDFISH_PIPE_SAVE_VERSION  4
+
+// Up to version 3, the batch descriptor address was not saved.
+#define GOLDFISH_PIPE_SAVE_VERSION_NO_BATCH  3
 
 // Up to Tools r22.6, the emulator saved with this version number.
 #define GOLDFISH_PIPE_SAVE_VERSION_LEGACY  2
@@ -131,6 +135,7 @@ typedef struct PipeDevice  PipeDevice;
 typedef struct Pipe {
     struct Pipe*              next;
     struct Pipe*              next_waked;
+    struct Pipe*              next_hash;
     PipeDevice*                device;
     uint64_t                   channel;
     void*                      opaque;
@@ -163,12 +168,12 @@ pipe_new(uint64_t channel, PipeDevice* dev)
 }
 
 static Pipe**
-pipe_list_findp_channel( Pipe** list, uint64_t channel )
+pipe_list_findp( Pipe** list, Pipe* pipe )
 {
     Pipe** pnode = list;
     for (;;) {
         Pipe* node = *pnode;
-        if (node == NULL || node->channel == channel) {
+        if (node == NULL || node == pipe) {
             break;
         }
         pnode = &node->next;
@@ -176,6 +181,40 @@ pipe_list_findp_channel( Pipe** list, uint64_t channel )
     return pnode;
 }
 
+/* Channels are looked up on every command, so they are also kept in a
+ * small hash table keyed on the channel value (which is the address of a
+ * guest kernel structure, hence the mixing). */
+#define PIPE_HASH_BITS  8
+#define PIPE_HASH_SIZE  (1 << PIPE_HASH_BITS)
+
+static unsigned
+pipe_hash_channel( uint64_t channel )
+{
+    return (unsigned)((channel * 0x9e3779b97f4a7c15ULL) >> (64 - PIPE_HASH_BITS));
+}
+
+static Pipe**
+pipe_hash_findp_channel( Pipe** table, uint64_t channel )
+{
+    Pipe** pnode = &table[pipe_hash_channel(channel)];
+    for (;;) {
+        Pipe* node = *pnode;
+        if (node == NULL || node->channel == channel) {
+            break;
+        }
+        pnode = &node->next_hash;
+    }
+    return pnode;
+}
+
+static void
+pipe_hash_add( Pipe** table, Pipe* pipe )
+{
+    Pipe** bucket = &table[pipe_hash_channel(pipe->channel)];
+    pipe->next_hash = *bucket;
+    *bucket = pipe;
+}
+
 #if 0
 static Pipe**
 pipe_list_findp_opaque( Pipe** list, void* opaque )
@@ -960,6 +999,9 @@ struct PipeDevice {
     /* the list of signalled pipes */
     Pipe*  signaled_pipes;
 
+    /* all pipes, hashed by channel */
+    Pipe*  channels[PIPE_HASH_SIZE];
+
     /* i/o registers */
     uint64_t  address;
     uint32_t  size;
@@ -967,14 +1009,84 @@ struct PipeDevice {
     uint64_t  channel;
     uint32_t  wakes;
     uint64_t  params_addr;
+    uint64_t  batch_addr;
+
+    /* copy of the guest's batch descriptors, allocated on first use */
+    struct pipe_batch_desc*  batch;
 };
 
+/* Maximum number of host memory segments in a single transfer. Physically
+ * contiguous guest pages are merged, so this is only reached by large and
+ * badly fragmented buffers, which are then transferred partially. */
+#define PIPE_MAX_SEGMENTS  64
+
+/* GoldfishPipeTranslateFunc for the current CPU's address space */
+static uint8_t*
+pipeDevice_translatePage( void* opaque, uint64_t page, int first )
+{
+    CPUOldState* env = cpu_single_env;
+    hwaddr       phys;
+
+    (void)opaque;
+    /* The safe variant re-syncs the MMU state from KVM, which only
+     * needs to happen once per buffer. */
+    if (first) {
+        phys = safe_get_phys_page_debug(ENV_GET_CPU(env), page);
+    } else {
+        phys = cpu_get_phys_page_debug(env, page);
+    }
+    if (phys == (hwaddr)-1) {
+        return NULL;
+    }
+#ifdef TARGET_X86_64
+    phys = phys & TARGET_PTE_MASK;
+#endif
+    return qemu_get_ram_ptr(phys);
+}
+
+/* Translate the guest virtual range [address, address+size) into host
+ * memory segments appended to 'buffers', see goldfish_pipe_sg_append().
+ * Returns 1 if the whole range was mapped, 0 if only a prefix was.
+ */
+static int
+pipeDevice_mapBuffer( target_ulong address, uint32_t size,
+                      GoldfishPipeBuffer* buffers, int* count, int maxBuffers )
+{
+    int  start = *count;
+    int  full;
+    int  nn;
+
+    full = goldfish_pipe_sg_append(buffers, count, maxBuffers,
+                                   address, size, TARGET_PAGE_SIZE,
+                                   pipeDevice_translatePage, NULL);
+    /* The first new entry may have been merged into the previous one,
+     * touching it again is harmless. */
+    for (nn = (start > 0) ? start - 1 : 0; nn < *count; nn++) {
+        ram_lazy_touch(buffers[nn].data, buffers[nn].size);
+    }
+    return full;
+}
+
+/* Run a READ_BUFFER or WRITE_BUFFER command on a scatter list */
+static int
+pipeDevice_transfer( Pipe* pipe, uint32_t command,
+                     GoldfishPipeBuffer* buffers, int count )
+{
+    if (count == 0) {
+        return PIPE_ERROR_INVAL;
+    }
+    if (command == PIPE_CMD_READ_BUFFER) {
+        return pipe->funcs->recvBuffers(pipe->opaque, buffers, count);
+    } else {
+        return pipe->funcs->sendBuffers(pipe->opaque, buffers, count);
+    }
+}
+
 static void
 pipeDevice_doCommand( PipeDevice* dev, uint32_t command )
 {
-    Pipe** lookup = pipe_list_findp_channel(&dev->pipes, dev->channel);
+    Pipe** lookup = pipe_hash_findp_channel(dev->channels, dev->channel);
     Pipe*  pipe   = *lookup;
-    CPUOldState* env = cpu_single_env;
 
     /* Check that we're referring a known pipe channel */
     if (command != PIPE_CMD_OPEN && pipe == NULL) {
@@ -998,13 +1110,16 @@ pipeDevice_doCommand( PipeDevice* dev, uint32_t command )
         pipe = pipe_new(dev->channel, dev);
         pipe->next = dev->pipes;
         dev->pipes = pipe;
+        pipe_hash_add(dev->channels, pipe);
         dev->status = 0;
         break;
 
     case PIPE_CMD_CLOSE:
         DD("%s: CMD_CLOSE channel=0x%llx", __FUNCTION__, (unsigned long long)dev->channel);
         /* Remove from device's lists */
-        *lookup = pipe->next;
+        *lookup = pipe->next_hash;
+        pipe->next_hash = NULL;
+        *pipe_list_findp(&dev->pipes, pipe) = pipe->next;
         pipe->next = NULL;
         pipe_list_remove_waked(&dev->signaled_pipes, pipe);
         pipe_free(pipe);
@@ -1015,41 +1130,20 @@ pipeDevice_doCommand( PipeDevice* dev, uint32_t command )
         DD("%s: CMD_POLL > status=%d", __FUNCTION__, dev->status);
         break;
 
-    case PIPE_CMD_READ_BUFFER: {
-        /* Translate virtual address into physical one, into emulator memory. */
-        GoldfishPipeBuffer  buffer;
-        target_ulong        address = dev->address;
-        target_ulong        page    = address & TARGET_PAGE_MASK;
-        hwaddr  phys;
-        phys = safe_get_phys_page_debug(ENV_GET_CPU(env), page);
-#ifdef TARGET_X86_64
-        phys = phys & TARGET_PTE_MASK;
-#endif
-        buffer.data = qemu_get_ram_ptr(phys) + (address - page);
-        buffer.size = dev->size;
-        dev->status = pipe->funcs->recvBuffers(pipe->opaque, &buffer, 1);
-        DD("%s: CMD_READ_BUFFER channel=0x%llx address=0x%16llx size=%d > status=%d",
-           __FUNCTION__, (unsigned long long)dev->channel, (unsigned long long)dev->address,
-           dev->size, dev->status);
-        break;
-    }
-
+    case PIPE_CMD_READ_BUFFER:
     case PIPE_CMD_WRITE_BUFFER: {
-        /* Translate virtual address into physical one, into emulator memory. */
-        GoldfishPipeBuffer  buffer;
-        target_ulong        address = dev->address;
-        target_ulong        page    = address & TARGET_PAGE_MASK;
-        hwaddr  phys;
-        phys = safe_get_phys_page_debug(ENV_GET_CPU(env), page);
-#ifdef TARGET_X86_64
-        phys = phys & TARGET_PTE_MASK;
-#endif
-        buffer.data = qemu_get_ram_ptr(phys) + (address - page);
-        buffer.size = dev->size;
-        dev->status = pipe->funcs->sendBuffers(pipe->opaque, &buffer, 1);
-        DD("%s: CMD_WRITE_BUFFER channel=0x%llx address=0x%16llx size=%d > status=%d",
-           __FUNCTION__, (unsigned long long)dev->channel, (unsigned long long)dev->address,
-           dev->size, dev->status);
+        /* Translate virtual address into physical one(s), into emulator
+         * memory. The buffer may cross page boundaries. */
+        GoldfishPipeBuffer  buffers[PIPE_MAX_SEGMENTS];
+        int                 count = 0;
+
+        pipeDevice_mapBuffer(dev->address, dev->size,
+                             buffers, &count, PIPE_MAX_SEGMENTS);
+        dev->status = pipeDevice_transfer(pipe, command, buffers, count);
+        DD("%s: CMD_%s_BUFFER channel=0x%llx address=0x%16llx size=%d segments=%d > status=%d",
+           __FUNCTION__, command == PIPE_CMD_READ_BUFFER ? "READ" : "WRITE",
+           (unsigned long long)dev->channel, (unsigned long long)dev->address,
+           dev->size, count, dev->status);
         break;
     }
 
@@ -1076,6 +1170,85 @@ pipeDevice_doCommand( PipeDevice* dev, uint32_t command )
     }
 }
 
+/* Process 'count' batch descriptors from the guest, see the description
+ * of PIPE_REG_BATCH_COMMAND in pipe.h. */
+static void
+pipeDevice_doBatch( PipeDevice* dev, uint32_t count )
+{
+    struct pipe_batch_desc*  desc;
+    uint32_t                 done;
+
+    if (dev->batch_addr == 0 || count == 0) {
+        dev->status = 0;
+        return;
+    }
+    if (count > PIPE_BATCH_MAX_DESCS) {
+        count = PIPE_BATCH_MAX_DESCS;
+    }
+    if (dev->batch == NULL) {
+        dev->batch = g_malloc(PIPE_BATCH_MAX_DESCS * sizeof(dev->batch[0]));
+    }
+    cpu_physical_memory_read(dev->batch_addr, (void*)dev->batch,
+                             count * sizeof(dev->batch[0]));
+
+    for (done = 0; done < count; ) {
+        uint32_t  wanted = 0;
+        int       complete;
+
+        desc = &dev->batch[done++];
+
+        if (desc->cmd == PIPE_CMD_READ_BUFFER ||
+            desc->cmd == PIPE_CMD_WRITE_BUFFER) {
+            GoldfishPipeBuffer  buffers[PIPE_MAX_SEGMENTS];
+            Pipe*  pipe = *pipe_hash_findp_channel(dev->channels, desc->channel);
+            int    nsegs = 0;
+            uint32_t nn;
+
+            if (pipe == NULL) {
+                desc->result = PIPE_ERROR_INVAL;
+                break;
+            }
+            if (pipe->closed) {
+                desc->result = PIPE_ERROR_IO;
+                break;
+            }
+            if (desc->num_buffers > PIPE_BATCH_MAX_BUFFERS) {
+                desc->num_buffers = PIPE_BATCH_MAX_BUFFERS;
+            }
+            for (nn = 0; nn < desc->num_buffers; nn++) {
+                wanted += desc->buffers[nn].size;
+            }
+            /* Stop at the first buffer that can't be mapped entirely, so
+             * that a short transfer is always a prefix of the data. */
+            for (nn = 0; nn < desc->num_buffers; nn++) {
+                if (!pipeDevice_mapBuffer(desc->buffers[nn].address,
+                                          desc->buffers[nn].size,
+                                          buffers, &nsegs, PIPE_MAX_SEGMENTS)) {
+                    break;
+                }
+            }
+            desc->result = pipeDevice_transfer(pipe, desc->cmd, buffers, nsegs);
+            complete = (desc->result >= 0 && (uint32_t)desc->result == wanted);
+        } else {
+            /* Everything else goes through the register-based path */
+            dev->channel = desc->channel;
+            pipeDevice_doCommand(dev, desc->cmd);
+            desc->result = dev->status;
+            complete = (desc->result >= 0);
+        }
+        DD("%s: desc #%d channel=0x%llx cmd=%d > result=%d", __FUNCTION__,
+           done - 1, (unsigned long long)desc->channel, desc->cmd, desc->result);
+        if (!complete) {
+            break;
+        }
+    }
+
+    /* Deliver all completions at once */
+    cpu_physical_memory_write(dev->batch_addr, (void*)dev->batch,
+                              done * sizeof(dev->batch[0]));
+    dev->status = done;
+}
+
 static void pipe_dev_write(void *opaque, hwaddr offset, uint32_t value)
 {
     PipeDevice *s = (PipeDevice *)opaque;
@@ -1120,6 +1293,19 @@ static void pipe_dev_write(void *opaque, hwaddr offset, uint32_t value)
         s->params_addr = (s->params_addr & ~(0xFFFFFFFFULL) ) | value;
         break;
 
+    case PIPE_REG_BATCH_ADDR_HIGH:
+        uint64_set_high(&s->batch_addr, value);
+        break;
+
+    case PIPE_REG_BATCH_ADDR_LOW:
+        uint64_set_low(&s->batch_addr, value);
+        break;
+
+    case PIPE_REG_BATCH_COMMAND:
+        DR("%s: batch count=%d", __FUNCTION__, value);
+        pipeDevice_doBatch(s, value);
+        break;
+
     case PIPE_REG_ACCESS_PARAMS:
     {
         struct access_params aps;
@@ -1220,6 +1406,15 @@ static uint32_t pipe_dev_read(void *opaque, hwaddr offset)
     case PIPE_REG_PARAMS_ADDR_LOW:
         return (uint32_t)(dev->params_addr & 0xFFFFFFFFUL);
 
+    case PIPE_REG_BATCH_ADDR_HIGH:
+        return (uint32_t)(dev->batch_addr >> 32);
+
+    case PIPE_REG_BATCH_ADDR_LOW:
+        return (uint32_t)(dev->batch_addr & 0xFFFFFFFFUL);
+
+    case PIPE_REG_BATCH_COMMAND:
+        return PIPE_BATCH_MAX_DESCS;
+
     default:
         D("%s: offset=%d (0x%x)\n", __FUNCTION__, offset, offset);
     }
@@ -1250,6 +1445,7 @@ goldfish_pipe_save( QEMUFile* file, void* opaque )
     qemu_put_be64(file, dev->channel);
     qemu_put_be32(file, dev->wakes);
     qemu_put_be64(file, dev->params_addr);
+    qemu_put_be64(file, dev->batch_addr);
 
     /* Count the number of pipe connections */
     int count = 0;
@@ -1271,6 +1467,7 @@ goldfish_pipe_load( QEMUFile* file, void* opaque, int version_id )
     Pipe*       pipe;
 
     if ((version_id != GOLDFISH_PIPE_SAVE_VERSION) &&
+        (version_id != GOLDFISH_PIPE_SAVE_VERSION_NO_BATCH) &&
         (version_id != GOLDFISH_PIPE_SAVE_VERSION_LEGACY)) {
         return -EINVAL;
     }
@@ -1288,6 +1485,11 @@ goldfish_pipe_load( QEMUFile* file, void* opaque, int version_id )
     }
     dev->wakes   = qemu_get_be32(file);
     dev->params_addr   = qemu_get_be64(file);
+    if (version_id >= GOLDFISH_PIPE_SAVE_VERSION) {
+        dev->batch_addr = qemu_get_be64(file);
+    } else {
+        dev->batch_addr = 0;
+    }
 
     /* Count the number of pipe connections */
     int count = qemu_get_sbe32(file);
@@ -1300,6 +1502,7 @@ goldfish_pipe_load( QEMUFile* file, void* opaque, int version_id )
         }
         pipe->next = dev->pipes;
         dev->pipes = pipe;
+        pipe_hash_add(dev->channels, pipe);
     }
 
     /* Now we need to wake/close all relevant pipes */
@@ -0,0 +1,53 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "hw/android/goldfish/pipe_sg.h"
+
+int
+goldfish_pipe_sg_append( GoldfishPipeBuffer* buffers, int* count,
+                         int maxBuffers, uint64_t address, uint32_t size,
+                         uint32_t pageSize,
+                         GoldfishPipeTranslateFunc translate, void* opaque )
+{
+    int  n     = *count;
+    int  first = 1;
+
+    while (size > 0) {
+        uint64_t  page  = address & ~(uint64_t)(pageSize - 1);
+        uint32_t  avail = pageSize - (uint32_t)(address - page);
+        uint8_t*  data;
+
+        if (avail > size) {
+            avail = size;
+        }
+        data = translate(opaque, page, first);
+        first = 0;
+        if (data == NULL) {
+            break;
+        }
+        data += address - page;
+
+        if (n > 0 && buffers[n-1].data + buffers[n-1].size == data) {
+            buffers[n-1].size += avail;
+        } else {
+            if (n == maxBuffers) {
+                break;
+            }
+            buffers[n].data = data;
+            buffers[n].size = avail;
+            n++;
+        }
+        address += avail;
+        size    -= avail;
+    }
+    *count = n;
+    return size == 0;
+}
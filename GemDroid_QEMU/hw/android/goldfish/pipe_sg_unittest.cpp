@@ -0,0 +1,159 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "hw/android/goldfish/pipe_sg.h"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+namespace {
+
+const uint32_t kPageSize = 4096;
+const int kNumPages = 8;
+
+// A fake guest address space of kNumPages virtual pages starting at
+// address 0. Virtual page N maps to host page hostPage[N], or is unmapped
+// when that is negative.
+struct FakeGuest {
+    uint8_t memory[kNumPages * kPageSize];
+    int hostPage[kNumPages];
+
+    // Identity mapping of all pages.
+    FakeGuest() {
+        for (int n = 0; n < kNumPages; ++n) {
+            hostPage[n] = n;
+        }
+        memset(memory, 0, sizeof(memory));
+    }
+
+    uint8_t* host(uint64_t address) {
+        return memory + hostPage[address / kPageSize] * kPageSize +
+               address % kPageSize;
+    }
+
+    static uint8_t* translate(void* opaque, uint64_t page, int /* first */) {
+        FakeGuest* guest = static_cast<FakeGuest*>(opaque);
+        int n = static_cast<int>(page / kPageSize);
+        if (n >= kNumPages || guest->hostPage[n] < 0) {
+            return NULL;
+        }
+        return guest->memory + guest->hostPage[n] * kPageSize;
+    }
+};
+
+}  // namespace
+
+TEST(GoldfishPipeSg, ContiguousPagesAreMerged) {
+    FakeGuest guest;
+    GoldfishPipeBuffer buffers[4];
+    int count = 0;
+
+    EXPECT_EQ(1, goldfish_pipe_sg_append(buffers, &count, 4,
+                                         100, 3 * kPageSize, kPageSize,
+                                         &FakeGuest::translate, &guest));
+    ASSERT_EQ(1, count);
+    EXPECT_EQ(guest.host(100), buffers[0].data);
+    EXPECT_EQ(3 * kPageSize, buffers[0].size);
+}
+
+TEST(GoldfishPipeSg, DiscontiguousPagesAreSplit) {
+    FakeGuest guest;
+    guest.hostPage[1] = 5;
+    GoldfishPipeBuffer buffers[4];
+    int count = 0;
+
+    EXPECT_EQ(1, goldfish_pipe_sg_append(buffers, &count, 4,
+                                         kPageSize - 10, 20, kPageSize,
+                                         &FakeGuest::translate, &guest));
+    ASSERT_EQ(2, count);
+    EXPECT_EQ(guest.host(kPageSize - 10), buffers[0].data);
+    EXPECT_EQ(10U, buffers[0].size);
+    EXPECT_EQ(guest.host(kPageSize), buffers[1].data);
+    EXPECT_EQ(10U, buffers[1].size);
+}
+
+TEST(GoldfishPipeSg, UnmappedPageGivesPrefix) {
+    FakeGuest guest;
+    guest.hostPage[1] = -1;
+    GoldfishPipeBuffer buffers[4];
+    int count = 0;
+
+    EXPECT_EQ(0, goldfish_pipe_sg_append(buffers, &count, 4,
+                                         kPageSize - 10, 20, kPageSize,
+                                         &FakeGuest::translate, &guest));
+    ASSERT_EQ(1, count);
+    EXPECT_EQ(guest.host(kPageSize - 10), buffers[0].data);
+    EXPECT_EQ(10U, buffers[0].size);
+}
+
+TEST(GoldfishPipeSg, SegmentLimitGivesPrefix) {
+    FakeGuest guest;
+    // Reverse the mapping so that no two pages can be merged.
+    for (int n = 0; n < kNumPages; ++n) {
+        guest.hostPage[n] = kNumPages - 1 - n;
+    }
+    GoldfishPipeBuffer buffers[2];
+    int count = 0;
+
+    EXPECT_EQ(0, goldfish_pipe_sg_append(buffers, &count, 2,
+                                         0, 3 * kPageSize, kPageSize,
+                                         &FakeGuest::translate, &guest));
+    EXPECT_EQ(2, count);
+}
+
+// This mirrors the batch descriptor loop in pipe.c: a descriptor whose
+// first buffer crosses an unmapped page must not describe any byte of the
+// second buffer, otherwise a short WRITE would send data out of order.
+TEST(GoldfishPipeSg, DescriptorStopsAtFirstShortBuffer) {
+    FakeGuest guest;
+    guest.hostPage[1] = -1;
+    const struct {
+        uint64_t address;
+        uint32_t size;
+    } descs[2] = {
+        { kPageSize - 16, 32 },     // crosses into unmapped page 1
+        { 2 * kPageSize, 64 },      // fully mapped
+    };
+    GoldfishPipeBuffer buffers[4];
+    int count = 0;
+    size_t mapped = 0;
+
+    for (int n = 0; n < 2; ++n) {
+        if (!goldfish_pipe_sg_append(buffers, &count, 4,
+                                     descs[n].address, descs[n].size,
+                                     kPageSize, &FakeGuest::translate,
+                                     &guest)) {
+            break;
+        }
+    }
+    for (int n = 0; n < count; ++n) {
+        mapped += buffers[n].size;
+    }
+    ASSERT_EQ(1, count);
+    EXPECT_EQ(guest.host(kPageSize - 16), buffers[0].data);
+    EXPECT_EQ(16U, mapped);
+}
+
+TEST(GoldfishPipeSg, AppendMergesWithPreviousBuffer) {
+    FakeGuest guest;
+    GoldfishPipeBuffer buffers[4];
+    int count = 0;
+
+    EXPECT_EQ(1, goldfish_pipe_sg_append(buffers, &count, 4, 0, 100,
+                                         kPageSize, &FakeGuest::translate,
+                                         &guest));
+    EXPECT_EQ(1, goldfish_pipe_sg_append(buffers, &count, 4, 100, 100,
+                                         kPageSize, &FakeGuest::translate,
+                                         &guest));
+    ASSERT_EQ(1, count);
+    EXPECT_EQ(200U, buffers[0].size);
+}
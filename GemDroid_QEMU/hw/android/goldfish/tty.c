@@ -343,6 +343,9 @@ static void goldfish_tty_write(void *opaque, hwaddr offset, uint32_t value)
 					s->data_count -= s->ptr_len;
 					if(s->data_count == 0 && s->ready)
 						goldfish_device_set_irq(&s->dev, 0, 0);
+					/* let the backend deliver pending data */
+					if(s->cs)
+						qemu_chr_accept_input(s->cs);
 					break;
 
 				default:
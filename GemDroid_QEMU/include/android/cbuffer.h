@@ -12,8 +12,12 @@
 #ifndef _qemu_cbuffer_h
 #define _qemu_cbuffer_h
 
+#include "android/utils/compiler.h"
+
 #include <stdint.h>
 
+ANDROID_BEGIN_HEADER
+
 /* Basic circular buffer type and methods */
 
 typedef struct {
@@ -26,7 +30,7 @@ typedef struct {
 static __inline__ void
 cbuffer_reset( CBuffer*  cb, void*  buff, int  size )
 {
-    cb->buff  = buff;
+    cb->buff  = (uint8_t*)buff;
     cb->size  = size;
     cb->rpos  = 0;
     cb->count = 0;
@@ -56,6 +60,8 @@ extern const char*  cbuffer_quote( CBuffer*  cb );
 extern const char*  cbuffer_quote_data( CBuffer*  cb );
 extern void         cbuffer_print( CBuffer*  cb );
 
+ANDROID_END_HEADER
+
 #endif /* qemu_cbuffer_h */
 
 
@@ -27,7 +27,4 @@ extern int  qemu_chr_open_charpipe( CharDriverState* *pfirst, CharDriverState* *
  */
 extern CharDriverState*  qemu_chr_open_buffer( CharDriverState*  endpoint );
 
-/* must be called from the main event loop to poll all charpipes */
-extern void charpipe_poll( void );
-
 #endif /* _CHARPIPE_H */
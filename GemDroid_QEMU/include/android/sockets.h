@@ -372,6 +372,14 @@ int   socket_send  ( int  fd, const void*  buf, int  buflen );
 int   socket_send_oob( int  fd, const void*  buf, int  buflen );
 int   socket_sendto( int  fd, const void*  buf, int  buflen, const SockAddress*  to );
 
+/* send the content of |iovcnt| buffers with a single system call, without
+ * copying them first. |iovcnt| must not exceed SOCKET_SENDV_MAX.
+ * returns the number of bytes sent, or -1 on error (see errno) */
+#define  SOCKET_SENDV_MAX  64
+
+struct iovec;
+int   socket_sendv( int  fd, const struct iovec*  iov, int  iovcnt );
+
 int   socket_connect( int  fd, const SockAddress*  address );
 int   socket_bind( int  fd, const SockAddress*  address );
 int   socket_get_address( int  fd, SockAddress*  address );
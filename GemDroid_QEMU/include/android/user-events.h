@@ -24,6 +24,36 @@ void  user_event_keycodes(int *kcodes, int count);
 void  user_event_mouse(int dx, int dy, int dz, unsigned buttons_state);
 void  user_event_generic(int type, int code, int value);
 
+/* Generic events sent between these two calls are delivered to the
+ * kernel as a single batch: they are queued atomically, and raise a
+ * single interrupt. Use this for each complete frame of events (i.e.
+ * up to and including the EV_SYN/SYN_REPORT). Calls can be nested.
+ */
+void  user_event_begin_batch(void);
+void  user_event_end_batch(void);
+
+/* Starts replaying the events recorded in 'path', with their original
+ * timing. The file must contain the output of 'getevent -t', i.e. lines
+ * like "[   1234.567890] /dev/input/event0: 0003 0035 000001c2", where
+ * the device name is optional and other lines are ignored. Any replay
+ * in progress is stopped first. Returns 0 on success, or -1 if the file
+ * can't be opened.
+ */
+int   user_event_replay_start(const char* path);
+
+/* Stops the current replay, if any. */
+void  user_event_replay_stop(void);
+
+/* Returns 1 if a replay is in progress, 0 otherwise. */
+int   user_event_replay_active(void);
+
+/* A single generic event. */
+typedef struct {
+    int  type;
+    int  code;
+    int  value;
+} UserEvent;
+
 /* The following is used to register a callback function that will receive
  * user_event_generic() calls. This is used by
  * hw/android/goldfish/events_device.c
@@ -31,4 +61,10 @@ void  user_event_generic(int type, int code, int value);
 typedef void QEMUPutGenericEvent(void*  opaque, int  type, int  code, int  value);
 void  user_event_register_generic(void* opaque, QEMUPutGenericEvent  callback);
 
+/* Same for batches of events. Without such a callback, batched events are
+ * passed one by one to the generic callback.
+ */
+typedef void QEMUPutGenericEventBatch(void*  opaque, const UserEvent*  events, int  count);
+void  user_event_register_generic_batch(void* opaque, QEMUPutGenericEventBatch  callback);
+
 #endif /* _QEMU_USEREVENTS_H */
@@ -14,6 +14,13 @@ typedef struct BlockDriverInfo {
     int cluster_size;
     /* offset at which the VM state can be saved (0 if not possible) */
     int64_t vm_state_offset;
+    /* metadata cache sizes in bytes and lookup counters, 0 if irrelevant */
+    int64_t l2_cache_size;
+    uint64_t l2_cache_hits;
+    uint64_t l2_cache_misses;
+    int64_t refcount_cache_size;
+    uint64_t refcount_cache_hits;
+    uint64_t refcount_cache_misses;
 } BlockDriverInfo;
 
 typedef struct QEMUSnapshotInfo {
@@ -59,6 +66,13 @@ void bdrv_info_stats(Monitor *mon, QObject **ret_data);
 
 void bdrv_init(void);
 void bdrv_init_with_whitelist(void);
+/* Sets the per-image budgets of the metadata caches of images opened
+ * afterwards, in bytes: one for the tables that map guest clusters to image
+ * clusters (e.g. qcow2 L2 tables), one for the allocation metadata (e.g.
+ * qcow2 refcount blocks). Values <= 0 keep the current setting; drivers use
+ * their own defaults until a budget is set. */
+void bdrv_set_metadata_cache_sizes(int64_t map_cache_size,
+                                   int64_t alloc_cache_size);
 BlockDriver *bdrv_find_protocol(const char *filename);
 BlockDriver *bdrv_find_format(const char *format_name);
 BlockDriver *bdrv_find_whitelisted_format(const char *format_name);
@@ -216,6 +216,11 @@ void qemu_aio_release(void *p);
 
 void *qemu_blockalign(BlockDriverState *bs, size_t size);
 
+/* Metadata cache budgets set with bdrv_set_metadata_cache_sizes(), in
+ * bytes, or 0 if not set */
+int64_t bdrv_get_map_cache_size(void);
+int64_t bdrv_get_alloc_cache_size(void);
+
 #ifdef _WIN32
 int is_windows_drive(const char *filename);
 #endif
@@ -15,6 +15,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "hw/hw.h"
+#include "hw/android/goldfish/pipe_sg.h"
 
 /* TECHNICAL NOTE:
  *
@@ -53,12 +54,6 @@
  *
  */
 
-/* Buffer descriptor for sendBuffers() and recvBuffers() callbacks */
-typedef struct GoldfishPipeBuffer {
-    uint8_t*  data;
-    size_t    size;
-} GoldfishPipeBuffer;
-
 /* Pipe handler funcs */
 typedef struct {
     /* Create new client connection, 'hwpipe' must be passed to other
@@ -161,6 +156,12 @@ extern void goldfish_pipe_wake( void* hwpipe, unsigned flags );
 #define PIPE_REG_ACCESS_PARAMS       0x20
 #define PIPE_REG_CHANNEL_HIGH        0x30 /* read/write: high 32 bit channel id */
 #define PIPE_REG_ADDRESS_HIGH        0x34 /* write: high 32 bit physical address */
+/* read/write: address of the batch descriptor array, see below */
+#define PIPE_REG_BATCH_ADDR_LOW      0x38
+#define PIPE_REG_BATCH_ADDR_HIGH     0x3c
+/* write: process that many batch descriptors.
+ * read: maximum number of descriptors per write, 0 if unsupported */
+#define PIPE_REG_BATCH_COMMAND       0x40
 
 /* list of commands for PIPE_REG_COMMAND */
 #define PIPE_CMD_OPEN               1  /* open new channel */
@@ -181,7 +182,7 @@ extern void goldfish_pipe_wake( void* hwpipe, unsigned flags );
  * will use (CMD_READ_BUFFER - CMD_WRITE_BUFFER) as a special offset
  * in qemu_pipe_read_write() below.
  */
-#define PIPE_CMD_READ_BUFFER        6  /* receive a page-contained buffer from the emulator */
+#define PIPE_CMD_READ_BUFFER        6  /* receive a buffer from the emulator */
 #define PIPE_CMD_WAKE_ON_READ       7  /* tell the emulator to wake us when reading is possible */
 
 /* Possible status values used to signal errors - see qemu_pipe_error_convert */
@@ -217,4 +218,42 @@ struct access_params_64 {
     uint32_t flags;
 };
 
+/* Batched commands:
+ *
+ * Instead of programming the channel/address/size registers for each
+ * transfer, the guest can fill an array of pipe_batch_desc in its memory,
+ * write its physical address to PIPE_REG_BATCH_ADDR_LOW/HIGH once, then
+ * write the number of valid descriptors to PIPE_REG_BATCH_COMMAND.
+ *
+ * Each descriptor names a channel, a PIPE_CMD_XXX command and, for
+ * PIPE_CMD_READ_BUFFER and PIPE_CMD_WRITE_BUFFER, up to
+ * PIPE_BATCH_MAX_BUFFERS guest virtual buffers that are transferred as a
+ * single scatter-gather operation. Buffers may span several pages.
+ *
+ * Descriptors are processed in order. Processing stops after the first
+ * one that fails or transfers less than requested, so that the data of a
+ * given channel is never reordered. The emulator then writes back the
+ * 'result' field of every processed descriptor (what PIPE_REG_STATUS
+ * would have returned for it), and PIPE_REG_STATUS holds the number of
+ * processed descriptors.
+ */
+#define PIPE_BATCH_MAX_BUFFERS   4
+#define PIPE_BATCH_MAX_DESCS     64
+
+struct pipe_batch_buffer {
+    uint64_t address;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+struct pipe_batch_desc {
+    uint64_t channel;
+    uint32_t cmd;
+    int32_t  result;
+    uint32_t num_buffers;
+    /* reserved for future extension */
+    uint32_t flags;
+    struct pipe_batch_buffer buffers[PIPE_BATCH_MAX_BUFFERS];
+};
+
 #endif /* _HW_GOLDFISH_PIPE_H */
@@ -0,0 +1,57 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef _HW_GOLDFISH_PIPE_SG_H
+#define _HW_GOLDFISH_PIPE_SG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "android/utils/compiler.h"
+
+ANDROID_BEGIN_HEADER
+
+/* Scatter list construction for goldfish pipe transfers. This doesn't
+ * depend on the target, so it can be tested on its own. */
+
+/* Buffer descriptor for sendBuffers() and recvBuffers() callbacks */
+typedef struct GoldfishPipeBuffer {
+    uint8_t*  data;
+    size_t    size;
+} GoldfishPipeBuffer;
+
+/* Return the host address of the guest virtual page starting at 'page', or
+ * NULL if it isn't mapped. 'first' is 1 for the first page of a buffer. */
+typedef uint8_t* (*GoldfishPipeTranslateFunc)(void* opaque,
+                                              uint64_t page,
+                                              int first);
+
+/* Translate the guest virtual range [address, address+size) into a list of
+ * host memory segments, appended to 'buffers' which already holds '*count'
+ * entries. Adjacent host segments are merged. Translation stops at the
+ * first unmapped page or when 'maxBuffers' entries are used.
+ *
+ * Returns 1 if the whole range was described, or 0 if only a prefix of it
+ * was. In the latter case, no later buffer must be appended to the list,
+ * otherwise the transfer would skip the tail of this one.
+ */
+int goldfish_pipe_sg_append(GoldfishPipeBuffer* buffers,
+                            int* count,
+                            int maxBuffers,
+                            uint64_t address,
+                            uint32_t size,
+                            uint32_t pageSize,
+                            GoldfishPipeTranslateFunc translate,
+                            void* opaque);
+
+ANDROID_END_HEADER
+
+#endif /* _HW_GOLDFISH_PIPE_SG_H */
@@ -109,4 +109,17 @@ uint64_t ram_bytes_total(void);
 int ram_save_live(QEMUFile *f, int stage, void *opaque);
 int ram_load(QEMUFile *f, void *opaque, int version_id);
 
+/* Lazy snapshot restore, see arch_init.c */
+void ram_set_lazy_load(int enable);
+void ram_lazy_populate(void *host, size_t size);
+extern int ram_lazy_pending;
+
+/* Must be called before guest memory is handed to a system call */
+static inline void ram_lazy_touch(void *host, size_t size)
+{
+    if (ram_lazy_pending) {
+        ram_lazy_populate(host, size);
+    }
+}
+
 #endif
@@ -22,7 +22,6 @@
  * THE SOFTWARE.
  */
 
-#include "android/charpipe.h"
 #include "android/log-rotate.h"
 #include "android/snaphost-android.h"
 #include "block/aio.h"
@@ -296,7 +295,6 @@ void main_loop_wait(int timeout)
         }
         slirp_select_poll(&rfds, &wfds, &xfds);
     }
-    charpipe_poll();
 
     qemu_clock_run_all_timers();
 
@@ -1785,6 +1785,12 @@ DEF("audio-test-out", 0, QEMU_OPTION_audio_test_out, \
 DEF("snapshot-no-time-update", 0, QEMU_OPTION_snapshot_no_time_update, \
     "-snapshot-no-time-update Disable time update when restoring snapshots\n")
 
+DEF("snapshot-lazy-restore", 0, QEMU_OPTION_snapshot_lazy_restore, \
+    "-snapshot-lazy-restore Restore snapshot RAM on demand after resuming\n")
+
+DEF("qcow2-cache-size", HAS_ARG, QEMU_OPTION_qcow2_cache_size, \
+    "-qcow2-cache-size <l2>[,<refcount>] qcow2 metadata cache sizes per image, in MB\n")
+
 DEF("list-webcam", 0, QEMU_OPTION_list_webcam, \
     "-list-webcam List web cameras available for emulation\n")
 
@@ -33,105 +33,127 @@
 #include <slirp.h>
 
 /*
- * Checksum routine for Internet Protocol family headers (Portable Version).
+ * Checksum routine for Internet Protocol family headers.
  *
  * This routine is very heavily used in the network
  * code and should be modified for each CPU to be as fast as possible.
  *
- * XXX Since we will never span more than 1 mbuf, we can optimise this
+ * Since we never span more than 1 mbuf, the data is a single contiguous
+ * buffer. The ones-complement sum is independent of the width of the
+ * words being added as long as carries are eventually folded back in, so
+ * the buffer is summed in the widest chunks the host handles cheaply and
+ * only folded to 16 bits at the very end. Loads go through memcpy() so
+ * that odd-aligned data needs no byte swapping.
  */
 
-#define ADDCARRY(x)  (x > 65535 ? x -= 65535 : x)
-#define REDUCE {l_util.l = sum; sum = l_util.s[0] + l_util.s[1]; ADDCARRY(sum);}
+#ifdef __SSE2__
+#include <emmintrin.h>
 
-int cksum(struct mbuf *m, int len)
+/* Each 32-bit lane grows by at most 2 * 0xffff per 64-byte block, so the
+ * accumulators cannot overflow within this many blocks. */
+#define CKSUM_SSE2_BLOCKS 16384
+
+static u_int64_t
+cksum_sse2(const u_int8_t **pp, int *lenp)
 {
-	register u_int16_t *w;
-	register int sum = 0;
-	register int mlen = 0;
-	int byte_swapped = 0;
+	const __m128i zero = _mm_setzero_si128();
+	const u_int8_t *p = *pp;
+	u_int64_t sum = 0;
+	int len = *lenp;
 
-	union {
-		u_int8_t	c[2];
-		u_int16_t	s;
-	} s_util;
-	union {
-		u_int16_t s[2];
-		u_int32_t l;
-	} l_util;
+	while (len >= 64) {
+		__m128i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+		int n = len / 64;
+		u_int32_t lanes[4];
 
-	if (m->m_len == 0)
-	   goto cont;
-	w = mtod(m, u_int16_t *);
+		if (n > CKSUM_SSE2_BLOCKS)
+			n = CKSUM_SSE2_BLOCKS;
+		len -= n * 64;
+		while (n--) {
+			__m128i v0 = _mm_loadu_si128((const __m128i *)p);
+			__m128i v1 = _mm_loadu_si128((const __m128i *)(p + 16));
+			__m128i v2 = _mm_loadu_si128((const __m128i *)(p + 32));
+			__m128i v3 = _mm_loadu_si128((const __m128i *)(p + 48));
+			acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v0, zero));
+			acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v0, zero));
+			acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v1, zero));
+			acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v1, zero));
+			acc2 = _mm_add_epi32(acc2, _mm_unpacklo_epi16(v2, zero));
+			acc3 = _mm_add_epi32(acc3, _mm_unpackhi_epi16(v2, zero));
+			acc2 = _mm_add_epi32(acc2, _mm_unpacklo_epi16(v3, zero));
+			acc3 = _mm_add_epi32(acc3, _mm_unpackhi_epi16(v3, zero));
+			p += 64;
+		}
+		_mm_storeu_si128((__m128i *)lanes, acc0);
+		sum += (u_int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		_mm_storeu_si128((__m128i *)lanes, acc1);
+		sum += (u_int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		_mm_storeu_si128((__m128i *)lanes, acc2);
+		sum += (u_int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		_mm_storeu_si128((__m128i *)lanes, acc3);
+		sum += (u_int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+	*pp = p;
+	*lenp = len;
+	return sum;
+}
+#endif
 
-	mlen = m->m_len;
+int cksum(struct mbuf *m, int len)
+{
+	const u_int8_t *p;
+	u_int64_t sum = 0;
+	int mlen;
 
+	mlen = m->m_len;
 	if (len < mlen)
 	   mlen = len;
-	len -= mlen;
-	/*
-	 * Force to even boundary.
-	 */
-	if ((1 & (intptr_t) w) && (mlen > 0)) {
-		REDUCE;
-		sum <<= 8;
-		s_util.c[0] = *(u_int8_t *)w;
-		w = (u_int16_t *)((int8_t *)w + 1);
-		mlen--;
-		byte_swapped = 1;
+#ifdef DEBUG
+	if (len > mlen) {
+		DEBUG_ERROR((dfd, "cksum: out of data\n"));
+		DEBUG_ERROR((dfd, " len = %d\n", len - mlen));
 	}
+#endif
+	p = mtod(m, const u_int8_t *);
+
+#ifdef __SSE2__
+	sum = cksum_sse2(&p, &mlen);
+#endif
 	/*
-	 * Unroll the loop to make overhead from
-	 * branches &c small.
+	 * 32-bit words into a 64-bit accumulator: no carry can be lost
+	 * for anything that fits in an mbuf.
 	 */
-	while ((mlen -= 32) >= 0) {
-		sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
-		sum += w[4]; sum += w[5]; sum += w[6]; sum += w[7];
-		sum += w[8]; sum += w[9]; sum += w[10]; sum += w[11];
-		sum += w[12]; sum += w[13]; sum += w[14]; sum += w[15];
-		w += 16;
+	while (mlen >= 16) {
+		u_int32_t w[4];
+		memcpy(w, p, sizeof(w));
+		sum += (u_int64_t)w[0] + w[1] + w[2] + w[3];
+		p += 16;
+		mlen -= 16;
 	}
-	mlen += 32;
-	while ((mlen -= 8) >= 0) {
-		sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
-		w += 4;
-	}
-	mlen += 8;
-	if (mlen == 0 && byte_swapped == 0)
-	   goto cont;
-	REDUCE;
-	while ((mlen -= 2) >= 0) {
-		sum += *w++;
-	}
-
-	if (byte_swapped) {
-		REDUCE;
-		sum <<= 8;
-		byte_swapped = 0;
-		if (mlen == -1) {
-			s_util.c[1] = *(u_int8_t *)w;
-			sum += s_util.s;
-			mlen = 0;
-		} else
-
-		   mlen = -1;
-	} else if (mlen == -1)
-	   s_util.c[0] = *(u_int8_t *)w;
-
-cont:
-#ifdef DEBUG
-	if (len) {
-		DEBUG_ERROR((dfd, "cksum: out of data\n"));
-		DEBUG_ERROR((dfd, " len = %d\n", len));
+	while (mlen >= 2) {
+		u_int16_t w;
+		memcpy(&w, p, sizeof(w));
+		sum += w;
+		p += 2;
+		mlen -= 2;
 	}
-#endif
-	if (mlen == -1) {
+	if (mlen == 1) {
 		/* The last mbuf has odd # of bytes. Follow the
 		 standard (the odd byte may be shifted left by 8 bits
 			   or not as determined by endian-ness of the machine) */
+		union {
+			u_int8_t	c[2];
+			u_int16_t	s;
+		} s_util;
+		s_util.c[0] = *p;
 		s_util.c[1] = 0;
 		sum += s_util.s;
 	}
-	REDUCE;
+
+	/* Fold the carries back in */
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
 	return (~sum & 0xffff);
 }
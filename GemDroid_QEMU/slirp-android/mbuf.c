@@ -19,7 +19,6 @@
 
 int mbuf_alloced = 0;
 struct mbuf m_freelist, m_usedlist;
-#define MBUF_THRESH 30
 int mbuf_max = 0;
 
 /*
@@ -28,6 +27,36 @@ int mbuf_max = 0;
  */
 #define SLIRP_MSIZE (IF_MTU + IF_MAXLINKHDR + sizeof(struct m_hdr ) + 6)
 
+/*
+ * The first MBUF_POOL_MAX mbufs are carved out of slabs of MBUF_SLAB
+ * and live on the free list forever, so the steady state of a busy
+ * connection never touches malloc(). Anything allocated beyond that is
+ * a burst and is marked M_DOFREE so that the memory goes back once the
+ * burst is over.
+ */
+#define MBUF_SLAB	32
+#define MBUF_POOL_MAX	512
+static int mbuf_pooled = 0;
+
+/*
+ * External data segments (M_EXT) are recycled per power-of-two size
+ * class, from MINCSIZE up to MEXT_MAX_SIZE; bigger ones are plain
+ * malloc()/free().
+ */
+#define MEXT_MIN_SHIFT	12
+#define MEXT_NCLASSES	5
+#define MEXT_MAX_SIZE	(1 << (MEXT_MIN_SHIFT + MEXT_NCLASSES - 1))
+#define MEXT_POOL_MAX	16
+
+struct m_extbuf {
+	struct m_extbuf *next;
+};
+
+static struct {
+	struct m_extbuf *head;
+	int count;
+} m_extpool[MEXT_NCLASSES];
+
 void
 m_init(void)
 {
@@ -35,12 +64,88 @@ m_init(void)
 	m_usedlist.m_next = m_usedlist.m_prev = &m_usedlist;
 }
 
+/* Size class for an external segment of exactly size bytes, or -1 */
+static int
+m_ext_class(int size)
+{
+	int c;
+
+	for (c = 0; c < MEXT_NCLASSES; c++)
+		if (size == 1 << (MEXT_MIN_SHIFT + c))
+			return c;
+	return -1;
+}
+
+/* Round a requested segment size up to what m_ext_alloc() hands out */
+static int
+m_ext_roundup(int size)
+{
+	int n;
+
+	if (size > MEXT_MAX_SIZE)
+		return size;
+	for (n = 1 << MEXT_MIN_SHIFT; n < size; n <<= 1)
+		;
+	return n;
+}
+
+static char *
+m_ext_alloc(int size)
+{
+	int c = m_ext_class(size);
+
+	if (c >= 0 && m_extpool[c].head) {
+		struct m_extbuf *b = m_extpool[c].head;
+		m_extpool[c].head = b->next;
+		m_extpool[c].count--;
+		return (char *)b;
+	}
+	return (char *)malloc(size);
+}
+
+static void
+m_ext_free(char *ext, int size)
+{
+	int c = m_ext_class(size);
+
+	if (c >= 0 && m_extpool[c].count < MEXT_POOL_MAX) {
+		struct m_extbuf *b = (struct m_extbuf *)ext;
+		b->next = m_extpool[c].head;
+		m_extpool[c].head = b;
+		m_extpool[c].count++;
+		return;
+	}
+	free(ext);
+}
+
+/*
+ * Put a new slab of mbufs on the free list. Slabs are never returned
+ * to the system.
+ */
+static int
+m_slab_grow(void)
+{
+	char *slab;
+	int i;
+
+	slab = (char *)malloc(MBUF_SLAB * SLIRP_MSIZE);
+	if (slab == NULL)
+		return -1;
+	for (i = 0; i < MBUF_SLAB; i++) {
+		struct mbuf *m = (struct mbuf *)(slab + i * SLIRP_MSIZE);
+		m->m_flags = M_FREELIST;
+		insque(m, &m_freelist);
+	}
+	mbuf_pooled += MBUF_SLAB;
+	return 0;
+}
+
 /*
  * Get an mbuf from the free list, if there are none
- * malloc one
+ * grow the pool or malloc one
  *
  * Because fragmentation can occur if we alloc new mbufs and
- * free old mbufs, we mark all mbufs above mbuf_thresh as M_DOFREE,
+ * free old mbufs, we mark all mbufs above the pool size as M_DOFREE,
  * which tells m_free to actually free() it
  */
 struct mbuf *
@@ -51,18 +156,21 @@ m_get(void)
 
 	DEBUG_CALL("m_get");
 
+	if (m_freelist.m_next == &m_freelist &&
+	    mbuf_pooled < MBUF_POOL_MAX)
+		m_slab_grow();
+
 	if (m_freelist.m_next == &m_freelist) {
 		m = (struct mbuf *)malloc(SLIRP_MSIZE);
 		if (m == NULL) goto end_error;
-		mbuf_alloced++;
-		if (mbuf_alloced > MBUF_THRESH)
-			flags = M_DOFREE;
-		if (mbuf_alloced > mbuf_max)
-			mbuf_max = mbuf_alloced;
+		flags = M_DOFREE;
 	} else {
 		m = m_freelist.m_next;
 		remque(m);
 	}
+	mbuf_alloced++;
+	if (mbuf_alloced > mbuf_max)
+		mbuf_max = mbuf_alloced;
 
 	/* Insert it in the used list */
 	insque(m,&m_usedlist);
@@ -91,9 +199,9 @@ m_free(struct mbuf *m)
 	if (m->m_flags & M_USEDLIST)
 	   remque(m);
 
-	/* If it's M_EXT, free() it */
+	/* If it's M_EXT, recycle or free() it */
 	if (m->m_flags & M_EXT)
-	   free(m->m_ext);
+	   m_ext_free(m->m_ext, m->m_size);
 
 	/*
 	 * Either free() it or put it on the free list
@@ -104,6 +212,7 @@ m_free(struct mbuf *m)
 	} else if ((m->m_flags & M_FREELIST) == 0) {
 		insque(m,&m_freelist);
 		m->m_flags = M_FREELIST; /* Clobber other flags */
+		mbuf_alloced--;
 	}
   } /* if(m) */
 }
@@ -129,36 +238,38 @@ m_cat(struct mbuf *m, struct mbuf *n)
 }
 
 
-/* make m size bytes large */
+/*
+ * make m at least size bytes large
+ *
+ * The segment is rounded up to its pool size class, and only the bytes
+ * up to the end of the valid data are carried over.
+ */
 void
 m_inc(struct mbuf *m, int size)
 {
 	int datasize;
+	char *dat;
 
 	/* some compiles throw up on gotos.  This one we can fake. */
         if(m->m_size>size) return;
 
+	size = m_ext_roundup(size);
+	dat = m_ext_alloc(size);
+/*	if (dat == NULL)
+ *		return (struct mbuf *)NULL;
+ */
         if (m->m_flags & M_EXT) {
 	  datasize = m->m_data - m->m_ext;
-	  m->m_ext = (char *)realloc(m->m_ext,size);
-/*		if (m->m_ext == NULL)
- *			return (struct mbuf *)NULL;
- */
-	  m->m_data = m->m_ext + datasize;
+	  memcpy(dat, m->m_ext, datasize + m->m_len);
+	  m_ext_free(m->m_ext, m->m_size);
         } else {
-	  char *dat;
 	  datasize = m->m_data - m->m_dat;
-	  dat = (char *)malloc(size);
-/*		if (dat == NULL)
- *			return (struct mbuf *)NULL;
- */
-	  memcpy(dat, m->m_dat, m->m_size);
-
-	  m->m_ext = dat;
-	  m->m_data = m->m_ext + datasize;
+	  memcpy(dat, m->m_dat, datasize + m->m_len);
 	  m->m_flags |= M_EXT;
         }
 
+	m->m_ext = dat;
+	m->m_data = m->m_ext + datasize;
         m->m_size = size;
 
 }
@@ -324,15 +324,15 @@ void slirp_select_fill(int *pnfds,
 		do_slowtimo = ((tcb.so_next != &tcb) ||
                 (&ipq.ip_link != ipq.ip_link.next));
 
+		/*
+		 * See if we need a tcp_fasttimo
+		 */
+		if (time_fasttimo == 0 && tcp_delack_list)
+		   time_fasttimo = curtime; /* Flag when we want a fasttimo */
+
 		for (so = tcb.so_next; so != &tcb; so = so_next) {
 			so_next = so->so_next;
 
-			/*
-			 * See if we need a tcp_fasttimo
-			 */
-			if (time_fasttimo == 0 && so->so_tcpcb->t_flags & TF_DELACK)
-			   time_fasttimo = curtime; /* Flag when we want a fasttimo */
-
 			/*
 			 * NOFDREF can include still connecting to local-host,
 			 * newly socreated() sockets etc. Don't want to select these.
@@ -1272,7 +1272,7 @@ static void slirp_tcp_save(QEMUFile *f, struct tcpcb *tp)
 
     qemu_put_sbe16(f, tp->t_state);
     for (i = 0; i < TCPT_NTIMERS; i++)
-        qemu_put_sbe16(f, tp->t_timer[i]);
+        qemu_put_sbe16(f, tcp_timer_get(tp, i));
     qemu_put_sbe16(f, tp->t_rxtshift);
     qemu_put_sbe16(f, tp->t_rxtcur);
     qemu_put_sbe16(f, tp->t_dupacks);
@@ -1294,8 +1294,8 @@ static void slirp_tcp_save(QEMUFile *f, struct tcpcb *tp)
     qemu_put_be32(f, tp->snd_max);
     qemu_put_be32(f, tp->snd_cwnd);
     qemu_put_be32(f, tp->snd_ssthresh);
-    qemu_put_sbe16(f, tp->t_idle);
-    qemu_put_sbe16(f, tp->t_rtt);
+    qemu_put_sbe16(f, MIN(TCP_IDLE(tp), 0x7fff));
+    qemu_put_sbe16(f, tp->t_rttstart ? TCP_RTT(tp) : 0);
     qemu_put_be32(f, tp->t_rtseq);
     qemu_put_sbe16(f, tp->t_srtt);
     qemu_put_sbe16(f, tp->t_rttvar);
@@ -1362,16 +1362,19 @@ static void slirp_state_save(QEMUFile *f, void *opaque)
 static void slirp_tcp_load(QEMUFile *f, struct tcpcb *tp)
 {
     int i;
+    short rtt;
 
     tp->t_state = qemu_get_sbe16(f);
     for (i = 0; i < TCPT_NTIMERS; i++)
-        tp->t_timer[i] = qemu_get_sbe16(f);
+        tcp_timer_set(tp, i, qemu_get_sbe16(f));
     tp->t_rxtshift = qemu_get_sbe16(f);
     tp->t_rxtcur = qemu_get_sbe16(f);
     tp->t_dupacks = qemu_get_sbe16(f);
     tp->t_maxseg = qemu_get_be16(f);
     tp->t_force = qemu_get_sbyte(f);
     tp->t_flags = qemu_get_be16(f);
+    if (tp->t_flags & TF_DELACK)
+        tcp_delack(tp);
     tp->snd_una = qemu_get_be32(f);
     tp->snd_nxt = qemu_get_be32(f);
     tp->snd_up = qemu_get_be32(f);
@@ -1387,8 +1390,9 @@ static void slirp_tcp_load(QEMUFile *f, struct tcpcb *tp)
     tp->snd_max = qemu_get_be32(f);
     tp->snd_cwnd = qemu_get_be32(f);
     tp->snd_ssthresh = qemu_get_be32(f);
-    tp->t_idle = qemu_get_sbe16(f);
-    tp->t_rtt = qemu_get_sbe16(f);
+    tp->t_lastrcv = tcp_now - qemu_get_sbe16(f);
+    rtt = qemu_get_sbe16(f);
+    tp->t_rttstart = rtt ? tcp_now - rtt + 2 : 0;
     tp->t_rtseq = qemu_get_be32(f);
     tp->t_srtt = qemu_get_sbe16(f);
     tp->t_rttvar = qemu_get_sbe16(f);
@@ -1440,6 +1444,7 @@ static int slirp_socket_load(QEMUFile *f, struct socket *so)
     so->so_laddr_ip = qemu_get_be32(f);
     so->so_faddr_port = qemu_get_be16(f);
     so->so_laddr_port = qemu_get_be16(f);
+    sohash(so, &tcb);
     so->so_iptos = qemu_get_byte(f);
     so->so_emu = qemu_get_byte(f);
     so->so_type = qemu_get_byte(f);
@@ -28,12 +28,85 @@ so_init()
 }
 #endif
 
+/*
+ * Sockets are indexed by address so that incoming packets don't have to
+ * walk the socket lists: TCP sockets (tcb) by their full 4-tuple, UDP
+ * sockets (udb) by their local address and port only, since a UDP
+ * "connection" is whatever the guest sends from that address. The lists
+ * stay the authoritative set of sockets; a socket must be (re)hashed with
+ * sohash() whenever the addresses its lookup key is made of change.
+ */
+#define SO_HASH_BITS 10
+#define SO_HASH_SIZE (1 << SO_HASH_BITS)
+
+static struct socket *tcb_hash[SO_HASH_SIZE];
+static struct socket *udb_hash[SO_HASH_SIZE];
+
+static inline u_int
+so_hash(uint32_t laddr, u_int lport, uint32_t faddr, u_int fport)
+{
+	uint32_t h = laddr * 0x9e3779b1u;
+
+	h ^= faddr * 0x85ebca6bu;
+	h ^= (lport << 16) | fport;
+	h ^= h >> 15;
+	h *= 0xc2b2ae35u;
+	return h >> (32 - SO_HASH_BITS);
+}
+
+static void
+sounhash(struct socket *so)
+{
+	if (so->so_hash_pprev) {
+		*so->so_hash_pprev = so->so_hash_next;
+		if (so->so_hash_next)
+			so->so_hash_next->so_hash_pprev = so->so_hash_pprev;
+		so->so_hash_next = NULL;
+		so->so_hash_pprev = NULL;
+	}
+}
+
+/*
+ * Index so under its current addresses in the lookup table of the
+ * socket list head (tcb or udb) it belongs to.
+ */
+void
+sohash(struct socket *so, struct socket *head)
+{
+	struct socket **bucket;
+
+	sounhash(so);
+	if (head == &tcb)
+		bucket = &tcb_hash[so_hash(so->so_laddr_ip, so->so_laddr_port,
+					   so->so_faddr_ip, so->so_faddr_port)];
+	else
+		bucket = &udb_hash[so_hash(so->so_laddr_ip, so->so_laddr_port,
+					   0, 0)];
+	so->so_hash_next = *bucket;
+	if (*bucket)
+		(*bucket)->so_hash_pprev = &so->so_hash_next;
+	so->so_hash_pprev = bucket;
+	*bucket = so;
+}
+
 struct socket *
 solookup(struct socket *head, uint32_t laddr, u_int lport,
          uint32_t faddr, u_int fport)
 {
 	struct socket *so;
 
+	if (head == &tcb) {
+		so = tcb_hash[so_hash(laddr, lport, faddr, fport)];
+		for (; so; so = so->so_hash_next) {
+			if (so->so_laddr_port == lport &&
+			    so->so_laddr_ip   == laddr &&
+			    so->so_faddr_ip   == faddr &&
+			    so->so_faddr_port == fport)
+				return so;
+		}
+		return (struct socket *)NULL;
+	}
+
 	for (so = head->so_next; so != head; so = so->so_next) {
 		if (so->so_laddr_port == lport &&
 		    so->so_laddr_ip   == laddr &&
@@ -48,6 +121,23 @@ solookup(struct socket *head, uint32_t laddr, u_int lport,
 
 }
 
+/*
+ * Find the UDP socket bound to the given guest address and port.
+ */
+struct socket *
+solookup_udp(uint32_t laddr, u_int lport)
+{
+	struct socket *so;
+
+	for (so = udb_hash[so_hash(laddr, lport, 0, 0)]; so;
+	     so = so->so_hash_next) {
+		if (so->so_laddr_port == lport &&
+		    so->so_laddr_ip   == laddr)
+			return so;
+	}
+	return (struct socket *)NULL;
+}
+
 /*
  * Create a new socket, initialise the fields
  * It is the responsibility of the caller to
@@ -87,6 +177,7 @@ sofree(struct socket *so)
 
   m_free(so->so_m);
 
+  sounhash(so);
   if(so->so_next && so->so_prev)
     remque(so);  /* crashes if so is not in a queue */
 
@@ -644,7 +735,7 @@ solisten(u_int port, u_int32_t laddr, u_int lport, int flags)
 	 * SS_FACCEPTONCE sockets must time out.
 	 */
 	if (flags & SS_FACCEPTONCE)
-	   so->so_tcpcb->t_timer[TCPT_KEEP] = TCPTV_KEEP_INIT*2;
+	   tcp_timer_set(so->so_tcpcb, TCPT_KEEP, TCPTV_KEEP_INIT*2);
 
 	so->so_state      = (SS_FACCEPTCONN|flags);
 	so->so_laddr_port = lport; /* Kept in host format */
@@ -665,6 +756,7 @@ solisten(u_int port, u_int32_t laddr, u_int lport, int flags)
         so->so_faddr_ip = alias_addr_ip;
     else
         so->so_faddr_ip = addr_ip;
+    sohash(so, &tcb);
 
 	so->s = s;
 	return so;
@@ -19,6 +19,8 @@
 
 struct socket {
   struct socket *so_next,*so_prev;      /* For a linked list of sockets */
+  struct socket *so_hash_next;          /* Lookup table chain, see sohash() */
+  struct socket **so_hash_pprev;        /* NULL if not in a lookup table */
 
   int s;                           /* The actual socket */
 
@@ -78,6 +80,8 @@ extern struct socket tcb;
 
 void so_init _P((void));
 struct socket * solookup _P((struct socket *, uint32_t, u_int, uint32_t, u_int));
+struct socket * solookup_udp _P((uint32_t, u_int));
+void sohash _P((struct socket *, struct socket *));
 struct socket * socreate _P((void));
 void sofree _P((struct socket *));
 int soread _P((struct socket *));
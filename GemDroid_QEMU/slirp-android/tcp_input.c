@@ -72,7 +72,7 @@ tcp_seq tcp_iss;                /* tcp initial send seq # */
                if (ti->ti_flags & TH_PUSH) \
                        tp->t_flags |= TF_ACKNOW; \
                else \
-                       tp->t_flags |= TF_DELACK; \
+                       tcp_delack(tp); \
                (tp)->rcv_nxt += (ti)->ti_len; \
                flags = (ti)->ti_flags & TH_FIN; \
                STAT(tcpstat.tcps_rcvpack++);         \
@@ -92,7 +92,7 @@ tcp_seq tcp_iss;                /* tcp initial send seq # */
 	if ((ti)->ti_seq == (tp)->rcv_nxt && \
         tcpfrag_list_empty(tp) && \
 	    (tp)->t_state == TCPS_ESTABLISHED) { \
-		tp->t_flags |= TF_DELACK; \
+		tcp_delack(tp); \
 		(tp)->rcv_nxt += (ti)->ti_len; \
 		flags = (ti)->ti_flags & TH_FIN; \
 		STAT(tcpstat.tcps_rcvpack++);        \
@@ -422,6 +422,7 @@ findso:
 	  so->so_laddr_port = port_geth(ti->ti_sport);
 	  so->so_faddr_ip   = ip_geth(ti->ti_dst);
 	  so->so_faddr_port = port_geth(ti->ti_dport);
+	  sohash(so, &tcb);
 
 	  if ((so->so_iptos = tcp_tos(so)) == 0)
 	    so->so_iptos = ((struct ip *)ti)->ip_tos;
@@ -457,11 +458,11 @@ findso:
 	 * Segment received on connection.
 	 * Reset idle time and keep-alive timer.
 	 */
-	tp->t_idle = 0;
+	tp->t_lastrcv = tcp_now;
 	if (SO_OPTIONS)
-	   tp->t_timer[TCPT_KEEP] = TCPTV_KEEPINTVL;
+	   tcp_timer_set(tp, TCPT_KEEP, TCPTV_KEEPINTVL);
 	else
-	   tp->t_timer[TCPT_KEEP] = TCPTV_KEEP_IDLE;
+	   tcp_timer_set(tp, TCPT_KEEP, TCPTV_KEEP_IDLE);
 
 	/*
 	 * Process options if not in LISTEN state,
@@ -517,9 +518,9 @@ findso:
 /*				if (ts_present)
  *					tcp_xmit_timer(tp, tcp_now-ts_ecr+1);
  *				else
- */				     if (tp->t_rtt &&
+ */				     if (tp->t_rttstart &&
 					    SEQ_GT(ti->ti_ack, tp->t_rtseq))
-					tcp_xmit_timer(tp, tp->t_rtt);
+					tcp_xmit_timer(tp, TCP_RTT(tp));
 				acked = ti->ti_ack - tp->snd_una;
 				STAT(tcpstat.tcps_rcvackpack++);
 				STAT(tcpstat.tcps_rcvackbyte += acked);
@@ -537,9 +538,9 @@ findso:
 				 * decide between more output or persist.
 				 */
 				if (tp->snd_una == tp->snd_max)
-					tp->t_timer[TCPT_REXMT] = 0;
-				else if (tp->t_timer[TCPT_PERSIST] == 0)
-					tp->t_timer[TCPT_REXMT] = tp->t_rxtcur;
+					tcp_timer_set(tp, TCPT_REXMT, 0);
+				else if (!tcp_timer_active(tp, TCPT_PERSIST))
+					tcp_timer_set(tp, TCPT_REXMT, tp->t_rxtcur);
 
 				/*
 				 * There's room in so_snd, sowwakup will read()
@@ -704,7 +705,7 @@ findso:
 	     */
 	    so->so_m = m;
 	    so->so_ti = ti;
-	    tp->t_timer[TCPT_KEEP] = TCPTV_KEEP_INIT;
+	    tcp_timer_set(tp, TCPT_KEEP, TCPTV_KEEP_INIT);
 	    tp->t_state = TCPS_SYN_RECEIVED;
 	  }
 	  return;
@@ -735,7 +736,7 @@ findso:
 	  tcp_rcvseqinit(tp);
 	  tp->t_flags |= TF_ACKNOW;
 	  tp->t_state = TCPS_SYN_RECEIVED;
-	  tp->t_timer[TCPT_KEEP] = TCPTV_KEEP_INIT;
+	  tcp_timer_set(tp, TCPT_KEEP, TCPTV_KEEP_INIT);
 	  STAT(tcpstat.tcps_accepts++);
 	  goto trimthenstep6;
 	} /* case TCPS_LISTEN */
@@ -772,7 +773,7 @@ findso:
 				tp->snd_nxt = tp->snd_una;
 		}
 
-		tp->t_timer[TCPT_REXMT] = 0;
+		tcp_timer_set(tp, TCPT_REXMT, 0);
 		tp->irs = ti->ti_seq;
 		tcp_rcvseqinit(tp);
 		tp->t_flags |= TF_ACKNOW;
@@ -794,8 +795,8 @@ findso:
 			 * if we didn't have to retransmit the SYN,
 			 * use its rtt as our initial srtt & rtt var.
 			 */
-			if (tp->t_rtt)
-				tcp_xmit_timer(tp, tp->t_rtt);
+			if (tp->t_rttstart)
+				tcp_xmit_timer(tp, TCP_RTT(tp));
 		} else
 			tp->t_state = TCPS_SYN_RECEIVED;
 
@@ -1109,7 +1110,7 @@ trimthenstep6:
 				 * to keep a constant cwnd packets in the
 				 * network.
 				 */
-				if (tp->t_timer[TCPT_REXMT] == 0 ||
+				if (!tcp_timer_active(tp, TCPT_REXMT) ||
 				    ti->ti_ack != tp->snd_una)
 					tp->t_dupacks = 0;
 				else if (++tp->t_dupacks == TCPREXMTTHRESH) {
@@ -1121,8 +1122,8 @@ trimthenstep6:
 					if (win < 2)
 						win = 2;
 					tp->snd_ssthresh = win * tp->t_maxseg;
-					tp->t_timer[TCPT_REXMT] = 0;
-					tp->t_rtt = 0;
+					tcp_timer_set(tp, TCPT_REXMT, 0);
+					tp->t_rttstart = 0;
 					tp->snd_nxt = ti->ti_ack;
 					tp->snd_cwnd = tp->t_maxseg;
 					(void) tcp_output(tp);
@@ -1170,8 +1171,8 @@ trimthenstep6:
  *			tcp_xmit_timer(tp, tcp_now-ts_ecr+1);
  *		else
  */
-		     if (tp->t_rtt && SEQ_GT(ti->ti_ack, tp->t_rtseq))
-			tcp_xmit_timer(tp,tp->t_rtt);
+		     if (tp->t_rttstart && SEQ_GT(ti->ti_ack, tp->t_rtseq))
+			tcp_xmit_timer(tp, TCP_RTT(tp));
 
 		/*
 		 * If all outstanding data is acked, stop retransmit
@@ -1180,10 +1181,10 @@ trimthenstep6:
 		 * timer, using current (possibly backed-off) value.
 		 */
 		if (ti->ti_ack == tp->snd_max) {
-			tp->t_timer[TCPT_REXMT] = 0;
+			tcp_timer_set(tp, TCPT_REXMT, 0);
 			needoutput = 1;
-		} else if (tp->t_timer[TCPT_PERSIST] == 0)
-			tp->t_timer[TCPT_REXMT] = tp->t_rxtcur;
+		} else if (!tcp_timer_active(tp, TCPT_PERSIST))
+			tcp_timer_set(tp, TCPT_REXMT, tp->t_rxtcur);
 		/*
 		 * When new data is acked, open the congestion window.
 		 * If the window gives us less than ssthresh packets
@@ -1237,7 +1238,7 @@ trimthenstep6:
 				 */
 				if (so->so_state & SS_FCANTRCVMORE) {
 					soisfdisconnected(so);
-					tp->t_timer[TCPT_2MSL] = TCP_MAXIDLE;
+					tcp_timer_set(tp, TCPT_2MSL, TCP_MAXIDLE);
 				}
 				tp->t_state = TCPS_FIN_WAIT_2;
 			}
@@ -1253,7 +1254,7 @@ trimthenstep6:
 			if (ourfinisacked) {
 				tp->t_state = TCPS_TIME_WAIT;
 				tcp_canceltimers(tp);
-				tp->t_timer[TCPT_2MSL] = 2 * TCPTV_MSL;
+				tcp_timer_set(tp, TCPT_2MSL, 2 * TCPTV_MSL);
 				soisfdisconnected(so);
 			}
 			break;
@@ -1277,7 +1278,7 @@ trimthenstep6:
 		 * it and restart the finack timer.
 		 */
 		case TCPS_TIME_WAIT:
-			tp->t_timer[TCPT_2MSL] = 2 * TCPTV_MSL;
+			tcp_timer_set(tp, TCPT_2MSL, 2 * TCPTV_MSL);
 			goto dropafterack;
 		}
 	} /* switch(tp->t_state) */
@@ -1423,7 +1424,7 @@ dodata:
 		case TCPS_FIN_WAIT_2:
 			tp->t_state = TCPS_TIME_WAIT;
 			tcp_canceltimers(tp);
-			tp->t_timer[TCPT_2MSL] = 2 * TCPTV_MSL;
+			tcp_timer_set(tp, TCPT_2MSL, 2 * TCPTV_MSL);
 			soisfdisconnected(so);
 			break;
 
@@ -1431,7 +1432,7 @@ dodata:
 		 * In TIME_WAIT state restart the 2 MSL time_wait timer.
 		 */
 		case TCPS_TIME_WAIT:
-			tp->t_timer[TCPT_2MSL] = 2 * TCPTV_MSL;
+			tcp_timer_set(tp, TCPT_2MSL, 2 * TCPTV_MSL);
 			break;
 		}
 	}
@@ -1656,7 +1657,7 @@ tcp_xmit_timer(register struct tcpcb *tp, int rtt)
 		tp->t_srtt = rtt << TCP_RTT_SHIFT;
 		tp->t_rttvar = rtt << (TCP_RTTVAR_SHIFT - 1);
 	}
-	tp->t_rtt = 0;
+	tp->t_rttstart = 0;
 	tp->t_rxtshift = 0;
 
 	/*
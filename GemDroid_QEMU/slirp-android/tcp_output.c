@@ -85,7 +85,7 @@ tcp_output(struct tcpcb *tp)
 	 * to send, then transmit; otherwise, investigate further.
 	 */
 	idle = (tp->snd_max == tp->snd_una);
-	if (idle && tp->t_idle >= tp->t_rxtcur)
+	if (idle && TCP_IDLE(tp) >= tp->t_rxtcur)
 		/*
 		 * We have been idle for "a while" and no acks are
 		 * expected to clock out any data we send --
@@ -129,7 +129,7 @@ again:
 				flags &= ~TH_FIN;
 			win = 1;
 		} else {
-			tp->t_timer[TCPT_PERSIST] = 0;
+			tcp_timer_set(tp, TCPT_PERSIST, 0);
 			tp->t_rxtshift = 0;
 		}
 	}
@@ -149,7 +149,7 @@ again:
 		 */
 		len = 0;
 		if (win == 0) {
-			tp->t_timer[TCPT_REXMT] = 0;
+			tcp_timer_set(tp, TCPT_REXMT, 0);
 			tp->snd_nxt = tp->snd_una;
 		}
 	}
@@ -235,11 +235,11 @@ again:
 	 *	persisting		to move a small or zero window
 	 *	(re)transmitting	and thereby not persisting
 	 *
-	 * tp->t_timer[TCPT_PERSIST]
+	 * tp->t_expire[TCPT_PERSIST]
 	 *	is set when we are in persist state.
 	 * tp->t_force
 	 *	is set when we are called to send a persist packet.
-	 * tp->t_timer[TCPT_REXMT]
+	 * tp->t_expire[TCPT_REXMT]
 	 *	is set when we are retransmitting
 	 * The output side is idle when both timers are zero.
 	 *
@@ -249,8 +249,8 @@ again:
 	 * if window is nonzero, transmit what we can,
 	 * otherwise force out a byte.
 	 */
-	if (so->so_snd.sb_cc && tp->t_timer[TCPT_REXMT] == 0 &&
-	    tp->t_timer[TCPT_PERSIST] == 0) {
+	if (so->so_snd.sb_cc && !tcp_timer_active(tp, TCPT_REXMT) &&
+	    !tcp_timer_active(tp, TCPT_PERSIST)) {
 		tp->t_rxtshift = 0;
 		tcp_setpersist(tp);
 	}
@@ -420,7 +420,7 @@ send:
 	 * case, since we know we aren't doing a retransmission.
 	 * (retransmit and persist are mutually exclusive...)
 	 */
-	if (len || (flags & (TH_SYN|TH_FIN)) || tp->t_timer[TCPT_PERSIST])
+	if (len || (flags & (TH_SYN|TH_FIN)) || tcp_timer_active(tp, TCPT_PERSIST))
 		ti->ti_seq = htonl(tp->snd_nxt);
 	else
 		ti->ti_seq = htonl(tp->snd_max);
@@ -471,7 +471,7 @@ send:
 	 * In transmit state, time the transmission and arrange for
 	 * the retransmit.  In persist state, just set snd_max.
 	 */
-	if (tp->t_force == 0 || tp->t_timer[TCPT_PERSIST] == 0) {
+	if (tp->t_force == 0 || !tcp_timer_active(tp, TCPT_PERSIST)) {
 		tcp_seq startseq = tp->snd_nxt;
 
 		/*
@@ -492,8 +492,8 @@ send:
 			 * Time this transmission if not a retransmission and
 			 * not currently timing anything.
 			 */
-			if (tp->t_rtt == 0) {
-				tp->t_rtt = 1;
+			if (tp->t_rttstart == 0) {
+				TCP_RTT_START(tp);
 				tp->t_rtseq = startseq;
 				STAT(tcpstat.tcps_segstimed++);
 			}
@@ -507,11 +507,11 @@ send:
 		 * Initialize shift counter which is used for backoff
 		 * of retransmit time.
 		 */
-		if (tp->t_timer[TCPT_REXMT] == 0 &&
+		if (!tcp_timer_active(tp, TCPT_REXMT) &&
 		    tp->snd_nxt != tp->snd_una) {
-			tp->t_timer[TCPT_REXMT] = tp->t_rxtcur;
-			if (tp->t_timer[TCPT_PERSIST]) {
-				tp->t_timer[TCPT_PERSIST] = 0;
+			tcp_timer_set(tp, TCPT_REXMT, tp->t_rxtcur);
+			if (tcp_timer_active(tp, TCPT_PERSIST)) {
+				tcp_timer_set(tp, TCPT_PERSIST, 0);
 				tp->t_rxtshift = 0;
 			}
 		}
@@ -584,16 +584,18 @@ void
 tcp_setpersist(struct tcpcb *tp)
 {
     int t = ((tp->t_srtt >> 2) + tp->t_rttvar) >> 1;
+    short persist;
 
-/*	if (tp->t_timer[TCPT_REXMT])
+/*	if (tcp_timer_active(tp, TCPT_REXMT))
  *		panic("tcp_output REXMT");
  */
 	/*
 	 * Start/restart persistence timer.
 	 */
-	TCPT_RANGESET(tp->t_timer[TCPT_PERSIST],
+	TCPT_RANGESET(persist,
 	    t * tcp_backoff[tp->t_rxtshift],
 	    TCPTV_PERSMIN, TCPTV_PERSMAX);
+	tcp_timer_set(tp, TCPT_PERSIST, persist);
 	if (tp->t_rxtshift < TCP_MAXRXTSHIFT)
 		tp->t_rxtshift++;
 }
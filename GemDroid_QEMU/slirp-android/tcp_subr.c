@@ -209,6 +209,7 @@ tcp_newtcpcb(struct socket *so)
 	tp->snd_cwnd = TCP_MAXWIN << TCP_MAX_WINSHIFT;
 	tp->snd_ssthresh = TCP_MAXWIN << TCP_MAX_WINSHIFT;
 	tp->t_state = TCPS_CLOSED;
+	tp->t_lastrcv = tcp_now;
 
 	so->so_tcpcb = tp;
 
@@ -273,6 +274,7 @@ tcp_close(struct tcpcb *tp)
 /*	if (tp->t_template)
  *		(void) m_free(dtom(tp->t_template));
  */
+	tcp_timer_detach(tp);
 /*	free(tp, M_PCB);  */
 	free(tp);
         so->so_tcpcb = NULL;
@@ -635,6 +637,7 @@ tcp_connect(struct socket *inso)
 	/* Translate connections from localhost to the real hostname */
 	if (addr_ip == 0 || addr_ip == loopback_addr_ip)
 	   so->so_faddr_ip = alias_addr_ip;
+	sohash(so, &tcb);
 
 	/* Close the accept() socket, set right state */
 	if (inso->so_state & SS_FACCEPTONCE) {
@@ -659,7 +662,7 @@ tcp_connect(struct socket *inso)
 	STAT(tcpstat.tcps_connattempt++);
 
 	tp->t_state = TCPS_SYN_SENT;
-	tp->t_timer[TCPT_KEEP] = TCPTV_KEEP_INIT;
+	tcp_timer_set(tp, TCPT_KEEP, TCPTV_KEEP_INIT);
 	tp->iss = tcp_iss;
 	tcp_iss += TCP_ISSINCR/2;
 	tcp_sendseqinit(tp);
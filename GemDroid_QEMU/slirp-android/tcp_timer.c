@@ -40,64 +40,221 @@ u_int32_t        tcp_now;                /* for RFC 1323 timestamps */
 
 static struct tcpcb *tcp_timers(register struct tcpcb *tp, int timer);
 
+/*
+ * The timer wheel. Level 0 has one slot per slow tick for the next
+ * TCP_WHEEL0_SIZE ticks; level 1 has one slot per TCP_WHEEL0_SIZE ticks
+ * beyond that, and is cascaded into level 0 as time goes by. Deadlines
+ * further away than level 1 can hold are parked in its last slot and
+ * re-slotted when they come up.
+ */
+#define	TCP_WHEEL0_BITS	8
+#define	TCP_WHEEL0_SIZE	(1 << TCP_WHEEL0_BITS)
+#define	TCP_WHEEL1_SIZE	64
+
+static struct tcpcb *tcp_wheel0[TCP_WHEEL0_SIZE];
+static struct tcpcb *tcp_wheel1[TCP_WHEEL1_SIZE];
+
+/*
+ * The tick timers are relative to: tcp_now between calls to
+ * tcp_slowtimo(), and the tick being processed (tcp_now + 1) during one.
+ */
+static u_int32_t tcp_timer_tick;
+
+struct tcpcb *tcp_delack_list;
+
+static void
+tcp_wheel_remove(struct tcpcb *tp)
+{
+	if (tp->t_wheel_pprev) {
+		*tp->t_wheel_pprev = tp->t_wheel_next;
+		if (tp->t_wheel_next)
+			tp->t_wheel_next->t_wheel_pprev = tp->t_wheel_pprev;
+		tp->t_wheel_next = NULL;
+		tp->t_wheel_pprev = NULL;
+	}
+}
+
+static void
+tcp_wheel_insert(struct tcpcb *tp, u_int32_t expire)
+{
+	u_int32_t delta = expire - tcp_timer_tick;
+	struct tcpcb **slot;
+
+	if (delta < TCP_WHEEL0_SIZE) {
+		slot = &tcp_wheel0[expire & (TCP_WHEEL0_SIZE - 1)];
+		tp->t_wheel_tick = expire;
+	} else {
+		/* Level 1 slots are visited when their first tick comes up */
+		if (delta >= (TCP_WHEEL1_SIZE - 1) << TCP_WHEEL0_BITS)
+			expire = tcp_timer_tick +
+			    ((TCP_WHEEL1_SIZE - 1) << TCP_WHEEL0_BITS);
+		slot = &tcp_wheel1[(expire >> TCP_WHEEL0_BITS) &
+				   (TCP_WHEEL1_SIZE - 1)];
+		tp->t_wheel_tick = expire & ~(TCP_WHEEL0_SIZE - 1);
+	}
+	tp->t_wheel_next = *slot;
+	if (*slot)
+		(*slot)->t_wheel_pprev = &tp->t_wheel_next;
+	tp->t_wheel_pprev = slot;
+	*slot = tp;
+}
+
+/*
+ * Puts tp on the wheel according to its earliest running timer. A
+ * connection already slotted no later than that is left alone: it will
+ * just find nothing to do when its slot comes up, and move on.
+ */
+static void
+tcp_timer_schedule(struct tcpcb *tp)
+{
+	u_int32_t first = 0;
+	int i;
+
+	for (i = 0; i < TCPT_NTIMERS; i++)
+		if (tp->t_expire[i] &&
+		    (first == 0 || (int)(tp->t_expire[i] - first) < 0))
+			first = tp->t_expire[i];
+	if (first == 0) {
+		tcp_wheel_remove(tp);
+		return;
+	}
+	if (tp->t_wheel_pprev && (int)(tp->t_wheel_tick - first) <= 0)
+		return;
+	tcp_wheel_remove(tp);
+	tcp_wheel_insert(tp, first);
+}
+
+/*
+ * Starts timer to go off in the given number of slow ticks, or stops it
+ * if ticks is 0.
+ */
+void
+tcp_timer_set(struct tcpcb *tp, int timer, int ticks)
+{
+	if (ticks <= 0) {
+		tp->t_expire[timer] = 0;
+		return;
+	}
+	tp->t_expire[timer] = tcp_timer_tick + ticks;
+	if (tp->t_expire[timer] == 0)
+		tp->t_expire[timer] = 1;
+	tcp_timer_schedule(tp);
+}
+
+/*
+ * Returns the number of slow ticks before timer goes off, 0 if stopped.
+ */
+int
+tcp_timer_get(struct tcpcb *tp, int timer)
+{
+	if (tp->t_expire[timer] == 0)
+		return 0;
+	return (int)(tp->t_expire[timer] - tcp_timer_tick);
+}
+
+/*
+ * Takes tp off the timer wheel and the delayed ACK list before it is freed.
+ */
+void
+tcp_timer_detach(struct tcpcb *tp)
+{
+	tcp_wheel_remove(tp);
+	if (tp->t_delack_pprev) {
+		*tp->t_delack_pprev = tp->t_delack_next;
+		if (tp->t_delack_next)
+			tp->t_delack_next->t_delack_pprev = tp->t_delack_pprev;
+		tp->t_delack_next = NULL;
+		tp->t_delack_pprev = NULL;
+	}
+}
+
+/*
+ * Asks for an ACK to be sent on the next fast timeout.
+ */
+void
+tcp_delack(struct tcpcb *tp)
+{
+	tp->t_flags |= TF_DELACK;
+	if (tp->t_delack_pprev == NULL) {
+		tp->t_delack_next = tcp_delack_list;
+		if (tcp_delack_list)
+			tcp_delack_list->t_delack_pprev = &tp->t_delack_next;
+		tp->t_delack_pprev = &tcp_delack_list;
+		tcp_delack_list = tp;
+	}
+}
+
 /*
  * Fast timeout routine for processing delayed acks
  */
 void
 tcp_fasttimo(void)
 {
-	register struct socket *so;
 	register struct tcpcb *tp;
 
 	DEBUG_CALL("tcp_fasttimo");
 
-	so = tcb.so_next;
-	if (so)
-	for (; so != &tcb; so = so->so_next)
-		if ((tp = (struct tcpcb *)so->so_tcpcb) &&
-		    (tp->t_flags & TF_DELACK)) {
+	while ((tp = tcp_delack_list) != NULL) {
+		tcp_delack_list = tp->t_delack_next;
+		if (tcp_delack_list)
+			tcp_delack_list->t_delack_pprev = &tcp_delack_list;
+		tp->t_delack_next = NULL;
+		tp->t_delack_pprev = NULL;
+
+		/* tcp_output() may have sent the ACK in the meantime */
+		if (tp->t_flags & TF_DELACK) {
 			tp->t_flags &= ~TF_DELACK;
 			tp->t_flags |= TF_ACKNOW;
 			STAT(tcpstat.tcps_delack++);
 			(void) tcp_output(tp);
 		}
+	}
 }
 
 /*
  * Tcp protocol timeout routine called every 500 ms.
- * Updates the timers in all active tcb's and
+ * Runs the timers that are due on this tick and
  * causes finite state machine actions if timers expire.
  */
 void
 tcp_slowtimo(void)
 {
-	register struct socket *ip, *ipnxt;
 	register struct tcpcb *tp;
+	struct tcpcb **slot;
 	register int i;
 
 	DEBUG_CALL("tcp_slowtimo");
 
+	tcp_timer_tick = tcp_now + 1;
+
+	/*
+	 * Move the level 1 slot starting at this tick down to level 0.
+	 */
+	if ((tcp_timer_tick & (TCP_WHEEL0_SIZE - 1)) == 0) {
+		slot = &tcp_wheel1[(tcp_timer_tick >> TCP_WHEEL0_BITS) &
+				   (TCP_WHEEL1_SIZE - 1)];
+		while ((tp = *slot) != NULL) {
+			tcp_wheel_remove(tp);
+			tcp_timer_schedule(tp);
+		}
+	}
+
 	/*
-	 * Search through tcb's and update active timers.
+	 * Run the timers of the connections in this tick's slot. Timers
+	 * started meanwhile always land in other slots.
 	 */
-	ip = tcb.so_next;
-	if (ip == 0)
-	   return;
-	for (; ip != &tcb; ip = ipnxt) {
-		ipnxt = ip->so_next;
-		tp = sototcpcb(ip);
-		if (tp == 0)
-			continue;
+	slot = &tcp_wheel0[tcp_timer_tick & (TCP_WHEEL0_SIZE - 1)];
+	while ((tp = *slot) != NULL) {
+		tcp_wheel_remove(tp);
 		for (i = 0; i < TCPT_NTIMERS; i++) {
-			if (tp->t_timer[i] && --tp->t_timer[i] == 0) {
-				tcp_timers(tp,i);
-				if (ipnxt->so_prev != ip)
+			if (tp->t_expire[i] &&
+			    (int)(tp->t_expire[i] - tcp_timer_tick) <= 0) {
+				tp->t_expire[i] = 0;
+				if (tcp_timers(tp, i) == NULL)
 					goto tpgone;
 			}
 		}
-		tp->t_idle++;
-		if (tp->t_rtt)
-		   tp->t_rtt++;
+		tcp_timer_schedule(tp);
 tpgone:
 		;
 	}
@@ -118,7 +275,8 @@ tcp_canceltimers(struct tcpcb *tp)
 	register int i;
 
 	for (i = 0; i < TCPT_NTIMERS; i++)
-		tp->t_timer[i] = 0;
+		tp->t_expire[i] = 0;
+	tcp_wheel_remove(tp);
 }
 
 const int tcp_backoff[TCP_MAXRXTSHIFT + 1] =
@@ -144,8 +302,8 @@ tcp_timers(register struct tcpcb *tp, int timer)
 	 */
 	case TCPT_2MSL:
 		if (tp->t_state != TCPS_TIME_WAIT &&
-		    tp->t_idle <= TCP_MAXIDLE)
-			tp->t_timer[TCPT_2MSL] = TCPTV_KEEPINTVL;
+		    TCP_IDLE(tp) <= TCP_MAXIDLE)
+			tcp_timer_set(tp, TCPT_2MSL, TCPTV_KEEPINTVL);
 		else
 			tp = tcp_close(tp);
 		break;
@@ -200,7 +358,7 @@ tcp_timers(register struct tcpcb *tp, int timer)
 		rexmt = TCP_REXMTVAL(tp) * tcp_backoff[tp->t_rxtshift];
 		TCPT_RANGESET(tp->t_rxtcur, rexmt,
 		    (short)tp->t_rttmin, TCPTV_REXMTMAX); /* XXX */
-		tp->t_timer[TCPT_REXMT] = tp->t_rxtcur;
+		tcp_timer_set(tp, TCPT_REXMT, tp->t_rxtcur);
 		/*
 		 * If losing, let the lower level know and try for
 		 * a better route.  Also, if we backed off this far,
@@ -218,7 +376,7 @@ tcp_timers(register struct tcpcb *tp, int timer)
 		/*
 		 * If timing a segment in this window, stop the timer.
 		 */
-		tp->t_rtt = 0;
+		tp->t_rttstart = 0;
 		/*
 		 * Close the congestion window down to one segment
 		 * (we'll open it by one segment for each ack we get).
@@ -277,7 +435,7 @@ tcp_timers(register struct tcpcb *tp, int timer)
 
 /*		if (tp->t_socket->so_options & SO_KEEPALIVE && */
 		if ((SO_OPTIONS) && tp->t_state <= TCPS_CLOSE_WAIT) {
-		    	if (tp->t_idle >= TCPTV_KEEP_IDLE + TCP_MAXIDLE)
+		    	if (TCP_IDLE(tp) >= TCPTV_KEEP_IDLE + TCP_MAXIDLE)
 				goto dropit;
 			/*
 			 * Send a packet designed to force a response
@@ -303,9 +461,9 @@ tcp_timers(register struct tcpcb *tp, int timer)
 			tcp_respond(tp, &tp->t_template, (struct mbuf *)NULL,
 			    tp->rcv_nxt, tp->snd_una - 1, 0);
 #endif
-			tp->t_timer[TCPT_KEEP] = TCPTV_KEEPINTVL;
+			tcp_timer_set(tp, TCPT_KEEP, TCPTV_KEEPINTVL);
 		} else
-			tp->t_timer[TCPT_KEEP] = TCPTV_KEEP_IDLE;
+			tcp_timer_set(tp, TCPT_KEEP, TCPTV_KEEP_IDLE);
 		break;
 
 	dropit:
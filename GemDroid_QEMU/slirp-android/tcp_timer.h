@@ -124,10 +124,32 @@ char *tcptimers[] =
 
 extern const int tcp_backoff[];
 
+/*
+ * Timers are kept as the slow tick at which they go off rather than being
+ * counted down on every tick. Connections with a timer running sit in a
+ * two-level timer wheel, slotted by their earliest deadline, so that
+ * tcp_slowtimo() only visits the ones that have something due. Likewise,
+ * connections with a delayed ACK are queued on tcp_delack_list for
+ * tcp_fasttimo().
+ *
+ * Idle and round trip times are derived from tcp_now in the same way.
+ */
+#define	tcp_timer_active(tp, timer)	((tp)->t_expire[timer] != 0)
+
+#define	TCP_IDLE(tp)		((int)(tcp_now - (tp)->t_lastrcv))
+#define	TCP_RTT(tp)		((short)(tcp_now - (tp)->t_rttstart + 2))
+#define	TCP_RTT_START(tp)	((tp)->t_rttstart = tcp_now + 1)
+
 struct tcpcb;
 
+extern struct tcpcb *tcp_delack_list;
+
 void tcp_fasttimo _P((void));
 void tcp_slowtimo _P((void));
 void tcp_canceltimers _P((struct tcpcb *));
+void tcp_timer_set _P((struct tcpcb *, int, int));
+int tcp_timer_get _P((struct tcpcb *, int));
+void tcp_timer_detach _P((struct tcpcb *));
+void tcp_delack _P((struct tcpcb *));
 
 #endif
@@ -48,7 +48,13 @@ struct tcpcb {
 	struct tcpiphdr  *seg_next;	/* sequencing queue */
 	struct tcpiphdr  *seg_prev;
 	short	t_state;		/* state of this connection */
-	short	t_timer[TCPT_NTIMERS];	/* tcp timers */
+	u_int32_t t_expire[TCPT_NTIMERS]; /* slow tick at which each timer
+					   * fires, 0 if off; see tcp_timer.h */
+	struct	tcpcb *t_wheel_next;	/* timer wheel slot list */
+	struct	tcpcb **t_wheel_pprev;	/* NULL if not on the wheel */
+	u_int32_t t_wheel_tick;		/* tick the wheel will look at us */
+	struct	tcpcb *t_delack_next;	/* tcp_delack_list, if TF_DELACK */
+	struct	tcpcb **t_delack_pprev;
 	short	t_rxtshift;		/* log(2) of rexmt exp. backoff */
 	short	t_rxtcur;		/* current retransmit value */
 	short	t_dupacks;		/* consecutive dup acks recd */
@@ -107,8 +113,9 @@ struct tcpcb {
  * transmit timing stuff.  See below for scale of srtt and rttvar.
  * "Variance" is actually smoothed difference.
  */
-	short	t_idle;			/* inactivity time */
-	short	t_rtt;			/* round trip time */
+	u_int32_t t_lastrcv;		/* tcp_now when last segment received */
+	u_int32_t t_rttstart;		/* tcp_now + 1 when t_rtseq was sent,
+					 * 0 if not timing */
 	tcp_seq	t_rtseq;		/* sequence number being timed */
 	short	t_srtt;			/* smoothed round-trip time */
 	short	t_rttvar;		/* variance in round-trip time */
@@ -28,6 +28,7 @@
 #include "sysemu/sysemu.h"
 #include "qemu/sockets.h"
 #include "qemu/timer.h"
+#include "qemu/host-utils.h"
 #ifdef CONFIG_VNC_TLS
 #include "qemu/acl.h"
 #endif
@@ -37,6 +38,10 @@
 #include "vnc_keysym.h"
 #include "d3des.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define count_bits(c, v) { \
     for (c = 0; v; v >>= 1) \
     { \
@@ -182,6 +187,15 @@ static void do_info_vnc_client(Monitor *mon, VncState *client)
     else
         monitor_printf(mon, "    username: none\n");
 #endif
+    monitor_printf(mon, "     updates: %" PRIu64 "\n", client->updates);
+    monitor_printf(mon, "   scan time: last %" PRId64 " us, avg %" PRId64 " us\n",
+                   client->scan_ns / 1000,
+                   client->scans ?
+                   client->scan_ns_total / 1000 / (int64_t)client->scans : 0);
+    monitor_printf(mon, " encode time: last %" PRId64 " us, avg %" PRId64 " us\n",
+                   client->encode_ns / 1000,
+                   client->updates ?
+                   client->encode_ns_total / 1000 / (int64_t)client->updates : 0);
 }
 
 void do_info_vnc(Monitor *mon)
@@ -228,38 +242,42 @@ static void vnc_disconnect_start(VncState *vs);
 static void vnc_disconnect_finish(VncState *vs);
 
 static void vnc_colordepth(VncState *vs);
+static void vnc_job_wait(VncState *vs);
+
+/* Number of 16-pixel tiles, and dirty bits, needed to cover 'width' */
+#define VNC_TILES(width)  (((width) + 15) / 16)
 
-static inline void vnc_set_bit(uint32_t *d, int k)
+static inline void vnc_set_bit(uint64_t *d, int k)
 {
-    d[k >> 5] |= 1 << (k & 0x1f);
+    d[k >> 6] |= 1ULL << (k & 0x3f);
 }
 
-static inline void vnc_clear_bit(uint32_t *d, int k)
+static inline void vnc_clear_bit(uint64_t *d, int k)
 {
-    d[k >> 5] &= ~(1 << (k & 0x1f));
+    d[k >> 6] &= ~(1ULL << (k & 0x3f));
 }
 
-static inline void vnc_set_bits(uint32_t *d, int n, int nb_words)
+static inline void vnc_set_bits(uint64_t *d, int n, int nb_words)
 {
     int j;
 
     j = 0;
-    while (n >= 32) {
+    while (n >= VNC_DIRTY_BITS) {
         d[j++] = -1;
-        n -= 32;
+        n -= VNC_DIRTY_BITS;
     }
     if (n > 0)
-        d[j++] = (1 << n) - 1;
+        d[j++] = (1ULL << n) - 1;
     while (j < nb_words)
         d[j++] = 0;
 }
 
-static inline int vnc_get_bit(const uint32_t *d, int k)
+static inline int vnc_get_bit(const uint64_t *d, int k)
 {
-    return (d[k >> 5] >> (k & 0x1f)) & 1;
+    return (d[k >> 6] >> (k & 0x3f)) & 1;
 }
 
-static inline int vnc_and_bits(const uint32_t *d1, const uint32_t *d2,
+static inline int vnc_and_bits(const uint64_t *d1, const uint64_t *d2,
                                int nb_words)
 {
     int i;
@@ -270,10 +288,85 @@ static inline int vnc_and_bits(const uint32_t *d1, const uint32_t *d2,
     return 0;
 }
 
+/* Mask of the bits [start, end) that fall into word 'j' */
+static inline uint64_t vnc_range_mask(int j, int start, int end)
+{
+    int lo = MAX(start - j * VNC_DIRTY_BITS, 0);
+    int hi = MIN(end - j * VNC_DIRTY_BITS, VNC_DIRTY_BITS);
+    uint64_t mask;
+
+    if (lo >= hi)
+        return 0;
+    mask = -1ULL << lo;
+    if (hi < VNC_DIRTY_BITS)
+        mask &= (1ULL << hi) - 1;
+    return mask;
+}
+
+static inline void vnc_set_range(uint64_t *d, int start, int end)
+{
+    int j;
+
+    for (j = start / VNC_DIRTY_BITS; j * VNC_DIRTY_BITS < end; j++)
+        d[j] |= vnc_range_mask(j, start, end);
+}
+
+static inline void vnc_clear_range(uint64_t *d, int start, int end)
+{
+    int j;
+
+    for (j = start / VNC_DIRTY_BITS; j * VNC_DIRTY_BITS < end; j++)
+        d[j] &= ~vnc_range_mask(j, start, end);
+}
+
+/* Index of the first bit at or after 'k' that is set ('set' != 0) or clear,
+   or 'n' if there is none below 'n' */
+static inline int vnc_find_next(const uint64_t *d, int n, int k, int set)
+{
+    int j = k / VNC_DIRTY_BITS;
+    uint64_t w;
+
+    if (k >= n)
+        return n;
+    w = set ? d[j] : ~d[j];
+    w &= -1ULL << (k & 0x3f);
+    while (!w) {
+        if (++j * VNC_DIRTY_BITS >= n)
+            return n;
+        w = set ? d[j] : ~d[j];
+    }
+    return MIN(j * VNC_DIRTY_BITS + ctz64(w), n);
+}
+
+/*
+ * Makes 'len' bytes of 'dst' equal to 'src' and returns 1 if they differed.
+ * Nothing is written for unchanged bytes: the copy starts at the first
+ * 16-byte chunk found to differ, so each byte is read at most once.
+ */
+static inline int vnc_sync_tile(uint8_t *dst, const uint8_t *src, int len)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(dst + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff)
+            goto copy;
+    }
+#endif
+    if (memcmp(dst + i, src + i, len - i) == 0)
+        return 0;
+#ifdef __SSE2__
+copy:
+#endif
+    memcpy(dst + i, src + i, len - i);
+    return 1;
+}
+
 static void vnc_update(VncState *vs, int x, int y, int w, int h)
 {
     struct VncSurface *s = &vs->guest;
-    int i;
 
     h += y;
 
@@ -289,9 +382,10 @@ static void vnc_update(VncState *vs, int x, int y, int w, int h)
     w = MIN(x + w, s->ds->width) - x;
     h = MIN(h, s->ds->height);
 
+    if (w <= 0)
+        return;
     for (; y < h; y++)
-        for (i = 0; i < w; i += 16)
-            vnc_set_bit(s->dirty[y], (x + i) / 16);
+        vnc_set_range(s->dirty[y], x / 16, VNC_TILES(x + w));
 }
 
 static void vnc_dpy_update(DisplayState *ds, int x, int y, int w, int h)
@@ -353,6 +447,8 @@ static void vnc_resize(VncState *vs)
     DisplayState *ds = vs->ds;
     int size_changed;
 
+    vnc_job_wait(vs);
+
     /* guest surface */
     if (!vs->guest.ds)
         vs->guest.ds = g_malloc0(sizeof(*vs->guest.ds));
@@ -679,6 +775,7 @@ static void vnc_dpy_copy(DisplayState *ds, int src_x, int src_y, int dst_x, int
     for (vs = vd->clients; vs != NULL; vs = vn) {
         vn = vs->next;
         if (vnc_has_feature(vs, VNC_FEATURE_COPYRECT)) {
+            vnc_job_wait(vs);
             vs->force_update = 1;
             vnc_update_client(vs);
             /* vs might be free()ed here */
@@ -686,9 +783,11 @@ static void vnc_dpy_copy(DisplayState *ds, int src_x, int src_y, int dst_x, int
     }
 
     for (vs = vd->clients; vs != NULL; vs = vs->next) {
-        if (vnc_has_feature(vs, VNC_FEATURE_COPYRECT))
+        if (vnc_has_feature(vs, VNC_FEATURE_COPYRECT)) {
+            /* the pending update must reach the client before the copy */
+            vnc_job_wait(vs);
             vnc_copy(vs, src_x, src_y, dst_x, dst_y, w, h);
-        else /* TODO */
+        } else /* TODO */
             vnc_update(vs, dst_x, dst_y, w, h);
     }
 }
@@ -699,28 +798,285 @@ static int find_and_clear_dirty_height(struct VncSurface *s,
     int h;
 
     for (h = 1; h < (s->ds->height - y); h++) {
-        int tmp_x;
         if (!vnc_get_bit(s->dirty[y + h], last_x))
             break;
-        for (tmp_x = last_x; tmp_x < x; tmp_x++)
-            vnc_clear_bit(s->dirty[y + h], tmp_x);
+        vnc_clear_range(s->dirty[y + h], last_x, x);
     }
 
     return h;
 }
 
+/*
+ * Walks through the guest dirty map, copies the tiles that really changed
+ * from the guest to the server surface and marks them in the server dirty
+ * map. Returns the number of such tiles.
+ */
+static int vnc_scan_guest(VncState *vs)
+{
+    int y, j;
+    int width = vs->guest.ds->width;
+    int bpp = ds_get_bytes_per_pixel(vs->ds);
+    int linesize = ds_get_linesize(vs->ds);
+    uint64_t width_mask[VNC_DIRTY_WORDS];
+    uint8_t *guest_row;
+    uint8_t *server_row;
+    int has_dirty = 0;
+
+    vnc_set_bits(width_mask, VNC_TILES(width), VNC_DIRTY_WORDS);
+    guest_row  = vs->guest.ds->data;
+    server_row = vs->server.ds->data;
+    for (y = 0; y < vs->guest.ds->height; y++) {
+        for (j = 0; j < VNC_DIRTY_WORDS; j++) {
+            uint64_t bits = vs->guest.dirty[y][j] & width_mask[j];
+
+            vs->guest.dirty[y][j] &= ~bits;
+            while (bits) {
+                int x = (j * VNC_DIRTY_BITS + ctz64(bits)) * 16;
+                int offset = x * bpp;
+
+                bits &= bits - 1;
+                if (vnc_sync_tile(server_row + offset, guest_row + offset,
+                                  MIN(16, width - x) * bpp)) {
+                    vnc_set_bit(vs->server.dirty[y], x / 16);
+                    has_dirty++;
+                }
+            }
+        }
+        guest_row  += linesize;
+        server_row += linesize;
+    }
+    return has_dirty;
+}
+
+/*
+ * Encodes a FramebufferUpdate message covering the server dirty map into
+ * vs->output, clearing the map on the way. Returns the number of rectangles.
+ */
+static int vnc_send_dirty_rects(VncState *vs)
+{
+    int y;
+    int width = vs->server.ds->width;
+    int tiles = VNC_TILES(width);
+    int n_rectangles;
+    int saved_offset;
+
+    n_rectangles = 0;
+    vnc_write_u8(vs, 0);  /* msg id */
+    vnc_write_u8(vs, 0);
+    saved_offset = vs->output.offset;
+    vnc_write_u16(vs, 0);
+
+    for (y = 0; y < vs->server.ds->height; y++) {
+        uint64_t *row = vs->server.dirty[y];
+        int x = 0;
+
+        while ((x = vnc_find_next(row, tiles, x, 1)) < tiles) {
+            int end = vnc_find_next(row, tiles, x, 0);
+            int h;
+
+            vnc_clear_range(row, x, end);
+            h = find_and_clear_dirty_height(&vs->server, y, x, end);
+            send_framebuffer_update(vs, x * 16, y,
+                                    MIN(end * 16, width) - x * 16, h);
+            n_rectangles++;
+            x = end;
+        }
+    }
+    vs->output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
+    vs->output.buffer[saved_offset + 1] = n_rectangles & 0xFF;
+    return n_rectangles;
+}
+
+/*
+ * Framebuffer updates are encoded on a thread owned by the VncDisplay.
+ * vnc_update_client() scans the guest surface on the main loop and hands
+ * the server dirty map over to the thread, which leaves the server surface
+ * alone until the job is done. Completion is signalled through a socket
+ * pair; the encoded message is then appended to the client output buffer
+ * by vnc_job_finish(), always on the main loop.
+ *
+ * Anything that touches the server surface, the client pixel format or
+ * the encoding settings must vnc_job_wait() first.
+ */
+
+static void vnc_job_run(VncJob *job)
+{
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    buffer_reset(&job->local->output);
+    vnc_send_dirty_rects(job->local);
+    job->encode_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+}
+
+static void *vnc_job_thread(void *opaque)
+{
+    VncDisplay *vd = opaque;
+    VncJob *job;
+    char byte = 0;
+
+    qemu_mutex_lock(&vd->job_lock);
+    for (;;) {
+        while (QTAILQ_EMPTY(&vd->jobs))
+            qemu_cond_wait(&vd->job_cond, &vd->job_lock);
+        job = QTAILQ_FIRST(&vd->jobs);
+        QTAILQ_REMOVE(&vd->jobs, job, next);
+        qemu_mutex_unlock(&vd->job_lock);
+
+        vnc_job_run(job);
+
+        qemu_mutex_lock(&vd->job_lock);
+        job->state = VNC_JOB_DONE;
+        qemu_cond_broadcast(&vd->job_done);
+        socket_send(vd->job_wfd, &byte, 1);
+    }
+    return NULL;
+}
+
+/* Called on the main loop with a job in the VNC_JOB_DONE state */
+static void vnc_job_finish(VncState *vs)
+{
+    Buffer *out = &vs->job.local->output;
+
+    if (buffer_empty(&vs->output)) {
+        /* nothing queued in front of it, hand the buffer over as is */
+        Buffer tmp = vs->output;
+
+        vs->output = *out;
+        *out = tmp;
+        if (vs->csock != -1 && !buffer_empty(&vs->output))
+            qemu_set_fd_handler2(vs->csock, NULL, vnc_client_read,
+                                 vnc_client_write, vs);
+    } else {
+        vnc_write(vs, out->buffer, out->offset);
+    }
+    vnc_flush(vs);
+
+    vs->job.state = VNC_JOB_IDLE;
+    vs->updates++;
+    vs->encode_ns = vs->job.encode_ns;
+    vs->encode_ns_total += vs->job.encode_ns;
+}
+
+/* Returns the state of the client job, finishing it if it is done */
+static int vnc_job_poll(VncState *vs)
+{
+    int state;
+
+    if (vs->job.state == VNC_JOB_IDLE)
+        return VNC_JOB_IDLE;
+
+    qemu_mutex_lock(&vs->vd->job_lock);
+    state = vs->job.state;
+    qemu_mutex_unlock(&vs->vd->job_lock);
+
+    if (state == VNC_JOB_DONE) {
+        vnc_job_finish(vs);
+        state = VNC_JOB_IDLE;
+    }
+    return state;
+}
+
+/* Waits for the client job, if any, and sends its output */
+static void vnc_job_wait(VncState *vs)
+{
+    VncDisplay *vd = vs->vd;
+
+    if (vs->job.state == VNC_JOB_IDLE)
+        return;
+
+    qemu_mutex_lock(&vd->job_lock);
+    while (vs->job.state == VNC_JOB_QUEUED)
+        qemu_cond_wait(&vd->job_done, &vd->job_lock);
+    qemu_mutex_unlock(&vd->job_lock);
+
+    vnc_job_finish(vs);
+}
+
+static void vnc_job_submit(VncState *vs)
+{
+    VncDisplay *vd = vs->vd;
+    VncJob *job = &vs->job;
+    VncState *local = job->local;
+
+    job->ds.surface = vs->server.ds;
+    local->ds = &job->ds;
+    local->vd = vd;
+    local->csock = -1;
+    local->server.ds = vs->server.ds;
+    memcpy(local->server.dirty, vs->server.dirty,
+           vs->server.ds->height * sizeof(vs->server.dirty[0]));
+    memset(vs->server.dirty, 0,
+           vs->server.ds->height * sizeof(vs->server.dirty[0]));
+    local->clientds = vs->clientds;
+    local->write_pixels = vs->write_pixels;
+    local->send_hextile_tile = vs->send_hextile_tile;
+    local->vnc_encoding = vs->vnc_encoding;
+    local->tight_quality = vs->tight_quality;
+    local->tight_compression = vs->tight_compression;
+
+    if (!vd->job_thread_running) {
+        vnc_job_run(job);
+        vnc_job_finish(vs);
+        return;
+    }
+
+    qemu_mutex_lock(&vd->job_lock);
+    job->state = VNC_JOB_QUEUED;
+    QTAILQ_INSERT_TAIL(&vd->jobs, job, next);
+    qemu_cond_signal(&vd->job_cond);
+    qemu_mutex_unlock(&vd->job_lock);
+}
+
+static void vnc_job_read(void *opaque)
+{
+    VncDisplay *vd = opaque;
+    VncState *vs;
+    char bytes[16];
+
+    while (socket_recv(vd->job_rfd, bytes, sizeof(bytes)) == sizeof(bytes))
+        ;
+
+    for (vs = vd->clients; vs != NULL; vs = vs->next)
+        vnc_job_poll(vs);
+}
+
+/* Starts the encoder thread; updates are encoded inline if that fails */
+static void vnc_job_start_thread(VncDisplay *vd)
+{
+    if (vd->job_thread_running)
+        return;
+
+    if (socket_pair(&vd->job_rfd, &vd->job_wfd) < 0) {
+        VNC_DEBUG("VNC: cannot create encoder notification pair: %s\n",
+                  errno_str);
+        return;
+    }
+    socket_set_nonblock(vd->job_rfd);
+    socket_set_nonblock(vd->job_wfd);
+    qemu_set_fd_handler2(vd->job_rfd, NULL, vnc_job_read, NULL, vd);
+
+    qemu_mutex_init(&vd->job_lock);
+    qemu_cond_init(&vd->job_cond);
+    qemu_cond_init(&vd->job_done);
+    QTAILQ_INIT(&vd->jobs);
+    qemu_thread_create(&vd->job_thread, vnc_job_thread, vd,
+                       QEMU_THREAD_DETACHED);
+    vd->job_thread_running = 1;
+}
+
 static void vnc_update_client(void *opaque)
 {
     VncState *vs = opaque;
     if (vs->need_update && vs->csock != -1) {
-        int y;
-        uint8_t *guest_row;
-        uint8_t *server_row;
-        int cmp_bytes;
-        uint32_t width_mask[VNC_DIRTY_WORDS];
-        int n_rectangles;
-        int saved_offset;
-        int has_dirty = 0;
+        int has_dirty;
+        int64_t start;
+
+        if (vnc_job_poll(vs) != VNC_JOB_IDLE) {
+            /* still encoding the previous update, the guest dirty map
+             * keeps accumulating until it is done */
+            timer_mod(vs->timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + VNC_REFRESH_INTERVAL);
+            return;
+        }
 
         if (vs->output.offset && !vs->audio_cap && !vs->force_update) {
             /* kernel send buffers are full -> drop frames to throttle */
@@ -730,39 +1086,11 @@ static void vnc_update_client(void *opaque)
 
         vga_hw_update();
 
-        /*
-         * Walk through the guest dirty map.
-         * Check and copy modified bits from guest to server surface.
-         * Update server dirty map.
-         */
-        vnc_set_bits(width_mask, (ds_get_width(vs->ds) / 16), VNC_DIRTY_WORDS);
-        cmp_bytes = 16 * ds_get_bytes_per_pixel(vs->ds);
-        guest_row  = vs->guest.ds->data;
-        server_row = vs->server.ds->data;
-        for (y = 0; y < vs->guest.ds->height; y++) {
-            if (vnc_and_bits(vs->guest.dirty[y], width_mask, VNC_DIRTY_WORDS)) {
-                int x;
-                uint8_t *guest_ptr;
-                uint8_t *server_ptr;
-
-                guest_ptr  = guest_row;
-                server_ptr = server_row;
-
-                for (x = 0; x < vs->guest.ds->width;
-                     x += 16, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
-                    if (!vnc_get_bit(vs->guest.dirty[y], (x / 16)))
-                        continue;
-                    vnc_clear_bit(vs->guest.dirty[y], (x / 16));
-                    if (memcmp(server_ptr, guest_ptr, cmp_bytes) == 0)
-                        continue;
-                    memcpy(server_ptr, guest_ptr, cmp_bytes);
-                    vnc_set_bit(vs->server.dirty[y], (x / 16));
-                    has_dirty++;
-                }
-            }
-            guest_row  += ds_get_linesize(vs->ds);
-            server_row += ds_get_linesize(vs->ds);
-        }
+        start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        has_dirty = vnc_scan_guest(vs);
+        vs->scan_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+        vs->scan_ns_total += vs->scan_ns;
+        vs->scans++;
 
         if (!has_dirty && !vs->audio_cap && !vs->force_update) {
             timer_mod(vs->timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + VNC_REFRESH_INTERVAL);
@@ -775,39 +1103,7 @@ static void vnc_update_client(void *opaque)
          * happening in parallel don't disturb us, the next pass will
          * send them to the client.
          */
-        n_rectangles = 0;
-        vnc_write_u8(vs, 0);  /* msg id */
-        vnc_write_u8(vs, 0);
-        saved_offset = vs->output.offset;
-        vnc_write_u16(vs, 0);
-
-        for (y = 0; y < vs->server.ds->height; y++) {
-            int x;
-            int last_x = -1;
-            for (x = 0; x < vs->server.ds->width / 16; x++) {
-                if (vnc_get_bit(vs->server.dirty[y], x)) {
-                    if (last_x == -1) {
-                        last_x = x;
-                    }
-                    vnc_clear_bit(vs->server.dirty[y], x);
-                } else {
-                    if (last_x != -1) {
-                        int h = find_and_clear_dirty_height(&vs->server, y, last_x, x);
-                        send_framebuffer_update(vs, last_x * 16, y, (x - last_x) * 16, h);
-                        n_rectangles++;
-                    }
-                    last_x = -1;
-                }
-            }
-            if (last_x != -1) {
-                int h = find_and_clear_dirty_height(&vs->server, y, last_x, x);
-                send_framebuffer_update(vs, last_x * 16, y, (x - last_x) * 16, h);
-                n_rectangles++;
-            }
-        }
-        vs->output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
-        vs->output.buffer[saved_offset + 1] = n_rectangles & 0xFF;
-        vnc_flush(vs);
+        vnc_job_submit(vs);
         vs->force_update = 0;
 
     }
@@ -895,8 +1191,24 @@ static void vnc_disconnect_start(VncState *vs)
     vs->csock = -1;
 }
 
+static void vnc_job_free(VncState *vs)
+{
+    VncState *local = vs->job.local;
+    int i;
+
+    vnc_job_wait(vs);
+    for (i = 0; i < (int)(sizeof(local->zlib_stream) / sizeof(z_stream)); i++) {
+        if (local->zlib_stream[i].opaque == local)
+            deflateEnd(&local->zlib_stream[i]);
+    }
+    g_free(local->output.buffer);
+    g_free(local->zlib.buffer);
+    g_free(local);
+}
+
 static void vnc_disconnect_finish(VncState *vs)
 {
+    vnc_job_free(vs);
     timer_del(vs->timer);
     timer_free(vs->timer);
     if (vs->input.buffer) g_free(vs->input.buffer);
@@ -1503,9 +1815,9 @@ static void framebuffer_update_request(VncState *vs, int incremental,
         vs->force_update = 1;
         for (i = 0; i < h; i++) {
             vnc_set_bits(vs->guest.dirty[y_position + i],
-                         (ds_get_width(vs->ds) / 16), VNC_DIRTY_WORDS);
+                         VNC_TILES(ds_get_width(vs->ds)), VNC_DIRTY_WORDS);
             vnc_set_bits(vs->server.dirty[y_position + i],
-                         (ds_get_width(vs->ds) / 16), VNC_DIRTY_WORDS);
+                         VNC_TILES(ds_get_width(vs->ds)), VNC_DIRTY_WORDS);
         }
     }
 }
@@ -1535,7 +1847,8 @@ static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
     int i;
     unsigned int enc = 0;
 
-    vnc_zlib_init(vs);
+    vnc_job_wait(vs);
+    vnc_zlib_init(vs->job.local);
     vs->features = 0;
     vs->vnc_encoding = 0;
     vs->tight_compression = 9;
@@ -1633,6 +1946,8 @@ static void set_pixel_format(VncState *vs,
         return;
     }
 
+    vnc_job_wait(vs);
+
     vs->clientds = *(vs->guest.ds);
     vs->clientds.pf.rmax = red_max;
     count_bits(vs->clientds.pf.rbits, red_max);
@@ -2074,6 +2389,8 @@ static void vnc_connect(VncDisplay *vd, int csock)
 
     vs->vd = vd;
     vs->ds = vd->ds;
+    vs->job.local = g_malloc0(sizeof(VncState));
+    vnc_job_start_thread(vd);
     vs->timer = timer_new(QEMU_CLOCK_REALTIME, SCALE_MS, vnc_update_client, vs);
     vs->last_x = -1;
     vs->last_y = -1;
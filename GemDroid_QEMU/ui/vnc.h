@@ -31,6 +31,8 @@
 #include "ui/console.h"
 #include "monitor/monitor.h"
 #include "audio/audio.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
 #include <zlib.h>
 
 #include "keymaps.h"
@@ -70,11 +72,13 @@ typedef void VncSendHextileTile(VncState *vs,
 
 #define VNC_MAX_WIDTH 2048
 #define VNC_MAX_HEIGHT 2048
-#define VNC_DIRTY_WORDS (VNC_MAX_WIDTH / (16 * 32))
+#define VNC_DIRTY_BITS 64
+#define VNC_DIRTY_WORDS (VNC_MAX_WIDTH / (16 * VNC_DIRTY_BITS))
 
 #define VNC_AUTH_CHALLENGE_SIZE 16
 
 typedef struct VncDisplay VncDisplay;
+typedef struct VncJob VncJob;
 
 #ifdef CONFIG_VNC_TLS
 #include "vnc-tls.h"
@@ -102,14 +106,46 @@ struct VncDisplay
 #ifdef CONFIG_VNC_SASL
     VncDisplaySASL sasl;
 #endif
+
+    /* framebuffer update encoder thread, shared by all clients */
+    QemuThread job_thread;
+    QemuMutex job_lock;
+    QemuCond job_cond;          /* a job was queued */
+    QemuCond job_done;          /* a job was completed */
+    QTAILQ_HEAD(, VncJob) jobs;
+    int job_rfd;                /* completion notifications, main loop side */
+    int job_wfd;                /* completion notifications, thread side */
+    int job_thread_running;
 };
 
 struct VncSurface
 {
-    uint32_t dirty[VNC_MAX_HEIGHT][VNC_DIRTY_WORDS];
+    uint64_t dirty[VNC_MAX_HEIGHT][VNC_DIRTY_WORDS];
     DisplaySurface *ds;
 };
 
+enum {
+    VNC_JOB_IDLE = 0,
+    VNC_JOB_QUEUED,             /* owned by the encoder thread */
+    VNC_JOB_DONE,               /* output ready to be sent */
+};
+
+/*
+ * A framebuffer update being encoded. 'local' is a private VncState that
+ * only holds what the encoders need: a snapshot of the server dirty map,
+ * the client pixel format and encoding, and the zlib streams, which must
+ * stay at a fixed address across updates. The encoded message ends up in
+ * local->output.
+ */
+struct VncJob
+{
+    VncState *local;
+    DisplayState ds;            /* local->ds, points at the server surface */
+    int state;
+    int64_t encode_ns;
+    QTAILQ_ENTRY(VncJob) next;
+};
+
 struct VncState
 {
     QEMUTimer *timer;
@@ -161,6 +197,16 @@ struct VncState
     Buffer zlib_tmp;
     z_stream zlib_stream[4];
 
+    VncJob job;
+
+    /* update statistics, reported by "info vnc" */
+    uint64_t scans;
+    uint64_t updates;
+    int64_t scan_ns;
+    int64_t scan_ns_total;
+    int64_t encode_ns;
+    int64_t encode_ns_total;
+
     VncState *next;
 };
 
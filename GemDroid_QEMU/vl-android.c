@@ -2984,6 +2984,27 @@ int main(int argc, char **argv, char **envp)
                 android_snapshot_update_time = 0;
                 break;
 
+            case QEMU_OPTION_snapshot_lazy_restore:
+                ram_set_lazy_load(1);
+                break;
+
+            case QEMU_OPTION_qcow2_cache_size:
+                {
+                    char* end;
+                    long l2_mb = strtol(optarg, &end, 0);
+                    long refcount_mb = 0;
+
+                    if (*end == ',') {
+                        refcount_mb = strtol(end + 1, &end, 0);
+                    }
+                    if (l2_mb <= 0 || refcount_mb < 0 || *end != '\0') {
+                        PANIC("qemu: invalid -qcow2-cache-size value: %s", optarg);
+                    }
+                    bdrv_set_metadata_cache_sizes((int64_t)l2_mb << 20,
+                                                  (int64_t)refcount_mb << 20);
+                }
+                break;
+
             case QEMU_OPTION_list_webcam:
                 android_list_web_cameras();
                 exit(0);
@@ -3640,7 +3661,7 @@ int main(int argc, char **argv, char **envp)
     register_savevm_live(NULL,
                          "ram",
                          0,
-                         3,
+                         5,
                          ops,
                          NULL);
 